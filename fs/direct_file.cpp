@@ -0,0 +1,240 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include "fs/direct_file.h"
+
+fs::direct_file::direct_file()
+  : _M_fd(-1),
+    _M_buffers(NULL),
+    _M_buffer_size(0),
+    _M_nbuffers(0),
+    _M_count(0),
+    _M_filled(0),
+    _M_written(0),
+    _M_last(0),
+    _M_running(false),
+    _M_error(false),
+    _M_latency(NULL)
+{
+  memset(&_M_stats, 0, sizeof(struct statistics));
+
+  pthread_mutex_init(&_M_mutex, NULL);
+  pthread_cond_init(&_M_cond, NULL);
+}
+
+fs::direct_file::~direct_file()
+{
+  close();
+
+  if (_M_buffers) {
+    free(_M_buffers);
+  }
+
+  pthread_cond_destroy(&_M_cond);
+  pthread_mutex_destroy(&_M_mutex);
+}
+
+bool fs::direct_file::create(size_t buffer_size, unsigned nbuffers)
+{
+  // Sanity checks.
+  if ((buffer_size < kMinBufferSize) ||
+      (buffer_size > kMaxBufferSize) ||
+      ((buffer_size % kAlignment) != 0) ||
+      (nbuffers < kMinBuffers) ||
+      (nbuffers > kMaxBuffers)) {
+    return false;
+  }
+
+  void* buffers;
+  if (posix_memalign(&buffers, kAlignment, buffer_size * nbuffers) != 0) {
+    return false;
+  }
+
+  _M_buffers = reinterpret_cast<uint8_t*>(buffers);
+  _M_buffer_size = buffer_size;
+  _M_nbuffers = nbuffers;
+
+  return true;
+}
+
+bool fs::direct_file::open(const char* pathname, mode_t mode)
+{
+  if ((_M_fd = ::open(pathname, O_CREAT | O_TRUNC | O_WRONLY | O_DIRECT, mode)) < 0) {
+    return false;
+  }
+
+  _M_count = 0;
+  _M_filled = 0;
+  _M_written = 0;
+  _M_last = 0;
+  _M_error = false;
+
+  // Start background thread.
+  _M_running = true;
+  if (pthread_create(&_M_thread, NULL, run, this) != 0) {
+    _M_running = false;
+
+    ::close(_M_fd);
+    _M_fd = -1;
+
+    return false;
+  }
+
+  return true;
+}
+
+bool fs::direct_file::close()
+{
+  if (_M_fd == -1) {
+    return true;
+  }
+
+  off_t size = (_M_filled * _M_buffer_size) + _M_count;
+
+  bool ret = true;
+
+  // If there is a partially filled buffer, pad it to the alignment (the
+  // file is truncated afterwards).
+  if (_M_count > 0) {
+    size_t len = ((_M_count + kAlignment - 1) / kAlignment) * kAlignment;
+    memset(buffer(_M_filled) + _M_count, 0, len - _M_count);
+
+    ret = flush(len);
+  }
+
+  // Stop background thread (it writes the pending buffers before exiting).
+  pthread_mutex_lock(&_M_mutex);
+  _M_running = false;
+  pthread_cond_broadcast(&_M_cond);
+  pthread_mutex_unlock(&_M_mutex);
+
+  pthread_join(_M_thread, NULL);
+
+  if (_M_error) {
+    ret = false;
+  }
+
+  // Remove padding.
+  if (ftruncate(_M_fd, size) < 0) {
+    ret = false;
+  }
+
+  if (::close(_M_fd) < 0) {
+    ret = false;
+  }
+
+  _M_fd = -1;
+
+  return ret;
+}
+
+bool fs::direct_file::flush(size_t len)
+{
+  pthread_mutex_lock(&_M_mutex);
+
+  if (len < _M_buffer_size) {
+    _M_last = len;
+  }
+
+  _M_filled++;
+  pthread_cond_broadcast(&_M_cond);
+
+  // If all the buffers are full, wait for the background thread.
+  if ((_M_filled - _M_written == _M_nbuffers) && (!_M_error)) {
+    _M_stats.stalls++;
+
+    do {
+      pthread_cond_wait(&_M_cond, &_M_mutex);
+    } while ((_M_filled - _M_written == _M_nbuffers) && (!_M_error));
+  }
+
+  bool ret = !_M_error;
+
+  pthread_mutex_unlock(&_M_mutex);
+
+  _M_count = 0;
+
+  return ret;
+}
+
+void* fs::direct_file::run(void* arg)
+{
+  reinterpret_cast<fs::direct_file*>(arg)->background();
+  return NULL;
+}
+
+void fs::direct_file::background()
+{
+  pthread_mutex_lock(&_M_mutex);
+
+  do {
+    if ((_M_written < _M_filled) && (!_M_error)) {
+      uint64_t n = _M_written;
+      size_t len = ((n + 1 == _M_filled) && (_M_last > 0)) ? _M_last : _M_buffer_size;
+
+      pthread_mutex_unlock(&_M_mutex);
+
+      const uint8_t* buf = buffer(n);
+      off_t offset = n * _M_buffer_size;
+
+      uint64_t start = now();
+
+      bool error = false;
+      size_t left = len;
+      while (left > 0) {
+        ssize_t ret;
+        if ((ret = pwrite(_M_fd, buf, left, offset)) < 0) {
+          if (errno != EINTR) {
+            error = true;
+            break;
+          }
+        } else if (ret == 0) {
+          error = true;
+          break;
+        } else {
+          buf += ret;
+          offset += ret;
+          left -= ret;
+        }
+      }
+
+      uint64_t write_time = now() - start;
+
+      if (_M_latency) {
+        _M_latency->record(write_time);
+      }
+
+      pthread_mutex_lock(&_M_mutex);
+
+      _M_stats.writes++;
+      _M_stats.write_time_sum += write_time;
+      if (write_time > _M_stats.max_write_time) {
+        _M_stats.max_write_time = write_time;
+      }
+
+      if (error) {
+        _M_error = true;
+      } else {
+        _M_written++;
+      }
+
+      pthread_cond_broadcast(&_M_cond);
+    } else if ((!_M_running) || (_M_error)) {
+      break;
+    } else {
+      pthread_cond_wait(&_M_cond, &_M_mutex);
+    }
+  } while (true);
+
+  pthread_mutex_unlock(&_M_mutex);
+}
+
+uint64_t fs::direct_file::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+}
@@ -0,0 +1,171 @@
+#ifndef FS_DIRECT_FILE_H
+#define FS_DIRECT_FILE_H
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "util/histogram.h"
+
+namespace fs {
+  // File written with O_DIRECT, bypassing the page cache.
+  //
+  // The data is copied into aligned buffers which are written by a
+  // background thread, so the thread which writes to the file only waits
+  // when all the buffers are full.
+  class direct_file {
+    public:
+      static const size_t kMinBufferSize = 1024 * 1024; // 1 MB.
+      static const size_t kMaxBufferSize = 8 * 1024 * 1024; // 8 MB.
+      static const size_t kDefaultBufferSize = 4 * 1024 * 1024; // 4 MB.
+
+      static const unsigned kMinBuffers = 2;
+      static const unsigned kMaxBuffers = 64;
+      static const unsigned kDefaultBuffers = 4;
+
+      // Alignment of the buffers, the offsets and the lengths.
+      static const size_t kAlignment = 4096;
+
+      struct statistics {
+        uint64_t writes;
+        uint64_t write_time_sum; // Nanoseconds.
+        uint64_t max_write_time; // Nanoseconds.
+
+        // Number of times all the buffers were full.
+        uint64_t stalls;
+      };
+
+      // Constructor.
+      direct_file();
+
+      // Destructor.
+      ~direct_file();
+
+      // Create (the buffer size must be a multiple of kAlignment).
+      bool create(size_t buffer_size, unsigned nbuffers);
+
+      // Open file.
+      bool open(const char* pathname, mode_t mode);
+
+      // Close file.
+      bool close();
+
+      // Write.
+      ssize_t write(const void* buf, size_t count);
+
+      // Write from multiple buffers.
+      ssize_t writev(const struct iovec* iov, unsigned iovcnt);
+
+      // Get statistics.
+      const struct statistics& stats() const;
+
+      // Record the duration of the writes of the background thread in a
+      // histogram (NULL: don't, to be set before the first write).
+      void latency(util::histogram* histogram);
+
+    private:
+      int _M_fd;
+
+      // Buffers.
+      uint8_t* _M_buffers;
+      size_t _M_buffer_size;
+      unsigned _M_nbuffers;
+
+      // Number of bytes in the buffer being filled.
+      size_t _M_count;
+
+      // Number of buffers filled / written.
+      uint64_t _M_filled;
+      uint64_t _M_written;
+
+      // Length of the last buffer (the other ones are full).
+      size_t _M_last;
+
+      // Background thread.
+      pthread_t _M_thread;
+      pthread_mutex_t _M_mutex;
+      pthread_cond_t _M_cond;
+      bool _M_running;
+      bool _M_error;
+
+      struct statistics _M_stats;
+
+      util::histogram* _M_latency;
+
+      // Get buffer.
+      uint8_t* buffer(uint64_t n);
+
+      // Hand the buffer being filled to the background thread.
+      bool flush(size_t len);
+
+      // Background thread.
+      static void* run(void* arg);
+      void background();
+
+      // Get monotonic time in nanoseconds.
+      static uint64_t now();
+
+      // Disable copy constructor and assignment operator.
+      direct_file(const direct_file&);
+      direct_file& operator=(const direct_file&);
+  };
+
+  inline const struct direct_file::statistics& direct_file::stats() const
+  {
+    return _M_stats;
+  }
+
+  inline void direct_file::latency(util::histogram* histogram)
+  {
+    _M_latency = histogram;
+  }
+
+  inline uint8_t* direct_file::buffer(uint64_t n)
+  {
+    return _M_buffers + ((n % _M_nbuffers) * _M_buffer_size);
+  }
+
+  inline ssize_t direct_file::write(const void* buf, size_t count)
+  {
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(buf);
+    size_t left = count;
+
+    do {
+      size_t n = _M_buffer_size - _M_count;
+      if (n > left) {
+        n = left;
+      }
+
+      memcpy(buffer(_M_filled) + _M_count, b, n);
+
+      _M_count += n;
+      b += n;
+      left -= n;
+
+      // If the buffer is full...
+      if ((_M_count == _M_buffer_size) && (!flush(_M_buffer_size))) {
+        return -1;
+      }
+    } while (left > 0);
+
+    return count;
+  }
+
+  inline ssize_t direct_file::writev(const struct iovec* iov, unsigned iovcnt)
+  {
+    size_t total = 0;
+    for (unsigned i = 0; i < iovcnt; i++) {
+      ssize_t ret;
+      if ((ret = write(iov[i].iov_base, iov[i].iov_len)) != static_cast<ssize_t>(iov[i].iov_len)) {
+        return ret;
+      }
+
+      total += ret;
+    }
+
+    return total;
+  }
+}
+
+#endif // FS_DIRECT_FILE_H
@@ -4,6 +4,7 @@
 #include <limits.h>
 #include <errno.h>
 #include "fs/file.h"
+#include "util/tsc.h"
 
 bool fs::file::open(const char* pathname, int flags)
 {
@@ -124,8 +125,15 @@ ssize_t fs::file::write(const void* buf, size_t count)
   size_t written = 0;
 
   do {
-    ssize_t ret;
-    if ((ret = ::write(_M_fd, b, count - written)) < 0) {
+    uint64_t start = _M_latency ? util::tsc::read() : 0;
+
+    ssize_t ret = ::write(_M_fd, b, count - written);
+
+    if (_M_latency) {
+      _M_latency->record(util::tsc::nanoseconds(util::tsc::read() - start));
+    }
+
+    if (ret < 0) {
       if (errno != EINTR) {
         return -1;
       }
@@ -146,8 +154,15 @@ ssize_t fs::file::pwrite(const void* buf, size_t count, off_t offset)
   size_t written = 0;
 
   do {
-    ssize_t ret;
-    if ((ret = ::pwrite(_M_fd, b, count - written, offset)) < 0) {
+    uint64_t start = _M_latency ? util::tsc::read() : 0;
+
+    ssize_t ret = ::pwrite(_M_fd, b, count - written, offset);
+
+    if (_M_latency) {
+      _M_latency->record(util::tsc::nanoseconds(util::tsc::read() - start));
+    }
+
+    if (ret < 0) {
       if (errno != EINTR) {
         return -1;
       }
@@ -190,8 +205,15 @@ ssize_t fs::file::writev(const struct iovec* iov, unsigned iovcnt)
   size_t written = 0;
 
   do {
-    ssize_t ret;
-    if ((ret = ::writev(_M_fd, v, iovcnt)) < 0) {
+    uint64_t start = _M_latency ? util::tsc::read() : 0;
+
+    ssize_t ret = ::writev(_M_fd, v, iovcnt);
+
+    if (_M_latency) {
+      _M_latency->record(util::tsc::nanoseconds(util::tsc::read() - start));
+    }
+
+    if (ret < 0) {
       if (errno != EINTR) {
         return -1;
       }
@@ -225,6 +247,17 @@ off_t fs::file::offset() const
   return lseek(_M_fd, 0, SEEK_CUR);
 }
 
+bool fs::file::allocate(off_t length)
+{
+  int ret;
+
+  do {
+    ret = fallocate(_M_fd, FALLOC_FL_KEEP_SIZE, 0, length);
+  } while ((ret < 0) && (errno == EINTR));
+
+  return (ret == 0);
+}
+
 bool fs::file::truncate(off_t length)
 {
   int ret;
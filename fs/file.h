@@ -5,6 +5,7 @@
 #include <fcntl.h>
 #include <sys/uio.h>
 #include "string/buffer.h"
+#include "util/histogram.h"
 
 namespace fs {
   class file {
@@ -53,15 +54,24 @@ namespace fs {
       // Truncate file.
       bool truncate(off_t length);
 
+      // Allocate disk space (the file size doesn't change).
+      bool allocate(off_t length);
+
       // Get file descriptor.
       int fd() const;
 
       // Set file descriptor.
       void fd(int descriptor);
 
+      // Record the duration of the write system calls in a histogram (NULL:
+      // don't).
+      void latency(util::histogram* histogram);
+
     protected:
       int _M_fd;
 
+      util::histogram* _M_latency;
+
     private:
       // Disable copy constructor and assignment operator.
       file(const file&);
@@ -69,12 +79,14 @@ namespace fs {
   };
 
   inline file::file()
-    : _M_fd(-1)
+    : _M_fd(-1),
+      _M_latency(NULL)
   {
   }
 
   inline file::file(int fd)
-    : _M_fd(fd)
+    : _M_fd(fd),
+      _M_latency(NULL)
   {
   }
 
@@ -92,6 +104,11 @@ namespace fs {
   {
     _M_fd = descriptor;
   }
+
+  inline void file::latency(util::histogram* histogram)
+  {
+    _M_latency = histogram;
+  }
 }
 
 #endif // FS_FILE_H
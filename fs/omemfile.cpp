@@ -1,8 +1,10 @@
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include "fs/omemfile.h"
 #include "macros/macros.h"
+#include "util/tsc.h"
 
 bool fs::omemfile::open(const char* pathname, mode_t mode)
 {
@@ -61,9 +63,15 @@ ssize_t fs::omemfile::write(const void* buf, size_t count)
         n -= left;
       }
 
+      uint64_t start = _M_latency ? util::tsc::read() : 0;
+
       if (!increase()) {
         return -1;
       }
+
+      if (_M_latency) {
+        _M_latency->record(util::tsc::nanoseconds(util::tsc::read() - start));
+      }
     }
 
     memcpy(reinterpret_cast<uint8_t*>(_M_addr) + (_M_off % kFileIncrement), b, n);
@@ -76,6 +84,17 @@ ssize_t fs::omemfile::write(const void* buf, size_t count)
   return count;
 }
 
+bool fs::omemfile::allocate(off_t length)
+{
+  int ret;
+
+  do {
+    ret = fallocate(_M_fd, FALLOC_FL_KEEP_SIZE, 0, length);
+  } while ((ret < 0) && (errno == EINTR));
+
+  return (ret == 0);
+}
+
 bool fs::omemfile::increase()
 {
   // Unmap previous region (if any).
@@ -6,6 +6,7 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
+#include "util/histogram.h"
 
 namespace fs {
   class omemfile {
@@ -28,6 +29,13 @@ namespace fs {
       // Write from multiple buffers.
       ssize_t writev(const struct iovec* iov, unsigned iovcnt);
 
+      // Allocate disk space (the file size doesn't change).
+      bool allocate(off_t length);
+
+      // Record the duration of the remappings of the file in a histogram
+      // (NULL: don't).
+      void latency(util::histogram* histogram);
+
     protected:
       static const off_t kFileIncrement = 256L * 1024L * 1024L;
 
@@ -37,6 +45,8 @@ namespace fs {
       off_t _M_filesize;
       off_t _M_off;
 
+      util::histogram* _M_latency;
+
       // Increase file.
       bool increase();
 
@@ -48,7 +58,8 @@ namespace fs {
 
   inline omemfile::omemfile()
     : _M_fd(-1),
-      _M_addr(MAP_FAILED)
+      _M_addr(MAP_FAILED),
+      _M_latency(NULL)
   {
   }
 
@@ -57,6 +68,11 @@ namespace fs {
     close();
   }
 
+  inline void omemfile::latency(util::histogram* histogram)
+  {
+    _M_latency = histogram;
+  }
+
   inline ssize_t omemfile::writev(const struct iovec* iov, unsigned iovcnt)
   {
     size_t total = 0;
@@ -0,0 +1,40 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "fs/path.h"
+
+bool fs::path::add_suffix(const char* pathname, const char* suffix, char* buf, size_t size)
+{
+  const char* slash = strrchr(pathname, '/');
+  const char* dot = strrchr(pathname, '.');
+
+  // No extension or hidden file without extension?
+  if ((!dot) || ((slash) && (dot < slash)) || (dot == pathname) || (dot == slash + 1)) {
+    dot = pathname + strlen(pathname);
+  }
+
+  int len = snprintf(buf, size, "%.*s%s%s", static_cast<int>(dot - pathname), pathname, suffix, dot);
+  return ((len > 0) && (static_cast<size_t>(len) < size));
+}
+
+bool fs::path::add_timestamp(const char* pathname, char* buf, size_t size)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+
+  struct tm tm;
+  localtime_r(&tv.tv_sec, &tm);
+
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%04d%02d%02d-%02d%02d%02d-%03u",
+           1900 + tm.tm_year,
+           1 + tm.tm_mon,
+           tm.tm_mday,
+           tm.tm_hour,
+           tm.tm_min,
+           tm.tm_sec,
+           static_cast<unsigned>(tv.tv_usec / 1000));
+
+  return add_suffix(pathname, suffix, buf, size);
+}
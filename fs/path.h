@@ -0,0 +1,19 @@
+#ifndef FS_PATH_H
+#define FS_PATH_H
+
+#include <stdlib.h>
+
+namespace fs {
+  class path {
+    public:
+      // Insert suffix before the extension (if any):
+      // ("capture.pcap", "-1") -> "capture-1.pcap".
+      static bool add_suffix(const char* pathname, const char* suffix, char* buf, size_t size);
+
+      // Insert the current local time (YYYYmmdd-HHMMSS-mmm) before the
+      // extension (if any).
+      static bool add_timestamp(const char* pathname, char* buf, size_t size);
+  };
+}
+
+#endif // FS_PATH_H
@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "fs/uring_file.h"
+
+fs::uring_file::uring_file()
+  : _M_ring_fd(-1),
+    _M_fixed_file(false),
+    _M_sq_ring(MAP_FAILED),
+    _M_sq_ring_size(0),
+    _M_cq_ring(MAP_FAILED),
+    _M_cq_ring_size(0),
+    _M_sqes(reinterpret_cast<struct io_uring_sqe*>(MAP_FAILED)),
+    _M_sqes_size(0),
+    _M_pending(0),
+    _M_inflight(0),
+    _M_offset(0)
+{
+}
+
+fs::uring_file::~uring_file()
+{
+  close();
+
+  if (_M_sqes != MAP_FAILED) {
+    munmap(_M_sqes, _M_sqes_size);
+  }
+
+  if (_M_cq_ring != MAP_FAILED) {
+    munmap(_M_cq_ring, _M_cq_ring_size);
+  }
+
+  if (_M_sq_ring != MAP_FAILED) {
+    munmap(_M_sq_ring, _M_sq_ring_size);
+  }
+
+  if (_M_ring_fd != -1) {
+    ::close(_M_ring_fd);
+  }
+}
+
+bool fs::uring_file::create(unsigned entries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(struct io_uring_params));
+
+  if ((_M_ring_fd = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+    _M_ring_fd = -1;
+    return false;
+  }
+
+  _M_sq_ring_size = params.sq_off.array + (params.sq_entries * sizeof(unsigned));
+  _M_cq_ring_size = params.cq_off.cqes + (params.cq_entries * sizeof(struct io_uring_cqe));
+
+  // Can both rings be mapped with a single mmap?
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (_M_cq_ring_size > _M_sq_ring_size) {
+      _M_sq_ring_size = _M_cq_ring_size;
+    }
+  }
+
+  if ((_M_sq_ring = mmap(NULL,
+                         _M_sq_ring_size,
+                         PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE,
+                         _M_ring_fd,
+                         IORING_OFF_SQ_RING)) == MAP_FAILED) {
+    return false;
+  }
+
+  void* cq_ring;
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ring = _M_sq_ring;
+  } else {
+    if ((_M_cq_ring = mmap(NULL,
+                           _M_cq_ring_size,
+                           PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE,
+                           _M_ring_fd,
+                           IORING_OFF_CQ_RING)) == MAP_FAILED) {
+      return false;
+    }
+
+    cq_ring = _M_cq_ring;
+  }
+
+  _M_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+  if ((_M_sqes = reinterpret_cast<struct io_uring_sqe*>(mmap(NULL,
+                                                             _M_sqes_size,
+                                                             PROT_READ | PROT_WRITE,
+                                                             MAP_SHARED | MAP_POPULATE,
+                                                             _M_ring_fd,
+                                                             IORING_OFF_SQES))) == MAP_FAILED) {
+    return false;
+  }
+
+  uint8_t* sq = reinterpret_cast<uint8_t*>(_M_sq_ring);
+  _M_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+  _M_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+  _M_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+  _M_sq_entries = params.sq_entries;
+  _M_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+
+  uint8_t* cq = reinterpret_cast<uint8_t*>(cq_ring);
+  _M_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+  _M_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+  _M_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+  _M_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+  return true;
+}
+
+bool fs::uring_file::open(const char* pathname, int flags, mode_t mode)
+{
+  if (!_M_file.open(pathname, flags, mode)) {
+    return false;
+  }
+
+  // Register the file, so that the kernel doesn't have to look it up for
+  // every write (if not supported, the file descriptor is used).
+  int fd = _M_file.fd();
+  _M_fixed_file = (syscall(__NR_io_uring_register, _M_ring_fd, IORING_REGISTER_FILES, &fd, 1) == 0);
+
+  _M_offset = 0;
+
+  return true;
+}
+
+bool fs::uring_file::close()
+{
+  if (_M_file.fd() == -1) {
+    return true;
+  }
+
+  bool ret = submit();
+
+  // Wait for the writes in flight.
+  while (_M_inflight > 0) {
+    uint64_t user_data;
+    int res;
+    if (!completion(user_data, res)) {
+      if (!wait()) {
+        ret = false;
+        break;
+      }
+    } else if (res < 0) {
+      ret = false;
+    }
+  }
+
+  if (_M_fixed_file) {
+    syscall(__NR_io_uring_register, _M_ring_fd, IORING_UNREGISTER_FILES, NULL, 0);
+    _M_fixed_file = false;
+  }
+
+  return (_M_file.close() && ret);
+}
+
+bool fs::uring_file::write(const void* buf, size_t count)
+{
+  if (_M_inflight > 0) {
+    return false;
+  }
+
+  if (_M_file.pwrite(buf, count, _M_offset) != static_cast<ssize_t>(count)) {
+    return false;
+  }
+
+  _M_offset += count;
+
+  return true;
+}
+
+ssize_t fs::uring_file::writev(const struct iovec* iov, unsigned iovcnt, uint64_t user_data)
+{
+  unsigned tail = *_M_sq_tail;
+
+  // If the submission queue is full...
+  if (tail - __atomic_load_n(_M_sq_head, __ATOMIC_ACQUIRE) == _M_sq_entries) {
+    return -1;
+  }
+
+  size_t len = 0;
+  for (unsigned i = 0; i < iovcnt; i++) {
+    len += iov[i].iov_len;
+  }
+
+  unsigned idx = tail & _M_sq_mask;
+
+  struct io_uring_sqe* sqe = &_M_sqes[idx];
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->opcode = IORING_OP_WRITEV;
+
+  if (_M_fixed_file) {
+    sqe->flags = IOSQE_FIXED_FILE;
+    sqe->fd = 0;
+  } else {
+    sqe->fd = _M_file.fd();
+  }
+
+  sqe->off = _M_offset;
+  sqe->addr = reinterpret_cast<uintptr_t>(iov);
+  sqe->len = iovcnt;
+  sqe->user_data = user_data;
+
+  _M_sq_array[idx] = idx;
+
+  __atomic_store_n(_M_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  _M_offset += len;
+
+  _M_pending++;
+  _M_inflight++;
+
+  return len;
+}
+
+bool fs::uring_file::submit()
+{
+  while (_M_pending > 0) {
+    int ret;
+    if ((ret = enter(_M_pending, 0, 0)) < 0) {
+      return false;
+    }
+
+    _M_pending -= ret;
+  }
+
+  return true;
+}
+
+bool fs::uring_file::wait()
+{
+  // Submit the queued writes (if any) and wait.
+  int ret;
+  if ((ret = enter(_M_pending, 1, IORING_ENTER_GETEVENTS)) < 0) {
+    return false;
+  }
+
+  _M_pending -= ret;
+
+  return true;
+}
+
+int fs::uring_file::enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+  int ret;
+
+  do {
+    ret = syscall(__NR_io_uring_enter, _M_ring_fd, to_submit, min_complete, flags, NULL, 0);
+  } while ((ret < 0) && (errno == EINTR));
+
+  return ret;
+}
@@ -0,0 +1,132 @@
+#ifndef FS_URING_FILE_H
+#define FS_URING_FILE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "fs/file.h"
+
+namespace fs {
+  // File written asynchronously through io_uring.
+  //
+  // The writes are appended at increasing offsets and are identified by
+  // an opaque value which is returned when they complete. The buffers
+  // must remain valid until then.
+  class uring_file {
+    public:
+      // Constructor.
+      uring_file();
+
+      // Destructor.
+      ~uring_file();
+
+      // Create (entries: maximum number of writes in flight).
+      bool create(unsigned entries);
+
+      // Open file.
+      bool open(const char* pathname, int flags, mode_t mode);
+
+      // Close file (waits for the writes in flight).
+      bool close();
+
+      // Write synchronously (only when there are no writes in flight).
+      bool write(const void* buf, size_t count);
+
+      // Queue write (returns the number of bytes which will be written or
+      // -1 if the submission queue is full).
+      ssize_t writev(const struct iovec* iov, unsigned iovcnt, uint64_t user_data);
+
+      // Submit the queued writes.
+      bool submit();
+
+      // Wait for at least one write to complete.
+      bool wait();
+
+      // Get next completed write (res: number of bytes written or -errno).
+      bool completion(uint64_t& user_data, int& res);
+
+      // Get number of writes in flight (queued or submitted).
+      unsigned inflight() const;
+
+      // Get offset.
+      off_t offset() const;
+
+    private:
+      fs::file _M_file;
+
+      int _M_ring_fd;
+
+      // Has the file been registered?
+      bool _M_fixed_file;
+
+      // Rings.
+      void* _M_sq_ring;
+      size_t _M_sq_ring_size;
+      void* _M_cq_ring;
+      size_t _M_cq_ring_size;
+
+      struct io_uring_sqe* _M_sqes;
+      size_t _M_sqes_size;
+
+      // Submission queue.
+      unsigned* _M_sq_head;
+      unsigned* _M_sq_tail;
+      unsigned _M_sq_mask;
+      unsigned _M_sq_entries;
+      unsigned* _M_sq_array;
+
+      // Completion queue.
+      unsigned* _M_cq_head;
+      unsigned* _M_cq_tail;
+      unsigned _M_cq_mask;
+      struct io_uring_cqe* _M_cqes;
+
+      // Number of writes queued but not submitted yet.
+      unsigned _M_pending;
+
+      // Number of writes queued or submitted which haven't completed.
+      unsigned _M_inflight;
+
+      off_t _M_offset;
+
+      // Enter.
+      int enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+      // Disable copy constructor and assignment operator.
+      uring_file(const uring_file&);
+      uring_file& operator=(const uring_file&);
+  };
+
+  inline unsigned uring_file::inflight() const
+  {
+    return _M_inflight;
+  }
+
+  inline off_t uring_file::offset() const
+  {
+    return _M_offset;
+  }
+
+  inline bool uring_file::completion(uint64_t& user_data, int& res)
+  {
+    unsigned head = *_M_cq_head;
+
+    // No completions?
+    if (head == __atomic_load_n(_M_cq_tail, __ATOMIC_ACQUIRE)) {
+      return false;
+    }
+
+    const struct io_uring_cqe* cqe = &_M_cqes[head & _M_cq_mask];
+    user_data = cqe->user_data;
+    res = cqe->res;
+
+    __atomic_store_n(_M_cq_head, head + 1, __ATOMIC_RELEASE);
+
+    _M_inflight--;
+
+    return true;
+  }
+}
+
+#endif // FS_URING_FILE_H
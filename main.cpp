@@ -1,27 +1,52 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <signal.h>
-#include "net/sniffer.h"
+#include <pthread.h>
+#include "net/capture.h"
 #include "macros/macros.h"
 
 static void usage(const char* program);
-static void signal_handler(int nsignal);
 static bool parse_size(const char* s, size_t min, size_t max, size_t& size);
-
-net::sniffer gsniffer;
+static bool parse_number(const char* s, unsigned min, unsigned max, unsigned& n);
+static bool dump_filter(const char* filter);
+static bool dump_expression(const char* expr);
+static bool recover_segment(const char* segment, const char* pathname);
+static bool parse_window(const char* s, unsigned& before, unsigned& after);
 
 int main(int argc, char** argv)
 {
+  // Dump BPF program?
+  if ((argc == 3) && (strcmp(argv[1], "-d") == 0)) {
+    return dump_filter(argv[2]) ? 0 : -1;
+  }
+
+  // Dump expression program?
+  if ((argc == 3) && (strcmp(argv[1], "-D") == 0)) {
+    return dump_expression(argv[2]) ? 0 : -1;
+  }
+
+  // Recover segment?
+  if ((argc == 4) && (strcmp(argv[1], "-r") == 0)) {
+    return recover_segment(argv[2], argv[3]) ? 0 : -1;
+  }
+
   // Check arguments.
   if (argc < 3) {
     usage(argv[0]);
     return -1;
   }
 
-  size_t ring_size = net::sniffer::kDefaultRingSize;
-  size_t max_pcap_filesize = 0;
+  net::sniffer::options opts;
+  const char* filter = NULL;
+  const char* sample_file = NULL;
+  const char* stats_socket = NULL;
+  const char* stats_file = NULL;
+  unsigned stats_interval = net::capture::kDefaultStatisticsInterval;
+  bool have_interval = false;
+  unsigned nworkers = 1;
 
   int i = 1;
 
@@ -34,7 +59,7 @@ int main(int argc, char** argv)
         return -1;
       }
 
-      if (!parse_size(argv[i + 1], net::sniffer::kMinRingSize, net::sniffer::kMaxRingSize, ring_size)) {
+      if (!parse_size(argv[i + 1], net::sniffer::kMinRingSize, net::sniffer::kMaxRingSize, opts.ring_size)) {
         fprintf(stderr, "Invalid ring size %s.\n", argv[i + 1]);
         return -1;
       }
@@ -47,11 +72,38 @@ int main(int argc, char** argv)
         return -1;
       }
 
-      if (!parse_size(argv[i + 1], 0, ULONG_MAX, max_pcap_filesize)) {
+      if (!parse_size(argv[i + 1], 0, ULONG_MAX, opts.max_pcap_filesize)) {
         fprintf(stderr, "Invalid max-pcap-filesize %s.\n", argv[i + 1]);
         return -1;
       }
 
+      i += 2;
+    } else if (strcmp(argv[i], "-M") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      opts.segment_dir = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-H") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (strcasecmp(argv[i + 1], "thp") == 0) {
+        opts.memory_flags |= string::buffer::kTransparentHugePages;
+      } else if (strcasecmp(argv[i + 1], "hugetlb") == 0) {
+        opts.memory_flags |= string::buffer::kHugePages;
+      } else {
+        fprintf(stderr, "Invalid huge pages %s.\n", argv[i + 1]);
+        return -1;
+      }
+
       i += 2;
     } else if (strcmp(argv[i], "-f") == 0) {
       // Last argument?
@@ -60,41 +112,462 @@ int main(int argc, char** argv)
         return -1;
       }
 
-      if (!gsniffer.filter().parse(argv[i + 1])) {
+      net::filter f;
+      if (!f.parse(argv[i + 1])) {
         fprintf(stderr, "Invalid filter (%s).\n", argv[i + 1]);
         return -1;
       }
 
+      filter = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-e") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      net::expression e;
+      if (!e.parse(argv[i + 1])) {
+        fprintf(stderr, "Invalid expression (%s).\n", argv[i + 1]);
+        return -1;
+      }
+
+      opts.expression = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-T") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      net::trigger t;
+      if (!t.parse(argv[i + 1])) {
+        fprintf(stderr, "Invalid trigger list (%s).\n", argv[i + 1]);
+        return -1;
+      }
+
+      opts.triggers = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-w") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_window(argv[i + 1], opts.trigger_before, opts.trigger_after)) {
+        fprintf(stderr, "Invalid capture window %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-t") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_number(argv[i + 1], 1, net::capture::kMaxWorkers, nworkers)) {
+        fprintf(stderr, "Invalid number of workers %s.\n", argv[i + 1]);
+        return -1;
+      }
+
       i += 2;
+    } else if (strcmp(argv[i], "-F") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!net::sniffer::parse_fanout_mode(argv[i + 1], opts.fanout_mode)) {
+        fprintf(stderr, "Invalid fanout mode %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-S") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      unsigned snaplen;
+      if (!parse_number(argv[i + 1], 1, net::filter::kMaxSnaplen, snaplen)) {
+        fprintf(stderr, "Invalid snap length %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      opts.snaplen = static_cast<uint16_t>(snaplen);
+
+      i += 2;
+    } else if (strcmp(argv[i], "-o") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!net::sniffer::parse_output(argv[i + 1], opts.output)) {
+        fprintf(stderr, "Invalid output %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-b") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if ((!parse_size(argv[i + 1],
+                       fs::direct_file::kMinBufferSize,
+                       fs::direct_file::kMaxBufferSize,
+                       opts.direct_buffer_size)) ||
+          ((opts.direct_buffer_size % fs::direct_file::kAlignment) != 0)) {
+        fprintf(stderr, "Invalid buffer size %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-C") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_size(argv[i + 1], 1, ULONG_MAX, opts.rotate_filesize)) {
+        fprintf(stderr, "Invalid file size %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-G") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_number(argv[i + 1], 1, UINT_MAX, opts.rotate_seconds)) {
+        fprintf(stderr, "Invalid number of seconds %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-N") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_number(argv[i + 1], net::pcap_rotator::kMinFiles, UINT_MAX, opts.max_files)) {
+        fprintf(stderr, "Invalid number of files %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-Q") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_size(argv[i + 1], 1, ULONG_MAX, opts.quota)) {
+        fprintf(stderr, "Invalid quota %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-U") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_number(argv[i + 1], 1, net::dedup::kMaxWindow, opts.dedup_window)) {
+        fprintf(stderr, "Invalid duplicate window %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-O") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!net::load_shedder::parse_watermarks(argv[i + 1], opts.watermarks)) {
+        fprintf(stderr, "Invalid watermarks %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      opts.load_shedding = true;
+
+      i += 2;
+    } else if (strcmp(argv[i], "-L") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      net::filter f;
+      if (!f.parse(argv[i + 1])) {
+        fprintf(stderr, "Invalid low-priority filter (%s).\n", argv[i + 1]);
+        return -1;
+      }
+
+      opts.low_priority = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-n") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (argv[i + 1][0] == '@') {
+        sample_file = argv[i + 1] + 1;
+      } else if (!parse_number(argv[i + 1], 1, net::flow_sampler::kMaxRate, opts.sample_rate)) {
+        fprintf(stderr, "Invalid sampling rate %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-k") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_size(argv[i + 1], 1, ULONG_MAX, opts.flow_cutoff)) {
+        fprintf(stderr, "Invalid flow cutoff %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      i += 2;
+    } else if (strcmp(argv[i], "-K") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      unsigned max_flows;
+      if (!parse_number(argv[i + 1], net::flow_cutoff::kMinFlows, net::flow_cutoff::kMaxFlows, max_flows)) {
+        fprintf(stderr, "Invalid number of flows %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      opts.max_flows = max_flows;
+
+      i += 2;
+    } else if (strcmp(argv[i], "-J") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      stats_socket = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-P") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      stats_file = argv[i + 1];
+
+      i += 2;
+    } else if (strcmp(argv[i], "-I") == 0) {
+      // Last argument?
+      if (i == last) {
+        usage(argv[0]);
+        return -1;
+      }
+
+      if (!parse_number(argv[i + 1], 1, net::capture::kMaxStatisticsInterval, stats_interval)) {
+        fprintf(stderr, "Invalid statistics interval %s.\n", argv[i + 1]);
+        return -1;
+      }
+
+      have_interval = true;
+
+      i += 2;
+    } else if (strcmp(argv[i], "-R") == 0) {
+      opts.flight_recorder = true;
+
+      i++;
+    } else if (strcmp(argv[i], "-u") == 0) {
+      opts.kernel_filter = false;
+
+      i++;
+    } else if (strcmp(argv[i], "-x") == 0) {
+      opts.decapsulate = true;
+
+      i++;
+    } else if (strcmp(argv[i], "-W") == 0) {
+      opts.writer_thread = true;
+
+      i++;
     } else {
       usage(argv[0]);
       return -1;
     }
   }
 
-  // Create sniffer.
-  if (!gsniffer.create(argv[argc - 2], argv[argc - 1], ring_size, max_pcap_filesize)) {
+  if ((opts.triggers) && (opts.max_pcap_filesize == 0)) {
+    fprintf(stderr, "The triggers (-T) require -m.\n");
+    return -1;
+  }
+
+  if ((have_interval) && (!stats_socket) && (!stats_file)) {
+    fprintf(stderr, "-I requires -J or -P.\n");
+    return -1;
+  }
+
+  opts.live_statistics = ((stats_socket) || (stats_file));
+
+  if ((opts.low_priority) && (!opts.load_shedding)) {
+    fprintf(stderr, "-L requires -O.\n");
+    return -1;
+  }
+
+  if ((opts.max_flows != net::flow_cutoff::kDefaultMaxFlows) && (opts.flow_cutoff == 0)) {
+    fprintf(stderr, "-K requires -k.\n");
+    return -1;
+  }
+
+  if ((opts.segment_dir) && (opts.max_pcap_filesize == 0)) {
+    fprintf(stderr, "-M requires -m.\n");
+    return -1;
+  }
+
+  if ((opts.flight_recorder) && (opts.max_pcap_filesize == 0)) {
+    fprintf(stderr, "The flight recorder (-R) requires -m.\n");
+    return -1;
+  }
+
+  if ((opts.rotate_filesize == 0) && (opts.rotate_seconds == 0)) {
+    if ((opts.max_files > 0) || (opts.quota > 0)) {
+      fprintf(stderr, "-N and -Q require -C or -G.\n");
+      return -1;
+    }
+  } else if (opts.max_pcap_filesize > 0) {
+    fprintf(stderr, "-C and -G cannot be combined with -m.\n");
+    return -1;
+  } else if ((opts.quota > 0) && (opts.rotate_filesize == 0)) {
+    // The size of the current file must be bounded.
+    fprintf(stderr, "-Q requires -C.\n");
+    return -1;
+  } else if ((opts.quota > 0) && (opts.quota < opts.rotate_filesize * net::pcap_rotator::kMinFiles)) {
+    fprintf(stderr, "The quota must be at least %u times the file size.\n", net::pcap_rotator::kMinFiles);
+    return -1;
+  }
+
+  // Block signals in all the threads, they are handled synchronously by the
+  // main thread. They are blocked before the capture is created, which
+  // starts the background threads of the file rotation, the O_DIRECT
+  // output and the capture windows (they inherit the signal mask).
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, SIGTERM);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGUSR1);
+  sigaddset(&set, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  // Create capture.
+  net::capture capture;
+  if (!capture.create(argv[argc - 2], argv[argc - 1], filter, nworkers, opts, sample_file)) {
     fprintf(stderr, "Couldn't create sniffer.\n");
     return -1;
   }
 
-  // Set signal handlers.
-  struct sigaction act;
-  sigemptyset(&act.sa_mask);
-  act.sa_flags = 0;
-  act.sa_handler = signal_handler;
-  sigaction(SIGTERM, &act, NULL);
-  sigaction(SIGINT, &act, NULL);
+  // Export the live statistics?
+  if ((opts.live_statistics) && (!capture.export_statistics(stats_socket, stats_file, stats_interval))) {
+    fprintf(stderr, "Couldn't export the statistics.\n");
+    return -1;
+  }
+
+  // Start workers.
+  if (!capture.start()) {
+    fprintf(stderr, "Couldn't start workers.\n");
+
+    capture.stop();
+    capture.join();
+
+    return -1;
+  }
+
+  // Wait until a signal is received or the workers finish.
+  struct timespec timeout;
+  timeout.tv_sec = 0;
+  timeout.tv_nsec = 200 * 1000000;
+
+  do {
+    int nsignal;
+    if ((nsignal = sigtimedwait(&set, NULL, &timeout)) > 0) {
+      // Dump snapshot of the flight recorder?
+      if (nsignal == SIGUSR1) {
+        capture.dump();
+        continue;
+      }
 
-  // Start sniffer.
-  gsniffer.start();
+      // Reload the flows of the filter and the sampling rate?
+      if (nsignal == SIGHUP) {
+        capture.reload_flows();
+        capture.reload_sample_rate();
+        continue;
+      }
 
-  return 0;
+      fprintf(stderr, "Signal received...\n");
+      break;
+    }
+  } while (capture.running());
+
+  capture.stop();
+
+  bool ret = capture.join();
+
+#if SHOW_STATISTICS
+  capture.show_statistics();
+#endif
+
+  return ret ? 0 : -1;
 }
 
 void usage(const char* program)
 {
   fprintf(stderr, "Usage: %s [options] <interface> <pathname>\n", program);
+  fprintf(stderr, "       %s -d \"<filter-list>\"\n", program);
+  fprintf(stderr, "       %s -D \"<expression>\"\n", program);
+  fprintf(stderr, "       %s -r <segment> <pathname>\n", program);
+  fprintf(stderr, "\t\t-d \"<filter-list>\"      Dump the BPF program generated for the filter list\n"
+                  "\t\t\t\t\tand exit\n");
+  fprintf(stderr, "\t\t-D \"<expression>\"       Dump the program compiled from the expression\n"
+                  "\t\t\t\t\tand exit\n");
+  fprintf(stderr, "\t\t-r <segment> <pathname> Turn a segment left by a previous run (-M) into\n"
+                  "\t\t\t\t\ta capture file and exit\n");
   fprintf(stderr, "\tOptions:\n");
   fprintf(stderr, "\t\t-s <ring-size>          Ring size in MiB (M) or GiB (G) (%u MB .. %u GB)\n",
           net::sniffer::kMinRingSize / (1024L * 1024L),
@@ -103,7 +576,102 @@ void usage(const char* program)
   fprintf(stderr, "\t\t-m <max-pcap-filesize>  If bigger than 0, the program will preallocate max-pcap-filesize\n"
                   "\t\t\t\t\tbytes in memory and will only write the capture file upon reception\n"
                   "\t\t\t\t\tof a signal\n");
+  fprintf(stderr, "\t\t-M <directory>           With -m, store the packets in a segment in\n"
+                  "\t\t\t\t\tdirectory (e.g. /dev/shm) which survives a crash\n"
+                  "\t\t\t\t\tand becomes the capture file on exit\n");
+  fprintf(stderr, "\t\t-H <huge-pages>          With -m, back the memory with huge pages: thp\n"
+                  "\t\t\t\t\t(transparent huge pages) or hugetlb (reserved\n"
+                  "\t\t\t\t\thuge pages). The memory is always pre-faulted and\n"
+                  "\t\t\t\t\tlocked at startup\n");
+  fprintf(stderr, "\t\t-R                      Flight recorder: with -m, the memory is used as a\n"
+                  "\t\t\t\t\tring which overwrites the oldest packets. SIGUSR1\n"
+                  "\t\t\t\t\tdumps a snapshot to a timestamped file while the\n"
+                  "\t\t\t\t\tcapture keeps running\n");
+  fprintf(stderr, "\t\t-o <output>             How the capture file is written: file (one\n"
+                  "\t\t\t\t\tsystem call per packet or memory mapped file) or\n"
+                  "\t\t\t\t\turing (one asynchronous write per block of the\n"
+                  "\t\t\t\t\tring, TPACKET_V3 only) or direct (O_DIRECT,\n"
+                  "\t\t\t\t\tbypassing the page cache) (default: file)\n");
+  fprintf(stderr, "\t\t-b <buffer-size>        Size of the %u buffers of the direct output\n"
+                  "\t\t\t\t\t(%u MB .. %u MB, default: %u MB)\n",
+          fs::direct_file::kDefaultBuffers,
+          fs::direct_file::kMinBufferSize / (1024 * 1024),
+          fs::direct_file::kMaxBufferSize / (1024 * 1024),
+          fs::direct_file::kDefaultBufferSize / (1024 * 1024));
+  fprintf(stderr, "\t\t-C <file-size>           Rotate the capture file when it reaches file-size\n"
+                  "\t\t\t\t\tbytes, the files are named <pathname>-000000,\n"
+                  "\t\t\t\t\t<pathname>-000001, ...\n");
+  fprintf(stderr, "\t\t-G <seconds>            Rotate the capture file every seconds seconds\n");
+  fprintf(stderr, "\t\t-N <files>              With -C or -G, keep at most files files (>= %u),\n"
+                  "\t\t\t\t\tthe oldest ones are deleted\n",
+          net::pcap_rotator::kMinFiles);
+  fprintf(stderr, "\t\t-Q <quota>              With -C, keep at most quota bytes of\n"
+                  "\t\t\t\t\tcapture files, the oldest ones are deleted\n");
+  fprintf(stderr, "\t\t-U <microseconds>        Drop the packets identical (apart from the TTL)\n"
+                  "\t\t\t\t\tto a packet received less than microseconds\n"
+                  "\t\t\t\t\tbefore (%u .. %u), e.g. packets mirrored twice by\n"
+                  "\t\t\t\t\ta SPAN session\n",
+          1, net::dedup::kMaxWindow);
+  fprintf(stderr, "\t\t-n <rate>|@<file>        Only write 1 in rate flows (%u .. %u), the\n"
+                  "\t\t\t\t\tsame flows in every worker and every run. With\n"
+                  "\t\t\t\t\t@file, the rate is read from file, SIGHUP reads\n"
+                  "\t\t\t\t\tit again\n",
+          1, net::flow_sampler::kMaxRate);
+  fprintf(stderr, "\t\t-O <t>:<s>:<d>           Load shedding: when the ring occupancy reaches\n"
+                  "\t\t\t\t\tt%%, truncate the packets to %u bytes, s%%, also\n"
+                  "\t\t\t\t\tsample 1 in %u flows, d%%, also drop the packets\n"
+                  "\t\t\t\t\tof the low-priority filter (e.g. %u:%u:%u). The\n"
+                  "\t\t\t\t\tlevel changes are logged to <pathname>.shed\n",
+          net::load_shedder::kTruncateSnaplen,
+          net::load_shedder::kSampleRate,
+          net::load_shedder::kDefaultTruncateWatermark,
+          net::load_shedder::kDefaultSampleWatermark,
+          net::load_shedder::kDefaultDropWatermark);
+  fprintf(stderr, "\t\t-L \"<filter-list>\"      With -O, low-priority packets\n");
+  fprintf(stderr, "\t\t-k <cutoff>             Only write the first cutoff bytes (K, M or G\n"
+                  "\t\t\t\t\tsuffix) of every flow, the TCP SYN, FIN and RST\n"
+                  "\t\t\t\t\tpackets are always written. Flows idle for %u\n"
+                  "\t\t\t\t\tseconds expire\n",
+          net::flow_cutoff::kIdleTimeout);
+  fprintf(stderr, "\t\t-K <flows>               With -k, maximum number of flows per worker\n"
+                  "\t\t\t\t\t(%u .. %u, default: %u), the flow idle for the\n"
+                  "\t\t\t\t\tlongest time is evicted when the table is full\n",
+          net::flow_cutoff::kMinFlows,
+          net::flow_cutoff::kMaxFlows,
+          net::flow_cutoff::kDefaultMaxFlows);
   fprintf(stderr, "\t\t-f \"<filter-list>\"      List of filters\n");
+  fprintf(stderr, "\t\t-e \"<expression>\"       Filter expression, and-ed with the filter list\n"
+                  "\t\t\t\t\t(always evaluated in user space)\n");
+  fprintf(stderr, "\t\t-S <snaplen>             Default snap length (%u .. %u), the packets are\n"
+                  "\t\t\t\t\ttruncated to snaplen bytes (default: %u)\n",
+          1, net::filter::kMaxSnaplen, net::filter::kMaxSnaplen);
+  fprintf(stderr, "\t\t-u                      Filter in user space instead of attaching the\n"
+                  "\t\t\t\t\tfilter to the socket\n");
+  fprintf(stderr, "\t\t-x                      Filter the inner packet of VXLAN, GTP-U, GRE\n"
+                  "\t\t\t\t\t(including ERSPAN) and IP-in-IP tunnels, the\n"
+                  "\t\t\t\t\twhole packet is written (implies -u)\n");
+  fprintf(stderr, "\t\t-T \"<trigger-list>\"     With -m, keep the packets in memory and only\n"
+                  "\t\t\t\t\twrite the packets around the triggers to\n"
+                  "\t\t\t\t\ttimestamped files\n");
+  fprintf(stderr, "\t\t-w <before>:<after>     Seconds written before and after a trigger\n"
+                  "\t\t\t\t\t(default: %u:%u)\n",
+          net::sniffer::kDefaultTriggerWindow,
+          net::sniffer::kDefaultTriggerWindow);
+  fprintf(stderr, "\t\t-t <workers>             Number of workers (%u .. %u), each one with its own\n"
+                  "\t\t\t\t\tsocket, ring, thread and capture file (default: 1)\n",
+          1, net::capture::kMaxWorkers);
+  fprintf(stderr, "\t\t-F <fanout-mode>        PACKET_FANOUT mode used when there is more than\n"
+                  "\t\t\t\t\tone worker: hash, lb, cpu, rollover, rnd or qm\n"
+                  "\t\t\t\t\t(default: hash)\n");
+  fprintf(stderr, "\t\t-W                      Write the packets from a dedicated writer thread,\n"
+                  "\t\t\t\t\tthe capture thread only filters them\n");
+  fprintf(stderr, "\t\t-J <socket>             Serve the live statistics as JSON on a Unix\n"
+                  "\t\t\t\t\tsocket (one report per connection)\n");
+  fprintf(stderr, "\t\t-P <file>               Write the live statistics to a Prometheus\n"
+                  "\t\t\t\t\ttextfile (e.g. pktsaver.prom), replaced atomically\n");
+  fprintf(stderr, "\t\t-I <seconds>            Interval of the live statistics (%u .. %u,\n"
+                  "\t\t\t\t\tdefault: %u)\n",
+          1, net::capture::kMaxStatisticsInterval, net::capture::kDefaultStatisticsInterval);
   fprintf(stderr, "\n");
   fprintf(stderr, "Filter list:\n");
   fprintf(stderr, "\tThe filter list is a list of filters separated by spaces.\n");
@@ -121,15 +689,116 @@ void usage(const char* program)
   fprintf(stderr, "\t\tudp:(sport|dport):port[-port]   Filter UDP port or range of ports by source or\n"
                   "\t\t\t\t\t\tdestination port\n");
   fprintf(stderr, "\n");
+  fprintf(stderr, "\t\tnet:prefix                      Filter IPv4 / IPv6 address or prefix (e.g.\n"
+                  "\t\t\t\t\t\t10.0.0.0/8, 2001:db8::/32) as source or\n"
+                  "\t\t\t\t\t\tdestination\n");
+  fprintf(stderr, "\t\t(src|dst):prefix                Filter source or destination address or prefix\n");
+  fprintf(stderr, "\t\t!(net|src|dst):prefix           Exclude address or prefix\n");
+  fprintf(stderr, "\t\t[!](net|src|dst):@file          Load the prefixes from a file (one per line)\n");
+  fprintf(stderr, "\t\tvlan:id[-id]                    Filter VLAN ID or range of VLAN IDs (any tag)\n");
+  fprintf(stderr, "\t\tflow:@file                      Filter the flows of a file, one per line:\n"
+                  "\t\t\t\t\t\t<protocol> <address> <port> <address> <port>\n"
+                  "\t\t\t\t\t\t(both directions), SIGHUP reloads the file\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "\tThe addresses, the VLAN IDs and the flows are and-ed with the protocols and\n"
+                  "\tports and are always matched in user space. The longest prefix of an address\n"
+                  "\tdecides whether it is included or excluded. A packet matches if none of its\n"
+                  "\taddresses is excluded and, if there are prefixes to include, one of them is\n"
+                  "\tincluded.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "\tIPv4 and IPv6 packets (after the IPv6 extension headers) are matched, with up\n"
+                  "\tto two 802.1Q / 802.1ad tags. The kernel only matches untagged IPv4 packets.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "\tEvery filter can be followed by /<snaplen> (e.g. tcp:443/128), the packets\n"
+                  "\twhich match it are truncated to snaplen bytes. When a packet matches several\n"
+                  "\tfilters, ICMP and source ports are checked first and, for the same protocol\n"
+                  "\tand port, the biggest snap length wins.\n");
+  fprintf(stderr, "\n");
   fprintf(stderr, "\tIf no filter is specified, everything is captured.\n");
   fprintf(stderr, "\n");
+  fprintf(stderr, "Expression:\n");
+  fprintf(stderr, "\tTerms combined with and (&&), or (||), not (!) and parentheses, juxtaposed\n"
+                  "\tterms are and-ed (e.g. \"tcp and not (port 22 or dport 1024-65535)\").\n");
+  fprintf(stderr, "\tSupported terms are:\n");
+  fprintf(stderr, "\t\tip, ip6                           IP version\n");
+  fprintf(stderr, "\t\ticmp, tcp, udp                    IP protocol (icmp: ICMP or ICMPv6)\n");
+  fprintf(stderr, "\t\tvlan [id[-id]]                    VLAN tagged, VLAN ID of the outermost tag\n");
+  fprintf(stderr, "\t\tfin, syn, rst, psh, ack, urg      TCP flag set\n");
+  fprintf(stderr, "\t\tport port[-port]                 TCP or UDP source or destination port\n");
+  fprintf(stderr, "\t\t(sport|dport) port[-port]        TCP or UDP source or destination port\n");
+  fprintf(stderr, "\t\t(src|dst) port port[-port]       Same as sport / dport\n");
+  fprintf(stderr, "\t\t(proto|len|ttl) <op> value       IP protocol, total length or TTL, op is\n"
+                  "\t\t\t\t\t\t=, ==, !=, <, <=, > or >=\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "\tThe expression is compiled to a program of range and mask tests, constants\n"
+                  "\tare folded, the ranges of the same field are merged and the cheapest and\n"
+                  "\tmost selective tests run first.\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Trigger list:\n");
+  fprintf(stderr, "\tThe trigger list is a list of triggers separated by spaces, they are\n"
+                  "\tevaluated on the packets which match the filter list.\n");
+  fprintf(stderr, "\tSupported triggers are:\n");
+  fprintf(stderr, "\t\trst                             TCP RST\n");
+  fprintf(stderr, "\t\trst:port[-port]                 TCP RST from or to a port or range of ports\n");
+  fprintf(stderr, "\t\tunreachable                     ICMP / ICMPv6 destination unreachable\n");
+  fprintf(stderr, "\n");
 }
 
-void signal_handler(int nsignal)
+
+bool dump_filter(const char* filter)
+{
+  net::filter f;
+  if (!f.parse(filter)) {
+    fprintf(stderr, "Invalid filter (%s).\n", filter);
+    return false;
+  }
+
+  net::bpf_program program;
+  if (!f.compile(program)) {
+    fprintf(stderr, "The filter is too complex to be compiled to BPF.\n");
+    return false;
+  }
+
+  program.dump(stdout);
+
+  return true;
+}
+
+bool dump_expression(const char* expr)
 {
-  fprintf(stderr, "Signal received...\n");
+  net::expression e;
+  if (!e.parse(expr)) {
+    fprintf(stderr, "Invalid expression (%s).\n", expr);
+    return false;
+  }
 
-  gsniffer.stop();
+  e.dump(stdout);
+
+  return true;
+}
+
+bool recover_segment(const char* segment, const char* pathname)
+{
+  return net::pcap_segment::recover(segment, pathname);
+}
+
+bool parse_window(const char* s, unsigned& before, unsigned& after)
+{
+  const char* colon;
+  if ((colon = strchr(s, ':')) == NULL) {
+    return false;
+  }
+
+  char buf[16];
+  size_t len;
+  if ((len = colon - s) >= sizeof(buf)) {
+    return false;
+  }
+
+  memcpy(buf, s, len);
+  buf[len] = 0;
+
+  return ((parse_number(buf, 0, 24 * 60 * 60, before)) && (parse_number(colon + 1, 0, 24 * 60 * 60, after)));
 }
 
 bool parse_size(const char* s, size_t min, size_t max, size_t& size)
@@ -145,6 +814,25 @@ bool parse_size(const char* s, size_t min, size_t max, size_t& size)
       }
 
       n = tmp;
+    } else if (*s == 'K') {
+      uint64_t tmp = n * 1024ULL;
+
+      // Overflow?
+      if (tmp < n) {
+        return false;
+      }
+
+      // If not the last character...
+      if (*(s + 1)) {
+        return false;
+      }
+
+      if ((tmp < min) || (tmp > max)) {
+        return false;
+      }
+
+      size = static_cast<size_t>(tmp);
+      return true;
     } else if (*s == 'M') {
       uint64_t tmp = n * (1024ULL * 1024ULL);
 
@@ -197,3 +885,30 @@ bool parse_size(const char* s, size_t min, size_t max, size_t& size)
   size = static_cast<size_t>(n);
   return true;
 }
+
+bool parse_number(const char* s, unsigned min, unsigned max, unsigned& n)
+{
+  if (!*s) {
+    return false;
+  }
+
+  uint64_t tmp = 0;
+  while (*s) {
+    if (!IS_DIGIT(*s)) {
+      return false;
+    }
+
+    if ((tmp = (tmp * 10) + (*s - '0')) > max) {
+      return false;
+    }
+
+    s++;
+  }
+
+  if (tmp < min) {
+    return false;
+  }
+
+  n = static_cast<unsigned>(tmp);
+  return true;
+}
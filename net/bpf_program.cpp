@@ -0,0 +1,151 @@
+#include "net/bpf_program.h"
+
+void net::bpf_program::dump(FILE* file) const
+{
+  for (unsigned i = 0; i < _M_count; i++) {
+    const struct sock_filter* insn = &_M_insns[i];
+
+    const char* op;
+    char operand[64];
+    operand[0] = 0;
+
+    switch (insn->code) {
+      case BPF_LD | BPF_W | BPF_ABS:
+        op = "ld";
+        snprintf(operand, sizeof(operand), "[%u]", insn->k);
+        break;
+      case BPF_LD | BPF_H | BPF_ABS:
+        op = "ldh";
+        snprintf(operand, sizeof(operand), "[%u]", insn->k);
+        break;
+      case BPF_LD | BPF_B | BPF_ABS:
+        op = "ldb";
+        snprintf(operand, sizeof(operand), "[%u]", insn->k);
+        break;
+      case BPF_LD | BPF_W | BPF_LEN:
+        op = "ld";
+        snprintf(operand, sizeof(operand), "#pktlen");
+        break;
+      case BPF_LD | BPF_W | BPF_IND:
+        op = "ld";
+        snprintf(operand, sizeof(operand), "[x + %u]", insn->k);
+        break;
+      case BPF_LD | BPF_H | BPF_IND:
+        op = "ldh";
+        snprintf(operand, sizeof(operand), "[x + %u]", insn->k);
+        break;
+      case BPF_LD | BPF_B | BPF_IND:
+        op = "ldb";
+        snprintf(operand, sizeof(operand), "[x + %u]", insn->k);
+        break;
+      case BPF_LD | BPF_IMM:
+        op = "ld";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_LD | BPF_MEM:
+        op = "ld";
+        snprintf(operand, sizeof(operand), "M[%u]", insn->k);
+        break;
+      case BPF_LDX | BPF_W | BPF_IMM:
+        op = "ldx";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_LDX | BPF_MEM:
+        op = "ldx";
+        snprintf(operand, sizeof(operand), "M[%u]", insn->k);
+        break;
+      case BPF_LDX | BPF_B | BPF_MSH:
+        op = "ldxb";
+        snprintf(operand, sizeof(operand), "4*([%u]&0xf)", insn->k);
+        break;
+      case BPF_ST:
+        op = "st";
+        snprintf(operand, sizeof(operand), "M[%u]", insn->k);
+        break;
+      case BPF_STX:
+        op = "stx";
+        snprintf(operand, sizeof(operand), "M[%u]", insn->k);
+        break;
+      case BPF_ALU | BPF_ADD | BPF_K:
+        op = "add";
+        snprintf(operand, sizeof(operand), "#%u", insn->k);
+        break;
+      case BPF_ALU | BPF_SUB | BPF_K:
+        op = "sub";
+        snprintf(operand, sizeof(operand), "#%u", insn->k);
+        break;
+      case BPF_ALU | BPF_AND | BPF_K:
+        op = "and";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_ALU | BPF_LSH | BPF_K:
+        op = "lsh";
+        snprintf(operand, sizeof(operand), "#%u", insn->k);
+        break;
+      case BPF_ALU | BPF_RSH | BPF_K:
+        op = "rsh";
+        snprintf(operand, sizeof(operand), "#%u", insn->k);
+        break;
+      case BPF_ALU | BPF_ADD | BPF_X:
+        op = "add";
+        snprintf(operand, sizeof(operand), "x");
+        break;
+      case BPF_MISC | BPF_TAX:
+        op = "tax";
+        break;
+      case BPF_MISC | BPF_TXA:
+        op = "txa";
+        break;
+      case BPF_JMP | BPF_JA:
+        op = "ja";
+        snprintf(operand, sizeof(operand), "%u", i + 1 + insn->k);
+        break;
+      case BPF_JMP | BPF_JEQ | BPF_K:
+        op = "jeq";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_JMP | BPF_JGT | BPF_K:
+        op = "jgt";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_JMP | BPF_JGE | BPF_K:
+        op = "jge";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_JMP | BPF_JSET | BPF_K:
+        op = "jset";
+        snprintf(operand, sizeof(operand), "#0x%x", insn->k);
+        break;
+      case BPF_JMP | BPF_JEQ | BPF_X:
+        op = "jeq";
+        snprintf(operand, sizeof(operand), "x");
+        break;
+      case BPF_JMP | BPF_JGT | BPF_X:
+        op = "jgt";
+        snprintf(operand, sizeof(operand), "x");
+        break;
+      case BPF_JMP | BPF_JGE | BPF_X:
+        op = "jge";
+        snprintf(operand, sizeof(operand), "x");
+        break;
+      case BPF_RET | BPF_K:
+        op = "ret";
+        snprintf(operand, sizeof(operand), "#%u", insn->k);
+        break;
+      case BPF_RET | BPF_A:
+        op = "ret";
+        break;
+      default:
+        op = "unimp";
+        snprintf(operand, sizeof(operand), "0x%x", insn->code);
+    }
+
+    if ((BPF_CLASS(insn->code) == BPF_JMP) && (BPF_OP(insn->code) != BPF_JA)) {
+      fprintf(file, "(%03u) %-8s %-16s jt %u\tjf %u\n", i, op, operand, i + 1 + insn->jt, i + 1 + insn->jf);
+    } else if (*operand) {
+      fprintf(file, "(%03u) %-8s %s\n", i, op, operand);
+    } else {
+      fprintf(file, "(%03u) %s\n", i, op);
+    }
+  }
+}
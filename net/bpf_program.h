@@ -0,0 +1,98 @@
+#ifndef NET_BPF_PROGRAM_H
+#define NET_BPF_PROGRAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <linux/filter.h>
+
+namespace net {
+  // Classic BPF program.
+  class bpf_program {
+    public:
+      static const unsigned kMaxInstructions = BPF_MAXINSNS;
+
+      // Constructor.
+      bpf_program();
+
+      // Clear program.
+      void clear();
+
+      // Append statement.
+      bool stmt(uint16_t code, uint32_t k);
+
+      // Append jump.
+      bool jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf);
+
+      // Set the target of an unconditional jump.
+      void set_target(unsigned idx, unsigned target);
+
+      // Get number of instructions.
+      unsigned count() const;
+
+      // Get program (for SO_ATTACH_FILTER).
+      struct sock_fprog* fprog();
+
+      // Dump program (in the same format as "tcpdump -d").
+      void dump(FILE* file) const;
+
+    private:
+      struct sock_filter _M_insns[kMaxInstructions];
+      unsigned _M_count;
+
+      struct sock_fprog _M_fprog;
+
+      // Disable copy constructor and assignment operator.
+      bpf_program(const bpf_program&);
+      bpf_program& operator=(const bpf_program&);
+  };
+
+  inline bpf_program::bpf_program()
+    : _M_count(0)
+  {
+  }
+
+  inline void bpf_program::clear()
+  {
+    _M_count = 0;
+  }
+
+  inline bool bpf_program::stmt(uint16_t code, uint32_t k)
+  {
+    return jump(code, k, 0, 0);
+  }
+
+  inline bool bpf_program::jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf)
+  {
+    if (_M_count == kMaxInstructions) {
+      return false;
+    }
+
+    struct sock_filter* insn = &_M_insns[_M_count++];
+    insn->code = code;
+    insn->jt = jt;
+    insn->jf = jf;
+    insn->k = k;
+
+    return true;
+  }
+
+  inline void bpf_program::set_target(unsigned idx, unsigned target)
+  {
+    _M_insns[idx].k = target - (idx + 1);
+  }
+
+  inline unsigned bpf_program::count() const
+  {
+    return _M_count;
+  }
+
+  inline struct sock_fprog* bpf_program::fprog()
+  {
+    _M_fprog.len = _M_count;
+    _M_fprog.filter = _M_insns;
+
+    return &_M_fprog;
+  }
+}
+
+#endif // NET_BPF_PROGRAM_H
@@ -0,0 +1,781 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <new>
+#include "net/capture.h"
+#include "fs/path.h"
+#include "util/tsc.h"
+#include "macros/macros.h"
+
+const struct net::capture::metric net::capture::kMetrics[] = {
+  {"received_packets", "Packets received by the kernel, including the dropped ones.", offsetof(struct sniffer::live_statistics, received), true, false},
+  {"dropped_packets", "Packets dropped by the kernel.", offsetof(struct sniffer::live_statistics, dropped), true, false},
+  {"queue_freezes", "Times the kernel froze the queue of blocks because the ring was full.", offsetof(struct sniffer::live_statistics, queue_freezes), true, false},
+  {"ring_packets", "Packets read from the ring.", offsetof(struct sniffer::live_statistics, ring_packets), true, false},
+  {"ring_bytes", "Original length of the packets read from the ring.", offsetof(struct sniffer::live_statistics, ring_bytes), true, false},
+  {"matched_packets", "Packets which matched the filter.", offsetof(struct sniffer::live_statistics, matched), true, false},
+  {"matched_bytes", "Original length of the packets which matched the filter.", offsetof(struct sniffer::live_statistics, matched_bytes), true, false},
+  {"written_packets", "Packets handed to the output.", offsetof(struct sniffer::live_statistics, written_packets), true, false},
+  {"written_bytes", "Captured length of the packets handed to the output.", offsetof(struct sniffer::live_statistics, written_bytes), true, false},
+  {"ring_occupancy_max_percent", "Highest ring occupancy since the previous report.", offsetof(struct sniffer::live_statistics, max_occupancy), false, true},
+  {"writer_backlog_blocks", "Blocks held by the writer thread or io_uring.", offsetof(struct sniffer::live_statistics, backlog), false, false}
+};
+
+const unsigned net::capture::kNumberMetrics = sizeof(kMetrics) / sizeof(kMetrics[0]);
+
+const struct net::capture::latency net::capture::kLatencies[sniffer::kLatencies] = {
+  {"block_handoff_latency", "Time from the last packet of a block to when the capture thread reads the block.", "Block hand-off latency", "blocks"},
+  {"block_processing_latency", "Time the capture thread spends processing a block.", "Block processing time", "blocks"},
+  {"output_call_latency", "Duration of the output system calls and remaps.", "Output call latency", "calls"}
+};
+
+net::capture::~capture()
+{
+  if (_M_workers) {
+    stop();
+    join();
+
+    delete [] _M_workers;
+  }
+}
+
+bool net::capture::create(const char* interface,
+                          const char* pathname,
+                          const char* filter,
+                          unsigned nworkers,
+                          const sniffer::options& opts,
+                          const char* sample_file)
+{
+  // Sanity check.
+  if ((nworkers == 0) || (nworkers > kMaxWorkers)) {
+    return false;
+  }
+
+  if ((_M_workers = new (std::nothrow) worker[nworkers]) == NULL) {
+    return false;
+  }
+
+  _M_nworkers = nworkers;
+
+  // The workers time the blocks and the output calls with the TSC.
+  util::tsc::calibrate();
+
+  snprintf(_M_interface, sizeof(_M_interface), "%s", interface);
+
+  sniffer::options o = opts;
+
+  // Load the sampling rate.
+  if (sample_file) {
+    if (!net::flow_sampler::load_rate(sample_file, o.sample_rate)) {
+      return false;
+    }
+
+    _M_sample_file = sample_file;
+  }
+
+  if (o.sample_rate > 0) {
+    printf("Sampling 1 in %u flows.\n", o.sample_rate);
+  }
+
+  // If there is more than one worker, all of them join the same fanout group.
+  if (nworkers > 1) {
+    o.fanout_id = getpid() & 0xffff;
+  }
+
+  for (unsigned i = 0; i < nworkers; i++) {
+    struct worker* w = &_M_workers[i];
+
+    w->started = false;
+    w->finished = false;
+    w->ret = false;
+
+    memset(&w->live, 0, sizeof(struct sniffer::live_statistics));
+    memset(&w->previous, 0, sizeof(struct sniffer::live_statistics));
+    memset(w->latencies, 0, sizeof(w->latencies));
+
+    // Each worker has its own copy of the filter, but the prefix and flow
+    // tables (read-only, possibly big) are built once by the first worker
+    // and shared (the workers are destroyed in reverse order).
+    w->sniffer.filter().snaplen(opts.snaplen);
+    if ((filter) && (!w->sniffer.filter().parse(filter, (i > 0) ? &_M_workers[0].sniffer.filter() : NULL))) {
+      return false;
+    }
+
+    if ((i == 0) && (w->sniffer.filter().have_flows())) {
+      const flow_table& flows = w->sniffer.filter().flows();
+      printf("%lu flows loaded from %s (capacity: %lu flows, %lu KB shared by the workers).\n",
+             flows.count(),
+             flows.filename(),
+             flows.capacity(),
+             flows.memory() / 1024);
+    }
+
+    char path[PATH_MAX];
+    if (nworkers == 1) {
+      if (!w->sniffer.create(interface, pathname, o)) {
+        return false;
+      }
+    } else {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "-%u", i);
+
+      if (!fs::path::add_suffix(pathname, suffix, path, sizeof(path))) {
+        return false;
+      }
+
+      if (!w->sniffer.create(interface, path, o)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+bool net::capture::export_statistics(const char* socket, const char* textfile, unsigned interval)
+{
+  // Sanity check.
+  if ((interval == 0) || (interval > kMaxStatisticsInterval)) {
+    return false;
+  }
+
+  if (!_M_exporter.create(socket, textfile)) {
+    return false;
+  }
+
+  _M_interval = interval;
+  _M_export = true;
+
+  return true;
+}
+
+bool net::capture::start()
+{
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    struct worker* w = &_M_workers[i];
+
+    if (pthread_create(&w->thread, NULL, run, w) != 0) {
+      return false;
+    }
+
+    w->started = true;
+  }
+
+  if (_M_export) {
+    _M_monitor_running = true;
+
+    if (pthread_create(&_M_monitor, NULL, monitor, this) != 0) {
+      _M_monitor_running = false;
+      return false;
+    }
+
+    _M_monitor_started = true;
+  }
+
+  return true;
+}
+
+void net::capture::stop()
+{
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    _M_workers[i].sniffer.stop();
+  }
+}
+
+bool net::capture::running() const
+{
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    const struct worker* w = &_M_workers[i];
+
+    if ((w->started) && (!__atomic_load_n(&w->finished, __ATOMIC_ACQUIRE))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool net::capture::join()
+{
+  bool ret = true;
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    struct worker* w = &_M_workers[i];
+
+    if (w->started) {
+      pthread_join(w->thread, NULL);
+      w->started = false;
+
+      if (!w->ret) {
+        ret = false;
+      }
+    }
+  }
+
+  stop_monitor();
+
+  return ret;
+}
+
+void net::capture::stop_monitor()
+{
+  if (_M_monitor_started) {
+    __atomic_store_n(&_M_monitor_running, false, __ATOMIC_RELAXED);
+
+    pthread_join(_M_monitor, NULL);
+    _M_monitor_started = false;
+  }
+}
+
+bool net::capture::reload_flows()
+{
+  bool ret = true;
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    net::filter& filter = _M_workers[i].sniffer.filter();
+
+    if ((filter.have_flows()) && (!filter.reload_flows())) {
+      ret = false;
+    }
+  }
+
+  if ((ret) && (_M_nworkers > 0)) {
+    const net::filter& filter = _M_workers[0].sniffer.filter();
+    if (filter.have_flows()) {
+      printf("%lu flows loaded from %s.\n", filter.flows().count(), filter.flows().filename());
+    }
+  }
+
+  return ret;
+}
+
+bool net::capture::reload_sample_rate()
+{
+  if (!_M_sample_file) {
+    return true;
+  }
+
+  unsigned rate;
+  if (!net::flow_sampler::load_rate(_M_sample_file, rate)) {
+    return false;
+  }
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    _M_workers[i].sniffer.sampler().rate(rate);
+  }
+
+  printf("Sampling 1 in %u flows.\n", rate);
+
+  return true;
+}
+
+bool net::capture::dump()
+{
+  bool ret = true;
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    if (!_M_workers[i].sniffer.dump()) {
+      ret = false;
+    }
+  }
+
+  return ret;
+}
+
+void net::capture::show_statistics()
+{
+  struct sniffer::statistics total;
+  memset(&total, 0, sizeof(struct sniffer::statistics));
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    net::sniffer* sniffer = &_M_workers[i].sniffer;
+
+    if (!sniffer->update_statistics()) {
+      continue;
+    }
+
+    const struct sniffer::statistics& stats = sniffer->stats();
+
+    if (_M_nworkers > 1) {
+      printf("Worker %u:\n", i);
+      show_statistics(stats);
+      show_latencies(i, i + 1);
+      printf("\n");
+    }
+
+    add_statistics(total, stats);
+  }
+
+  if (_M_nworkers > 1) {
+    printf("Total:\n");
+  }
+
+  show_statistics(total);
+  show_latencies(0, _M_nworkers);
+}
+
+void* net::capture::run(void* arg)
+{
+  struct worker* w = reinterpret_cast<struct worker*>(arg);
+
+  w->ret = w->sniffer.start();
+
+  __atomic_store_n(&w->finished, true, __ATOMIC_RELEASE);
+
+  return NULL;
+}
+
+void* net::capture::monitor(void* arg)
+{
+  reinterpret_cast<capture*>(arg)->monitor();
+
+  return NULL;
+}
+
+void net::capture::monitor()
+{
+  uint64_t interval = static_cast<uint64_t>(_M_interval) * 1000000000ULL;
+
+  // First report (the counters since the start).
+  report();
+  uint64_t next = _M_report_time + interval;
+
+  while (__atomic_load_n(&_M_monitor_running, __ATOMIC_RELAXED)) {
+    uint64_t t = now();
+    if (t < next) {
+      // Serve the clients until the next report.
+      _M_exporter.serve(MIN(static_cast<int>((next - t) / 1000000) + 1, kMonitorTimeout));
+    } else {
+      report();
+
+      // Don't try to catch up if the reports are late.
+      if ((next += interval) <= _M_report_time) {
+        next = _M_report_time + interval;
+      }
+    }
+  }
+}
+
+void net::capture::report()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  uint64_t t = now();
+  double elapsed = (_M_report_time != 0) ? (t - _M_report_time) / 1000000000.0 : 0.0;
+  _M_report_time = t;
+
+  // Snapshot of the workers (the workers are never stalled) and totals.
+  struct sniffer::live_statistics total;
+  struct sniffer::live_statistics previous;
+  memset(&total, 0, sizeof(struct sniffer::live_statistics));
+  memset(&previous, 0, sizeof(struct sniffer::live_statistics));
+
+  struct latency_summary latencies[sniffer::kLatencies];
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    struct worker* w = &_M_workers[i];
+
+    w->previous = w->live;
+
+    // If the counters of the kernel cannot be read, the worker is
+    // reported without changes.
+    w->sniffer.snapshot(w->live);
+
+    for (unsigned j = 0; j < kNumberMetrics; j++) {
+      uint64_t* sum = reinterpret_cast<uint64_t*>(reinterpret_cast<uint8_t*>(&total) + kMetrics[j].offset);
+      uint64_t* prev = reinterpret_cast<uint64_t*>(reinterpret_cast<uint8_t*>(&previous) + kMetrics[j].offset);
+
+      if (kMetrics[j].maximum) {
+        *sum = MAX(*sum, value(w->live, kMetrics[j]));
+        *prev = MAX(*prev, value(w->previous, kMetrics[j]));
+      } else {
+        *sum += value(w->live, kMetrics[j]);
+        *prev += value(w->previous, kMetrics[j]);
+      }
+    }
+
+    for (unsigned j = 0; j < sniffer::kLatencies; j++) {
+      summarize(j, i, i + 1, w->latencies[j]);
+    }
+  }
+
+  // The percentiles of the total come from the merged histograms.
+  for (unsigned i = 0; i < sniffer::kLatencies; i++) {
+    summarize(i, 0, _M_nworkers, latencies[i]);
+  }
+
+  // JSON.
+  _M_json.reset();
+  _M_json.format("{\"timestamp\":%lu.%03lu,\"interface\":\"%s\",\"interval\":%.3f,\"workers\":[",
+                 ts.tv_sec,
+                 ts.tv_nsec / 1000000,
+                 _M_interface,
+                 elapsed);
+
+  for (unsigned i = 0; i < _M_nworkers; i++) {
+    _M_json.format("%s{\"worker\":%u,", (i > 0) ? "," : "", i);
+    format_json(_M_workers[i].live, _M_workers[i].previous, _M_workers[i].latencies, elapsed);
+  }
+
+  _M_json.append("],\"total\":{");
+  format_json(total, previous, latencies, elapsed);
+  _M_json.append("}\n");
+
+  // Prometheus exposition format (the samples of a metric are grouped).
+  _M_text.reset();
+
+  for (unsigned i = 0; i < kNumberMetrics; i++) {
+    const struct metric* m = &kMetrics[i];
+    const char* suffix = m->counter ? "_total" : "";
+
+    _M_text.format("# HELP pktsaver_%s%s %s\n", m->name, suffix, m->help);
+    _M_text.format("# TYPE pktsaver_%s%s %s\n", m->name, suffix, m->counter ? "counter" : "gauge");
+
+    for (unsigned j = 0; j < _M_nworkers; j++) {
+      _M_text.format("pktsaver_%s%s{interface=\"%s\",worker=\"%u\"} %llu\n",
+                     m->name,
+                     suffix,
+                     _M_interface,
+                     j,
+                     value(_M_workers[j].live, *m));
+    }
+  }
+
+  // Latencies (summaries, quantile 1 is the maximum).
+  for (unsigned i = 0; i < sniffer::kLatencies; i++) {
+    const struct latency* l = &kLatencies[i];
+
+    _M_text.format("# HELP pktsaver_%s_seconds %s\n", l->name, l->help);
+    _M_text.format("# TYPE pktsaver_%s_seconds summary\n", l->name);
+
+    for (unsigned j = 0; j < _M_nworkers; j++) {
+      const struct latency_summary* s = &_M_workers[j].latencies[i];
+
+      const uint64_t values[] = {s->p50, s->p99, s->p999, s->max};
+      static const char* const quantiles[] = {"0.5", "0.99", "0.999", "1"};
+
+      for (unsigned k = 0; k < sizeof(values) / sizeof(values[0]); k++) {
+        _M_text.format("pktsaver_%s_seconds{interface=\"%s\",worker=\"%u\",quantile=\"%s\"} %.9f\n",
+                       l->name,
+                       _M_interface,
+                       j,
+                       quantiles[k],
+                       values[k] / 1000000000.0);
+      }
+
+      _M_text.format("pktsaver_%s_seconds_sum{interface=\"%s\",worker=\"%u\"} %.9f\n",
+                     l->name,
+                     _M_interface,
+                     j,
+                     s->sum / 1000000000.0);
+
+      _M_text.format("pktsaver_%s_seconds_count{interface=\"%s\",worker=\"%u\"} %llu\n",
+                     l->name,
+                     _M_interface,
+                     j,
+                     s->count);
+    }
+  }
+
+  _M_text.format("# HELP pktsaver_last_report_timestamp_seconds Time of the report.\n"
+                 "# TYPE pktsaver_last_report_timestamp_seconds gauge\n"
+                 "pktsaver_last_report_timestamp_seconds{interface=\"%s\"} %lu.%03lu\n",
+                 _M_interface,
+                 ts.tv_sec,
+                 ts.tv_nsec / 1000000);
+
+  _M_exporter.publish(_M_json, _M_text);
+}
+
+void net::capture::format_json(const struct sniffer::live_statistics& live,
+                               const struct sniffer::live_statistics& previous,
+                               const struct latency_summary* latencies,
+                               double elapsed)
+{
+  for (unsigned i = 0; i < kNumberMetrics; i++) {
+    const struct metric* m = &kMetrics[i];
+    uint64_t n = value(live, *m);
+
+    if (m->counter) {
+      // The counters never go backwards.
+      uint64_t delta = n - value(previous, *m);
+
+      _M_json.format("\"%s\":{\"total\":%llu,\"delta\":%llu,\"rate\":%.1f}",
+                     m->name,
+                     n,
+                     delta,
+                     (elapsed > 0.0) ? delta / elapsed : 0.0);
+    } else {
+      _M_json.format("\"%s\":%llu", m->name, n);
+    }
+
+    _M_json.append(',');
+  }
+
+  _M_json.append("\"latency_ns\":{");
+
+  for (unsigned i = 0; i < sniffer::kLatencies; i++) {
+    const struct latency_summary* s = &latencies[i];
+
+    _M_json.format("%s\"%s\":{\"count\":%llu,\"sum\":%llu,\"p50\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}",
+                   (i > 0) ? "," : "",
+                   kLatencies[i].name,
+                   s->count,
+                   s->sum,
+                   s->p50,
+                   s->p99,
+                   s->p999,
+                   s->max);
+  }
+
+  _M_json.append("}}");
+}
+
+void net::capture::summarize(unsigned idx, unsigned first, unsigned last, struct latency_summary& summary) const
+{
+  // The histograms are being written: the merged copy is consistent.
+  util::histogram merged;
+  for (unsigned i = first; i < last; i++) {
+    merged.merge(_M_workers[i].sniffer.latency(idx));
+  }
+
+  summary.count = merged.count();
+  summary.sum = merged.sum();
+  summary.p50 = merged.percentile(50.0);
+  summary.p99 = merged.percentile(99.0);
+  summary.p999 = merged.percentile(99.9);
+  summary.max = merged.max();
+}
+
+void net::capture::show_latencies(unsigned first, unsigned last) const
+{
+  for (unsigned i = 0; i < sniffer::kLatencies; i++) {
+    struct latency_summary s;
+    summarize(i, first, last, s);
+
+    if (s.count > 0) {
+      printf("%s: p50 %.3f ms, p99 %.3f ms, p99.9 %.3f ms, maximum %.3f ms (%llu %s).\n",
+             kLatencies[i].label,
+             s.p50 / 1000000.0,
+             s.p99 / 1000000.0,
+             s.p999 / 1000000.0,
+             s.max / 1000000.0,
+             s.count,
+             kLatencies[i].unit);
+    }
+  }
+}
+
+void net::capture::add_statistics(struct sniffer::statistics& total, const struct sniffer::statistics& stats)
+{
+  total.received += stats.received;
+  total.matched += stats.matched;
+  total.dropped += stats.dropped;
+  total.queue_freezes += stats.queue_freezes;
+  total.ring_packets += stats.ring_packets;
+  total.ring_bytes += stats.ring_bytes;
+  total.written_packets += stats.written_packets;
+  total.written_bytes += stats.written_bytes;
+  total.bytes += stats.bytes;
+  total.saved_bytes += stats.saved_bytes;
+  total.overwritten += stats.overwritten;
+
+  total.ring_blocks += stats.ring_blocks;
+  total.queued_blocks += stats.queued_blocks;
+  total.queue_depth_sum += stats.queue_depth_sum;
+  total.max_queue_depth = MAX(total.max_queue_depth, stats.max_queue_depth);
+  total.hold_time_sum += stats.hold_time_sum;
+  total.max_hold_time = MAX(total.max_hold_time, stats.max_hold_time);
+
+  total.files += stats.files;
+  total.late_rotations += stats.late_rotations;
+  total.deleted_files += stats.deleted_files;
+
+  total.async_writes += stats.async_writes;
+  total.max_inflight_writes = MAX(total.max_inflight_writes, stats.max_inflight_writes);
+
+  total.direct_writes += stats.direct_writes;
+  total.direct_write_time_sum += stats.direct_write_time_sum;
+  total.max_direct_write_time = MAX(total.max_direct_write_time, stats.max_direct_write_time);
+  total.direct_stalls += stats.direct_stalls;
+
+  total.written_blocks += stats.written_blocks;
+  total.write_calls += stats.write_calls;
+
+  total.triggers += stats.triggers;
+  total.trigger_windows += stats.trigger_windows;
+  total.trigger_packets += stats.trigger_packets;
+  total.trigger_overruns += stats.trigger_overruns;
+
+  total.cutoff_packets += stats.cutoff_packets;
+  total.cutoff_bytes += stats.cutoff_bytes;
+  total.expired_flows += stats.expired_flows;
+  total.evicted_flows += stats.evicted_flows;
+
+  total.duplicate_packets += stats.duplicate_packets;
+  total.duplicate_bytes += stats.duplicate_bytes;
+
+  total.sampled_packets += stats.sampled_packets;
+  total.sampled_bytes += stats.sampled_bytes;
+  total.sample_rate = MAX(total.sample_rate, stats.sample_rate);
+
+  total.shed_packets += stats.shed_packets;
+  total.shed_bytes += stats.shed_bytes;
+  total.shed_truncated_bytes += stats.shed_truncated_bytes;
+  for (unsigned i = 0; i < net::load_shedder::kLevels; i++) {
+    total.shed_blocks[i] += stats.shed_blocks[i];
+  }
+
+  total.shed_changes += stats.shed_changes;
+  total.max_occupancy = MAX(total.max_occupancy, stats.max_occupancy);
+}
+
+void net::capture::show_statistics(const struct sniffer::statistics& stats)
+{
+  printf("%llu packets received.\n", stats.received);
+  printf("%llu packets matched the filter.\n", stats.matched);
+  printf("%llu packets dropped by kernel.\n", stats.dropped);
+
+  if (stats.queue_freezes > 0) {
+    printf("%llu times the ring was full (queue of blocks frozen by the kernel).\n", stats.queue_freezes);
+  }
+
+  if (stats.saved_bytes > 0) {
+    printf("%llu bytes (%.1f%%) not written because of the snap length.\n",
+           stats.saved_bytes,
+           (100.0 * stats.saved_bytes) / stats.bytes);
+  }
+
+  // Duplicates?
+  if (stats.duplicate_packets > 0) {
+    printf("%llu duplicate packets (%.1f%% of the matching packets, %llu bytes) not written.\n",
+           stats.duplicate_packets,
+           (100.0 * stats.duplicate_packets) / stats.matched,
+           stats.duplicate_bytes);
+  }
+
+  // Flow sampling?
+  if (stats.sample_rate > 0) {
+    printf("%llu packets (%llu bytes, %.1f%%) not written because their flow was not sampled (1 in %llu flows).\n",
+           stats.sampled_packets,
+           stats.sampled_bytes,
+           (stats.bytes > 0) ? (100.0 * stats.sampled_bytes) / stats.bytes : 0.0,
+           stats.sample_rate);
+  }
+
+  // Load shedding?
+  uint64_t shed_blocks = 0;
+  for (unsigned i = 0; i < net::load_shedder::kLevels; i++) {
+    shed_blocks += stats.shed_blocks[i];
+  }
+
+  if (shed_blocks > 0) {
+    printf("Load shedding: %llu level changes, highest ring occupancy %llu%%.\n",
+           stats.shed_changes,
+           stats.max_occupancy);
+
+    printf("Blocks per level:");
+    for (unsigned i = 0; i < net::load_shedder::kLevels; i++) {
+      printf(" %s %llu (%.1f%%)%s",
+             net::load_shedder::name(i),
+             stats.shed_blocks[i],
+             (100.0 * stats.shed_blocks[i]) / shed_blocks,
+             (i < net::load_shedder::kLevels - 1) ? "," : ".\n");
+    }
+
+    if ((stats.shed_packets > 0) || (stats.shed_truncated_bytes > 0)) {
+      printf("%llu packets (%llu bytes) dropped and %llu bytes truncated by the load shedding.\n",
+             stats.shed_packets,
+             stats.shed_bytes,
+             stats.shed_truncated_bytes);
+    }
+  }
+
+  // Flow cutoff?
+  if (stats.cutoff_packets > 0) {
+    printf("%llu packets (%llu bytes, %.1f%%) not written because of the flow cutoff.\n",
+           stats.cutoff_packets,
+           stats.cutoff_bytes,
+           (100.0 * stats.cutoff_bytes) / stats.bytes);
+  }
+
+  if ((stats.expired_flows > 0) || (stats.evicted_flows > 0)) {
+    printf("%llu flows expired, %llu flows evicted (flow table full).\n",
+           stats.expired_flows,
+           stats.evicted_flows);
+  }
+
+  if (stats.overwritten > 0) {
+    printf("%llu packets overwritten in the ring.\n", stats.overwritten);
+  }
+
+  // Writer thread?
+  if (stats.ring_blocks > 0) {
+    printf("%llu blocks handed to the writer thread (ring: %llu blocks).\n",
+           stats.queued_blocks,
+           stats.ring_blocks);
+
+    if (stats.queued_blocks > 0) {
+      printf("Writer queue depth: average %.1f blocks, maximum %llu blocks (%.1f%% of the ring).\n",
+             static_cast<double>(stats.queue_depth_sum) / stats.queued_blocks,
+             stats.max_queue_depth,
+             (100.0 * stats.max_queue_depth) / stats.ring_blocks);
+
+      printf("Block hold time: average %.3f ms, maximum %.3f ms.\n",
+             (static_cast<double>(stats.hold_time_sum) / stats.queued_blocks) / 1000000.0,
+             stats.max_hold_time / 1000000.0);
+    }
+  }
+
+  // File rotation?
+  if (stats.files > 0) {
+    printf("%llu capture files written, %llu deleted.\n", stats.files, stats.deleted_files);
+
+    if (stats.late_rotations > 0) {
+      printf("%llu rotations delayed (next file not ready).\n", stats.late_rotations);
+    }
+  }
+
+  // io_uring?
+  if (stats.async_writes > 0) {
+    printf("%llu asynchronous writes (maximum %llu in flight).\n",
+           stats.async_writes,
+           stats.max_inflight_writes);
+  }
+
+  // O_DIRECT?
+  if (stats.direct_writes > 0) {
+    printf("%llu O_DIRECT writes: average %.3f ms, maximum %.3f ms.\n",
+           stats.direct_writes,
+           (static_cast<double>(stats.direct_write_time_sum) / stats.direct_writes) / 1000000.0,
+           stats.max_direct_write_time / 1000000.0);
+
+    if (stats.direct_stalls > 0) {
+      printf("%llu times all the buffers were full.\n", stats.direct_stalls);
+    }
+  }
+
+  // Batched writes?
+  if (stats.written_blocks > 0) {
+    printf("%llu blocks written with %llu system calls (%.2f per block).\n",
+           stats.written_blocks,
+           stats.write_calls,
+           static_cast<double>(stats.write_calls) / stats.written_blocks);
+  }
+
+  // Triggers?
+  if (stats.triggers > 0) {
+    printf("%llu triggers fired, %llu packets written in %llu capture windows.\n",
+           stats.triggers,
+           stats.trigger_packets,
+           stats.trigger_windows);
+
+    if (stats.trigger_overruns > 0) {
+      printf("%llu times the ring overwrote packets before they were written.\n", stats.trigger_overruns);
+    }
+  }
+}
@@ -0,0 +1,234 @@
+#ifndef NET_CAPTURE_H
+#define NET_CAPTURE_H
+
+#include <pthread.h>
+#include <net/if.h>
+#include "net/sniffer.h"
+#include "net/stats_exporter.h"
+#include "string/buffer.h"
+#include "util/histogram.h"
+
+namespace net {
+  class capture {
+    public:
+      static const unsigned kMaxWorkers = 128;
+
+      // Default / maximum interval of the live statistics (seconds).
+      static const unsigned kDefaultStatisticsInterval = 1;
+      static const unsigned kMaxStatisticsInterval = 3600;
+
+      // Constructor.
+      capture();
+
+      // Destructor.
+      ~capture();
+
+      // Create (sample_file: file of the sampling rate, which overrides
+      // opts.sample_rate, or NULL).
+      bool create(const char* interface,
+                  const char* pathname,
+                  const char* filter,
+                  unsigned nworkers,
+                  const sniffer::options& opts,
+                  const char* sample_file);
+
+      // Export the live statistics every interval seconds from a monitor
+      // thread (socket: Unix socket serving them as JSON, textfile:
+      // Prometheus textfile, NULL if not used). The workers must have been
+      // created with options::live_statistics. Call before start().
+      bool export_statistics(const char* socket, const char* textfile, unsigned interval);
+
+      // Start (one thread per worker).
+      bool start();
+
+      // Stop.
+      void stop();
+
+      // Is any worker still running?
+      bool running() const;
+
+      // Wait for the workers to finish.
+      bool join();
+
+      // Dump a snapshot of the in-memory rings.
+      bool dump();
+
+      // Reload the flow tables of the filters.
+      bool reload_flows();
+
+      // Reload the sampling rate from its file.
+      bool reload_sample_rate();
+
+      // Show statistics.
+      void show_statistics();
+
+    private:
+      // Summary of a latency histogram (nanoseconds).
+      struct latency_summary {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t p50;
+        uint64_t p99;
+        uint64_t p999;
+        uint64_t max;
+      };
+
+      struct worker {
+        net::sniffer sniffer;
+
+        pthread_t thread;
+        bool started;
+
+        // Has the worker finished?
+        bool finished;
+
+        // Return value of sniffer::start().
+        bool ret;
+
+        // Last two snapshots of the live statistics.
+        struct sniffer::live_statistics live;
+        struct sniffer::live_statistics previous;
+
+        // Latencies at the last snapshot.
+        struct latency_summary latencies[sniffer::kLatencies];
+      };
+
+      // Metric of the live statistics.
+      struct metric {
+        // Name (Prometheus: pktsaver_<name>[_total]).
+        const char* name;
+
+        // Description.
+        const char* help;
+
+        // Offset in sniffer::live_statistics.
+        size_t offset;
+
+        // Counter (rates are computed) or gauge?
+        bool counter;
+
+        // Total of the workers: maximum (gauges) or sum?
+        bool maximum;
+      };
+
+      static const struct metric kMetrics[];
+      static const unsigned kNumberMetrics;
+
+      // Latency histogram of the live and exit statistics (indexed by
+      // sniffer::kHandoffLatency, ...).
+      struct latency {
+        // Name (Prometheus: pktsaver_<name>_seconds).
+        const char* name;
+
+        // Description.
+        const char* help;
+
+        // Label of the exit statistics.
+        const char* label;
+
+        // What a value is the duration of.
+        const char* unit;
+      };
+
+      static const struct latency kLatencies[sniffer::kLatencies];
+
+      // Maximum time the monitor thread waits before checking whether it
+      // has to stop (milliseconds).
+      static const int kMonitorTimeout = 200;
+
+      struct worker* _M_workers;
+      unsigned _M_nworkers;
+
+      char _M_interface[IFNAMSIZ];
+
+      // File of the sampling rate (NULL: none).
+      const char* _M_sample_file;
+
+      // Live statistics.
+      bool _M_export;
+      net::stats_exporter _M_exporter;
+      unsigned _M_interval;
+
+      // Monitor thread.
+      pthread_t _M_monitor;
+      bool _M_monitor_started;
+      bool _M_monitor_running;
+
+      // Time of the previous report (monotonic, nanoseconds, 0: none).
+      uint64_t _M_report_time;
+
+      // Report (JSON and Prometheus exposition format).
+      string::buffer _M_json;
+      string::buffer _M_text;
+
+      // Worker thread.
+      static void* run(void* arg);
+
+      // Monitor thread.
+      static void* monitor(void* arg);
+      void monitor();
+
+      // Stop the monitor thread.
+      void stop_monitor();
+
+      // Take a snapshot of the workers and publish a report.
+      void report();
+
+      // Format the metrics of a worker (or the total) as a JSON object.
+      void format_json(const struct sniffer::live_statistics& live,
+                       const struct sniffer::live_statistics& previous,
+                       const struct latency_summary* latencies,
+                       double elapsed);
+
+      // Merge a latency histogram of the workers [first, last) and
+      // summarize it.
+      void summarize(unsigned idx, unsigned first, unsigned last, struct latency_summary& summary) const;
+
+      // Show the latencies of the workers [first, last).
+      void show_latencies(unsigned first, unsigned last) const;
+
+      // Get the value of a metric.
+      static uint64_t value(const struct sniffer::live_statistics& live, const struct metric& metric);
+
+      // Get monotonic time in nanoseconds.
+      static uint64_t now();
+
+      // Add statistics.
+      static void add_statistics(struct sniffer::statistics& total, const struct sniffer::statistics& stats);
+
+      // Show statistics.
+      static void show_statistics(const struct sniffer::statistics& stats);
+
+      // Disable copy constructor and assignment operator.
+      capture(const capture&);
+      capture& operator=(const capture&);
+  };
+
+  inline capture::capture()
+    : _M_workers(NULL),
+      _M_nworkers(0),
+      _M_sample_file(NULL),
+      _M_export(false),
+      _M_interval(kDefaultStatisticsInterval),
+      _M_monitor_started(false),
+      _M_monitor_running(false),
+      _M_report_time(0)
+  {
+    *_M_interface = 0;
+  }
+
+  inline uint64_t capture::value(const struct sniffer::live_statistics& live, const struct metric& metric)
+  {
+    return *reinterpret_cast<const uint64_t*>(reinterpret_cast<const uint8_t*>(&live) + metric.offset);
+  }
+
+  inline uint64_t capture::now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+  }
+}
+
+#endif // NET_CAPTURE_H
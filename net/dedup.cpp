@@ -0,0 +1,154 @@
+#include <string.h>
+#if HAVE_SSE42
+  #include <nmmintrin.h>
+#endif
+#include "net/dedup.h"
+#include "macros/macros.h"
+
+net::dedup::dedup()
+  : _M_slots(NULL),
+    _M_window(0),
+    _M_hash(hash_generic)
+{
+  // Bytes of the first two words which are hashed: IPv4 without the TTL and
+  // the header checksum, IPv6 without the hop limit.
+  static const uint8_t masks[2][16] = {
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0xff, 0x00, 0x00, 0xff, 0xff, 0xff, 0xff},
+    {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x00, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff}
+  };
+
+  memcpy(_M_masks, masks, sizeof(_M_masks));
+}
+
+net::dedup::~dedup()
+{
+  if (_M_slots) {
+    free(_M_slots);
+  }
+}
+
+bool net::dedup::create(unsigned window)
+{
+  // Sanity check.
+  if ((window == 0) || (window > kMaxWindow)) {
+    return false;
+  }
+
+  if ((_M_slots = reinterpret_cast<struct slot*>(calloc(kBuckets * kSlots, sizeof(struct slot)))) == NULL) {
+    return false;
+  }
+
+  _M_window = window;
+
+#if HAVE_SSE42
+  if (__builtin_cpu_supports("sse4.2")) {
+    _M_hash = hash_crc32c;
+  }
+#endif
+
+  return true;
+}
+
+bool net::dedup::duplicate(const struct headers& h, uint32_t len, uint64_t usec)
+{
+  if (h.version == 0) {
+    return false;
+  }
+
+  // Copy the invariant part of the packet a word at a time (a memcpy() of
+  // variable size would be a "rep movs") and mask the first two words (the
+  // IP header is at least 20 bytes long).
+  size_t count = MIN(h.iplen, kHashedBytes);
+  size_t nwords = count / 8;
+
+  uint64_t words[kHashedBytes / 8];
+  for (size_t i = 0; i < nwords; i++) {
+    memcpy(&words[i], h.ip + (i * 8), 8);
+  }
+
+  if ((count & 7) != 0) {
+    words[nwords] = 0;
+    memcpy(&words[nwords], h.ip + (nwords * 8), count & 7);
+    nwords++;
+  }
+
+  const uint64_t* masks = (h.version == 4) ? _M_masks[0] : _M_masks[1];
+  words[0] &= masks[0];
+  words[1] &= masks[1];
+
+  uint64_t hash = _M_hash(words, nwords, len);
+
+  uint32_t tag = static_cast<uint32_t>(hash >> 32);
+  if (tag == 0) {
+    tag = 1;
+  }
+
+  uint32_t now = static_cast<uint32_t>(usec);
+
+  struct slot* bucket = &_M_slots[(hash & (kBuckets - 1)) * kSlots];
+  unsigned oldest = 0;
+  uint32_t max_age = 0;
+
+  for (unsigned i = 0; i < kSlots; i++) {
+    uint32_t age = now - bucket[i].time;
+
+    if (bucket[i].tag == tag) {
+      if (age < _M_window) {
+        return true;
+      }
+
+      // Same packet, too old: reuse its slot.
+      oldest = i;
+      break;
+    }
+
+    // A free slot is older than any other one.
+    if (bucket[i].tag == 0) {
+      age = UINT32_MAX;
+    }
+
+    if (age > max_age) {
+      max_age = age;
+      oldest = i;
+    }
+  }
+
+  bucket[oldest].tag = tag;
+  bucket[oldest].time = now;
+
+  return false;
+}
+
+#if HAVE_SSE42
+__attribute__((target("sse4.2")))
+uint64_t net::dedup::hash_crc32c(const uint64_t* words, size_t nwords, uint32_t len)
+{
+  // The second lane sees the words with their halves swapped, so that both
+  // lanes depend on every byte but are not the same linear function of the
+  // packet.
+  uint64_t a = 0x9e3779b9 ^ len;
+  uint64_t b = 0x85ebca6b;
+
+  for (size_t i = 0; i < nwords; i++) {
+    a = _mm_crc32_u64(a, words[i]);
+    b = _mm_crc32_u64(b, (words[i] << 32) | (words[i] >> 32));
+  }
+
+  return (b << 32) | a;
+}
+#endif // HAVE_SSE42
+
+uint64_t net::dedup::hash_generic(const uint64_t* words, size_t nwords, uint32_t len)
+{
+  uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
+
+  for (size_t i = 0; i < nwords; i++) {
+    h = (h ^ words[i]) * 0xff51afd7ed558ccdULL;
+    h ^= h >> 32;
+  }
+
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 29;
+
+  return h;
+}
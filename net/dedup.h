@@ -0,0 +1,80 @@
+#ifndef NET_DEDUP_H
+#define NET_DEDUP_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "net/headers.h"
+
+namespace net {
+  // Duplicate packet suppression (SPAN sessions which mirror the packets
+  // both on ingress and on egress).
+  //
+  // The invariant part of each IP packet (the first kHashedBytes bytes from
+  // the IP header, with the TTL / hop limit and the IPv4 header checksum
+  // masked) is hashed with CRC32C (SSE4.2) or, without it, with a multiply
+  // hash. The hashes of the packets seen in the last window microseconds
+  // are kept in a small table: kBuckets buckets of kSlots slots (tag and
+  // timestamp), a packet whose hash is in its bucket and is more recent than
+  // the window is a duplicate. The oldest slot of the bucket is replaced.
+  class dedup {
+    public:
+      // Maximum window (microseconds).
+      static const unsigned kMaxWindow = 1000000;
+
+      // Number of bytes hashed from the IP header.
+      static const unsigned kHashedBytes = 128;
+
+      // Constructor.
+      dedup();
+
+      // Destructor.
+      ~dedup();
+
+      // Create (window: microseconds).
+      bool create(unsigned window);
+
+      // Is the packet a duplicate of a packet seen less than window
+      // microseconds before (len: original length, usec: timestamp)? The
+      // packets which are not IP packets are never duplicates.
+      bool duplicate(const struct headers& h, uint32_t len, uint64_t usec);
+
+    private:
+      // Number of buckets and slots per bucket (32 bytes per bucket).
+      static const unsigned kBuckets = 16 * 1024;
+      static const unsigned kSlots = 4;
+
+      struct slot {
+        // High 32 bits of the hash (0: free slot).
+        uint32_t tag;
+
+        // Timestamp (microseconds, wraps around every 71 minutes).
+        uint32_t time;
+      };
+
+      struct slot* _M_slots;
+
+      uint32_t _M_window;
+
+      // Masks of the first two words of IPv4 and IPv6 packets.
+      uint64_t _M_masks[2][2];
+
+      // Hash function (words: invariant part of the packet, len: original
+      // length).
+      typedef uint64_t (*hash_function)(const uint64_t* words, size_t nwords, uint32_t len);
+      hash_function _M_hash;
+
+#if HAVE_SSE42
+      // Hash with CRC32C (two independent lanes).
+      static uint64_t hash_crc32c(const uint64_t* words, size_t nwords, uint32_t len);
+#endif
+
+      // Hash with multiplications.
+      static uint64_t hash_generic(const uint64_t* words, size_t nwords, uint32_t len);
+
+      // Disable copy constructor and assignment operator.
+      dedup(const dedup&);
+      dedup& operator=(const dedup&);
+  };
+}
+
+#endif // NET_DEDUP_H
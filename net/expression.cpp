@@ -0,0 +1,776 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "net/expression.h"
+#include "macros/macros.h"
+
+bool net::expression::parse(const char* expr)
+{
+  free();
+
+  _M_expression = false;
+  _M_count = 0;
+
+  if ((_M_nodes = reinterpret_cast<struct node*>(malloc(kMaxNodes * sizeof(struct node)))) == NULL) {
+    return false;
+  }
+
+  _M_nnodes = 0;
+
+  _M_token = expr;
+  _M_toklen = 0;
+
+  struct node* root;
+  if ((!next()) || ((root = parse_or()) == NULL) || (_M_toklen != 0)) {
+    free();
+    return false;
+  }
+
+  root = fold(root);
+  estimate(root);
+
+  // The program ends with "accept" and "reject", the code is generated
+  // backwards so that the targets of the jumps are always known.
+  unsigned pos = kMaxInstructions;
+
+  int entry;
+  if (root->type == kTrue) {
+    entry = emit(kAccept, 0, 0, 0, 0, 0, pos);
+  } else if (root->type == kFalse) {
+    entry = emit(kReject, 0, 0, 0, 0, 0, pos);
+  } else {
+    int accept = emit(kAccept, 0, 0, 0, 0, 0, pos);
+    int reject = emit(kReject, 0, 0, 0, 0, 0, pos);
+
+    entry = generate(root, accept, reject, pos);
+  }
+
+  free();
+
+  // The first instruction of the program is the entry point.
+  if ((entry < 0) || (static_cast<unsigned>(entry) != pos)) {
+    return false;
+  }
+
+  // Move the program to the beginning.
+  _M_count = kMaxInstructions - pos;
+  memmove(_M_program, _M_program + pos, _M_count * sizeof(struct instruction));
+
+  for (unsigned i = 0; i < _M_count; i++) {
+    _M_program[i].jt -= pos;
+    _M_program[i].jf -= pos;
+  }
+
+  _M_expression = true;
+  return true;
+}
+
+void net::expression::dump(FILE* file) const
+{
+  static const char* const registers[kRegisters] = {"proto", "len", "ttl", "sport", "dport", "flags", "version", "vlan"};
+
+  for (unsigned i = 0; i < _M_count; i++) {
+    const struct instruction* insn = &_M_program[i];
+
+    char operand[64];
+
+    switch (insn->op) {
+      case kRange:
+        if (insn->n == 0) {
+          snprintf(operand, sizeof(operand), "%s %u", registers[insn->reg], insn->k);
+        } else {
+          snprintf(operand, sizeof(operand), "%s %u-%u", registers[insn->reg], insn->k, insn->k + insn->n);
+        }
+
+        fprintf(file, "(%03u) %-8s %-16s jt %u\tjf %u\n", i, "range", operand, insn->jt, insn->jf);
+        break;
+      case kMask:
+        snprintf(operand, sizeof(operand), "%s 0x%02x", registers[insn->reg], insn->k);
+        fprintf(file, "(%03u) %-8s %-16s jt %u\tjf %u\n", i, "mask", operand, insn->jt, insn->jf);
+        break;
+      case kAccept:
+        fprintf(file, "(%03u) accept\n", i);
+        break;
+      default:
+        fprintf(file, "(%03u) reject\n", i);
+    }
+  }
+}
+
+void net::expression::free()
+{
+  if (_M_nodes) {
+    ::free(_M_nodes);
+    _M_nodes = NULL;
+  }
+}
+
+bool net::expression::next()
+{
+  const char* s = _M_token + _M_toklen;
+
+  while (IS_WHITE_SPACE(*s)) {
+    s++;
+  }
+
+  _M_token = s;
+
+  if (!*s) {
+    _M_toklen = 0;
+    return true;
+  }
+
+  if (IS_ALPHA(*s)) {
+    while ((IS_ALPHA(*s)) || (IS_DIGIT(*s))) {
+      s++;
+    }
+  } else if (IS_DIGIT(*s)) {
+    while (IS_DIGIT(*s)) {
+      s++;
+    }
+  } else if (((s[0] == '&') && (s[1] == '&')) ||
+             ((s[0] == '|') && (s[1] == '|')) ||
+             (((s[0] == '=') || (s[0] == '!') || (s[0] == '<') || (s[0] == '>')) && (s[1] == '='))) {
+    s += 2;
+  } else if (strchr("()!<>=-", *s)) {
+    s++;
+  } else {
+    return false;
+  }
+
+  _M_toklen = s - _M_token;
+  return true;
+}
+
+bool net::expression::is(const char* s) const
+{
+  return ((strlen(s) == _M_toklen) && (strncasecmp(_M_token, s, _M_toklen) == 0));
+}
+
+net::expression::node* net::expression::parse_or()
+{
+  struct node* left;
+  if ((left = parse_and()) == NULL) {
+    return NULL;
+  }
+
+  if ((!is("or")) && (!is("||"))) {
+    return left;
+  }
+
+  struct node* n;
+  if ((n = new_node(kOr)) == NULL) {
+    return NULL;
+  }
+
+  n->child = left;
+
+  struct node* last = left;
+  while ((is("or")) || (is("||"))) {
+    struct node* right;
+    if ((!next()) || ((right = parse_and()) == NULL)) {
+      return NULL;
+    }
+
+    last->next = right;
+    last = right;
+  }
+
+  return n;
+}
+
+net::expression::node* net::expression::parse_and()
+{
+  struct node* left;
+  if ((left = parse_unary()) == NULL) {
+    return NULL;
+  }
+
+  struct node* n = NULL;
+  struct node* last = left;
+
+  do {
+    if ((is("and")) || (is("&&"))) {
+      if (!next()) {
+        return NULL;
+      }
+    } else if ((_M_toklen == 0) || (is(")")) || (is("or")) || (is("||"))) {
+      // End of the "and".
+      return n ? n : left;
+    }
+
+    // Juxtaposed terms are and-ed.
+    struct node* right;
+    if ((right = parse_unary()) == NULL) {
+      return NULL;
+    }
+
+    if (!n) {
+      if ((n = new_node(kAnd)) == NULL) {
+        return NULL;
+      }
+
+      n->child = left;
+    }
+
+    last->next = right;
+    last = right;
+  } while (true);
+}
+
+net::expression::node* net::expression::parse_unary()
+{
+  if ((is("not")) || (is("!"))) {
+    struct node* n;
+    if ((!next()) || ((n = new_node(kNot)) == NULL) || ((n->child = parse_unary()) == NULL)) {
+      return NULL;
+    }
+
+    return n;
+  }
+
+  if (is("(")) {
+    struct node* n;
+    if ((!next()) || ((n = parse_or()) == NULL) || (!is(")")) || (!next())) {
+      return NULL;
+    }
+
+    return n;
+  }
+
+  return parse_term();
+}
+
+net::expression::node* net::expression::parse_term()
+{
+  static const struct {
+    const char* name;
+    uint8_t protocol;
+  } protocols[] = {
+    {"tcp", IPPROTO_TCP},
+    {"udp", IPPROTO_UDP}
+  };
+
+  static const struct {
+    const char* name;
+    uint8_t flag;
+  } flags[] = {
+    {"fin", 0x01},
+    {"syn", 0x02},
+    {"rst", 0x04},
+    {"psh", 0x08},
+    {"ack", 0x10},
+    {"urg", 0x20}
+  };
+
+  for (unsigned i = 0; i < ARRAY_SIZE(protocols); i++) {
+    if (is(protocols[i].name)) {
+      return next() ? new_test(kProtocol, protocols[i].protocol, protocols[i].protocol) : NULL;
+    }
+  }
+
+  if (is("icmp")) {
+    // ICMP or ICMPv6.
+    struct node* n;
+    if ((!next()) ||
+        ((n = new_node(kOr)) == NULL) ||
+        ((n->child = new_test(kProtocol, IPPROTO_ICMP, IPPROTO_ICMP)) == NULL) ||
+        ((n->child->next = new_test(kProtocol, IPPROTO_ICMPV6, IPPROTO_ICMPV6)) == NULL)) {
+      return NULL;
+    }
+
+    return n;
+  }
+
+  for (unsigned i = 0; i < ARRAY_SIZE(flags); i++) {
+    if (is(flags[i].name)) {
+      struct node* n;
+      if ((!next()) || ((n = new_node(kFlags)) == NULL)) {
+        return NULL;
+      }
+
+      n->reg = kTcpFlags;
+      n->first = flags[i].flag;
+
+      return n;
+    }
+  }
+
+  if (is("ip")) {
+    // IPv4 packet.
+    return next() ? new_test(kVersion, 4, 4) : NULL;
+  } else if (is("ip6")) {
+    // IPv6 packet.
+    return next() ? new_test(kVersion, 6, 6) : NULL;
+  } else if (is("vlan")) {
+    if (!next()) {
+      return NULL;
+    }
+
+    // Any VLAN ID if no VLAN ID follows.
+    if ((_M_toklen == 0) || (!IS_DIGIT(*_M_token))) {
+      return new_test(kVlan, 0, headers::kMaxVlanId);
+    }
+
+    uint32_t first, last;
+    if ((!parse_range(first, last)) || (last > headers::kMaxVlanId)) {
+      return NULL;
+    }
+
+    return new_test(kVlan, first, last);
+  } else if (is("port")) {
+    return next() ? parse_ports(true, true) : NULL;
+  } else if (is("sport")) {
+    return next() ? parse_ports(true, false) : NULL;
+  } else if (is("dport")) {
+    return next() ? parse_ports(false, true) : NULL;
+  } else if ((is("src")) || (is("dst"))) {
+    bool src = is("src");
+    if ((!next()) || (!is("port")) || (!next())) {
+      return NULL;
+    }
+
+    return parse_ports(src, !src);
+  } else if (is("proto")) {
+    return next() ? parse_comparison(kProtocol, 0xff) : NULL;
+  } else if (is("len")) {
+    return next() ? parse_comparison(kLength, 0xffff) : NULL;
+  } else if (is("ttl")) {
+    return next() ? parse_comparison(kTtl, 0xff) : NULL;
+  }
+
+  return NULL;
+}
+
+net::expression::node* net::expression::parse_ports(bool src, bool dest)
+{
+  uint32_t first, last;
+  if (!parse_range(first, last)) {
+    return NULL;
+  }
+
+  if ((src) && (dest)) {
+    // Source or destination port.
+    struct node* n;
+    if (((n = new_node(kOr)) == NULL) ||
+        ((n->child = new_test(kSport, first, last)) == NULL) ||
+        ((n->child->next = new_test(kDport, first, last)) == NULL)) {
+      return NULL;
+    }
+
+    return n;
+  }
+
+  return new_test(src ? kSport : kDport, first, last);
+}
+
+net::expression::node* net::expression::parse_comparison(unsigned reg, uint32_t max)
+{
+  // Comparison operator.
+  unsigned op;
+  if ((is("=")) || (is("=="))) {
+    op = 0;
+  } else if (is("!=")) {
+    op = 1;
+  } else if (is("<")) {
+    op = 2;
+  } else if (is("<=")) {
+    op = 3;
+  } else if (is(">")) {
+    op = 4;
+  } else if (is(">=")) {
+    op = 5;
+  } else {
+    return NULL;
+  }
+
+  uint32_t value;
+  if ((!next()) || (!parse_number(value))) {
+    return NULL;
+  }
+
+  // The comparisons are ranges, the empty ones are false.
+  switch (op) {
+    case 0: // ==
+      return (value <= max) ? new_test(reg, value, value) : new_node(kFalse);
+    case 1: // !=
+      {
+        if (value > max) {
+          return new_test(reg, 0, max);
+        } else if (value == 0) {
+          return new_test(reg, 1, max);
+        } else if (value == max) {
+          return new_test(reg, 0, max - 1);
+        }
+
+        struct node* n;
+        if (((n = new_node(kOr)) == NULL) ||
+            ((n->child = new_test(reg, 0, value - 1)) == NULL) ||
+            ((n->child->next = new_test(reg, value + 1, max)) == NULL)) {
+          return NULL;
+        }
+
+        return n;
+      }
+    case 2: // <
+      return (value > 0) ? new_test(reg, 0, MIN(value - 1, max)) : new_node(kFalse);
+    case 3: // <=
+      return new_test(reg, 0, MIN(value, max));
+    case 4: // >
+      return (value < max) ? new_test(reg, value + 1, max) : new_node(kFalse);
+    default: // >=
+      return (value <= max) ? new_test(reg, value, max) : new_node(kFalse);
+  }
+}
+
+bool net::expression::parse_range(uint32_t& first, uint32_t& last)
+{
+  if (!parse_number(first)) {
+    return false;
+  }
+
+  if (is("-")) {
+    return ((next()) && (parse_number(last)) && (first <= last));
+  }
+
+  last = first;
+  return true;
+}
+
+bool net::expression::parse_number(uint32_t& n)
+{
+  if ((_M_toklen == 0) || (!IS_DIGIT(*_M_token))) {
+    return false;
+  }
+
+  n = 0;
+  for (size_t i = 0; i < _M_toklen; i++) {
+    if ((n = (n * 10) + (_M_token[i] - '0')) > 0xffff) {
+      return false;
+    }
+  }
+
+  return next();
+}
+
+net::expression::node* net::expression::new_node(unsigned type)
+{
+  if (_M_nnodes == kMaxNodes) {
+    return NULL;
+  }
+
+  struct node* n = &_M_nodes[_M_nnodes++];
+  memset(n, 0, sizeof(struct node));
+  n->type = type;
+
+  return n;
+}
+
+net::expression::node* net::expression::new_test(unsigned reg, uint32_t first, uint32_t last)
+{
+  struct node* n;
+  if ((n = new_node(kTest)) == NULL) {
+    return NULL;
+  }
+
+  n->reg = reg;
+  n->first = first;
+  n->last = last;
+
+  return n;
+}
+
+net::expression::node* net::expression::fold(struct node* n)
+{
+  switch (n->type) {
+    case kNot:
+      {
+        struct node* child = fold(n->child);
+
+        if (child->type == kTrue) {
+          child->type = kFalse;
+          return child;
+        } else if (child->type == kFalse) {
+          child->type = kTrue;
+          return child;
+        } else if (child->type == kNot) {
+          return child->child;
+        }
+
+        n->child = child;
+        return n;
+      }
+    case kAnd:
+    case kOr:
+      {
+        // "and": true is neutral, false absorbs everything.
+        // "or": false is neutral, true absorbs everything.
+        unsigned neutral = (n->type == kAnd) ? kTrue : kFalse;
+
+        struct node* children = NULL;
+        struct node* last = NULL;
+
+        struct node* child = n->child;
+        while (child) {
+          struct node* next = child->next;
+          struct node* c = fold(child);
+
+          if (c->type == neutral) {
+            child = next;
+            continue;
+          } else if ((c->type == kTrue) || (c->type == kFalse)) {
+            return c;
+          }
+
+          // Flatten nested operators of the same type.
+          struct node* first = c;
+          struct node* end = c;
+          if (c->type == n->type) {
+            first = c->child;
+            end = first;
+            while (end->next) {
+              end = end->next;
+            }
+          }
+
+          if (last) {
+            last->next = first;
+          } else {
+            children = first;
+          }
+
+          last = end;
+          last->next = NULL;
+
+          child = next;
+        }
+
+        if (!children) {
+          n->type = neutral;
+          n->child = NULL;
+          return n;
+        }
+
+        n->child = children;
+
+        if (!merge(n)) {
+          n->type = kFalse;
+          n->child = NULL;
+          return n;
+        }
+
+        // A single operand?
+        if (!n->child->next) {
+          return n->child;
+        }
+
+        return n;
+      }
+    default:
+      return n;
+  }
+}
+
+bool net::expression::merge(struct node* n)
+{
+  for (struct node* a = n->child; a; a = a->next) {
+    if (a->type != kTest) {
+      continue;
+    }
+
+    struct node* prev = a;
+    struct node* b = a->next;
+    while (b) {
+      if ((b->type == kTest) && (b->reg == a->reg)) {
+        if (n->type == kAnd) {
+          // Intersection.
+          a->first = MAX(a->first, b->first);
+          a->last = MIN(a->last, b->last);
+
+          if (a->first > a->last) {
+            return false;
+          }
+        } else if ((b->first <= a->last + 1) && (a->first <= b->last + 1)) {
+          // Union of overlapping or adjacent ranges.
+          a->first = MIN(a->first, b->first);
+          a->last = MAX(a->last, b->last);
+        } else {
+          prev = b;
+          b = b->next;
+          continue;
+        }
+
+        // Remove b and check again the previous operands.
+        prev->next = b->next;
+        b = a->next;
+        prev = a;
+      } else {
+        prev = b;
+        b = b->next;
+      }
+    }
+  }
+
+  return true;
+}
+
+void net::expression::estimate(struct node* n)
+{
+  switch (n->type) {
+    case kTest:
+      n->cost = 1;
+      n->probability = probability(n->reg, n->first, n->last);
+      break;
+    case kFlags:
+      n->cost = 1;
+      n->probability = 0.1f;
+      break;
+    case kNot:
+      estimate(n->child);
+
+      n->cost = n->child->cost;
+      n->probability = 1 - n->child->probability;
+      break;
+    case kAnd:
+    case kOr:
+      {
+        bool conjunction = (n->type == kAnd);
+
+        // Sort the operands by rank (insertion sort).
+        struct node* sorted = NULL;
+
+        struct node* child = n->child;
+        while (child) {
+          struct node* next = child->next;
+          estimate(child);
+
+          float r = rank(child, conjunction);
+
+          struct node** p = &sorted;
+          while ((*p) && (rank(*p, conjunction) <= r)) {
+            p = &(*p)->next;
+          }
+
+          child->next = *p;
+          *p = child;
+
+          child = next;
+        }
+
+        n->child = sorted;
+
+        // The next operand only runs if the previous ones didn't decide.
+        float cost = 0;
+        float undecided = 1;
+        for (child = n->child; child; child = child->next) {
+          cost += undecided * child->cost;
+          undecided *= conjunction ? child->probability : 1 - child->probability;
+        }
+
+        n->cost = cost;
+        n->probability = conjunction ? undecided : 1 - undecided;
+      }
+
+      break;
+    default:
+      n->cost = 0;
+      n->probability = (n->type == kTrue) ? 1 : 0;
+  }
+}
+
+float net::expression::probability(unsigned reg, uint32_t first, uint32_t last)
+{
+  switch (reg) {
+    case kProtocol:
+      if (first == last) {
+        switch (first) {
+          case IPPROTO_TCP:
+            return 0.6f;
+          case IPPROTO_UDP:
+            return 0.3f;
+          case IPPROTO_ICMP:
+          case IPPROTO_ICMPV6:
+            return 0.02f;
+          default:
+            return 0.01f;
+        }
+      }
+
+      return (last - first + 1) / 256.0f;
+    case kLength:
+      // Most of the packets are not bigger than the Ethernet MTU.
+      first = MIN(first, 1500);
+      last = MIN(last, 1500);
+      return (last - first + 1) / 1501.0f;
+    case kTtl:
+      return (last - first + 1) / 256.0f;
+    case kVersion:
+      // Most of the packets are IPv4.
+      return (first == 4) ? 0.8f : 0.2f;
+    case kVlan:
+      // Most of the packets are untagged.
+      return (last - first + 1) / (4.0f * (headers::kMaxVlanId + 1));
+    default: // Ports.
+      return (last - first + 1) / 65536.0f;
+  }
+}
+
+float net::expression::rank(const struct node* n, bool conjunction)
+{
+  // An operand of an "and" decides when it is false, an operand of an "or"
+  // decides when it is true: the cheapest and most decisive ones run first.
+  float p = conjunction ? 1 - n->probability : n->probability;
+
+  return (p > 0) ? n->cost / p : 1e30f;
+}
+
+int net::expression::generate(const struct node* n, unsigned jt, unsigned jf, unsigned& pos)
+{
+  switch (n->type) {
+    case kTrue:
+      return jt;
+    case kFalse:
+      return jf;
+    case kTest:
+      return emit(kRange, n->reg, jt, jf, n->first, n->last - n->first, pos);
+    case kFlags:
+      return emit(kMask, n->reg, jt, jf, n->first, 0, pos);
+    case kNot:
+      return generate(n->child, jf, jt, pos);
+    default:
+      return generate(n->child, n->type == kAnd, jt, jf, pos);
+  }
+}
+
+int net::expression::generate(const struct node* n, bool conjunction, unsigned jt, unsigned jf, unsigned& pos)
+{
+  // The last operand is generated first: an operand of an "and" jumps to the
+  // next one when it is true, an operand of an "or" when it is false.
+  if (!n->next) {
+    return generate(n, jt, jf, pos);
+  }
+
+  int target;
+  if ((target = generate(n->next, conjunction, jt, jf, pos)) < 0) {
+    return -1;
+  }
+
+  return conjunction ? generate(n, target, jf, pos) : generate(n, jt, target, pos);
+}
+
+int net::expression::emit(uint8_t op, unsigned reg, unsigned jt, unsigned jf, uint32_t k, uint32_t n, unsigned& pos)
+{
+  if (pos == 0) {
+    return -1;
+  }
+
+  struct instruction* insn = &_M_program[--pos];
+  insn->op = op;
+  insn->reg = reg;
+  insn->jt = jt;
+  insn->jf = jf;
+  insn->k = k;
+  insn->n = n;
+
+  return pos;
+}
@@ -0,0 +1,293 @@
+#ifndef NET_EXPRESSION_H
+#define NET_EXPRESSION_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include "net/headers.h"
+
+namespace net {
+  // Filter expression (e.g. "tcp and not port 22"), compiled to a bytecode
+  // which runs on the fields of the packet.
+  class expression {
+    public:
+      // Maximum number of instructions.
+      static const unsigned kMaxInstructions = 256;
+
+      // Registers (fields of the packet).
+      static const unsigned kProtocol = 0; // IP protocol (transport protocol for IPv6).
+      static const unsigned kLength = 1;   // IP total length.
+      static const unsigned kTtl = 2;      // IP time to live / IPv6 hop limit.
+      static const unsigned kSport = 3;    // TCP / UDP source port.
+      static const unsigned kDport = 4;    // TCP / UDP destination port.
+      static const unsigned kTcpFlags = 5; // TCP flags (0 if not TCP).
+      static const unsigned kVersion = 6;  // IP version.
+      static const unsigned kVlan = 7;     // VLAN ID of the outermost tag.
+      static const unsigned kRegisters = 8;
+
+      // Value of the registers whose field is not in the packet (no range
+      // contains it).
+      static const uint32_t kAbsent = 0xffffffff;
+
+      // Constructor.
+      expression();
+
+      // Destructor.
+      ~expression();
+
+      // Parse and compile expression.
+      bool parse(const char* expr);
+
+      // Have expression?
+      bool have_expression() const;
+
+      // Match packet.
+      bool match(const struct headers& h) const;
+
+      // Load the fields of a packet into the registers.
+      static void load(const struct headers& h, uint32_t* regs);
+
+      // Run program.
+      bool run(const uint32_t* regs) const;
+
+      // Get number of instructions.
+      unsigned count() const;
+
+      // Dump program.
+      void dump(FILE* file) const;
+
+    private:
+      // Opcodes.
+      static const uint8_t kRange = 0;  // k <= register <= k + n?
+      static const uint8_t kMask = 1;   // (register & k) != 0?
+      static const uint8_t kAccept = 2;
+      static const uint8_t kReject = 3;
+
+      // Instruction (jt / jf: next instruction if the test is true / false,
+      // the jumps always go forward).
+      struct instruction {
+        uint8_t op;
+        uint8_t reg;
+        uint16_t jt;
+        uint16_t jf;
+        uint32_t k;
+        uint32_t n;
+      };
+
+      struct instruction _M_program[kMaxInstructions];
+      unsigned _M_count;
+
+      bool _M_expression;
+
+      // Maximum number of nodes of the syntax tree.
+      static const unsigned kMaxNodes = 1024;
+
+      // Node types.
+      static const unsigned kFalse = 0;
+      static const unsigned kTrue = 1;
+      static const unsigned kTest = 2;  // Register in a range.
+      static const unsigned kFlags = 3; // Register & mask.
+      static const unsigned kNot = 4;
+      static const unsigned kAnd = 5;
+      static const unsigned kOr = 6;
+
+      // Node of the syntax tree (the operands of "not", "and" and "or" are
+      // the list of children).
+      struct node {
+        unsigned type;
+        unsigned reg;
+        uint32_t first;
+        uint32_t last;
+
+        struct node* child;
+        struct node* next;
+
+        // Estimated cost (number of tests run) and probability of being true.
+        float cost;
+        float probability;
+      };
+
+      // Nodes (only while parsing).
+      struct node* _M_nodes;
+      unsigned _M_nnodes;
+
+      // Current token.
+      const char* _M_token;
+      size_t _M_toklen;
+
+      // Free nodes.
+      void free();
+
+      // Get next token.
+      bool next();
+
+      // Is the current token s?
+      bool is(const char* s) const;
+
+      // Parse "or" expression.
+      struct node* parse_or();
+
+      // Parse "and" expression (juxtaposed terms are and-ed).
+      struct node* parse_and();
+
+      // Parse "not" expression, parenthesized expression or term.
+      struct node* parse_unary();
+
+      // Parse term.
+      struct node* parse_term();
+
+      // Parse port or range of ports.
+      struct node* parse_ports(bool src, bool dest);
+
+      // Parse number or range of numbers.
+      bool parse_range(uint32_t& first, uint32_t& last);
+
+      // Parse comparison of a register.
+      struct node* parse_comparison(unsigned reg, uint32_t max);
+
+      // Parse number.
+      bool parse_number(uint32_t& n);
+
+      // New node.
+      struct node* new_node(unsigned type);
+
+      // New test node.
+      struct node* new_test(unsigned reg, uint32_t first, uint32_t last);
+
+      // Fold constants, flatten "and" / "or" and merge the ranges of the
+      // same register.
+      struct node* fold(struct node* n);
+
+      // Merge the tests of the same register of an "and" / "or" (returns
+      // false if an "and" can never be true).
+      static bool merge(struct node* n);
+
+      // Estimate cost and probability, sort the operands of "and" / "or" so
+      // that the cheapest and most decisive tests run first.
+      static void estimate(struct node* n);
+
+      // Estimated probability of a register being in a range.
+      static float probability(unsigned reg, uint32_t first, uint32_t last);
+
+      // Rank of an operand (the lowest rank runs first).
+      static float rank(const struct node* n, bool conjunction);
+
+      // Generate code backwards (returns the first instruction or -1).
+      int generate(const struct node* n, unsigned jt, unsigned jf, unsigned& pos);
+
+      // Generate the operands of an "and" / "or".
+      int generate(const struct node* n, bool conjunction, unsigned jt, unsigned jf, unsigned& pos);
+
+      // Emit instruction backwards.
+      int emit(uint8_t op, unsigned reg, unsigned jt, unsigned jf, uint32_t k, uint32_t n, unsigned& pos);
+
+      // Disable copy constructor and assignment operator.
+      expression(const expression&);
+      expression& operator=(const expression&);
+  };
+
+  inline expression::expression()
+    : _M_count(0),
+      _M_expression(false),
+      _M_nodes(NULL),
+      _M_nnodes(0)
+  {
+  }
+
+  inline expression::~expression()
+  {
+    free();
+  }
+
+  inline bool expression::have_expression() const
+  {
+    return _M_expression;
+  }
+
+  inline unsigned expression::count() const
+  {
+    return _M_count;
+  }
+
+  inline bool expression::match(const struct headers& h) const
+  {
+    uint32_t regs[kRegisters];
+    load(h, regs);
+
+    return run(regs);
+  }
+
+  inline void expression::load(const struct headers& h, uint32_t* regs)
+  {
+    regs[kProtocol] = kAbsent;
+    regs[kLength] = kAbsent;
+    regs[kTtl] = kAbsent;
+    regs[kSport] = kAbsent;
+    regs[kDport] = kAbsent;
+    regs[kTcpFlags] = 0;
+    regs[kVersion] = kAbsent;
+    regs[kVlan] = (h.nvlans > 0) ? h.vlans[0] : kAbsent;
+
+    if (h.version == 4) {
+      const struct iphdr* ip_header = h.ipv4();
+
+      regs[kLength] = ntohs(ip_header->tot_len);
+      regs[kTtl] = ip_header->ttl;
+    } else if (h.version == 6) {
+      const struct ip6_hdr* ip6_header = h.ipv6();
+
+      regs[kLength] = sizeof(struct ip6_hdr) + ntohs(ip6_header->ip6_plen);
+      regs[kTtl] = ip6_header->ip6_hlim;
+    } else {
+      return;
+    }
+
+    regs[kVersion] = h.version;
+    regs[kProtocol] = h.protocol;
+
+    // Only the first fragment has the transport header.
+    if (h.fragment) {
+      return;
+    }
+
+    const uint8_t* l4 = h.l4;
+    size_t l4len = h.l4len;
+
+    if (h.protocol == IPPROTO_TCP) {
+      if (l4len >= sizeof(struct tcphdr)) {
+        regs[kSport] = (l4[0] << 8) | l4[1];
+        regs[kDport] = (l4[2] << 8) | l4[3];
+        regs[kTcpFlags] = l4[13];
+      }
+    } else if (h.protocol == IPPROTO_UDP) {
+      if (l4len >= sizeof(struct udphdr)) {
+        regs[kSport] = (l4[0] << 8) | l4[1];
+        regs[kDport] = (l4[2] << 8) | l4[3];
+      }
+    }
+  }
+
+  inline bool expression::run(const uint32_t* regs) const
+  {
+    const struct instruction* insn = _M_program;
+
+    do {
+      switch (insn->op) {
+        case kRange:
+          insn = &_M_program[(regs[insn->reg] - insn->k <= insn->n) ? insn->jt : insn->jf];
+          break;
+        case kMask:
+          insn = &_M_program[((regs[insn->reg] & insn->k) != 0) ? insn->jt : insn->jf];
+          break;
+        case kAccept:
+          return true;
+        default:
+          return false;
+      }
+    } while (true);
+  }
+}
+
+#endif // NET_EXPRESSION_H
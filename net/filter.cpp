@@ -1,16 +1,31 @@
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
+#include <string.h>
+#include <strings.h>
 #include <limits.h>
+#include <linux/if_ether.h>
+#if defined(HAVE_AVX2) || defined(HAVE_AVX512)
+  #include <immintrin.h>
+#endif
 #include "net/filter.h"
 #include "macros/macros.h"
 
-bool net::filter::parse(const char* filter)
+bool net::filter::parse(const char* filter, const net::filter* shared)
 {
   if (!init()) {
     return false;
   }
 
+  // With a shared filter, the terms of the addresses and the flows are
+  // parsed (for the flags of the filter) but the tables are not built.
+  if (shared) {
+    _M_shared = true;
+    _M_prefixes = shared->_M_prefixes;
+    _M_flow_tables = shared->_M_flow_tables;
+  }
+
+  bool icmp = false;
   bool tcp = false;
   bool udp = false;
   bool src = false;
@@ -22,6 +37,33 @@ bool net::filter::parse(const char* filter)
   while (*filter) {
     switch (state) {
       case 0: // Initial state.
+        // Address or prefix?
+        if (address_term(filter)) {
+          if (!parse_address(filter)) {
+            return false;
+          }
+
+          break;
+        }
+
+        // VLAN IDs?
+        if (vlan_term(filter)) {
+          if (!parse_vlans(filter)) {
+            return false;
+          }
+
+          break;
+        }
+
+        // Flows?
+        if (flow_term(filter)) {
+          if (!parse_flows(filter)) {
+            return false;
+          }
+
+          break;
+        }
+
         switch (*filter) {
           case 'i':
           case 'I':
@@ -104,14 +146,20 @@ bool net::filter::parse(const char* filter)
           return false;
         }
 
-        if ((filter[3]) && (!IS_WHITE_SPACE(filter[3]))) {
+        if ((!filter[3]) || (IS_WHITE_SPACE(filter[3]))) {
+          set_snaplen(_M_icmp, _M_snaplen);
+
+          filter += 3;
+          state = 0; // Initial state.
+        } else if (filter[3] == '/') {
+          icmp = true;
+
+          filter += 4;
+          state = 7; // Snap length.
+        } else {
           return false;
         }
 
-        _M_icmp = true;
-
-        filter += 3;
-        state = 0; // Initial state.
         break;
       case 2: // TCP.
         if (((filter[0] != 'c') && (filter[0] != 'C')) || \
@@ -120,10 +168,18 @@ bool net::filter::parse(const char* filter)
         }
 
         if ((!filter[2]) || (IS_WHITE_SPACE(filter[2]))) {
-          set_tcp_ports(0, USHRT_MAX, true);
+          set_tcp_ports(0, USHRT_MAX, _M_snaplen);
 
           filter += 2;
           state = 0; // Initial state.
+        } else if (filter[2] == '/') {
+          src = true;
+          dest = true;
+          first = 0;
+          last = USHRT_MAX;
+
+          filter += 3;
+          state = 7; // Snap length.
         } else if (filter[2] == ':') {
           if ((filter[3] == 's') || (filter[3] == 'S')) {
             src = true;
@@ -158,10 +214,18 @@ bool net::filter::parse(const char* filter)
         }
 
         if ((!filter[2]) || (IS_WHITE_SPACE(filter[2]))) {
-          set_udp_ports(0, USHRT_MAX, true);
+          set_udp_ports(0, USHRT_MAX, _M_snaplen);
 
           filter += 2;
           state = 0; // Initial state.
+        } else if (filter[2] == '/') {
+          src = true;
+          dest = true;
+          first = 0;
+          last = USHRT_MAX;
+
+          filter += 3;
+          state = 7; // Snap length.
         } else if (filter[2] == ':') {
           if ((filter[3] == 's') || (filter[3] == 'S')) {
             src = true;
@@ -223,9 +287,14 @@ bool net::filter::parse(const char* filter)
           filter++;
           state = 6; // Range of ports.
         } else if ((!*filter) || (IS_WHITE_SPACE(*filter))) {
-          install_filter(tcp, udp, src, dest, first, first, true);
+          install_filter(tcp, udp, src, dest, first, first, _M_snaplen);
 
           state = 0; // Initial state.
+        } else if (*filter == '/') {
+          last = first;
+
+          filter++;
+          state = 7; // Snap length.
         } else {
           return false;
         }
@@ -244,17 +313,53 @@ bool net::filter::parse(const char* filter)
           return false;
         }
 
-        if ((*filter) && (!IS_WHITE_SPACE(*filter))) {
+        if (first > last) {
           return false;
         }
 
-        if (first > last) {
+        if (*filter == '/') {
+          filter++;
+          state = 7; // Snap length.
+          break;
+        }
+
+        if ((*filter) && (!IS_WHITE_SPACE(*filter))) {
           return false;
         }
 
-        install_filter(tcp, udp, src, dest, first, last, true);
+        install_filter(tcp, udp, src, dest, first, last, _M_snaplen);
 
         state = 0; // Initial state.
+        break;
+      case 7: // Snap length.
+        {
+          unsigned snaplen = 0;
+          while (IS_DIGIT(*filter)) {
+            if ((snaplen = (snaplen * 10) + (*filter - '0')) > kMaxSnaplen) {
+              return false;
+            }
+
+            filter++;
+          }
+
+          if (snaplen == 0) {
+            return false;
+          }
+
+          if ((*filter) && (!IS_WHITE_SPACE(*filter))) {
+            return false;
+          }
+
+          if (icmp) {
+            set_snaplen(_M_icmp, snaplen);
+            icmp = false;
+          } else {
+            install_filter(tcp, udp, src, dest, first, last, snaplen);
+          }
+
+          state = 0; // Initial state.
+        }
+
         break;
     }
   }
@@ -263,57 +368,230 @@ bool net::filter::parse(const char* filter)
     return false;
   }
 
-  _M_filter = true;
+  return build();
+}
+
+bool net::filter::compile(bpf_program& program) const
+{
+  program.clear();
+
+  // The addresses are always matched in user space.
+  if (!_M_ports) {
+    // Accept everything (truncated to the snap length).
+    return program.stmt(BPF_RET | BPF_K, _M_snaplen);
+  }
+
+  bool tcp = ((_M_tcp_src.nranges > 0) || (_M_tcp_dest.nranges > 0));
+  bool udp = ((_M_udp_src.nranges > 0) || (_M_udp_dest.nranges > 0));
+
+  // IPv6 and VLAN tagged packets are accepted, user space parses their
+  // headers and matches them.
+  if ((!program.stmt(BPF_LD | BPF_H | BPF_ABS, 12)) ||
+      (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 6, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IPV6, 3, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_8021Q, 2, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_8021AD, 1, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_QINQ1, 0, 1)) ||
+      (!program.stmt(BPF_RET | BPF_K, max_snaplen())) ||
+      (!program.stmt(BPF_RET | BPF_K, 0))) {
+    return false;
+  }
+
+  // IP packet with a complete IP header?
+  if ((!program.stmt(BPF_LD | BPF_W | BPF_LEN, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JGE | BPF_K, ETH_HLEN + sizeof(struct iphdr), 1, 0)) ||
+      (!program.stmt(BPF_RET | BPF_K, 0))) {
+    return false;
+  }
+
+  // X = offset of the transport header.
+  if ((!program.stmt(BPF_LDX | BPF_B | BPF_MSH, ETH_HLEN)) ||
+      (!program.stmt(BPF_MISC | BPF_TXA, 0)) ||
+      (!program.stmt(BPF_ALU | BPF_ADD | BPF_K, ETH_HLEN)) ||
+      (!program.stmt(BPF_ST, kBpfTransportOffset)) ||
+      (!program.stmt(BPF_MISC | BPF_TAX, 0)) ||
+      (!program.stmt(BPF_LD | BPF_W | BPF_LEN, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JGE | BPF_X, 0, 1, 0)) ||
+      (!program.stmt(BPF_RET | BPF_K, 0))) {
+    return false;
+  }
+
+  // Dispatch on the IP protocol. The blocks of the transport protocols might
+  // be further than a conditional jump can reach, hence the "ja".
+  if (!program.stmt(BPF_LD | BPF_B | BPF_ABS, ETH_HLEN + 9)) {
+    return false;
+  }
+
+  unsigned tcp_jump = 0;
+  if (tcp) {
+    if (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, 0x06, 0, 1)) {
+      return false;
+    }
+
+    tcp_jump = program.count();
+    if (!program.stmt(BPF_JMP | BPF_JA, 0)) {
+      return false;
+    }
+  }
+
+  unsigned udp_jump = 0;
+  if (udp) {
+    if (!program.jump(BPF_JMP | BPF_JEQ | BPF_K, 0x11, 0, 1)) {
+      return false;
+    }
+
+    udp_jump = program.count();
+    if (!program.stmt(BPF_JMP | BPF_JA, 0)) {
+      return false;
+    }
+  }
+
+  if (_M_icmp) {
+    if ((!program.jump(BPF_JMP | BPF_JEQ | BPF_K, 0x01, 0, 1)) ||
+        (!program.stmt(BPF_RET | BPF_K, _M_icmp))) {
+      return false;
+    }
+  }
+
+  if (!program.stmt(BPF_RET | BPF_K, 0)) {
+    return false;
+  }
+
+  if (tcp) {
+    program.set_target(tcp_jump, program.count());
+    if (!compile_protocol(program, _M_tcp_src, _M_tcp_dest, sizeof(struct tcphdr), true)) {
+      return false;
+    }
+  }
+
+  if (udp) {
+    program.set_target(udp_jump, program.count());
+    if (!compile_protocol(program, _M_udp_src, _M_udp_dest, sizeof(struct udphdr), false)) {
+      return false;
+    }
+  }
+
   return true;
 }
 
-bool net::filter::match(const struct iphdr* ip_header, size_t iphdrlen, size_t iplen) const
+bool net::filter::compile_protocol(bpf_program& program, const struct port_set& src, const struct port_set& dest, uint32_t hdrlen, bool tcp)
 {
-  if (!_M_filter) {
-    return true;
+  // Not the first fragment?
+  if ((!program.stmt(BPF_LD | BPF_H | BPF_ABS, ETH_HLEN + 6)) ||
+      (!program.jump(BPF_JMP | BPF_JSET | BPF_K, IP_OFFMASK, 0, 1)) ||
+      (!program.stmt(BPF_RET | BPF_K, 0))) {
+    return false;
   }
 
-  switch (ip_header->protocol) {
-    case 0x06: // TCP.
-      {
-        if (iplen < iphdrlen + sizeof(struct tcphdr)) {
-          return false;
-        }
+  // Complete transport header?
+  if ((!program.stmt(BPF_LD | BPF_MEM, kBpfTransportOffset)) ||
+      (!program.stmt(BPF_ALU | BPF_ADD | BPF_K, hdrlen)) ||
+      (!program.stmt(BPF_MISC | BPF_TAX, 0)) ||
+      (!program.stmt(BPF_LD | BPF_W | BPF_LEN, 0)) ||
+      (!program.jump(BPF_JMP | BPF_JGE | BPF_X, 0, 1, 0)) ||
+      (!program.stmt(BPF_RET | BPF_K, 0)) ||
+      (!program.stmt(BPF_LDX | BPF_MEM, kBpfTransportOffset))) {
+    return false;
+  }
 
-        const struct tcphdr* tcp_header;
-        tcp_header = reinterpret_cast<const struct tcphdr*>(reinterpret_cast<const uint8_t*>(ip_header) + iphdrlen);
-        size_t tcphdrlen = tcp_header->doff * 4;
-        if (iplen < iphdrlen + tcphdrlen) {
-          return false;
-        }
+  if (tcp) {
+    // Complete TCP header (including options)?
+    if ((!program.stmt(BPF_LD | BPF_B | BPF_IND, 12)) ||
+        (!program.stmt(BPF_ALU | BPF_RSH | BPF_K, 4)) ||
+        (!program.stmt(BPF_ALU | BPF_LSH | BPF_K, 2)) ||
+        (!program.stmt(BPF_ALU | BPF_ADD | BPF_X, 0)) ||
+        (!program.stmt(BPF_MISC | BPF_TAX, 0)) ||
+        (!program.stmt(BPF_LD | BPF_W | BPF_LEN, 0)) ||
+        (!program.jump(BPF_JMP | BPF_JGE | BPF_X, 0, 1, 0)) ||
+        (!program.stmt(BPF_RET | BPF_K, 0)) ||
+        (!program.stmt(BPF_LDX | BPF_MEM, kBpfTransportOffset))) {
+      return false;
+    }
+  }
 
-        uint16_t sport = ntohs(tcp_header->source);
-        uint16_t dport = ntohs(tcp_header->dest);
+  return ((compile_ports(program, src, true)) &&
+          (compile_ports(program, dest, false)) &&
+          (program.stmt(BPF_RET | BPF_K, 0)));
+}
 
-        return ((_M_tcp[sport].sport) || (_M_tcp[dport].dport));
-      }
-    case 0x11: // UDP.
-      {
-        if (iplen < iphdrlen + sizeof(struct udphdr)) {
-          return false;
-        }
+bool net::filter::compile_ports(bpf_program& program, const struct port_set& set, bool src)
+{
+  if (set.nranges == 0) {
+    return true;
+  }
 
-        const struct udphdr* udp_header;
-        udp_header = reinterpret_cast<const struct udphdr*>(reinterpret_cast<const uint8_t*>(ip_header) + iphdrlen);
+  // Load port.
+  if (!program.stmt(BPF_LD | BPF_H | BPF_IND, src ? 0 : 2)) {
+    return false;
+  }
 
-        uint16_t sport = ntohs(udp_header->source);
-        uint16_t dport = ntohs(udp_header->dest);
+  for (unsigned i = 0; i < set.nranges; i++) {
+    const struct port_range* range = &set.ranges[i];
 
-        return ((_M_udp[sport].sport) || (_M_udp[dport].dport));
+    // All the jumps are local, the matching packets are accepted in place
+    // (the return value is the snap length).
+    if ((range->first == 0) && (range->last == USHRT_MAX)) {
+      return program.stmt(BPF_RET | BPF_K, range->snaplen);
+    } else if (range->first == range->last) {
+      if ((!program.jump(BPF_JMP | BPF_JEQ | BPF_K, range->first, 0, 1)) ||
+          (!program.stmt(BPF_RET | BPF_K, range->snaplen))) {
+        return false;
       }
-    case 0x01: // ICMP.
-      return _M_icmp;
-    default:
-      return false;
+    } else {
+      if ((!program.jump(BPF_JMP | BPF_JGE | BPF_K, range->first, 0, 2)) ||
+          (!program.jump(BPF_JMP | BPF_JGT | BPF_K, range->last, 1, 0)) ||
+          (!program.stmt(BPF_RET | BPF_K, range->snaplen))) {
+        return false;
+      }
+    }
   }
+
+  return true;
 }
 
 void net::filter::free()
+{
+  free_ports();
+
+  if (_M_tcp_src.ranges) {
+    ::free(_M_tcp_src.ranges);
+  }
+
+  if (_M_tcp_dest.ranges) {
+    ::free(_M_tcp_dest.ranges);
+  }
+
+  if (_M_udp_src.ranges) {
+    ::free(_M_udp_src.ranges);
+  }
+
+  if (_M_udp_dest.ranges) {
+    ::free(_M_udp_dest.ranges);
+  }
+
+  memset(&_M_tcp_src, 0, sizeof(struct port_set));
+  memset(&_M_tcp_dest, 0, sizeof(struct port_set));
+  memset(&_M_udp_src, 0, sizeof(struct port_set));
+  memset(&_M_udp_dest, 0, sizeof(struct port_set));
+
+  if (_M_bits) {
+    ::free(_M_bits);
+    _M_bits = NULL;
+  }
+
+  _M_shape = kProtocolShape;
+  _M_match = match_all;
+  _M_match_keys = match_keys_all;
+
+  _M_prefix_table.free();
+  _M_flow_table.free();
+
+  _M_shared = false;
+  _M_prefixes = &_M_prefix_table;
+  _M_flow_tables = &_M_flow_table;
+}
+
+void net::filter::free_ports()
 {
   if (_M_tcp) {
     ::free(_M_tcp);
@@ -339,37 +617,658 @@ bool net::filter::init()
   }
 
   _M_filter = false;
-  _M_icmp = false;
-  set_ports(0, USHRT_MAX, false);
+  _M_ports = false;
+  _M_addresses = false;
+  _M_include = false;
+  _M_vlans = false;
+  _M_flows = false;
+  _M_headers = false;
+  _M_icmp = 0;
+
+  memset(_M_vlan_bits, 0, sizeof(_M_vlan_bits));
+
+  memset(_M_tcp, 0, (USHRT_MAX + 1) * sizeof(struct port_pair));
+  memset(_M_udp, 0, (USHRT_MAX + 1) * sizeof(struct port_pair));
+
+  return true;
+}
+
+bool net::filter::address_term(const char* filter)
+{
+  if (*filter == '!') {
+    filter++;
+  }
+
+  return ((strncasecmp(filter, "net:", 4) == 0) ||
+          (strncasecmp(filter, "src:", 4) == 0) ||
+          (strncasecmp(filter, "dst:", 4) == 0));
+}
+
+bool net::filter::parse_address(const char*& filter)
+{
+  bool exclude = (*filter == '!');
+  if (exclude) {
+    filter++;
+  }
+
+  uint8_t mask;
+  switch (*filter) {
+    case 'n':
+    case 'N':
+      mask = kSrcMask | kDestMask;
+      break;
+    case 's':
+    case 'S':
+      mask = kSrcMask;
+      break;
+    default:
+      mask = kDestMask;
+  }
+
+  uint8_t value = exclude ? kExclude : kInclude;
+
+  filter += 4;
+
+  const char* end = filter;
+  while ((*end) && (!IS_WHITE_SPACE(*end))) {
+    end++;
+  }
+
+  if (*filter == '@') {
+    // File of prefixes.
+    char filename[PATH_MAX];
+    size_t len = end - filter - 1;
+    if ((len == 0) || (len >= sizeof(filename))) {
+      return false;
+    }
+
+    memcpy(filename, filter + 1, len);
+    filename[len] = 0;
+
+    if ((!_M_shared) && (!_M_prefix_table.load(filename, mask, value))) {
+      return false;
+    }
+  } else if ((!_M_shared) && (!_M_prefix_table.add(filter, end - filter, mask, value))) {
+    return false;
+  }
+
+  if (!exclude) {
+    _M_include = true;
+  }
+
+  _M_addresses = true;
+
+  filter = end;
+  return true;
+}
+
+bool net::filter::vlan_term(const char* filter)
+{
+  return (strncasecmp(filter, "vlan:", 5) == 0);
+}
+
+bool net::filter::parse_vlans(const char*& filter)
+{
+  filter += 5;
+
+  unsigned first = 0;
+  if (!IS_DIGIT(*filter)) {
+    return false;
+  }
+
+  while (IS_DIGIT(*filter)) {
+    if ((first = (first * 10) + (*filter - '0')) > headers::kMaxVlanId) {
+      return false;
+    }
+
+    filter++;
+  }
+
+  unsigned last = first;
+  if (*filter == '-') {
+    filter++;
 
+    if (!IS_DIGIT(*filter)) {
+      return false;
+    }
+
+    last = 0;
+    while (IS_DIGIT(*filter)) {
+      if ((last = (last * 10) + (*filter - '0')) > headers::kMaxVlanId) {
+        return false;
+      }
+
+      filter++;
+    }
+
+    if (first > last) {
+      return false;
+    }
+  }
+
+  if ((*filter) && (!IS_WHITE_SPACE(*filter))) {
+    return false;
+  }
+
+  for (unsigned id = first; id <= last; id++) {
+    _M_vlan_bits[id / 64] |= static_cast<uint64_t>(1) << (id % 64);
+  }
+
+  _M_vlans = true;
+
+  return true;
+}
+
+bool net::filter::flow_term(const char* filter)
+{
+  return (strncasecmp(filter, "flow:", 5) == 0);
+}
+
+bool net::filter::parse_flows(const char*& filter)
+{
+  // Only one file of flows.
+  if (_M_flows) {
+    return false;
+  }
+
+  filter += 5;
+
+  const char* end = filter;
+  while ((*end) && (!IS_WHITE_SPACE(*end))) {
+    end++;
+  }
+
+  char filename[PATH_MAX];
+  size_t len = end - filter - 1;
+  if ((*filter != '@') || (len == 0) || (len >= sizeof(filename))) {
+    return false;
+  }
+
+  memcpy(filename, filter + 1, len);
+  filename[len] = 0;
+
+  if ((!_M_shared) && (!_M_flow_table.load(filename))) {
+    return false;
+  }
+
+  _M_flows = true;
+
+  filter = end;
+  return true;
+}
+
+bool net::filter::build()
+{
+  // Bitsets of the TCP source / destination and UDP source / destination
+  // ports (8 KB each).
+  if ((_M_bits = reinterpret_cast<uint64_t*>(malloc(4 * kBitsetWords * sizeof(uint64_t)))) == NULL) {
+    return false;
+  }
+
+  memset(_M_bits, 0, 4 * kBitsetWords * sizeof(uint64_t));
+
+  if ((!build(_M_tcp_src, _M_tcp, true, _M_bits)) ||
+      (!build(_M_tcp_dest, _M_tcp, false, _M_bits + kBitsetWords)) ||
+      (!build(_M_udp_src, _M_udp, true, _M_bits + 2 * kBitsetWords)) ||
+      (!build(_M_udp_dest, _M_udp, false, _M_bits + 3 * kBitsetWords))) {
+    return false;
+  }
+
+  // The port tables are not needed anymore.
+  free_ports();
+
+  _M_ports = ((_M_icmp != 0) ||
+              (_M_tcp_src.nranges > 0) || (_M_tcp_dest.nranges > 0) ||
+              (_M_udp_src.nranges > 0) || (_M_udp_dest.nranges > 0));
+
+  _M_headers = ((_M_vlans) || (_M_addresses) || (_M_flows));
+
+  if ((_M_addresses) && (!_M_shared) && (!_M_prefix_table.build())) {
+    return false;
+  }
+
+  // The shape of the filter is the most general shape of its sets.
+  _M_shape = MAX(MAX(classify(_M_tcp_src), classify(_M_tcp_dest)),
+                 MAX(classify(_M_udp_src), classify(_M_udp_dest)));
+
+  // A set with all the ports doesn't fit the single port shape.
+  if ((_M_shape == kPortShape) &&
+      ((full(_M_tcp_src)) || (full(_M_tcp_dest)) || (full(_M_udp_src)) || (full(_M_udp_dest)))) {
+    _M_shape = kRangesShape;
+  }
+
+  switch (_M_shape) {
+    case kProtocolShape:
+      _M_match = match_ports<kProtocolShape>;
+      _M_match_keys = match_keys<kProtocolShape>;
+      break;
+    case kPortShape:
+      _M_match = match_ports<kPortShape>;
+      _M_match_keys = match_keys<kPortShape>;
+      break;
+    case kRangesShape:
+      _M_match = match_ports<kRangesShape>;
+      _M_match_keys = match_keys<kRangesShape>;
+      break;
+    default:
+      _M_match = match_ports<kBitsetShape>;
+      _M_match_keys = match_keys<kBitsetShape>;
+  }
+
+  // Only addresses: any protocol matches.
+  if (!_M_ports) {
+    _M_match = match_all;
+    _M_match_keys = match_keys_all;
+  }
+
+  // The vectorized functions look up the ports in the bitsets, they are
+  // used when the filter has ranges of ports and all the ports of each set
+  // have the same snap length.
+  if ((_M_shape >= kRangesShape) &&
+      ((_M_tcp_src.nranges == 0) || (_M_tcp_src.snaplen != 0)) &&
+      ((_M_tcp_dest.nranges == 0) || (_M_tcp_dest.snaplen != 0)) &&
+      ((_M_udp_src.nranges == 0) || (_M_udp_src.snaplen != 0)) &&
+      ((_M_udp_dest.nranges == 0) || (_M_udp_dest.snaplen != 0))) {
+#if HAVE_AVX512
+    if (__builtin_cpu_supports("avx512f")) {
+      _M_match_keys = match_keys_avx512;
+    } else
+#endif
+#if HAVE_AVX2
+    if (__builtin_cpu_supports("avx2")) {
+      _M_match_keys = match_keys_avx2;
+    }
+#endif
+  }
+
+  _M_filter = true;
   return true;
 }
 
-void net::filter::install_filter(bool tcp, bool udp, bool src, bool dest, uint16_t first, uint16_t last, bool val)
+bool net::filter::build(struct port_set& set, const struct port_pair* ports, bool src, uint64_t* bits)
+{
+  // Count the ranges (ports with the same snap length).
+  unsigned nranges = 0;
+  for (unsigned port = 0; port <= USHRT_MAX; port++) {
+    uint16_t snaplen = src ? ports[port].sport : ports[port].dport;
+    if ((snaplen != 0) &&
+        ((port == 0) || ((src ? ports[port - 1].sport : ports[port - 1].dport) != snaplen))) {
+      nranges++;
+    }
+  }
+
+  if (nranges > 0) {
+    if ((set.ranges = reinterpret_cast<struct port_range*>(malloc(nranges * sizeof(struct port_range)))) == NULL) {
+      return false;
+    }
+  }
+
+  set.nranges = 0;
+  set.bits = bits;
+  set.snaplen = 0;
+
+  for (unsigned port = 0; port <= USHRT_MAX; port++) {
+    uint16_t snaplen = src ? ports[port].sport : ports[port].dport;
+    if (snaplen == 0) {
+      continue;
+    }
+
+    bits[port / 64] |= static_cast<uint64_t>(1) << (port % 64);
+
+    if ((set.nranges > 0) &&
+        (set.ranges[set.nranges - 1].last == port - 1) &&
+        (set.ranges[set.nranges - 1].snaplen == snaplen)) {
+      set.ranges[set.nranges - 1].last = port;
+    } else {
+      struct port_range* range = &set.ranges[set.nranges++];
+      range->first = port;
+      range->last = port;
+      range->snaplen = snaplen;
+
+      // Do all the ports have the same snap length?
+      if (set.nranges == 1) {
+        set.snaplen = snaplen;
+      } else if (snaplen != set.snaplen) {
+        set.snaplen = 0;
+      }
+    }
+  }
+
+  // Copy the first ranges.
+  for (unsigned i = 0; i < kMaxRanges; i++) {
+    if (i < set.nranges) {
+      set.first[i] = set.ranges[i].first;
+      set.width[i] = set.ranges[i].last - set.ranges[i].first;
+      set.snaplens[i] = set.ranges[i].snaplen;
+    } else {
+      set.first[i] = 0;
+      set.width[i] = 0;
+      set.snaplens[i] = 0;
+    }
+  }
+
+  return true;
+}
+
+unsigned net::filter::classify(const struct port_set& set)
+{
+  if ((set.nranges == 0) || (full(set))) {
+    return kProtocolShape;
+  } else if ((set.nranges == 1) && (set.ranges[0].first == set.ranges[0].last)) {
+    return kPortShape;
+  }
+
+  return (set.nranges <= kMaxRanges) ? kRangesShape : kBitsetShape;
+}
+
+bool net::filter::match_fields(const struct headers& h) const
+{
+  return (((!_M_vlans) || (match_vlans(h))) &&
+          ((!_M_addresses) || (match_addresses(h))) &&
+          ((!_M_flows) || (match_flows(h))));
+}
+
+uint16_t net::filter::match_all(const filter& f, const struct headers& h)
+{
+  return f._M_snaplen;
+}
+
+template<unsigned shape>
+uint16_t net::filter::match_ports(const filter& f, const struct headers& h)
+{
+  switch (h.protocol) {
+    case IPPROTO_TCP:
+      {
+        if ((h.fragment) || (h.l4len < sizeof(struct tcphdr))) {
+          return 0;
+        }
+
+        const struct tcphdr* tcp_header = reinterpret_cast<const struct tcphdr*>(h.l4);
+        size_t tcphdrlen = tcp_header->doff * 4;
+        if (h.l4len < tcphdrlen) {
+          return 0;
+        }
+
+        // Source ports are checked first.
+        uint16_t snaplen;
+        if ((snaplen = lookup<shape>(f._M_tcp_src, ntohs(tcp_header->source))) != 0) {
+          return snaplen;
+        }
+
+        return lookup<shape>(f._M_tcp_dest, ntohs(tcp_header->dest));
+      }
+    case IPPROTO_UDP:
+      {
+        if ((h.fragment) || (h.l4len < sizeof(struct udphdr))) {
+          return 0;
+        }
+
+        const struct udphdr* udp_header = reinterpret_cast<const struct udphdr*>(h.l4);
+
+        // Source ports are checked first.
+        uint16_t snaplen;
+        if ((snaplen = lookup<shape>(f._M_udp_src, ntohs(udp_header->source))) != 0) {
+          return snaplen;
+        }
+
+        return lookup<shape>(f._M_udp_dest, ntohs(udp_header->dest));
+      }
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+      return (h.version != 0) ? f._M_icmp : 0;
+    default:
+      return 0;
+  }
+}
+
+template<unsigned shape>
+inline uint16_t net::filter::lookup(const struct port_set& set, uint16_t port)
+{
+  switch (shape) {
+    case kProtocolShape:
+      // The set is either empty or it has all the ports.
+      return set.snaplens[0];
+    case kPortShape:
+      return (port == set.first[0]) ? set.snaplens[0] : 0;
+    case kRangesShape:
+      {
+        // The ranges don't overlap and the padding ranges have a snap length
+        // of 0, so all of them can be checked without branches.
+        uint16_t snaplen = 0;
+        for (unsigned i = 0; i < kMaxRanges; i++) {
+          uint16_t mask = -static_cast<uint16_t>(static_cast<uint16_t>(port - set.first[i]) <= set.width[i]);
+          snaplen |= set.snaplens[i] & mask;
+        }
+
+        return snaplen;
+      }
+    default:
+      if ((set.bits[port / 64] & (static_cast<uint64_t>(1) << (port % 64))) == 0) {
+        return 0;
+      }
+
+      return (set.snaplen != 0) ? set.snaplen : search(set, port);
+  }
+}
+
+void net::filter::match_keys_all(const filter& f, struct keys& keys, unsigned count)
+{
+  for (unsigned i = 0; i < count; i++) {
+    keys.snaplen[i] = f._M_snaplen;
+  }
+}
+
+template<unsigned shape>
+void net::filter::match_keys(const filter& f, struct keys& keys, unsigned count)
+{
+  for (unsigned i = 0; i < count; i++) {
+    uint16_t snaplen;
+
+    switch (keys.protocol[i]) {
+      case 0x06: // TCP.
+        // Source ports are checked first.
+        if ((snaplen = lookup<shape>(f._M_tcp_src, keys.sport[i])) == 0) {
+          snaplen = lookup<shape>(f._M_tcp_dest, keys.dport[i]);
+        }
+
+        break;
+      case 0x11: // UDP.
+        // Source ports are checked first.
+        if ((snaplen = lookup<shape>(f._M_udp_src, keys.sport[i])) == 0) {
+          snaplen = lookup<shape>(f._M_udp_dest, keys.dport[i]);
+        }
+
+        break;
+      case 0x01: // ICMP.
+        snaplen = f._M_icmp;
+        break;
+      default:
+        snaplen = 0;
+    }
+
+    keys.snaplen[i] = snaplen;
+  }
+}
+
+#if HAVE_AVX2
+__attribute__((target("avx2")))
+void net::filter::match_keys_avx2(const filter& f, struct keys& keys, unsigned count)
+{
+  // The bitsets are contiguous (TCP source, TCP destination, UDP source and
+  // UDP destination), they are read as 32-bit words.
+  const int* bits = reinterpret_cast<const int*>(f._M_bits);
+  const int words = 2 * kBitsetWords;
+
+  const __m256i tcp = _mm256_set1_epi32(0x06);
+  const __m256i udp = _mm256_set1_epi32(0x11);
+  const __m256i icmp = _mm256_set1_epi32(0x01);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i mask = _mm256_set1_epi32(31);
+  const __m256i dest_words = _mm256_set1_epi32(words);
+  const __m256i udp_words = _mm256_set1_epi32(2 * words);
+  const __m256i zero = _mm256_setzero_si256();
+
+  const __m256i tcp_src_snaplen = _mm256_set1_epi32(f._M_tcp_src.snaplen);
+  const __m256i tcp_dest_snaplen = _mm256_set1_epi32(f._M_tcp_dest.snaplen);
+  const __m256i udp_src_snaplen = _mm256_set1_epi32(f._M_udp_src.snaplen);
+  const __m256i udp_dest_snaplen = _mm256_set1_epi32(f._M_udp_dest.snaplen);
+  const __m256i icmp_snaplen = _mm256_set1_epi32(f._M_icmp);
+
+  // The arrays have room for whole vectors.
+  for (unsigned i = 0; i < count; i += 8) {
+    __m256i protocol = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(&keys.protocol[i])));
+    __m256i sport = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&keys.sport[i])));
+    __m256i dport = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&keys.dport[i])));
+
+    __m256i is_tcp = _mm256_cmpeq_epi32(protocol, tcp);
+    __m256i is_udp = _mm256_cmpeq_epi32(protocol, udp);
+    __m256i is_icmp = _mm256_cmpeq_epi32(protocol, icmp);
+    __m256i has_ports = _mm256_or_si256(is_tcp, is_udp);
+
+    // Gather the words of the bitsets which contain the ports.
+    __m256i base = _mm256_and_si256(is_udp, udp_words);
+    __m256i sindex = _mm256_add_epi32(base, _mm256_srli_epi32(sport, 5));
+    __m256i dindex = _mm256_add_epi32(_mm256_add_epi32(base, dest_words), _mm256_srli_epi32(dport, 5));
+
+    __m256i sword = _mm256_mask_i32gather_epi32(zero, bits, sindex, has_ports, 4);
+    __m256i dword = _mm256_mask_i32gather_epi32(zero, bits, dindex, has_ports, 4);
+
+    __m256i shit = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(sword, _mm256_and_si256(sport, mask)), one), one);
+    __m256i dhit = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_srlv_epi32(dword, _mm256_and_si256(dport, mask)), one), one);
+
+    // Source ports are checked first.
+    __m256i ssnaplen = _mm256_blendv_epi8(tcp_src_snaplen, udp_src_snaplen, is_udp);
+    __m256i dsnaplen = _mm256_blendv_epi8(tcp_dest_snaplen, udp_dest_snaplen, is_udp);
+    __m256i snaplen = _mm256_blendv_epi8(_mm256_and_si256(dhit, dsnaplen), ssnaplen, shit);
+
+    snaplen = _mm256_or_si256(_mm256_and_si256(snaplen, has_ports), _mm256_and_si256(is_icmp, icmp_snaplen));
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&keys.snaplen[i]),
+                     _mm_packus_epi32(_mm256_castsi256_si128(snaplen), _mm256_extracti128_si256(snaplen, 1)));
+  }
+}
+#endif // HAVE_AVX2
+
+#if HAVE_AVX512
+__attribute__((target("avx512f")))
+void net::filter::match_keys_avx512(const filter& f, struct keys& keys, unsigned count)
+{
+  const int* bits = reinterpret_cast<const int*>(f._M_bits);
+  const int words = 2 * kBitsetWords;
+
+  const __m512i tcp = _mm512_set1_epi32(0x06);
+  const __m512i udp = _mm512_set1_epi32(0x11);
+  const __m512i icmp = _mm512_set1_epi32(0x01);
+  const __m512i one = _mm512_set1_epi32(1);
+  const __m512i mask = _mm512_set1_epi32(31);
+  const __m512i dest_words = _mm512_set1_epi32(words);
+  const __m512i udp_words = _mm512_set1_epi32(2 * words);
+  const __m512i zero = _mm512_setzero_si512();
+
+  const __m512i tcp_src_snaplen = _mm512_set1_epi32(f._M_tcp_src.snaplen);
+  const __m512i tcp_dest_snaplen = _mm512_set1_epi32(f._M_tcp_dest.snaplen);
+  const __m512i udp_src_snaplen = _mm512_set1_epi32(f._M_udp_src.snaplen);
+  const __m512i udp_dest_snaplen = _mm512_set1_epi32(f._M_udp_dest.snaplen);
+  const __m512i icmp_snaplen = _mm512_set1_epi32(f._M_icmp);
+
+  // The arrays have room for whole vectors.
+  for (unsigned i = 0; i < count; i += 16) {
+    __m512i protocol = _mm512_cvtepu8_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&keys.protocol[i])));
+    __m512i sport = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&keys.sport[i])));
+    __m512i dport = _mm512_cvtepu16_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(&keys.dport[i])));
+
+    __mmask16 is_tcp = _mm512_cmpeq_epi32_mask(protocol, tcp);
+    __mmask16 is_udp = _mm512_cmpeq_epi32_mask(protocol, udp);
+    __mmask16 is_icmp = _mm512_cmpeq_epi32_mask(protocol, icmp);
+    __mmask16 has_ports = is_tcp | is_udp;
+
+    // Gather the words of the bitsets which contain the ports.
+    __m512i base = _mm512_maskz_mov_epi32(is_udp, udp_words);
+    __m512i sindex = _mm512_add_epi32(base, _mm512_srli_epi32(sport, 5));
+    __m512i dindex = _mm512_add_epi32(_mm512_add_epi32(base, dest_words), _mm512_srli_epi32(dport, 5));
+
+    __m512i sword = _mm512_mask_i32gather_epi32(zero, has_ports, sindex, bits, 4);
+    __m512i dword = _mm512_mask_i32gather_epi32(zero, has_ports, dindex, bits, 4);
+
+    __mmask16 shit = _mm512_test_epi32_mask(_mm512_srlv_epi32(sword, _mm512_and_si512(sport, mask)), one);
+    __mmask16 dhit = _mm512_test_epi32_mask(_mm512_srlv_epi32(dword, _mm512_and_si512(dport, mask)), one);
+
+    // Source ports are checked first.
+    __m512i ssnaplen = _mm512_mask_blend_epi32(is_udp, tcp_src_snaplen, udp_src_snaplen);
+    __m512i dsnaplen = _mm512_mask_blend_epi32(is_udp, tcp_dest_snaplen, udp_dest_snaplen);
+    __m512i snaplen = _mm512_mask_blend_epi32(shit, _mm512_maskz_mov_epi32(dhit, dsnaplen), ssnaplen);
+
+    snaplen = _mm512_mask_blend_epi32(is_icmp, _mm512_maskz_mov_epi32(has_ports, snaplen), icmp_snaplen);
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&keys.snaplen[i]), _mm512_cvtepi32_epi16(snaplen));
+  }
+}
+#endif // HAVE_AVX512
+
+uint16_t net::filter::search(const struct port_set& set, uint16_t port)
+{
+  // Binary search of the range which contains the port.
+  unsigned i = 0;
+  unsigned j = set.nranges;
+
+  while (i < j) {
+    unsigned mid = (i + j) / 2;
+
+    if (port < set.ranges[mid].first) {
+      j = mid;
+    } else if (port > set.ranges[mid].last) {
+      i = mid + 1;
+    } else {
+      return set.ranges[mid].snaplen;
+    }
+  }
+
+  return 0;
+}
+
+uint16_t net::filter::max_snaplen() const
+{
+  if (!_M_ports) {
+    return _M_snaplen;
+  }
+
+  const struct port_set* sets[] = {&_M_tcp_src, &_M_tcp_dest, &_M_udp_src, &_M_udp_dest};
+
+  uint16_t snaplen = _M_icmp;
+  for (unsigned i = 0; i < ARRAY_SIZE(sets); i++) {
+    for (unsigned j = 0; j < sets[i]->nranges; j++) {
+      snaplen = MAX(snaplen, sets[i]->ranges[j].snaplen);
+    }
+  }
+
+  return snaplen;
+}
+
+void net::filter::install_filter(bool tcp, bool udp, bool src, bool dest, uint16_t first, uint16_t last, uint16_t snaplen)
 {
   if ((tcp) && (udp)) {
     if ((src) && (dest)) {
-      set_ports(first, last, val);
+      set_ports(first, last, snaplen);
     } else if (src) {
-      set_src_ports(first, last, val);
+      set_src_ports(first, last, snaplen);
     } else if (dest) {
-      set_dest_ports(first, last, val);
+      set_dest_ports(first, last, snaplen);
     }
   } else if (tcp) {
     if ((src) && (dest)) {
-      set_tcp_ports(first, last, val);
+      set_tcp_ports(first, last, snaplen);
     } else if (src) {
-      set_tcp_src_ports(first, last, val);
+      set_tcp_src_ports(first, last, snaplen);
     } else if (dest) {
-      set_tcp_dest_ports(first, last, val);
+      set_tcp_dest_ports(first, last, snaplen);
     }
   } else if (udp) {
     if ((src) && (dest)) {
-      set_udp_ports(first, last, val);
+      set_udp_ports(first, last, snaplen);
     } else if (src) {
-      set_udp_src_ports(first, last, val);
+      set_udp_src_ports(first, last, snaplen);
     } else if (dest) {
-      set_udp_dest_ports(first, last, val);
+      set_udp_dest_ports(first, last, snaplen);
     }
   }
 }
@@ -3,73 +3,337 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
+#include "net/bpf_program.h"
+#include "net/headers.h"
+#include "net/prefix_table.h"
+#include "net/flow_table.h"
 
 namespace net {
   class filter {
     public:
+      // Maximum snap length.
+      static const uint16_t kMaxSnaplen = 0xffff;
+
+      // Maximum number of packets matched at once.
+      static const unsigned kBatchSize = 64;
+
+      // Keys of a batch of packets, one array per field (protocol 0: the
+      // packet doesn't match).
+      struct keys {
+        uint8_t protocol[kBatchSize];
+        uint16_t sport[kBatchSize];
+        uint16_t dport[kBatchSize];
+
+        // Snap lengths (set by match()).
+        uint16_t snaplen[kBatchSize];
+      };
+
       // Constructor.
       filter();
 
       // Destructor.
       ~filter();
 
-      // Parse filter.
-      bool parse(const char* filter);
+      // Set default snap length (for the packets and rules without one).
+      void snaplen(uint16_t snaplen);
+
+      // Get default snap length.
+      uint16_t snaplen() const;
+
+      // Get the biggest snap length.
+      uint16_t max_snaplen() const;
+
+      // Parse filter (shared: filter already parsed from the same string
+      // whose prefix and flow tables are used instead of building new ones,
+      // it must outlive this filter, NULL: none).
+      bool parse(const char* filter, const net::filter* shared = NULL);
 
       // Have filter?
       bool have_filter() const;
 
-      // Match filter.
-      bool match(const struct iphdr* ip_header, size_t iphdrlen, size_t iplen) const;
+      // Does the filter have protocols / ports?
+      bool have_ports() const;
+
+      // Does the filter have addresses?
+      bool have_addresses() const;
+
+      // Does the filter have VLAN IDs?
+      bool have_vlans() const;
+
+      // Does the filter have a flow table?
+      bool have_flows() const;
+
+      // Get flow table.
+      const flow_table& flows() const;
+
+      // Reload the file of the flow table (while the filter is being used by
+      // another thread, nothing to do if the table is shared).
+      bool reload_flows();
+
+      // Match filter (returns the snap length or 0 if the packet doesn't match).
+      uint16_t match(const struct headers& h) const;
+
+      // Match the VLAN IDs, the addresses and the flows (the parts of the
+      // filter which are always matched in user space).
+      bool match_headers(const struct headers& h) const;
+
+      // Extract the keys of a packet.
+      static void extract(const struct headers& h, struct keys& keys, unsigned i);
+
+      // Match a batch of packets (sets the snap lengths of the keys).
+      void match(struct keys& keys, unsigned count) const;
+
+      // Compile filter to classic BPF.
+      bool compile(bpf_program& program) const;
 
     private:
+      // Scratch memory slot where the BPF program saves the offset of the
+      // transport header.
+      static const uint32_t kBpfTransportOffset = 0;
+
+      // Maximum number of ranges per set of ports of the "ranges" shape.
+      static const unsigned kMaxRanges = 4;
+
+      // Number of 64-bit words of a bitset of ports.
+      static const unsigned kBitsetWords = (USHRT_MAX + 1) / 64;
+
+      // Shapes of the filter, from the most specific to the most general one.
+      // Each shape has its own match function.
+      static const unsigned kProtocolShape = 0; // Whole protocols.
+      static const unsigned kPortShape = 1;     // A single port per set.
+      static const unsigned kRangesShape = 2;   // Up to kMaxRanges ranges per set.
+      static const unsigned kBitsetShape = 3;   // Any set of ports.
+
+      // Bits of the values of the prefix table: what the longest source and
+      // destination prefixes say about the packet.
+      static const uint8_t kSrcMask = 0x03;
+      static const uint8_t kDestMask = 0x0c;
+      static const uint8_t kInclude = 0x05;
+      static const uint8_t kExclude = 0x0a;
+
       bool _M_filter;
-      bool _M_icmp;
 
+      // Protocols / ports?
+      bool _M_ports;
+
+      // Prefix and flow tables of another filter (read-only)?
+      bool _M_shared;
+
+      // Prefixes (the longest prefix of an address decides whether it is
+      // included or excluded): _M_prefix_table or the table of another
+      // filter.
+      net::prefix_table _M_prefix_table;
+      const net::prefix_table* _M_prefixes;
+      bool _M_addresses;
+
+      // Are there prefixes which include addresses (otherwise any address
+      // which is not excluded matches)?
+      bool _M_include;
+
+      // VLAN IDs (one bit per VLAN ID, any tag of the packet can match).
+      uint64_t _M_vlan_bits[(headers::kMaxVlanId + 1) / 64];
+      bool _M_vlans;
+
+      // Flows (the packet must belong to one of them): _M_flow_table or the
+      // table of another filter.
+      net::flow_table _M_flow_table;
+      const net::flow_table* _M_flow_tables;
+      bool _M_flows;
+
+      // Are the VLANs, the addresses or the flows matched?
+      bool _M_headers;
+
+      // Snap lengths (0: the protocol / port doesn't match).
+      uint16_t _M_icmp;
+
+      // Snap lengths of the ports (only while parsing).
       struct port_pair {
-        bool sport;
-        bool dport;
+        uint16_t sport;
+        uint16_t dport;
       };
 
       struct port_pair* _M_tcp;
       struct port_pair* _M_udp;
 
+      // Range of ports with the same snap length.
+      struct port_range {
+        uint16_t first;
+        uint16_t last;
+        uint16_t snaplen;
+      };
+
+      // Set of ports of a transport protocol and a direction.
+      struct port_set {
+        // Ranges (sorted).
+        struct port_range* ranges;
+        unsigned nranges;
+
+        // First ranges (first port, number of ports - 1 and snap length),
+        // padded with ranges whose snap length is 0.
+        uint16_t first[kMaxRanges];
+        uint16_t width[kMaxRanges];
+        uint16_t snaplens[kMaxRanges];
+
+        // Bitset (one bit per port).
+        uint64_t* bits;
+
+        // Snap length of all the ports (0 if they have different snap lengths).
+        uint16_t snaplen;
+      };
+
+      struct port_set _M_tcp_src;
+      struct port_set _M_tcp_dest;
+      struct port_set _M_udp_src;
+      struct port_set _M_udp_dest;
+
+      // Bitsets.
+      uint64_t* _M_bits;
+
+      // Shape of the filter.
+      unsigned _M_shape;
+
+      // Match function.
+      typedef uint16_t (*match_function)(const filter&, const struct headers&);
+      match_function _M_match;
+
+      // Batch match function.
+      typedef void (*match_keys_function)(const filter&, struct keys&, unsigned);
+      match_keys_function _M_match_keys;
+
+      uint16_t _M_snaplen;
+
       // Free.
       void free();
 
+      // Free the port tables.
+      void free_ports();
+
       // Initialize.
       bool init();
 
+      // Is it an address term ("[!](net|src|dst):")?
+      static bool address_term(const char* filter);
+
+      // Parse address term ("[!](net|src|dst):(prefix|@file)").
+      bool parse_address(const char*& filter);
+
+      // Is it a VLAN term ("vlan:")?
+      static bool vlan_term(const char* filter);
+
+      // Parse VLAN term ("vlan:id[-id]").
+      bool parse_vlans(const char*& filter);
+
+      // Is it a flow term ("flow:")?
+      static bool flow_term(const char* filter);
+
+      // Parse flow term ("flow:@file").
+      bool parse_flows(const char*& filter);
+
+      // Match the VLAN IDs.
+      bool match_vlans(const struct headers& h) const;
+
+      // Match the flows.
+      bool match_flows(const struct headers& h) const;
+
+      // Match the addresses.
+      bool match_addresses(const struct headers& h) const;
+
+      // Match the VLAN IDs, the addresses and the flows of the filter (out
+      // of line, the filter seldom has them).
+      bool match_fields(const struct headers& h) const;
+
+      // Do the values of the prefixes of the addresses match?
+      bool match_prefixes(uint8_t value) const;
+
+      // Build the sets of ports and select the match function.
+      bool build();
+
+      // Build set of ports.
+      bool build(struct port_set& set, const struct port_pair* ports, bool src, uint64_t* bits);
+
+      // Get the shape of a set of ports.
+      static unsigned classify(const struct port_set& set);
+
+      // Does the set have all the ports?
+      static bool full(const struct port_set& set);
+
+      // Match everything.
+      static uint16_t match_all(const filter& f, const struct headers& h);
+
+      // Match protocols and ports (specialized for the shape of the filter).
+      template<unsigned shape>
+      static uint16_t match_ports(const filter& f, const struct headers& h);
+
+      // Look up port (returns its snap length or 0).
+      template<unsigned shape>
+      static uint16_t lookup(const struct port_set& set, uint16_t port);
+
+      // Match a batch of packets without filter.
+      static void match_keys_all(const filter& f, struct keys& keys, unsigned count);
+
+      // Match a batch of packets (specialized for the shape of the filter).
+      template<unsigned shape>
+      static void match_keys(const filter& f, struct keys& keys, unsigned count);
+
+#if HAVE_AVX2
+      // Match a batch of packets with AVX2 (8 packets at once). The ports
+      // are looked up in the bitsets, all the ports of each set must have
+      // the same snap length.
+      static void match_keys_avx2(const filter& f, struct keys& keys, unsigned count);
+#endif
+
+#if HAVE_AVX512
+      // Match a batch of packets with AVX-512 (16 packets at once).
+      static void match_keys_avx512(const filter& f, struct keys& keys, unsigned count);
+#endif
+
+      // Search the snap length of a port in the ranges.
+      static uint16_t search(const struct port_set& set, uint16_t port);
+
       // Install filter.
-      void install_filter(bool tcp, bool udp, bool src, bool dest, uint16_t first, uint16_t last, bool val);
+      void install_filter(bool tcp, bool udp, bool src, bool dest, uint16_t first, uint16_t last, uint16_t snaplen);
+
+      // Set snap length of a protocol / port (the biggest one wins).
+      static void set_snaplen(uint16_t& dest, uint16_t snaplen);
+
+      // Compile transport protocol.
+      static bool compile_protocol(bpf_program& program, const struct port_set& src, const struct port_set& dest, uint32_t hdrlen, bool tcp);
+
+      // Compile the source or destination ports of a transport protocol.
+      static bool compile_ports(bpf_program& program, const struct port_set& set, bool src);
 
       // Set ports.
-      void set_ports(uint16_t first, uint16_t last, bool val);
+      void set_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set source ports.
-      void set_src_ports(uint16_t first, uint16_t last, bool val);
+      void set_src_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set destination ports.
-      void set_dest_ports(uint16_t first, uint16_t last, bool val);
+      void set_dest_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set TCP ports.
-      void set_tcp_ports(uint16_t first, uint16_t last, bool val);
+      void set_tcp_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set TCP source ports.
-      void set_tcp_src_ports(uint16_t first, uint16_t last, bool val);
+      void set_tcp_src_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set TCP destination ports.
-      void set_tcp_dest_ports(uint16_t first, uint16_t last, bool val);
+      void set_tcp_dest_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set UDP ports.
-      void set_udp_ports(uint16_t first, uint16_t last, bool val);
+      void set_udp_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set UDP source ports.
-      void set_udp_src_ports(uint16_t first, uint16_t last, bool val);
+      void set_udp_src_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Set UDP destination ports.
-      void set_udp_dest_ports(uint16_t first, uint16_t last, bool val);
+      void set_udp_dest_ports(uint16_t first, uint16_t last, uint16_t snaplen);
 
       // Disable copy constructor and assignment operator.
       filter(const filter&);
@@ -77,9 +341,30 @@ namespace net {
   };
 
   inline filter::filter()
-    : _M_tcp(NULL),
-      _M_udp(NULL)
+    : _M_filter(false),
+      _M_ports(false),
+      _M_shared(false),
+      _M_prefixes(&_M_prefix_table),
+      _M_addresses(false),
+      _M_include(false),
+      _M_vlans(false),
+      _M_flow_tables(&_M_flow_table),
+      _M_flows(false),
+      _M_headers(false),
+      _M_icmp(0),
+      _M_tcp(NULL),
+      _M_udp(NULL),
+      _M_bits(NULL),
+      _M_shape(kProtocolShape),
+      _M_match(match_all),
+      _M_match_keys(match_keys_all),
+      _M_snaplen(kMaxSnaplen)
   {
+    memset(_M_vlan_bits, 0, sizeof(_M_vlan_bits));
+    memset(&_M_tcp_src, 0, sizeof(struct port_set));
+    memset(&_M_tcp_dest, 0, sizeof(struct port_set));
+    memset(&_M_udp_src, 0, sizeof(struct port_set));
+    memset(&_M_udp_dest, 0, sizeof(struct port_set));
   }
 
   inline filter::~filter()
@@ -87,78 +372,231 @@ namespace net {
     free();
   }
 
+  inline void filter::snaplen(uint16_t snaplen)
+  {
+    _M_snaplen = snaplen;
+  }
+
+  inline uint16_t filter::snaplen() const
+  {
+    return _M_snaplen;
+  }
+
   inline bool filter::have_filter() const
   {
     return _M_filter;
   }
 
-  inline void filter::set_ports(uint16_t first, uint16_t last, bool val)
+  inline bool filter::have_ports() const
+  {
+    return _M_ports;
+  }
+
+  inline bool filter::have_addresses() const
+  {
+    return _M_addresses;
+  }
+
+  inline bool filter::have_vlans() const
+  {
+    return _M_vlans;
+  }
+
+  inline bool filter::have_flows() const
+  {
+    return _M_flows;
+  }
+
+  inline const flow_table& filter::flows() const
+  {
+    return *_M_flow_tables;
+  }
+
+  inline bool filter::reload_flows()
+  {
+    return (_M_shared) ? true : _M_flow_table.reload();
+  }
+
+  inline uint16_t filter::match(const struct headers& h) const
+  {
+    if (!match_headers(h)) {
+      return 0;
+    }
+
+    return _M_match(*this, h);
+  }
+
+  inline bool filter::match_headers(const struct headers& h) const
+  {
+    return ((!_M_headers) || (match_fields(h)));
+  }
+
+  inline bool filter::match_vlans(const struct headers& h) const
+  {
+    for (unsigned i = 0; i < h.nvlans; i++) {
+      if ((_M_vlan_bits[h.vlans[i] / 64] & (static_cast<uint64_t>(1) << (h.vlans[i] % 64))) != 0) {
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  inline bool filter::match_prefixes(uint8_t value) const
+  {
+    return (((value & kExclude) == 0) && ((!_M_include) || ((value & kInclude) != 0)));
+  }
+
+  inline bool filter::match_addresses(const struct headers& h) const
+  {
+    if (h.version == 4) {
+      return match_prefixes((_M_prefixes->lookup(ntohl(h.ipv4()->saddr)) & kSrcMask) |
+                            (_M_prefixes->lookup(ntohl(h.ipv4()->daddr)) & kDestMask));
+    } else if (h.version == 6) {
+      return match_prefixes((_M_prefixes->lookup(h.ipv6()->ip6_src.s6_addr) & kSrcMask) |
+                            (_M_prefixes->lookup(h.ipv6()->ip6_dst.s6_addr) & kDestMask));
+    }
+
+    return false;
+  }
+
+  inline bool filter::match_flows(const struct headers& h) const
+  {
+    struct flow_key k;
+    return ((k.build(h)) && (_M_flow_tables->lookup(k)));
+  }
+
+  inline void filter::extract(const struct headers& h, struct keys& keys, unsigned i)
+  {
+    switch (h.protocol) {
+      case IPPROTO_TCP:
+        {
+          if ((h.fragment) || (h.l4len < sizeof(struct tcphdr))) {
+            break;
+          }
+
+          const struct tcphdr* tcp_header = reinterpret_cast<const struct tcphdr*>(h.l4);
+          if (h.l4len < static_cast<size_t>(tcp_header->doff * 4)) {
+            break;
+          }
+
+          keys.protocol[i] = IPPROTO_TCP;
+          keys.sport[i] = ntohs(tcp_header->source);
+          keys.dport[i] = ntohs(tcp_header->dest);
+
+          return;
+        }
+      case IPPROTO_UDP:
+        {
+          if ((h.fragment) || (h.l4len < sizeof(struct udphdr))) {
+            break;
+          }
+
+          const struct udphdr* udp_header = reinterpret_cast<const struct udphdr*>(h.l4);
+
+          keys.protocol[i] = IPPROTO_UDP;
+          keys.sport[i] = ntohs(udp_header->source);
+          keys.dport[i] = ntohs(udp_header->dest);
+
+          return;
+        }
+      case IPPROTO_ICMP:
+      case IPPROTO_ICMPV6:
+        if (h.version != 0) {
+          keys.protocol[i] = IPPROTO_ICMP;
+          return;
+        }
+
+        break;
+    }
+
+    keys.protocol[i] = 0;
+  }
+
+  inline void filter::match(struct keys& keys, unsigned count) const
+  {
+    _M_match_keys(*this, keys, count);
+  }
+
+  inline bool filter::full(const struct port_set& set)
+  {
+    return ((set.nranges == 1) && (set.ranges[0].first == 0) && (set.ranges[0].last == USHRT_MAX));
+  }
+
+  inline void filter::set_snaplen(uint16_t& dest, uint16_t snaplen)
+  {
+    if (snaplen > dest) {
+      dest = snaplen;
+    }
+  }
+
+  inline void filter::set_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_tcp[i].sport = val;
-      _M_tcp[i].dport = val;
-      _M_udp[i].sport = val;
-      _M_udp[i].dport = val;
+      set_snaplen(_M_tcp[i].sport, snaplen);
+      set_snaplen(_M_tcp[i].dport, snaplen);
+      set_snaplen(_M_udp[i].sport, snaplen);
+      set_snaplen(_M_udp[i].dport, snaplen);
     }
   }
 
-  inline void filter::set_src_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_src_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_tcp[i].sport = val;
-      _M_udp[i].sport = val;
+      set_snaplen(_M_tcp[i].sport, snaplen);
+      set_snaplen(_M_udp[i].sport, snaplen);
     }
   }
 
-  inline void filter::set_dest_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_dest_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_tcp[i].dport = val;
-      _M_udp[i].dport = val;
+      set_snaplen(_M_tcp[i].dport, snaplen);
+      set_snaplen(_M_udp[i].dport, snaplen);
     }
   }
 
-  inline void filter::set_tcp_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_tcp_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_tcp[i].sport = val;
-      _M_tcp[i].dport = val;
+      set_snaplen(_M_tcp[i].sport, snaplen);
+      set_snaplen(_M_tcp[i].dport, snaplen);
     }
   }
 
-  inline void filter::set_tcp_src_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_tcp_src_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_tcp[i].sport = val;
+      set_snaplen(_M_tcp[i].sport, snaplen);
     }
   }
 
-  inline void filter::set_tcp_dest_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_tcp_dest_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_tcp[i].dport = val;
+      set_snaplen(_M_tcp[i].dport, snaplen);
     }
   }
 
-  inline void filter::set_udp_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_udp_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_udp[i].sport = val;
-      _M_udp[i].dport = val;
+      set_snaplen(_M_udp[i].sport, snaplen);
+      set_snaplen(_M_udp[i].dport, snaplen);
     }
   }
 
-  inline void filter::set_udp_src_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_udp_src_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_udp[i].sport = val;
+      set_snaplen(_M_udp[i].sport, snaplen);
     }
   }
 
-  inline void filter::set_udp_dest_ports(uint16_t first, uint16_t last, bool val)
+  inline void filter::set_udp_dest_ports(uint16_t first, uint16_t last, uint16_t snaplen)
   {
     for (unsigned i = first; i <= last; i++) {
-      _M_udp[i].dport = val;
+      set_snaplen(_M_udp[i].dport, snaplen);
     }
   }
 }
@@ -0,0 +1,183 @@
+#include <string.h>
+#include "net/flow_cutoff.h"
+
+net::flow_cutoff::flow_cutoff()
+  : _M_flows(NULL),
+    _M_max_flows(0),
+    _M_buckets(NULL),
+    _M_mask(0),
+    _M_free(kNone),
+    _M_count(0),
+    _M_wheel_time(0),
+    _M_cutoff(0)
+{
+  for (unsigned i = 0; i < kWheelSlots; i++) {
+    _M_wheel[i] = kNone;
+  }
+
+  memset(&_M_stats, 0, sizeof(struct statistics));
+}
+
+net::flow_cutoff::~flow_cutoff()
+{
+  if (_M_flows) {
+    free(_M_flows);
+  }
+
+  if (_M_buckets) {
+    free(_M_buckets);
+  }
+}
+
+bool net::flow_cutoff::create(uint64_t cutoff, size_t max_flows)
+{
+  // Sanity checks.
+  if ((max_flows < kMinFlows) || (max_flows > kMaxFlows)) {
+    return false;
+  }
+
+  // At least one bucket per flow.
+  size_t nbuckets = 1;
+  while (nbuckets < max_flows) {
+    nbuckets *= 2;
+  }
+
+  if (((_M_flows = reinterpret_cast<struct flow*>(malloc(max_flows * sizeof(struct flow)))) == NULL) ||
+      ((_M_buckets = reinterpret_cast<uint32_t*>(malloc(nbuckets * sizeof(uint32_t)))) == NULL)) {
+    return false;
+  }
+
+  // Touch the memory now rather than while capturing.
+  for (size_t i = 0; i < nbuckets; i++) {
+    _M_buckets[i] = kNone;
+  }
+
+  for (size_t i = 0; i < max_flows; i++) {
+    _M_flows[i].next = (i + 1 < max_flows) ? static_cast<uint32_t>(i + 1) : kNone;
+  }
+
+  _M_max_flows = max_flows;
+  _M_mask = nbuckets - 1;
+  _M_free = 0;
+
+  _M_cutoff = cutoff;
+
+  return true;
+}
+
+uint32_t net::flow_cutoff::add(const struct flow_key& k, size_t bucket, uint32_t sec)
+{
+  if (_M_free == kNone) {
+    evict();
+  }
+
+  uint32_t idx = _M_free;
+  struct flow* f = &_M_flows[idx];
+
+  _M_free = f->next;
+
+  f->key = k;
+  f->bytes = 0;
+
+  // A late packet is accounted in the oldest slot which has not been
+  // expired yet.
+  f->last_seen = (sec > _M_wheel_time) ? sec : _M_wheel_time;
+
+  f->next = _M_buckets[bucket];
+  _M_buckets[bucket] = idx;
+
+  link_timer(idx);
+
+  _M_count++;
+
+  return idx;
+}
+
+void net::flow_cutoff::remove(uint32_t idx)
+{
+  struct flow* f = &_M_flows[idx];
+
+  // Unlink from the hash chain.
+  uint32_t* prev = &_M_buckets[f->key.hash() & _M_mask];
+  while (*prev != idx) {
+    prev = &_M_flows[*prev].next;
+  }
+
+  *prev = f->next;
+
+  unlink_timer(idx);
+
+  f->next = _M_free;
+  _M_free = idx;
+
+  _M_count--;
+}
+
+void net::flow_cutoff::link_timer(uint32_t idx)
+{
+  struct flow* f = &_M_flows[idx];
+  uint32_t* head = &_M_wheel[f->last_seen % kWheelSlots];
+
+  f->prev_timer = kNone;
+  f->next_timer = *head;
+
+  if (*head != kNone) {
+    _M_flows[*head].prev_timer = idx;
+  }
+
+  *head = idx;
+}
+
+void net::flow_cutoff::unlink_timer(uint32_t idx)
+{
+  const struct flow* f = &_M_flows[idx];
+
+  if (f->prev_timer != kNone) {
+    _M_flows[f->prev_timer].next_timer = f->next_timer;
+  } else {
+    _M_wheel[f->last_seen % kWheelSlots] = f->next_timer;
+  }
+
+  if (f->next_timer != kNone) {
+    _M_flows[f->next_timer].prev_timer = f->prev_timer;
+  }
+}
+
+void net::flow_cutoff::advance(uint32_t sec)
+{
+  // The flows whose last packet is older than limit expire.
+  uint32_t limit = sec - kIdleTimeout;
+
+  // After a jump in time, walk each slot once.
+  if (limit - _M_wheel_time > kWheelSlots) {
+    _M_wheel_time = limit - kWheelSlots;
+  }
+
+  for (; _M_wheel_time < limit; _M_wheel_time++) {
+    uint32_t idx = _M_wheel[_M_wheel_time % kWheelSlots];
+    while (idx != kNone) {
+      uint32_t next = _M_flows[idx].next_timer;
+
+      // The slot might also have flows of a later second.
+      if (_M_flows[idx].last_seen < limit) {
+        remove(idx);
+        _M_stats.expired++;
+      }
+
+      idx = next;
+    }
+  }
+}
+
+void net::flow_cutoff::evict()
+{
+  for (unsigned i = 0; i < kWheelSlots; i++) {
+    uint32_t idx = _M_wheel[(_M_wheel_time + i) % kWheelSlots];
+    if (idx != kNone) {
+      remove(idx);
+      _M_stats.evicted++;
+
+      return;
+    }
+  }
+}
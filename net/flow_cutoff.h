@@ -0,0 +1,205 @@
+#ifndef NET_FLOW_CUTOFF_H
+#define NET_FLOW_CUTOFF_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <netinet/in.h>
+#include "net/headers.h"
+#include "net/flow_key.h"
+
+namespace net {
+  // Per-flow cutoff: only the first bytes of every flow (both directions)
+  // are kept, the TCP packets with the SYN, FIN or RST flags are always
+  // kept.
+  //
+  // The flows live in a fixed number of preallocated entries (hash table
+  // with chaining). The idle flows are expired by a timer wheel with one
+  // slot per second: a flow is only moved to another slot when the second
+  // of its last packet changes and only the slots which have become too
+  // old are walked. When the table is full, the flow idle for the longest
+  // time is evicted.
+  class flow_cutoff {
+    public:
+      // Default maximum number of flows.
+      static const size_t kDefaultMaxFlows = 1024 * 1024;
+
+      // Minimum / maximum number of flows.
+      static const size_t kMinFlows = 1024;
+      static const size_t kMaxFlows = 64 * 1024 * 1024;
+
+      // Number of seconds without packets after which a flow expires.
+      static const unsigned kIdleTimeout = 60;
+
+      struct statistics {
+        // Flows which have expired / have been evicted because the table
+        // was full.
+        uint64_t expired;
+        uint64_t evicted;
+      };
+
+      // Constructor.
+      flow_cutoff();
+
+      // Destructor.
+      ~flow_cutoff();
+
+      // Create.
+      bool create(uint64_t cutoff, size_t max_flows);
+
+      // Account packet (len: original length, sec: timestamp). Returns
+      // false if the packet has to be dropped: its flow has already reached
+      // the cutoff and it is not a TCP SYN, FIN or RST. The packets which
+      // are not IP packets and the fragments are always kept.
+      bool account(const struct headers& h, uint32_t len, uint32_t sec);
+
+      // Get number of flows.
+      size_t count() const;
+
+      // Get memory footprint.
+      size_t memory() const;
+
+      // Get statistics.
+      const struct statistics& stats() const;
+
+    private:
+      // Number of slots of the timer wheel (power of two bigger than
+      // kIdleTimeout).
+      static const unsigned kWheelSlots = 64;
+
+      // No entry.
+      static const uint32_t kNone = 0xffffffff;
+
+      // Flow (64 bytes).
+      struct flow {
+        struct flow_key key;
+
+        // Number of bytes seen.
+        uint64_t bytes;
+
+        // Next flow of the hash chain (or of the free list).
+        uint32_t next;
+
+        // Previous / next flow of the slot of the timer wheel.
+        uint32_t prev_timer;
+        uint32_t next_timer;
+
+        // Timestamp of the last packet.
+        uint32_t last_seen;
+      };
+
+      struct flow* _M_flows;
+      size_t _M_max_flows;
+
+      // Heads of the hash chains.
+      uint32_t* _M_buckets;
+      size_t _M_mask;
+
+      // Free list.
+      uint32_t _M_free;
+
+      size_t _M_count;
+
+      // Heads of the slots of the timer wheel.
+      uint32_t _M_wheel[kWheelSlots];
+
+      // Oldest second which has not been expired yet.
+      uint32_t _M_wheel_time;
+
+      uint64_t _M_cutoff;
+
+      struct statistics _M_stats;
+
+      // Find flow (returns its index or kNone).
+      uint32_t find(const struct flow_key& k, size_t bucket) const;
+
+      // Add flow.
+      uint32_t add(const struct flow_key& k, size_t bucket, uint32_t sec);
+
+      // Remove flow.
+      void remove(uint32_t idx);
+
+      // Link flow to the slot of its last packet / unlink flow.
+      void link_timer(uint32_t idx);
+      void unlink_timer(uint32_t idx);
+
+      // Expire the flows idle for more than kIdleTimeout seconds.
+      void advance(uint32_t sec);
+
+      // Evict the flow idle for the longest time.
+      void evict();
+
+      // Is it a TCP packet with the SYN, FIN or RST flags?
+      static bool control(const struct headers& h);
+
+      // Disable copy constructor and assignment operator.
+      flow_cutoff(const flow_cutoff&);
+      flow_cutoff& operator=(const flow_cutoff&);
+  };
+
+  inline size_t flow_cutoff::count() const
+  {
+    return _M_count;
+  }
+
+  inline size_t flow_cutoff::memory() const
+  {
+    return (_M_max_flows * sizeof(struct flow)) + ((_M_mask + 1) * sizeof(uint32_t));
+  }
+
+  inline const struct flow_cutoff::statistics& flow_cutoff::stats() const
+  {
+    return _M_stats;
+  }
+
+  inline uint32_t flow_cutoff::find(const struct flow_key& k, size_t bucket) const
+  {
+    uint32_t idx = _M_buckets[bucket];
+    while ((idx != kNone) && (!_M_flows[idx].key.equal(k))) {
+      idx = _M_flows[idx].next;
+    }
+
+    return idx;
+  }
+
+  inline bool flow_cutoff::control(const struct headers& h)
+  {
+    // Flags: byte 13 of the TCP header (FIN: 0x01, SYN: 0x02, RST: 0x04).
+    return ((h.protocol == IPPROTO_TCP) && (!h.fragment) && (h.l4len > 13) && ((h.l4[13] & 0x07) != 0));
+  }
+
+  inline bool flow_cutoff::account(const struct headers& h, uint32_t len, uint32_t sec)
+  {
+    if (sec > _M_wheel_time + kIdleTimeout) {
+      advance(sec);
+    }
+
+    struct flow_key k;
+    if (!k.build(h)) {
+      return true;
+    }
+
+    size_t bucket = k.hash() & _M_mask;
+
+    uint32_t idx;
+    if ((idx = find(k, bucket)) == kNone) {
+      idx = add(k, bucket, sec);
+    } else if (sec > _M_flows[idx].last_seen) {
+      // Move the flow to the slot of this second.
+      unlink_timer(idx);
+      _M_flows[idx].last_seen = sec;
+      link_timer(idx);
+    }
+
+    struct flow* f = &_M_flows[idx];
+
+    // The packet which crosses the cutoff is kept.
+    if (f->bytes < _M_cutoff) {
+      f->bytes += len;
+      return true;
+    }
+
+    return control(h);
+  }
+}
+
+#endif // NET_FLOW_CUTOFF_H
@@ -0,0 +1,142 @@
+#ifndef NET_FLOW_KEY_H
+#define NET_FLOW_KEY_H
+
+#include <stdint.h>
+#include <string.h>
+#include <endian.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "net/headers.h"
+
+namespace net {
+  // Key of a flow (protocol, addresses and ports), the same for both
+  // directions: the smallest endpoint comes first.
+  struct flow_key {
+    // Number of 64-bit words: two addresses (IPv4 addresses in host byte
+    // order in the low bits of the second word), two ports, the protocol and
+    // whether it is an IPv6 flow.
+    static const unsigned kWords = 5;
+
+    // IPv6 flow.
+    static const uint64_t kIpv6 = static_cast<uint64_t>(1) << 40;
+
+    uint64_t words[kWords];
+
+    // Build key of an IPv4 flow (addresses in host byte order).
+    void build(uint8_t protocol, uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport);
+
+    // Build key of an IPv6 flow (addresses: 16 bytes, network byte order).
+    void build(uint8_t protocol, const uint8_t* saddr, uint16_t sport, const uint8_t* daddr, uint16_t dport);
+
+    // Build key of a packet (ports: TCP, UDP and SCTP, 0 for the other
+    // protocols). Returns false if it is not an IP packet or the ports are
+    // not in the packet.
+    bool build(const struct headers& h);
+
+    // Hash.
+    uint64_t hash() const;
+
+    // Are the keys equal?
+    bool equal(const struct flow_key& other) const;
+
+    // Get the last word (protocol and ports).
+    static uint64_t port_word(uint8_t protocol, uint16_t port1, uint16_t port2);
+  };
+
+  inline void flow_key::build(uint8_t protocol, uint32_t saddr, uint16_t sport, uint32_t daddr, uint16_t dport)
+  {
+    // Smallest endpoint first (without branches, the direction of the
+    // packets is not predictable).
+    bool swap = (((static_cast<uint64_t>(saddr) << 16) | sport) > ((static_cast<uint64_t>(daddr) << 16) | dport));
+
+    words[0] = 0;
+    words[1] = swap ? daddr : saddr;
+    words[2] = 0;
+    words[3] = swap ? saddr : daddr;
+    words[4] = port_word(protocol, swap ? dport : sport, swap ? sport : dport);
+  }
+
+  inline void flow_key::build(uint8_t protocol, const uint8_t* saddr, uint16_t sport, const uint8_t* daddr, uint16_t dport)
+  {
+    uint64_t src[2];
+    uint64_t dest[2];
+    memcpy(src, saddr, 16);
+    memcpy(dest, daddr, 16);
+
+    // Smallest endpoint first (the addresses are compared as big endian
+    // words).
+    uint64_t s0 = be64toh(src[0]);
+    uint64_t d0 = be64toh(dest[0]);
+    uint64_t s1 = be64toh(src[1]);
+    uint64_t d1 = be64toh(dest[1]);
+    bool swap = ((s0 > d0) | ((s0 == d0) & ((s1 > d1) | ((s1 == d1) & (sport > dport)))));
+
+    words[0] = swap ? dest[0] : src[0];
+    words[1] = swap ? dest[1] : src[1];
+    words[2] = swap ? src[0] : dest[0];
+    words[3] = swap ? src[1] : dest[1];
+    words[4] = kIpv6 | port_word(protocol, swap ? dport : sport, swap ? sport : dport);
+  }
+
+  inline bool flow_key::build(const struct headers& h)
+  {
+    uint16_t sport = 0;
+    uint16_t dport = 0;
+
+    switch (h.protocol) {
+      case IPPROTO_TCP:
+      case IPPROTO_UDP:
+      case IPPROTO_SCTP:
+        if ((h.fragment) || (h.l4len < 4)) {
+          return false;
+        }
+
+        sport = (h.l4[0] << 8) | h.l4[1];
+        dport = (h.l4[2] << 8) | h.l4[3];
+
+        break;
+    }
+
+    if (h.version == 4) {
+      build(h.protocol, ntohl(h.ipv4()->saddr), sport, ntohl(h.ipv4()->daddr), dport);
+      return true;
+    } else if (h.version == 6) {
+      build(h.protocol, h.ipv6()->ip6_src.s6_addr, sport, h.ipv6()->ip6_dst.s6_addr, dport);
+      return true;
+    }
+
+    return false;
+  }
+
+  inline uint64_t flow_key::hash() const
+  {
+    // The multiplications are independent, only the final mix is serial.
+    uint64_t h = (words[0] * 0x9e3779b97f4a7c15ULL) ^
+                 (words[1] * 0xc2b2ae3d27d4eb4fULL) ^
+                 (words[2] * 0x165667b19e3779f9ULL) ^
+                 (words[3] * 0xd6e8feb86659fd93ULL) ^
+                 (words[4] * 0xff51afd7ed558ccdULL);
+
+    h ^= h >> 32;
+    h *= 0x9e3779b97f4a7c15ULL;
+    h ^= h >> 29;
+
+    return h;
+  }
+
+  inline bool flow_key::equal(const struct flow_key& other) const
+  {
+    return (((words[0] ^ other.words[0]) |
+             (words[1] ^ other.words[1]) |
+             (words[2] ^ other.words[2]) |
+             (words[3] ^ other.words[3]) |
+             (words[4] ^ other.words[4])) == 0);
+  }
+
+  inline uint64_t flow_key::port_word(uint8_t protocol, uint16_t port1, uint16_t port2)
+  {
+    return (static_cast<uint64_t>(protocol) << 32) | (static_cast<uint64_t>(port1) << 16) | port2;
+  }
+}
+
+#endif // NET_FLOW_KEY_H
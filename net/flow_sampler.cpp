@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include "net/flow_sampler.h"
+#include "macros/macros.h"
+
+bool net::flow_sampler::load_rate(const char* filename, unsigned& rate)
+{
+  FILE* file;
+  if ((file = fopen(filename, "r")) == NULL) {
+    fprintf(stderr, "Couldn't open sampling rate file %s.\n", filename);
+    return false;
+  }
+
+  char line[64];
+  if (!fgets(line, sizeof(line), file)) {
+    fprintf(stderr, "Couldn't read sampling rate file %s.\n", filename);
+
+    fclose(file);
+    return false;
+  }
+
+  fclose(file);
+
+  const char* ptr = line;
+  while (IS_WHITE_SPACE(*ptr)) {
+    ptr++;
+  }
+
+  uint64_t n = 0;
+  const char* begin = ptr;
+  while (IS_DIGIT(*ptr)) {
+    if ((n = (n * 10) + (*ptr - '0')) > kMaxRate) {
+      break;
+    }
+
+    ptr++;
+  }
+
+  while ((IS_WHITE_SPACE(*ptr)) || (*ptr == '\r') || (*ptr == '\n')) {
+    ptr++;
+  }
+
+  if ((ptr == begin) || (*ptr) || (n == 0) || (n > kMaxRate)) {
+    fprintf(stderr, "Invalid sampling rate in %s (1 .. %u).\n", filename, kMaxRate);
+    return false;
+  }
+
+  rate = static_cast<unsigned>(n);
+  return true;
+}
@@ -0,0 +1,79 @@
+#ifndef NET_FLOW_SAMPLER_H
+#define NET_FLOW_SAMPLER_H
+
+#include <stdint.h>
+#include "net/headers.h"
+#include "net/flow_key.h"
+
+namespace net {
+  // Flow sampler: keeps whole flows (both directions), 1 in rate flows.
+  //
+  // A flow is kept if the 32 high bits of the hash of its key (see
+  // flow_key) are below 2^32 / rate. The hash has no seed, so every worker
+  // and every run keep the same flows, and the flows kept at a high rate
+  // are a subset of the ones kept at a lower rate. The rate can be changed
+  // while the sampler is being used.
+  class flow_sampler {
+    public:
+      // Maximum rate.
+      static const unsigned kMaxRate = 1000000;
+
+      // Constructor.
+      flow_sampler();
+
+      // Get rate.
+      unsigned rate() const;
+
+      // Set rate (1: keep every flow).
+      void rate(unsigned rate);
+
+      // Is the flow of the packet kept? The packets which are not IP packets
+      // and the fragments are always kept.
+      bool sample(const struct headers& h) const;
+
+      // Load rate from a file (a single number).
+      static bool load_rate(const char* filename, unsigned& rate);
+
+    private:
+      // Hashes (32 high bits) kept: [0, threshold).
+      uint64_t _M_threshold;
+
+      unsigned _M_rate;
+
+      // Disable copy constructor and assignment operator.
+      flow_sampler(const flow_sampler&);
+      flow_sampler& operator=(const flow_sampler&);
+  };
+
+  inline flow_sampler::flow_sampler()
+    : _M_threshold(static_cast<uint64_t>(1) << 32),
+      _M_rate(1)
+  {
+  }
+
+  inline unsigned flow_sampler::rate() const
+  {
+    return __atomic_load_n(&_M_rate, __ATOMIC_RELAXED);
+  }
+
+  inline void flow_sampler::rate(unsigned rate)
+  {
+    __atomic_store_n(&_M_threshold, (static_cast<uint64_t>(1) << 32) / rate, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_rate, rate, __ATOMIC_RELAXED);
+  }
+
+  inline bool flow_sampler::sample(const struct headers& h) const
+  {
+    uint64_t threshold = __atomic_load_n(&_M_threshold, __ATOMIC_RELAXED);
+
+    // Keeping every flow?
+    if (threshold >> 32) {
+      return true;
+    }
+
+    struct flow_key k;
+    return ((!k.build(h)) || ((k.hash() >> 32) < threshold));
+  }
+}
+
+#endif // NET_FLOW_SAMPLER_H
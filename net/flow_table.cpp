@@ -0,0 +1,445 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "net/flow_table.h"
+#include "macros/macros.h"
+
+void net::flow_table::free()
+{
+  if (_M_tags) {
+    ::free(_M_tags);
+    _M_tags = NULL;
+  }
+
+  if (_M_keys) {
+    ::free(_M_keys);
+    _M_keys = NULL;
+  }
+
+  if (_M_generations) {
+    ::free(_M_generations);
+    _M_generations = NULL;
+  }
+
+  _M_generation = 0;
+
+  _M_nbuckets = 0;
+  _M_mask = 0;
+
+  _M_count = 0;
+
+  if (_M_filename) {
+    ::free(_M_filename);
+    _M_filename = NULL;
+  }
+
+  if (_M_steps) {
+    ::free(_M_steps);
+    _M_steps = NULL;
+  }
+}
+
+bool net::flow_table::load(const char* filename)
+{
+  FILE* file;
+  if ((file = fopen(filename, "r")) == NULL) {
+    fprintf(stderr, "Couldn't open flow file %s.\n", filename);
+    return false;
+  }
+
+  struct flow_key* keys = NULL;
+  size_t nkeys = 0;
+  size_t size = 0;
+
+  char line[256];
+  unsigned nline = 0;
+  while (fgets(line, sizeof(line), file)) {
+    nline++;
+
+    // Strip comment.
+    char* end;
+    if ((end = strchr(line, '#')) != NULL) {
+      *end = 0;
+    }
+
+    struct flow_key k;
+    switch (parse(line, k)) {
+      case 1:
+        if (nkeys == size) {
+          size_t s = (size == 0) ? kInitialFlows : size * 2;
+
+          struct flow_key* tmp;
+          if ((tmp = reinterpret_cast<struct flow_key*>(realloc(keys, s * sizeof(struct flow_key)))) == NULL) {
+            ::free(keys);
+            fclose(file);
+
+            return false;
+          }
+
+          keys = tmp;
+          size = s;
+        }
+
+        keys[nkeys++] = k;
+        break;
+      case 0:
+        // Empty line.
+        break;
+      default:
+        fprintf(stderr, "Invalid flow in %s, line %u.\n", filename, nline);
+
+        ::free(keys);
+        fclose(file);
+
+        return false;
+    }
+  }
+
+  fclose(file);
+
+  // Remove the flows which appear more than once in the file (the lookups
+  // below are done before inserting, they wouldn't catch them).
+  if (nkeys > 1) {
+    qsort(keys, nkeys, sizeof(struct flow_key), compare);
+
+    size_t n = 1;
+    for (size_t i = 1; i < nkeys; i++) {
+      if (!keys[i].equal(keys[n - 1])) {
+        keys[n++] = keys[i];
+      }
+    }
+
+    nkeys = n;
+  }
+
+  if ((!_M_filename) || (strcmp(_M_filename, filename) != 0)) {
+    char* s;
+    if ((s = strdup(filename)) == NULL) {
+      ::free(keys);
+      return false;
+    }
+
+    if (_M_filename) {
+      ::free(_M_filename);
+    }
+
+    _M_filename = s;
+  }
+
+  if ((!_M_tags) && (!allocate(nkeys))) {
+    ::free(keys);
+    return false;
+  }
+
+  // Mark the flows which are already in the table, remove the other ones
+  // and only then insert the new ones: a flow which stays in the table is
+  // never missing and the table never holds more flows than the biggest of
+  // both sets.
+  _M_generation++;
+
+  size_t nnew = 0;
+  for (size_t i = 0; i < nkeys; i++) {
+    uint64_t h = keys[i].hash();
+    uint16_t t = tag(h);
+    size_t bucket1 = h & _M_mask;
+
+    ssize_t slot;
+    if ((slot = find(keys[i], bucket1, alternate(bucket1, t), t)) >= 0) {
+      _M_generations[slot] = _M_generation;
+    } else {
+      keys[nnew++] = keys[i];
+    }
+  }
+
+  sweep();
+
+  for (size_t i = 0; i < nnew; i++) {
+    if (!insert(keys[i])) {
+      fprintf(stderr,
+              "The flow table is full (%lu flows), %lu flows of %s were not added.\n",
+              _M_count,
+              nnew - i,
+              filename);
+
+      ::free(keys);
+      return false;
+    }
+  }
+
+  ::free(keys);
+
+  return true;
+}
+
+bool net::flow_table::reload()
+{
+  return _M_filename ? load(_M_filename) : false;
+}
+
+bool net::flow_table::allocate(size_t nflows)
+{
+  // Fill the table at most to 80% (leaving room for the flows added when
+  // the file is reloaded).
+  size_t nbuckets = kMinBuckets;
+  while (nbuckets * kSlots * 4 < nflows * 5) {
+    nbuckets *= 2;
+  }
+
+  size_t nslots = nbuckets * kSlots;
+
+  if (((_M_tags = reinterpret_cast<uint16_t*>(calloc(nslots, sizeof(uint16_t)))) == NULL) ||
+      ((_M_keys = reinterpret_cast<struct flow_key*>(malloc(nslots * sizeof(struct flow_key)))) == NULL) ||
+      ((_M_generations = reinterpret_cast<uint8_t*>(calloc(nslots, sizeof(uint8_t)))) == NULL) ||
+      ((_M_steps = reinterpret_cast<struct step*>(malloc(kMaxSearch * sizeof(struct step)))) == NULL)) {
+    return false;
+  }
+
+  _M_nbuckets = nbuckets;
+  _M_mask = nbuckets - 1;
+
+  return true;
+}
+
+int net::flow_table::parse(const char* line, struct flow_key& k)
+{
+  // Split line into fields.
+  static const unsigned kMaxFields = 5;
+  char fields[kMaxFields][INET6_ADDRSTRLEN];
+  unsigned nfields = 0;
+
+  const char* ptr = line;
+  do {
+    while ((IS_WHITE_SPACE(*ptr)) || (*ptr == '\r') || (*ptr == '\n')) {
+      ptr++;
+    }
+
+    if (!*ptr) {
+      break;
+    }
+
+    const char* begin = ptr;
+    while ((*ptr) && (!IS_WHITE_SPACE(*ptr)) && (*ptr != '\r') && (*ptr != '\n')) {
+      ptr++;
+    }
+
+    size_t len = ptr - begin;
+    if ((nfields == kMaxFields) || (len >= INET6_ADDRSTRLEN)) {
+      return -1;
+    }
+
+    memcpy(fields[nfields], begin, len);
+    fields[nfields++][len] = 0;
+  } while (true);
+
+  if (nfields == 0) {
+    return 0;
+  }
+
+  // Protocol, addresses and ports.
+  uint8_t protocol;
+  if (!parse_protocol(fields[0], protocol)) {
+    return -1;
+  }
+
+  unsigned port1 = 0;
+  unsigned port2 = 0;
+  const char* addr1;
+  const char* addr2;
+
+  if (nfields == 5) {
+    if ((!parse_port(fields[2], port1)) || (!parse_port(fields[4], port2))) {
+      return -1;
+    }
+
+    addr1 = fields[1];
+    addr2 = fields[3];
+  } else if (nfields == 3) {
+    addr1 = fields[1];
+    addr2 = fields[2];
+  } else {
+    return -1;
+  }
+
+  uint8_t a1[16];
+  uint8_t a2[16];
+  bool ipv6 = (strchr(addr1, ':') != NULL);
+  if ((ipv6 != (strchr(addr2, ':') != NULL)) ||
+      (!parse_address(addr1, ipv6, a1)) ||
+      (!parse_address(addr2, ipv6, a2))) {
+    return -1;
+  }
+
+  if (ipv6) {
+    k.build(protocol, a1, port1, a2, port2);
+  } else {
+    uint32_t saddr;
+    uint32_t daddr;
+    memcpy(&saddr, a1, 4);
+    memcpy(&daddr, a2, 4);
+
+    k.build(protocol, ntohl(saddr), port1, ntohl(daddr), port2);
+  }
+
+  return 1;
+}
+
+bool net::flow_table::parse_protocol(const char* s, uint8_t& protocol)
+{
+  if (strcasecmp(s, "tcp") == 0) {
+    protocol = IPPROTO_TCP;
+  } else if (strcasecmp(s, "udp") == 0) {
+    protocol = IPPROTO_UDP;
+  } else if (strcasecmp(s, "sctp") == 0) {
+    protocol = IPPROTO_SCTP;
+  } else if (strcasecmp(s, "icmp") == 0) {
+    protocol = IPPROTO_ICMP;
+  } else if (strcasecmp(s, "icmp6") == 0) {
+    protocol = IPPROTO_ICMPV6;
+  } else {
+    unsigned n;
+    if ((!parse_port(s, n)) || (n > UCHAR_MAX)) {
+      return false;
+    }
+
+    protocol = static_cast<uint8_t>(n);
+  }
+
+  return true;
+}
+
+bool net::flow_table::parse_port(const char* s, unsigned& port)
+{
+  if (!*s) {
+    return false;
+  }
+
+  port = 0;
+  while (*s) {
+    if ((!IS_DIGIT(*s)) || ((port = (port * 10) + (*s - '0')) > USHRT_MAX)) {
+      return false;
+    }
+
+    s++;
+  }
+
+  return true;
+}
+
+bool net::flow_table::parse_address(const char* s, bool ipv6, uint8_t* addr)
+{
+  return (inet_pton(ipv6 ? AF_INET6 : AF_INET, s, addr) == 1);
+}
+
+bool net::flow_table::insert(const struct flow_key& k)
+{
+  uint64_t h = k.hash();
+  uint16_t t = tag(h);
+  size_t bucket1 = h & _M_mask;
+  size_t bucket2 = alternate(bucket1, t);
+
+  // Find a path of flows to move ending at a free slot.
+  unsigned free_slot;
+  int i;
+  if ((i = search(bucket1, bucket2, free_slot)) < 0) {
+    return false;
+  }
+
+  begin_write();
+
+  // Move the flows, from the end of the path.
+  unsigned to = free_slot;
+  while (_M_steps[i].parent >= 0) {
+    const struct step* s = &_M_steps[i];
+
+    move((_M_steps[s->parent].bucket * kSlots) + s->slot, (s->bucket * kSlots) + to);
+
+    to = s->slot;
+    i = s->parent;
+  }
+
+  size_t slot = (_M_steps[i].bucket * kSlots) + to;
+
+  _M_keys[slot] = k;
+  _M_generations[slot] = _M_generation;
+  __atomic_store_n(&_M_tags[slot], t, __ATOMIC_RELEASE);
+
+  end_write();
+
+  _M_count++;
+
+  return true;
+}
+
+int net::flow_table::compare(const void* p1, const void* p2)
+{
+  const struct flow_key* k1 = reinterpret_cast<const struct flow_key*>(p1);
+  const struct flow_key* k2 = reinterpret_cast<const struct flow_key*>(p2);
+
+  for (unsigned i = 0; i < flow_key::kWords; i++) {
+    if (k1->words[i] != k2->words[i]) {
+      return (k1->words[i] < k2->words[i]) ? -1 : 1;
+    }
+  }
+
+  return 0;
+}
+
+int net::flow_table::search(size_t bucket1, size_t bucket2, unsigned& free_slot)
+{
+  // Breadth-first search: the shortest path is found.
+  _M_steps[0].bucket = bucket1;
+  _M_steps[0].parent = -1;
+  _M_steps[1].bucket = bucket2;
+  _M_steps[1].parent = -1;
+
+  unsigned nsteps = 2;
+
+  for (unsigned i = 0; i < nsteps; i++) {
+    const uint16_t* tags = &_M_tags[_M_steps[i].bucket * kSlots];
+
+    for (unsigned s = 0; s < kSlots; s++) {
+      if (tags[s] == 0) {
+        free_slot = s;
+        return i;
+      }
+    }
+
+    // Each flow of the bucket could move to its other bucket.
+    for (unsigned s = 0; (s < kSlots) && (nsteps < kMaxSearch); s++) {
+      _M_steps[nsteps].bucket = alternate(_M_steps[i].bucket, tags[s]);
+      _M_steps[nsteps].parent = i;
+      _M_steps[nsteps].slot = s;
+
+      nsteps++;
+    }
+  }
+
+  return -1;
+}
+
+void net::flow_table::move(size_t from, size_t to)
+{
+  // The flow is in both slots before the old one is freed.
+  _M_keys[to] = _M_keys[from];
+  _M_generations[to] = _M_generations[from];
+  __atomic_store_n(&_M_tags[to], _M_tags[from], __ATOMIC_RELEASE);
+  __atomic_store_n(&_M_tags[from], 0, __ATOMIC_RELEASE);
+}
+
+void net::flow_table::sweep()
+{
+  size_t nslots = _M_nbuckets * kSlots;
+  for (size_t i = 0; i < nslots; i++) {
+    if ((_M_tags[i] != 0) && (_M_generations[i] != _M_generation)) {
+      begin_write();
+      __atomic_store_n(&_M_tags[i], 0, __ATOMIC_RELEASE);
+      end_write();
+
+      _M_count--;
+    }
+  }
+}
@@ -0,0 +1,287 @@
+#ifndef NET_FLOW_TABLE_H
+#define NET_FLOW_TABLE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+#ifdef __SSE2__
+  #include <emmintrin.h>
+#endif
+#include "net/flow_key.h"
+
+namespace net {
+  // Table of flows (protocol, addresses and ports). A flow matches the
+  // packets of both directions (see flow_key).
+  //
+  // Bucketized cuckoo hash table: each flow lives in one of the 8 slots of
+  // one of two buckets. Each slot has a 16-bit tag (0: free) taken from the
+  // hash of the key, the second bucket is derived from the first one and
+  // the tag. A lookup compares the 8 tags of each bucket at once (SSE2)
+  // and only reads the keys whose tag matches (two cache lines of tags and
+  // usually one key).
+  //
+  // The table has a single writer and lock-free readers: the writer makes
+  // the version odd while it moves or removes flows, a reader whose lookup
+  // overlapped a write retries.
+  class flow_table {
+    public:
+      // Constructor.
+      flow_table();
+
+      // Destructor.
+      ~flow_table();
+
+      // Free.
+      void free();
+
+      // Load flows from a file (one per line, '#' starts a comment):
+      // "<protocol> <address> <port> <address> <port>" or, for the protocols
+      // without ports, "<protocol> <address> <address>". If the table has
+      // already been loaded, the flows which are not in the file anymore
+      // are removed, the table can be reloaded while it is being read.
+      bool load(const char* filename);
+
+      // Reload the file.
+      bool reload();
+
+      // Get number of flows.
+      size_t count() const;
+
+      // Get maximum number of flows.
+      size_t capacity() const;
+
+      // Get memory footprint.
+      size_t memory() const;
+
+      // Get filename.
+      const char* filename() const;
+
+      // Look up flow.
+      bool lookup(const struct flow_key& k) const;
+
+    private:
+      // Number of slots per bucket.
+      static const unsigned kSlots = 8;
+
+      // Minimum number of buckets.
+      static const size_t kMinBuckets = 64;
+
+      // Maximum number of buckets visited to find a free slot (about four
+      // levels of moves).
+      static const unsigned kMaxSearch = 2048;
+
+      // Initial number of flows read from the file.
+      static const size_t kInitialFlows = 1024;
+
+      // Tags (kSlots per bucket, 0: free slot).
+      uint16_t* _M_tags;
+
+      // Keys (kSlots per bucket).
+      struct flow_key* _M_keys;
+
+      // Generation of each slot (only used by the writer, to remove the
+      // flows which are not in the file anymore).
+      uint8_t* _M_generations;
+      uint8_t _M_generation;
+
+      size_t _M_nbuckets;
+      size_t _M_mask;
+
+      size_t _M_count;
+
+      // Version (odd while the writer moves or removes flows).
+      unsigned _M_version;
+
+      char* _M_filename;
+
+      // Path of buckets found by the search of a free slot.
+      struct step {
+        size_t bucket;
+        int parent;
+        unsigned slot; // Slot of the parent bucket moved to this bucket.
+      };
+
+      struct step* _M_steps;
+
+      // Get tag from hash.
+      static uint16_t tag(uint64_t h);
+
+      // Get the other bucket of a tag.
+      size_t alternate(size_t bucket, uint16_t tag) const;
+
+      // Find key (returns its slot or -1).
+      ssize_t find(const struct flow_key& k, size_t bucket1, size_t bucket2, uint16_t t) const;
+
+      // Allocate table.
+      bool allocate(size_t nflows);
+
+      // Parse flow (returns 1 if the line has a flow, 0 if it is empty and
+      // -1 if it is not valid).
+      static int parse(const char* line, struct flow_key& k);
+
+      // Parse protocol (name or number).
+      static bool parse_protocol(const char* s, uint8_t& protocol);
+
+      // Parse port.
+      static bool parse_port(const char* s, unsigned& port);
+
+      // Parse address (16 bytes for IPv6, 4 bytes for IPv4).
+      static bool parse_address(const char* s, bool ipv6, uint8_t* addr);
+
+      // Insert key.
+      bool insert(const struct flow_key& k);
+
+      // Compare keys (for sorting them).
+      static int compare(const void* p1, const void* p2);
+
+      // Search free slot starting from two buckets (returns the last step
+      // or -1).
+      int search(size_t bucket1, size_t bucket2, unsigned& free_slot);
+
+      // Move slot.
+      void move(size_t from, size_t to);
+
+      // Remove the flows of older generations.
+      void sweep();
+
+      // Begin / end write.
+      void begin_write();
+      void end_write();
+
+      // Disable copy constructor and assignment operator.
+      flow_table(const flow_table&);
+      flow_table& operator=(const flow_table&);
+  };
+
+  inline flow_table::flow_table()
+    : _M_tags(NULL),
+      _M_keys(NULL),
+      _M_generations(NULL),
+      _M_generation(0),
+      _M_nbuckets(0),
+      _M_mask(0),
+      _M_count(0),
+      _M_version(0),
+      _M_filename(NULL),
+      _M_steps(NULL)
+  {
+  }
+
+  inline flow_table::~flow_table()
+  {
+    free();
+  }
+
+  inline size_t flow_table::count() const
+  {
+    return _M_count;
+  }
+
+  inline size_t flow_table::capacity() const
+  {
+    return _M_nbuckets * kSlots;
+  }
+
+  inline size_t flow_table::memory() const
+  {
+    return _M_nbuckets * kSlots * (sizeof(uint16_t) + sizeof(struct flow_key) + sizeof(uint8_t));
+  }
+
+  inline const char* flow_table::filename() const
+  {
+    return _M_filename;
+  }
+
+  inline uint16_t flow_table::tag(uint64_t h)
+  {
+    uint16_t t = static_cast<uint16_t>(h >> 48);
+    return (t != 0) ? t : 1;
+  }
+
+  inline size_t flow_table::alternate(size_t bucket, uint16_t tag) const
+  {
+    return (bucket ^ (tag * 0x5bd1e995U)) & _M_mask;
+  }
+
+  inline ssize_t flow_table::find(const struct flow_key& k, size_t bucket1, size_t bucket2, uint16_t t) const
+  {
+#ifdef __SSE2__
+    // Compare the 8 tags of each bucket at once (two bits per tag).
+    __m128i key_tag = _mm_set1_epi16(t);
+    __m128i tags1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&_M_tags[bucket1 * kSlots]));
+    __m128i tags2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&_M_tags[bucket2 * kSlots]));
+
+    uint32_t matches = _mm_movemask_epi8(_mm_cmpeq_epi16(tags1, key_tag)) |
+                       (_mm_movemask_epi8(_mm_cmpeq_epi16(tags2, key_tag)) << 16);
+
+    while (matches != 0) {
+      unsigned i = __builtin_ctz(matches) / 2;
+      size_t slot = (i < kSlots) ? (bucket1 * kSlots) + i : (bucket2 * kSlots) + (i - kSlots);
+
+      if (_M_keys[slot].equal(k)) {
+        return slot;
+      }
+
+      // Clear both bits of the tag.
+      matches &= matches - 1;
+      matches &= matches - 1;
+    }
+#else
+    for (unsigned i = 0; i < kSlots; i++) {
+      size_t slot = (bucket1 * kSlots) + i;
+      if ((_M_tags[slot] == t) && (_M_keys[slot].equal(k))) {
+        return slot;
+      }
+    }
+
+    for (unsigned i = 0; i < kSlots; i++) {
+      size_t slot = (bucket2 * kSlots) + i;
+      if ((_M_tags[slot] == t) && (_M_keys[slot].equal(k))) {
+        return slot;
+      }
+    }
+#endif
+
+    return -1;
+  }
+
+  inline bool flow_table::lookup(const struct flow_key& k) const
+  {
+    if (!_M_tags) {
+      return false;
+    }
+
+    uint64_t h = k.hash();
+    uint16_t t = tag(h);
+    size_t bucket1 = h & _M_mask;
+    size_t bucket2 = alternate(bucket1, t);
+
+    do {
+      unsigned version = __atomic_load_n(&_M_version, __ATOMIC_ACQUIRE);
+      if ((version & 1) == 0) {
+        bool found = (find(k, bucket1, bucket2, t) >= 0);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&_M_version, __ATOMIC_RELAXED) == version) {
+          return found;
+        }
+      }
+
+      __builtin_ia32_pause();
+    } while (true);
+  }
+
+  inline void flow_table::begin_write()
+  {
+    __atomic_store_n(&_M_version, _M_version + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+  }
+
+  inline void flow_table::end_write()
+  {
+    __atomic_store_n(&_M_version, _M_version + 1, __ATOMIC_RELEASE);
+  }
+}
+
+#endif // NET_FLOW_TABLE_H
@@ -0,0 +1,282 @@
+#include "net/headers.h"
+
+void net::headers::parse_tagged(const struct ethhdr* eth, size_t ethlen, int vlan)
+{
+  nvlans = 0;
+  clear();
+
+  if (vlan != kNoVlan) {
+    vlans[nvlans++] = vlan;
+  }
+
+  parse_ethernet(reinterpret_cast<const uint8_t*>(eth), ethlen);
+}
+
+void net::headers::parse_ethernet(const uint8_t* pkt, size_t len)
+{
+  if (len < ETH_HLEN) {
+    return;
+  }
+
+  size_t offset = ETH_HLEN;
+  uint16_t type = (pkt[12] << 8) | pkt[13];
+
+  // VLAN tags (TCI and EtherType of the next header).
+  while ((type == ETH_P_8021Q) || (type == ETH_P_8021AD) || (type == ETH_P_QINQ1)) {
+    if (offset + 4 > len) {
+      return;
+    }
+
+    if (nvlans < kMaxVlans) {
+      vlans[nvlans++] = ((pkt[offset] << 8) | pkt[offset + 1]) & 0x0fff;
+    }
+
+    type = (pkt[offset + 2] << 8) | pkt[offset + 3];
+    offset += 4;
+  }
+
+  if (type == ETH_P_IP) {
+    parse_ipv4(pkt + offset, len - offset);
+  } else if (type == ETH_P_IPV6) {
+    parse_ipv6(pkt + offset, len - offset);
+  }
+}
+
+void net::headers::parse_ipv6(const uint8_t* pkt, size_t len)
+{
+  if (len < sizeof(struct ip6_hdr)) {
+    return;
+  }
+
+  version = 6;
+  ip = pkt;
+  iplen = len;
+
+  uint8_t next = reinterpret_cast<const struct ip6_hdr*>(pkt)->ip6_nxt;
+  size_t offset = sizeof(struct ip6_hdr);
+
+  for (unsigned i = 0; i < kMaxExtensionHeaders; i++) {
+    size_t hdrlen;
+
+    switch (next) {
+      case IPPROTO_HOPOPTS:
+      case IPPROTO_ROUTING:
+      case IPPROTO_DSTOPTS:
+        if (offset + 2 > len) {
+          protocol = next;
+          return;
+        }
+
+        hdrlen = (pkt[offset + 1] + 1) * 8;
+        break;
+      case IPPROTO_AH:
+        if (offset + 2 > len) {
+          protocol = next;
+          return;
+        }
+
+        hdrlen = (pkt[offset + 1] + 2) * 4;
+        break;
+      case IPPROTO_FRAGMENT:
+        if (offset + 8 > len) {
+          protocol = next;
+          return;
+        }
+
+        // Fragment offset.
+        if ((((pkt[offset + 2] << 8) | pkt[offset + 3]) & 0xfff8) != 0) {
+          fragment = true;
+        }
+
+        hdrlen = 8;
+        break;
+      default:
+        // Upper layer header.
+        protocol = next;
+
+        l4 = pkt + offset;
+        l4len = len - offset;
+
+        return;
+    }
+
+    next = pkt[offset];
+    offset += hdrlen;
+
+    if (offset > len) {
+      protocol = next;
+      return;
+    }
+  }
+
+  // Too many extension headers.
+  protocol = next;
+}
+
+void net::headers::decapsulate()
+{
+  switch (protocol) {
+    case IPPROTO_UDP:
+      {
+        uint16_t port = (l4[2] << 8) | l4[3];
+        const uint8_t* pkt = l4 + sizeof(struct udphdr);
+        size_t len = l4len - sizeof(struct udphdr);
+
+        if (port == kVxlanPort) {
+          // VXLAN header: flags (I: valid VNI), reserved, VNI and reserved.
+          if ((len >= 8) && ((pkt[0] & 0x08) != 0)) {
+            parse_inner_ethernet(pkt + 8, len - 8);
+          }
+        } else {
+          decapsulate_gtpu(pkt, len);
+        }
+      }
+
+      break;
+    case IPPROTO_GRE:
+      decapsulate_gre(l4, l4len);
+      break;
+    case IPPROTO_IPIP:
+    case IPPROTO_IPV6:
+      parse_inner_ip(l4, l4len);
+      break;
+  }
+}
+
+void net::headers::parse_inner_ethernet(const uint8_t* pkt, size_t len)
+{
+  nvlans = 0;
+  clear();
+
+  parse_ethernet(pkt, len);
+}
+
+void net::headers::parse_inner_ip(const uint8_t* pkt, size_t len)
+{
+  nvlans = 0;
+  clear();
+
+  if (len > 0) {
+    switch (pkt[0] >> 4) {
+      case 4:
+        parse_ipv4(pkt, len);
+        break;
+      case 6:
+        parse_ipv6(pkt, len);
+        break;
+    }
+  }
+}
+
+void net::headers::decapsulate_gtpu(const uint8_t* pkt, size_t len)
+{
+  // GTPv1 G-PDU (flags: version, protocol type, E, S and PN)?
+  if ((len < 8) || ((pkt[0] & 0xf0) != 0x30) || (pkt[1] != 0xff)) {
+    return;
+  }
+
+  size_t offset = 8;
+
+  // Sequence number, N-PDU number and next extension header type?
+  if ((pkt[0] & 0x07) != 0) {
+    if (len < 12) {
+      return;
+    }
+
+    offset = 12;
+
+    // Extension headers (length in 4-byte units, the last byte is the
+    // type of the next one).
+    if ((pkt[0] & 0x04) != 0) {
+      uint8_t next = pkt[11];
+      for (unsigned i = 0; (next != 0) && (i < kMaxExtensionHeaders); i++) {
+        size_t extlen;
+        if ((offset >= len) || ((extlen = pkt[offset] * 4) == 0) || (offset + extlen > len)) {
+          return;
+        }
+
+        next = pkt[offset + extlen - 1];
+        offset += extlen;
+      }
+
+      if (next != 0) {
+        return;
+      }
+    }
+  }
+
+  parse_inner_ip(pkt + offset, len - offset);
+}
+
+void net::headers::decapsulate_gre(const uint8_t* pkt, size_t len)
+{
+  if (len < 4) {
+    return;
+  }
+
+  // Flags (C: checksum, R: routing, K: key, S: sequence number) and
+  // version.
+  uint16_t flags = (pkt[0] << 8) | pkt[1];
+  if ((flags & 0x4007) != 0) {
+    return;
+  }
+
+  size_t offset = 4;
+  if ((flags & 0x8000) != 0) {
+    offset += 4;
+  }
+
+  if ((flags & 0x2000) != 0) {
+    offset += 4;
+  }
+
+  if ((flags & 0x1000) != 0) {
+    offset += 4;
+  }
+
+  switch ((pkt[2] << 8) | pkt[3]) {
+    case ETH_P_IP:
+    case ETH_P_IPV6:
+      if (offset <= len) {
+        parse_inner_ip(pkt + offset, len - offset);
+      }
+
+      break;
+    case ETH_P_TEB:
+      if (offset <= len) {
+        parse_inner_ethernet(pkt + offset, len - offset);
+      }
+
+      break;
+    case ETH_P_ERSPAN:
+      // ERSPAN type II has an 8-byte header and a sequence number, type I
+      // has neither.
+      if ((flags & 0x1000) != 0) {
+        offset += 8;
+      }
+
+      if (offset <= len) {
+        parse_inner_ethernet(pkt + offset, len - offset);
+      }
+
+      break;
+    case ETH_P_ERSPAN2:
+      // ERSPAN type III: 12-byte header followed by an 8-byte platform
+      // specific subheader if the O flag is set.
+      if (offset + 12 > len) {
+        return;
+      }
+
+      if ((pkt[offset + 11] & 0x01) != 0) {
+        offset += 8;
+      }
+
+      offset += 12;
+
+      if (offset <= len) {
+        parse_inner_ethernet(pkt + offset, len - offset);
+      }
+
+      break;
+  }
+}
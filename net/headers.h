@@ -0,0 +1,198 @@
+#ifndef NET_HEADERS_H
+#define NET_HEADERS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+#include <linux/if_ether.h>
+
+namespace net {
+  // Headers of a packet, parsed in a single pass: Ethernet, 802.1Q / 802.1ad
+  // (QinQ) tags, IPv4 or IPv6 (with its extension headers) and the position
+  // of the transport header.
+  //
+  // A tunneled packet (VXLAN, GTP-U, GRE or IP-in-IP) can be decapsulated:
+  // the headers are then the ones of the inner packet.
+  struct headers {
+    // Maximum number of VLAN IDs kept.
+    static const unsigned kMaxVlans = 2;
+
+    // Maximum number of IPv6 extension headers walked.
+    static const unsigned kMaxExtensionHeaders = 8;
+
+    // Maximum VLAN ID.
+    static const unsigned kMaxVlanId = 4095;
+
+    // UDP ports of VXLAN and GTP-U.
+    static const uint16_t kVxlanPort = 4789;
+    static const uint16_t kGtpuPort = 2152;
+
+    // No VLAN tag stripped by the kernel.
+    static const int kNoVlan = -1;
+
+    // IP header (only if version is not 0).
+    const uint8_t* ip;
+
+    // Transport header (NULL if the IP headers are truncated).
+    const uint8_t* l4;
+
+    // Number of bytes captured from the IP header / the transport header.
+    uint32_t iplen;
+    uint32_t l4len;
+
+    // VLAN IDs, the outermost first (including the tag stripped by the
+    // kernel).
+    uint16_t vlans[kMaxVlans];
+    uint8_t nvlans;
+
+    // IP version (4 or 6, 0 if it is not an IP packet).
+    uint8_t version;
+
+    // Transport protocol (after the IPv6 extension headers).
+    uint8_t protocol;
+
+    // Not the first fragment (the transport header is not in the packet).
+    bool fragment;
+
+    // Parse packet (vlan: ID of the tag stripped by the kernel or kNoVlan).
+    void parse(const struct ethhdr* eth, size_t ethlen, int vlan);
+
+    // Parse packet which is not an untagged IPv4 packet without options
+    // which is not a fragment.
+    void parse_tagged(const struct ethhdr* eth, size_t ethlen, int vlan);
+
+    // Is it a tunneled packet?
+    bool tunneled() const;
+
+    // Parse the inner packet of a tunneled packet (the headers don't change
+    // if the tunnel header is not valid).
+    void decapsulate();
+
+    // Clear the IP and transport fields.
+    void clear();
+
+    // Parse IPv4 header.
+    void parse_ipv4(const uint8_t* pkt, size_t len);
+
+    // Parse IPv6 header and extension headers.
+    void parse_ipv6(const uint8_t* pkt, size_t len);
+
+    // Parse Ethernet frame (VLAN tags and IP header).
+    void parse_ethernet(const uint8_t* pkt, size_t len);
+
+    // Parse the inner Ethernet frame of a tunnel.
+    void parse_inner_ethernet(const uint8_t* pkt, size_t len);
+
+    // Parse the inner IP packet of a tunnel.
+    void parse_inner_ip(const uint8_t* pkt, size_t len);
+
+    // Decapsulate GTP-U (pkt: GTP header).
+    void decapsulate_gtpu(const uint8_t* pkt, size_t len);
+
+    // Decapsulate GRE (pkt: GRE header).
+    void decapsulate_gre(const uint8_t* pkt, size_t len);
+
+    // Get IPv4 header.
+    const struct iphdr* ipv4() const;
+
+    // Get IPv6 header.
+    const struct ip6_hdr* ipv6() const;
+  };
+
+  inline void headers::parse(const struct ethhdr* eth, size_t ethlen, int vlan)
+  {
+    const uint8_t* pkt = reinterpret_cast<const uint8_t*>(eth) + ETH_HLEN;
+
+    // Untagged IPv4 packet without options which is not a fragment (the
+    // most common case)?
+    if ((vlan == kNoVlan) &&
+        (ethlen >= ETH_HLEN + sizeof(struct iphdr)) &&
+        (eth->h_proto == htons(ETH_P_IP)) &&
+        (pkt[0] == 0x45) &&
+        ((reinterpret_cast<const struct iphdr*>(pkt)->frag_off & htons(IP_OFFMASK)) == 0)) {
+      ip = pkt;
+      l4 = pkt + sizeof(struct iphdr);
+      iplen = ethlen - ETH_HLEN;
+      l4len = iplen - sizeof(struct iphdr);
+      nvlans = 0;
+      version = 4;
+      protocol = reinterpret_cast<const struct iphdr*>(pkt)->protocol;
+      fragment = false;
+    } else {
+      parse_tagged(eth, ethlen, vlan);
+    }
+  }
+
+  inline void headers::clear()
+  {
+    l4 = NULL;
+    l4len = 0;
+    version = 0;
+    protocol = 0;
+    fragment = false;
+  }
+
+  inline void headers::parse_ipv4(const uint8_t* pkt, size_t len)
+  {
+    if (len < sizeof(struct iphdr)) {
+      clear();
+      return;
+    }
+
+    const struct iphdr* ip_header = reinterpret_cast<const struct iphdr*>(pkt);
+
+    ip = pkt;
+    iplen = len;
+    version = 4;
+    protocol = ip_header->protocol;
+    fragment = ((ip_header->frag_off & htons(IP_OFFMASK)) != 0);
+
+    size_t iphdrlen = ip_header->ihl * 4;
+    if (len >= iphdrlen) {
+      l4 = pkt + iphdrlen;
+      l4len = len - iphdrlen;
+    } else {
+      l4 = NULL;
+      l4len = 0;
+    }
+  }
+
+  inline bool headers::tunneled() const
+  {
+    if ((fragment) || (!l4)) {
+      return false;
+    }
+
+    switch (protocol) {
+      case IPPROTO_UDP:
+        if (l4len >= sizeof(struct udphdr)) {
+          uint16_t port = (l4[2] << 8) | l4[3];
+          return ((port == kVxlanPort) || (port == kGtpuPort));
+        }
+
+        return false;
+      case IPPROTO_GRE:
+      case IPPROTO_IPIP:
+      case IPPROTO_IPV6:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  inline const struct iphdr* headers::ipv4() const
+  {
+    return reinterpret_cast<const struct iphdr*>(ip);
+  }
+
+  inline const struct ip6_hdr* headers::ipv6() const
+  {
+    return reinterpret_cast<const struct ip6_hdr*>(ip);
+  }
+}
+
+#endif // NET_HEADERS_H
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "net/load_shedder.h"
+#include "macros/macros.h"
+
+net::load_shedder::load_shedder()
+  : _M_level(kFull),
+    _M_pressure(0),
+    _M_log(NULL)
+{
+  _M_watermarks[kTruncate - 1] = kDefaultTruncateWatermark;
+  _M_watermarks[kSample - 1] = kDefaultSampleWatermark;
+  _M_watermarks[kDrop - 1] = kDefaultDropWatermark;
+
+  memset(&_M_stats, 0, sizeof(struct statistics));
+}
+
+net::load_shedder::~load_shedder()
+{
+  if (_M_log) {
+    fclose(_M_log);
+  }
+}
+
+bool net::load_shedder::create(const unsigned* watermarks, const char* log)
+{
+  if ((_M_log = fopen(log, "a")) == NULL) {
+    fprintf(stderr, "Couldn't open load shedding log %s.\n", log);
+    return false;
+  }
+
+  for (unsigned i = 0; i < kLevels - 1; i++) {
+    _M_watermarks[i] = watermarks[i];
+  }
+
+  fprintf(_M_log, "# timestamp level name ring-occupancy\n");
+  fflush(_M_log);
+
+  return true;
+}
+
+void net::load_shedder::change(unsigned level, unsigned occupancy, uint64_t now)
+{
+  _M_level = level;
+  _M_pressure = now;
+  _M_stats.changes++;
+
+  // The capture is lossy from this timestamp until the next change to the
+  // full level.
+  if (_M_log) {
+    fprintf(_M_log,
+            "%llu.%06llu %u %s %u%%\n",
+            static_cast<unsigned long long>(now / 1000000),
+            static_cast<unsigned long long>(now % 1000000),
+            level,
+            name(level),
+            occupancy);
+    fflush(_M_log);
+  }
+}
+
+const char* net::load_shedder::name(unsigned level)
+{
+  switch (level) {
+    case kFull:
+      return "full";
+    case kTruncate:
+      return "truncate";
+    case kSample:
+      return "sample";
+    case kDrop:
+      return "drop";
+    default:
+      return "unknown";
+  }
+}
+
+bool net::load_shedder::parse_watermarks(const char* s, unsigned* watermarks)
+{
+  for (unsigned i = 0; i < kLevels - 1; i++) {
+    if (!IS_DIGIT(*s)) {
+      return false;
+    }
+
+    unsigned n = 0;
+    while (IS_DIGIT(*s)) {
+      if ((n = (n * 10) + (*s - '0')) > 100) {
+        return false;
+      }
+
+      s++;
+    }
+
+    // Each level must be able to stop and the watermarks must increase.
+    if ((n <= kHysteresis) || ((i > 0) && (n < watermarks[i - 1]))) {
+      return false;
+    }
+
+    watermarks[i] = n;
+
+    if (i < kLevels - 2) {
+      if (*s != ':') {
+        return false;
+      }
+
+      s++;
+    }
+  }
+
+  return (*s == 0);
+}
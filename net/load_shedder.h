@@ -0,0 +1,170 @@
+#ifndef NET_LOAD_SHEDDER_H
+#define NET_LOAD_SHEDDER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+namespace net {
+  // Load shedding: when the ring fills up (the capture falls behind the
+  // kernel), the capture degrades in steps instead of letting the kernel
+  // drop packets at random, and restores full capture when the ring
+  // drains:
+  //   - truncate: the packets are truncated to kTruncateSnaplen bytes.
+  //   - sample: only 1 in kSampleRate flows is kept (see flow_sampler).
+  //   - drop: the packets of the low-priority filter are dropped.
+  //
+  // Each level starts as soon as the ring occupancy reaches its watermark.
+  // The levels stop one at a time, when the occupancy is kHysteresis points
+  // below the watermark and has not reached it for kMinDuration (the ring is
+  // drained in bursts, the occupancy alone would make the level flap). The
+  // level changes are appended to a log file, so that the lossy time spans
+  // of the capture file are known.
+  class load_shedder {
+    public:
+      // Levels.
+      static const unsigned kFull = 0;
+      static const unsigned kTruncate = 1;
+      static const unsigned kSample = 2;
+      static const unsigned kDrop = 3;
+
+      // Number of levels.
+      static const unsigned kLevels = 4;
+
+      // Number of bytes kept by the truncate level (headers).
+      static const uint16_t kTruncateSnaplen = 128;
+
+      // 1 in kSampleRate flows kept by the sample level.
+      static const unsigned kSampleRate = 8;
+
+      // Points of occupancy below a watermark before its level stops.
+      static const unsigned kHysteresis = 10;
+
+      // Time without reaching the watermark before a level stops
+      // (microseconds).
+      static const uint64_t kMinDuration = 1000000;
+
+      // Default watermarks (percentage of the ring).
+      static const unsigned kDefaultTruncateWatermark = 50;
+      static const unsigned kDefaultSampleWatermark = 70;
+      static const unsigned kDefaultDropWatermark = 85;
+
+      struct statistics {
+        // Number of blocks processed at each level.
+        uint64_t blocks[kLevels];
+
+        // Number of level changes.
+        uint64_t changes;
+
+        // Highest ring occupancy (percentage).
+        uint64_t max_occupancy;
+      };
+
+      // Constructor.
+      load_shedder();
+
+      // Destructor.
+      ~load_shedder();
+
+      // Create (watermarks: kLevels - 1 increasing percentages, log: file
+      // where the level changes are appended).
+      bool create(const unsigned* watermarks, const char* log);
+
+      // Update the level with the ring occupancy (percentage) when a block
+      // is processed (sec, usec: timestamp of its first packet). Returns the
+      // level.
+      unsigned update(unsigned occupancy, uint32_t sec, uint32_t usec);
+
+      // Update the level while there are no blocks to process (sec, usec:
+      // current time).
+      void idle(unsigned occupancy, uint32_t sec, uint32_t usec);
+
+      // Get level.
+      unsigned level() const;
+
+      // Get statistics.
+      const struct statistics& stats() const;
+
+      // Get the name of a level.
+      static const char* name(unsigned level);
+
+      // Parse watermarks ("<truncate>:<sample>:<drop>").
+      static bool parse_watermarks(const char* s, unsigned* watermarks);
+
+    private:
+      unsigned _M_watermarks[kLevels - 1];
+
+      unsigned _M_level;
+
+      // Last time the occupancy reached the watermark of the level or the
+      // level changed (microseconds).
+      uint64_t _M_pressure;
+
+      FILE* _M_log;
+
+      struct statistics _M_stats;
+
+      // Adjust the level to the occupancy.
+      unsigned adjust(unsigned occupancy, uint64_t now);
+
+      // Change level.
+      void change(unsigned level, unsigned occupancy, uint64_t now);
+
+      // Disable copy constructor and assignment operator.
+      load_shedder(const load_shedder&);
+      load_shedder& operator=(const load_shedder&);
+  };
+
+  inline unsigned load_shedder::level() const
+  {
+    return _M_level;
+  }
+
+  inline const struct load_shedder::statistics& load_shedder::stats() const
+  {
+    return _M_stats;
+  }
+
+  inline unsigned load_shedder::update(unsigned occupancy, uint32_t sec, uint32_t usec)
+  {
+    if (occupancy > _M_stats.max_occupancy) {
+      _M_stats.max_occupancy = occupancy;
+    }
+
+    unsigned level = adjust(occupancy, (static_cast<uint64_t>(sec) * 1000000ULL) + usec);
+    _M_stats.blocks[level]++;
+
+    return level;
+  }
+
+  inline void load_shedder::idle(unsigned occupancy, uint32_t sec, uint32_t usec)
+  {
+    if (_M_level != kFull) {
+      adjust(occupancy, (static_cast<uint64_t>(sec) * 1000000ULL) + usec);
+    }
+  }
+
+  inline unsigned load_shedder::adjust(unsigned occupancy, uint64_t now)
+  {
+    unsigned level = _M_level;
+
+    // Degrade...
+    while ((level < kLevels - 1) && (occupancy >= _M_watermarks[level])) {
+      level++;
+    }
+
+    if (level != _M_level) {
+      change(level, occupancy, now);
+    } else if (level > kFull) {
+      if (occupancy >= _M_watermarks[level - 1]) {
+        _M_pressure = now;
+      } else if ((occupancy + kHysteresis < _M_watermarks[level - 1]) && (now >= _M_pressure + kMinDuration)) {
+        // ... or restore one level.
+        change(--level, occupancy, now);
+      }
+    }
+
+    return level;
+  }
+}
+
+#endif // NET_LOAD_SHEDDER_H
@@ -1,15 +1,9 @@
 #include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
 #include "net/pcap_file.h"
-
-const struct net::pcap_file::pcap_hdr_t net::pcap_file::_M_pcap_hdr = {
-  kMagicNumber,
-  kVersionMajor,
-  kVersionMinor,
-  kThisZone,
-  kSigfigs,
-  kSnaplen,
-  kLinkType
-};
+#include "net/pcap_ring.h"
+#include "macros/macros.h"
 
 bool net::pcap_file::open(const char* pathname)
 {
@@ -44,13 +38,91 @@ bool net::pcap_file::write_packets(const char* pathname, const string::buffer& p
   return (writev(iov, 2) == static_cast<ssize_t>(sizeof(struct pcap_hdr_t) + pkts.count()));
 }
 
-bool net::pcap_file::write_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count)
+ssize_t net::pcap_file::write_packets(const char* pathname, const pcap_ring& ring)
+{
+  // Buffer where the records are copied before writing them.
+  static const size_t kBufferSize = 1024 * 1024;
+
+  if (!open(pathname)) {
+    return -1;
+  }
+
+  void* buf;
+  if ((buf = malloc(kBufferSize)) == NULL) {
+    close();
+    unlink(pathname);
+
+    return -1;
+  }
+
+  // Snapshot: the packets received from now on are not written.
+  uint64_t end = ring.head();
+  uint64_t pos = ring.tail();
+
+  ssize_t npackets = 0;
+
+  while (pos < end) {
+    size_t count;
+    if ((count = ring.copy(pos, end, buf, kBufferSize)) == 0) {
+      // The records were overwritten, try again from the oldest record.
+      continue;
+    }
+
+    if (write(buf, count) != static_cast<ssize_t>(count)) {
+      free(buf);
+
+      close();
+      unlink(pathname);
+
+      return -1;
+    }
+
+    // Count packets.
+    const char* rec = reinterpret_cast<const char*>(buf);
+    const char* recend = rec + count;
+    while (rec < recend) {
+      rec += sizeof(struct pcaprec_hdr_t) + reinterpret_cast<const struct pcaprec_hdr_t*>(rec)->incl_len;
+      npackets++;
+    }
+  }
+
+  free(buf);
+
+  return close() ? npackets : -1;
+}
+
+int net::pcap_file::write_records(const struct iovec* iov, unsigned iovcnt)
+{
+  int ncalls = 0;
+
+  while (iovcnt > 0) {
+    unsigned n = MIN(iovcnt, IOV_MAX);
+
+    size_t len = 0;
+    for (unsigned i = 0; i < n; i++) {
+      len += iov[i].iov_len;
+    }
+
+    if (writev(iov, n) != static_cast<ssize_t>(len)) {
+      return -1;
+    }
+
+    iov += n;
+    iovcnt -= n;
+
+    ncalls++;
+  }
+
+  return ncalls;
+}
+
+bool net::pcap_file::write_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len)
 {
   struct pcaprec_hdr_t hdr;
   hdr.tv.ts_sec = sec;
   hdr.tv.ts_usec = usec;
-  hdr.len = count;
-  hdr.snaplen = count;
+  hdr.incl_len = count;
+  hdr.orig_len = len;
 
   struct iovec iov[2];
   iov[0].iov_base = &hdr;
@@ -62,7 +134,7 @@ bool net::pcap_file::write_packet(uint32_t sec, uint32_t usec, const void* buf,
   return (writev(iov, 2) == static_cast<ssize_t>(sizeof(struct pcaprec_hdr_t) + count));
 }
 
-bool net::pcap_file::append_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, string::buffer& pkts)
+bool net::pcap_file::append_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len, string::buffer& pkts)
 {
   // If the packet doesn't fit...
   if (pkts.count() + sizeof(struct pcaprec_hdr_t) + count > pkts.size()) {
@@ -75,8 +147,8 @@ bool net::pcap_file::append_packet(uint32_t sec, uint32_t usec, const void* buf,
   struct pcaprec_hdr_t* hdr = reinterpret_cast<struct pcaprec_hdr_t*>(end);
   hdr->tv.ts_sec = sec;
   hdr->tv.ts_usec = usec;
-  hdr->len = count;
-  hdr->snaplen = count;
+  hdr->incl_len = count;
+  hdr->orig_len = len;
 
   end += sizeof(struct pcaprec_hdr_t);
 
@@ -12,6 +12,8 @@
 #include "string/buffer.h"
 
 namespace net {
+  class pcap_ring;
+
   class pcap_file
 #ifdef USE_OMEMFILE
                   : protected fs::omemfile {
@@ -19,20 +21,69 @@ namespace net {
                   : protected fs::file {
 #endif
     public:
+      struct pcap_hdr_t {
+        uint32_t magic_number;
+        uint16_t version_major;
+        uint16_t version_minor;
+        int32_t thiszone;
+        uint32_t sigfigs;
+        uint32_t snaplen;
+        uint32_t linktype;
+      };
+
+      struct pcap_timeval_t {
+        uint32_t ts_sec;
+        uint32_t ts_usec;
+      };
+
+      struct pcaprec_hdr_t {
+        struct pcap_timeval_t tv;
+        uint32_t incl_len; // Number of bytes saved in the file.
+        uint32_t orig_len; // Original length of the packet.
+      };
+
       // Constructor.
       pcap_file();
 
+      // Set snap length (written in the file header).
+      void snaplen(uint32_t snaplen);
+
+      // Get snap length.
+      uint32_t snaplen() const;
+
+      // Get file header.
+      const struct pcap_hdr_t& header() const;
+
       // Open file.
       bool open(const char* pathname);
 
+      // Close file.
+      bool close();
+
+      // Preallocate disk space.
+      bool preallocate(off_t size);
+
+      // Record the duration of the output calls in a histogram (NULL:
+      // don't).
+      void latency(util::histogram* histogram);
+
       // Write packets.
       bool write_packets(const char* pathname, const string::buffer& pkts);
 
-      // Write packet.
-      bool write_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count);
+      // Write snapshot of the packets of a ring (returns the number of
+      // packets written or -1 on error).
+      ssize_t write_packets(const char* pathname, const pcap_ring& ring);
+
+      // Write records (pairs of record header and packet) with one writev()
+      // per IOV_MAX iovecs (returns the number of writev() calls or -1 on
+      // error).
+      int write_records(const struct iovec* iov, unsigned iovcnt);
+
+      // Write packet (count: number of bytes captured, len: original length).
+      bool write_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len);
 
       // Append packet.
-      static bool append_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, string::buffer& pkts);
+      static bool append_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len, string::buffer& pkts);
 
     private:
       static const uint32_t kMagicNumber = 0xa1b2c3d4;
@@ -43,28 +94,10 @@ namespace net {
       static const uint32_t kSnaplen = (64 * 1024) - 1;
       static const uint32_t kLinkType = 1; // LINKTYPE_ETHERNET
 
-      struct pcap_hdr_t {
-        uint32_t magic_number;
-        uint16_t version_major;
-        uint16_t version_minor;
-        int32_t thiszone;
-        uint32_t sigfigs;
-        uint32_t snaplen;
-        uint32_t linktype;
-      };
-
-      struct pcap_timeval_t {
-        uint32_t ts_sec;
-        uint32_t ts_usec;
-      };
-
-      struct pcaprec_hdr_t {
-        struct pcap_timeval_t tv;
-        uint32_t len;
-        uint32_t snaplen;
-      };
+      struct pcap_hdr_t _M_pcap_hdr;
 
-      static const struct pcap_hdr_t _M_pcap_hdr;
+      // Has disk space been preallocated?
+      bool _M_preallocated;
 
       // Write header.
       bool write_header();
@@ -75,7 +108,64 @@ namespace net {
   };
 
   inline pcap_file::pcap_file()
+    : _M_preallocated(false)
+  {
+    _M_pcap_hdr.magic_number = kMagicNumber;
+    _M_pcap_hdr.version_major = kVersionMajor;
+    _M_pcap_hdr.version_minor = kVersionMinor;
+    _M_pcap_hdr.thiszone = kThisZone;
+    _M_pcap_hdr.sigfigs = kSigfigs;
+    _M_pcap_hdr.snaplen = kSnaplen;
+    _M_pcap_hdr.linktype = kLinkType;
+  }
+
+  inline void pcap_file::snaplen(uint32_t snaplen)
+  {
+    _M_pcap_hdr.snaplen = snaplen;
+  }
+
+  inline uint32_t pcap_file::snaplen() const
+  {
+    return _M_pcap_hdr.snaplen;
+  }
+
+  inline const struct pcap_file::pcap_hdr_t& pcap_file::header() const
+  {
+    return _M_pcap_hdr;
+  }
+
+  inline bool pcap_file::close()
+  {
+#ifdef USE_OMEMFILE
+    return fs::omemfile::close();
+#else
+    // Free the disk space preallocated beyond the packets written.
+    if ((_M_preallocated) && (_M_fd != -1)) {
+      _M_preallocated = false;
+
+      off_t off;
+      if (((off = offset()) < 0) || (!truncate(off))) {
+        fs::file::close();
+        return false;
+      }
+    }
+
+    return fs::file::close();
+#endif
+  }
+
+  inline void pcap_file::latency(util::histogram* histogram)
+  {
+#ifdef USE_OMEMFILE
+    fs::omemfile::latency(histogram);
+#else
+    fs::file::latency(histogram);
+#endif
+  }
+
+  inline bool pcap_file::preallocate(off_t size)
   {
+    return (_M_preallocated = allocate(size));
   }
 
   inline bool pcap_file::write_header()
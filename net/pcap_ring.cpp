@@ -0,0 +1,128 @@
+#include "net/pcap_ring.h"
+
+bool net::pcap_ring::create(size_t size, unsigned flags)
+{
+  if (size < sizeof(pcaprec_hdr_t)) {
+    return false;
+  }
+
+  if (!_M_buf.map(size, flags)) {
+    return false;
+  }
+
+  // Use the whole buffer.
+  _M_buf.count(_M_buf.size());
+
+  _M_tail = 0;
+  _M_head = 0;
+
+  return true;
+}
+
+bool net::pcap_ring::append(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len)
+{
+  size_t size = _M_buf.size();
+  size_t reclen = sizeof(pcaprec_hdr_t) + count;
+
+  // If the record doesn't fit in the buffer...
+  if (reclen > size) {
+    return false;
+  }
+
+  uint64_t head = _M_head;
+  size_t off = head % size;
+
+  // Skip the end of the buffer if the record doesn't fit.
+  size_t skip = 0;
+  if (off + reclen > size) {
+    skip = size - off;
+  }
+
+  // Advance the tail past the records which are going to be overwritten.
+  uint64_t end = head + skip + reclen;
+  uint64_t tail = _M_tail;
+  if (end - tail > size) {
+    do {
+      if (!padding(tail)) {
+        _M_overwritten++;
+      }
+
+      tail += record_size(tail);
+    } while ((tail < head) && (end - tail > size));
+
+    // If all the records are overwritten, the new record is the oldest one.
+    if (tail >= head) {
+      tail = head + skip;
+    }
+
+    __atomic_store_n(&_M_tail, tail, __ATOMIC_RELAXED);
+
+    // The new tail has to be visible before the records are overwritten.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  }
+
+  char* data = _M_buf.data();
+
+  if (skip > 0) {
+    if (skip >= sizeof(pcaprec_hdr_t)) {
+      reinterpret_cast<pcaprec_hdr_t*>(data + off)->incl_len = kPadding;
+    }
+
+    off = 0;
+  }
+
+  // Fill header.
+  pcaprec_hdr_t* hdr = reinterpret_cast<pcaprec_hdr_t*>(data + off);
+  hdr->tv.ts_sec = sec;
+  hdr->tv.ts_usec = usec;
+  hdr->incl_len = count;
+  hdr->orig_len = len;
+
+  memcpy(data + off + sizeof(pcaprec_hdr_t), buf, count);
+
+  // Publish record.
+  __atomic_store_n(&_M_head, end, __ATOMIC_RELEASE);
+
+  return true;
+}
+
+size_t net::pcap_ring::copy(uint64_t& pos, uint64_t end, void* buf, size_t size) const
+{
+  const char* data = _M_buf.data();
+  size_t bufsize = _M_buf.size();
+
+  uint64_t p = pos;
+  size_t copied = 0;
+
+  while (p < end) {
+    size_t off = p % bufsize;
+    size_t reclen = record_size(p);
+
+    if (padding(p)) {
+      p += reclen;
+      continue;
+    }
+
+    // If the record doesn't fit in the buffer (or it is being overwritten)...
+    if ((copied + reclen > size) || (off + reclen > bufsize)) {
+      break;
+    }
+
+    memcpy(reinterpret_cast<char*>(buf) + copied, data + off, reclen);
+
+    copied += reclen;
+    p += reclen;
+  }
+
+  // Have the records been overwritten while they were being copied?
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+  uint64_t tail = __atomic_load_n(&_M_tail, __ATOMIC_RELAXED);
+  if (tail > pos) {
+    pos = tail;
+    return 0;
+  }
+
+  pos = p;
+  return copied;
+}
@@ -0,0 +1,125 @@
+#ifndef NET_PCAP_RING_H
+#define NET_PCAP_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include "net/pcap_file.h"
+#include "string/buffer.h"
+
+namespace net {
+  // Circular buffer of pcap records which overwrites the oldest records.
+  //
+  // The positions are logical (they never wrap): the physical offset is the
+  // position modulo the size of the buffer. A record is never split, if it
+  // doesn't fit at the end of the buffer, the rest of the buffer is skipped.
+  //
+  // There is a single writer (the thread which captures the packets). Other
+  // threads can take a snapshot while the writer keeps running: the writer
+  // advances the tail before overwriting the oldest records, so the readers
+  // can detect whether the records they have copied were overwritten.
+  class pcap_ring {
+    public:
+      // Constructor.
+      pcap_ring();
+
+      // Create (flags: string::buffer::map() flags).
+      bool create(size_t size, unsigned flags);
+
+      // Has the memory been locked?
+      bool locked() const;
+
+      // Append packet (writer).
+      bool append(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len);
+
+      // Get position of the oldest record.
+      uint64_t tail() const;
+
+      // Get position after the newest record.
+      uint64_t head() const;
+
+      // Copy whole records from pos up to end (readers).
+      // Returns the number of bytes copied to buf and advances pos. If the
+      // records were overwritten while copying them, nothing is copied and
+      // pos is moved to the oldest record.
+      size_t copy(uint64_t& pos, uint64_t end, void* buf, size_t size) const;
+
+      // Get number of records overwritten.
+      uint64_t overwritten() const;
+
+    private:
+      typedef pcap_file::pcaprec_hdr_t pcaprec_hdr_t;
+
+      // Marks the end of the used part of the buffer.
+      static const uint32_t kPadding = 0xffffffff;
+
+      string::buffer _M_buf;
+
+      uint64_t _M_tail;
+      uint64_t _M_head;
+
+      uint64_t _M_overwritten;
+
+      // Get size of the record at the given position.
+      size_t record_size(uint64_t pos) const;
+
+      // Is there padding at the given position?
+      bool padding(uint64_t pos) const;
+
+      // Disable copy constructor and assignment operator.
+      pcap_ring(const pcap_ring&);
+      pcap_ring& operator=(const pcap_ring&);
+  };
+
+  inline pcap_ring::pcap_ring()
+    : _M_tail(0),
+      _M_head(0),
+      _M_overwritten(0)
+  {
+  }
+
+  inline uint64_t pcap_ring::tail() const
+  {
+    return __atomic_load_n(&_M_tail, __ATOMIC_ACQUIRE);
+  }
+
+  inline uint64_t pcap_ring::head() const
+  {
+    return __atomic_load_n(&_M_head, __ATOMIC_ACQUIRE);
+  }
+
+  inline bool pcap_ring::locked() const
+  {
+    return _M_buf.locked();
+  }
+
+  inline uint64_t pcap_ring::overwritten() const
+  {
+    return _M_overwritten;
+  }
+
+  inline size_t pcap_ring::record_size(uint64_t pos) const
+  {
+    size_t off = pos % _M_buf.size();
+
+    if (padding(pos)) {
+      return _M_buf.size() - off;
+    }
+
+    const pcaprec_hdr_t* hdr = reinterpret_cast<const pcaprec_hdr_t*>(_M_buf.data() + off);
+    return sizeof(pcaprec_hdr_t) + hdr->incl_len;
+  }
+
+  inline bool pcap_ring::padding(uint64_t pos) const
+  {
+    size_t off = pos % _M_buf.size();
+
+    // Not enough room for a record header?
+    if (off + sizeof(pcaprec_hdr_t) > _M_buf.size()) {
+      return true;
+    }
+
+    return (reinterpret_cast<const pcaprec_hdr_t*>(_M_buf.data() + off)->incl_len == kPadding);
+  }
+}
+
+#endif // NET_PCAP_RING_H
@@ -0,0 +1,285 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "net/pcap_rotator.h"
+#include "fs/path.h"
+
+net::pcap_rotator::pcap_rotator()
+  : _M_filesize(0),
+    _M_seconds(0),
+    _M_max_files(0),
+    _M_quota(0),
+    _M_current(0),
+    _M_latency(NULL),
+    _M_start(0),
+    _M_started(false),
+    _M_late(false),
+    _M_seqno(0),
+    _M_closed(NULL),
+    _M_nclosed(0),
+    _M_closed_size(0),
+    _M_closed_bytes(0),
+    _M_running(false),
+    _M_next_ready(false),
+    _M_to_close(-1)
+{
+  memset(&_M_stats, 0, sizeof(struct statistics));
+
+  pthread_mutex_init(&_M_mutex, NULL);
+  pthread_cond_init(&_M_cond, NULL);
+}
+
+net::pcap_rotator::~pcap_rotator()
+{
+  close();
+
+  if (_M_closed) {
+    free(_M_closed);
+  }
+
+  pthread_cond_destroy(&_M_cond);
+  pthread_mutex_destroy(&_M_mutex);
+}
+
+bool net::pcap_rotator::create(const char* pathname,
+                               uint32_t snaplen,
+                               off_t filesize,
+                               unsigned seconds,
+                               unsigned max_files,
+                               off_t quota)
+{
+  size_t len;
+  if ((len = strlen(pathname)) >= sizeof(_M_pathname)) {
+    return false;
+  }
+
+  memcpy(_M_pathname, pathname, len + 1);
+
+  _M_filesize = filesize;
+  _M_seconds = seconds;
+  _M_max_files = max_files;
+  _M_quota = quota;
+
+  _M_files[0].pcap_file.snaplen(snaplen);
+  _M_files[1].pcap_file.snaplen(snaplen);
+
+  // Open the first file.
+  _M_current = 0;
+  if (!open(&_M_files[0])) {
+    return false;
+  }
+
+  _M_stats.files = 1;
+
+  // Start background thread, it will prepare the next file.
+  _M_running = true;
+  if (pthread_create(&_M_thread, NULL, run, this) != 0) {
+    _M_running = false;
+    return false;
+  }
+
+  return true;
+}
+
+bool net::pcap_rotator::close()
+{
+  if (_M_running) {
+    pthread_mutex_lock(&_M_mutex);
+    _M_running = false;
+    pthread_cond_signal(&_M_cond);
+    pthread_mutex_unlock(&_M_mutex);
+
+    pthread_join(_M_thread, NULL);
+  }
+
+  bool ret = true;
+
+  // Close the current file.
+  if (_M_files[_M_current].pathname[0]) {
+    ret = close(&_M_files[_M_current], false);
+  }
+
+  // The next file is empty, remove it.
+  if (_M_files[_M_current ^ 1].pathname[0]) {
+    close(&_M_files[_M_current ^ 1], true);
+  }
+
+  return ret;
+}
+
+void net::pcap_rotator::rotate(uint32_t sec)
+{
+  unsigned prev = _M_current;
+
+  _M_current ^= 1;
+  _M_start = sec;
+  _M_late = false;
+
+  // Only the current file records the duration of the output calls (the
+  // background thread writes the header of the next file).
+  _M_files[prev].pcap_file.latency(NULL);
+  _M_files[_M_current].pcap_file.latency(_M_latency);
+
+  _M_stats.files++;
+
+  // Hand the previous file to the background thread.
+  pthread_mutex_lock(&_M_mutex);
+
+  _M_next_ready = false;
+  _M_to_close = prev;
+
+  pthread_cond_signal(&_M_cond);
+  pthread_mutex_unlock(&_M_mutex);
+}
+
+bool net::pcap_rotator::open(struct file* f)
+{
+  char suffix[32];
+  snprintf(suffix, sizeof(suffix), "-%06llu", _M_seqno);
+
+  if (!fs::path::add_suffix(_M_pathname, suffix, f->pathname, sizeof(f->pathname))) {
+    f->pathname[0] = 0;
+    return false;
+  }
+
+  if (!f->pcap_file.open(f->pathname)) {
+    fprintf(stderr, "Couldn't open capture file %s for writing.\n", f->pathname);
+
+    f->pathname[0] = 0;
+    return false;
+  }
+
+  // Reserve disk space (not supported by every file system).
+  if (_M_filesize > 0) {
+    f->pcap_file.preallocate(_M_filesize);
+  }
+
+  f->size = sizeof(struct pcap_file::pcap_hdr_t);
+
+  _M_seqno++;
+
+  return true;
+}
+
+bool net::pcap_rotator::close(struct file* f, bool remove)
+{
+  bool ret = f->pcap_file.close();
+
+  if (remove) {
+    unlink(f->pathname);
+  } else {
+    // Add file to the list of closed files.
+    if (_M_nclosed == _M_closed_size) {
+      unsigned size = (_M_closed_size == 0) ? 16 : _M_closed_size * 2;
+
+      struct closed_file* closed;
+      if ((closed = reinterpret_cast<struct closed_file*>(realloc(_M_closed, size * sizeof(struct closed_file)))) != NULL) {
+        _M_closed = closed;
+        _M_closed_size = size;
+      }
+    }
+
+    if (_M_nclosed < _M_closed_size) {
+      struct closed_file* closed = &_M_closed[_M_nclosed++];
+      memcpy(closed->pathname, f->pathname, sizeof(closed->pathname));
+      closed->size = f->size;
+
+      _M_closed_bytes += f->size;
+    }
+  }
+
+  f->pathname[0] = 0;
+
+  return ret;
+}
+
+void net::pcap_rotator::apply_retention()
+{
+  // The current file counts as well (with its maximum size).
+  unsigned n = 0;
+  while (n < _M_nclosed) {
+    if (((_M_max_files == 0) || (_M_nclosed - n + 1 <= _M_max_files)) &&
+        ((_M_quota == 0) || (_M_closed_bytes + _M_filesize <= _M_quota))) {
+      break;
+    }
+
+    unlink(_M_closed[n].pathname);
+    _M_closed_bytes -= _M_closed[n].size;
+
+    n++;
+  }
+
+  if (n > 0) {
+    _M_nclosed -= n;
+    memmove(_M_closed, _M_closed + n, _M_nclosed * sizeof(struct closed_file));
+
+    __atomic_add_fetch(&_M_stats.deleted_files, n, __ATOMIC_RELAXED);
+  }
+}
+
+void* net::pcap_rotator::run(void* arg)
+{
+  reinterpret_cast<net::pcap_rotator*>(arg)->background();
+  return NULL;
+}
+
+void net::pcap_rotator::background()
+{
+  // Has the next file failed to open?
+  bool failed = false;
+
+  pthread_mutex_lock(&_M_mutex);
+
+  do {
+    // The previous file is closed even when stopping, otherwise close()
+    // would take it for the next (empty) file.
+    if (_M_to_close != -1) {
+      struct file* f = &_M_files[_M_to_close];
+      _M_to_close = -1;
+
+      pthread_mutex_unlock(&_M_mutex);
+
+      // Close the previous file and delete the oldest files.
+      close(f, false);
+      apply_retention();
+
+      pthread_mutex_lock(&_M_mutex);
+    } else if (!_M_running) {
+      break;
+    } else if (!_M_next_ready) {
+      struct file* f = &_M_files[_M_current ^ 1];
+
+      pthread_mutex_unlock(&_M_mutex);
+
+      // Prepare the next file.
+      bool ready = open(f);
+
+      pthread_mutex_lock(&_M_mutex);
+
+      if (!ready) {
+        if (!failed) {
+          fprintf(stderr, "Couldn't prepare the next capture file, retrying.\n");
+          failed = true;
+        }
+
+        // Keep writing to the current file and try again later.
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += kRetryInterval;
+
+        pthread_cond_timedwait(&_M_cond, &_M_mutex, &ts);
+        continue;
+      }
+
+      failed = false;
+
+      __atomic_store_n(&_M_next_ready, true, __ATOMIC_RELEASE);
+    } else {
+      pthread_cond_wait(&_M_cond, &_M_mutex);
+    }
+  } while (true);
+
+  pthread_mutex_unlock(&_M_mutex);
+}
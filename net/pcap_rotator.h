@@ -0,0 +1,179 @@
+#ifndef NET_PCAP_ROTATOR_H
+#define NET_PCAP_ROTATOR_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include "net/pcap_file.h"
+
+namespace net {
+  // Writes the packets to a sequence of capture files (<pathname>-000000,
+  // <pathname>-000001, ...), switching to the next file when the current
+  // one gets too big or too old.
+  //
+  // A background thread opens and preallocates the next file in advance,
+  // closes the previous one and deletes the oldest files, so switching
+  // files only takes a few instructions in the thread which writes the
+  // packets.
+  class pcap_rotator {
+    public:
+      static const unsigned kMinFiles = 2;
+
+      // Time between two attempts to open the next file (seconds).
+      static const unsigned kRetryInterval = 1;
+
+      struct statistics {
+        uint64_t files;
+        uint64_t late_rotations;
+        uint64_t deleted_files;
+      };
+
+      // Constructor.
+      pcap_rotator();
+
+      // Destructor.
+      ~pcap_rotator();
+
+      // Create.
+      // filesize: rotate when the file reaches filesize bytes (0: no limit).
+      // seconds: rotate every seconds seconds (0: no limit).
+      // max_files: maximum number of files (0: no limit).
+      // quota: maximum number of bytes used by the files (0: no limit,
+      // requires filesize).
+      bool create(const char* pathname,
+                  uint32_t snaplen,
+                  off_t filesize,
+                  unsigned seconds,
+                  unsigned max_files,
+                  off_t quota);
+
+      // Close.
+      bool close();
+
+      // Record the duration of the output calls of the current file in a
+      // histogram (NULL: don't).
+      void latency(util::histogram* histogram);
+
+      // Write packet.
+      bool write_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len);
+
+      // Get statistics.
+      const struct statistics& stats() const;
+
+    private:
+      struct file {
+        net::pcap_file pcap_file;
+        char pathname[PATH_MAX];
+        off_t size; // Including the file header.
+      };
+
+      // Closed file (kept for the retention policy).
+      struct closed_file {
+        char pathname[PATH_MAX];
+        off_t size;
+      };
+
+      char _M_pathname[PATH_MAX];
+
+      off_t _M_filesize;
+      unsigned _M_seconds;
+      unsigned _M_max_files;
+      off_t _M_quota;
+
+      // Current file and the next one (prepared by the background thread).
+      struct file _M_files[2];
+      unsigned _M_current;
+
+      util::histogram* _M_latency;
+
+      // Timestamp of the first packet of the current file.
+      uint32_t _M_start;
+      bool _M_started;
+
+      // Has the current file exceeded its limits?
+      bool _M_late;
+
+      uint64_t _M_seqno;
+
+      // Closed files (oldest first).
+      struct closed_file* _M_closed;
+      unsigned _M_nclosed;
+      unsigned _M_closed_size;
+      off_t _M_closed_bytes;
+
+      // Background thread.
+      pthread_t _M_thread;
+      pthread_mutex_t _M_mutex;
+      pthread_cond_t _M_cond;
+      bool _M_running;
+
+      // Is the next file ready?
+      bool _M_next_ready;
+
+      // Index of the file to be closed by the background thread (-1: none).
+      int _M_to_close;
+
+      struct statistics _M_stats;
+
+      // Rotate.
+      void rotate(uint32_t sec);
+
+      // Open file.
+      bool open(struct file* f);
+
+      // Close file.
+      bool close(struct file* f, bool remove);
+
+      // Delete the oldest files.
+      void apply_retention();
+
+      // Background thread.
+      static void* run(void* arg);
+      void background();
+
+      // Disable copy constructor and assignment operator.
+      pcap_rotator(const pcap_rotator&);
+      pcap_rotator& operator=(const pcap_rotator&);
+  };
+
+  inline const struct pcap_rotator::statistics& pcap_rotator::stats() const
+  {
+    return _M_stats;
+  }
+
+  inline void pcap_rotator::latency(util::histogram* histogram)
+  {
+    _M_latency = histogram;
+    _M_files[_M_current].pcap_file.latency(histogram);
+  }
+
+  inline bool pcap_rotator::write_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len)
+  {
+    size_t reclen = sizeof(pcap_file::pcaprec_hdr_t) + count;
+
+    if (!_M_started) {
+      _M_start = sec;
+      _M_started = true;
+    } else if (((_M_filesize > 0) && (_M_files[_M_current].size + static_cast<off_t>(reclen) > _M_filesize)) ||
+               ((_M_seconds > 0) && (sec - _M_start >= _M_seconds))) {
+      // If the next file is not ready yet, keep writing to the current one.
+      if (__atomic_load_n(&_M_next_ready, __ATOMIC_ACQUIRE)) {
+        rotate(sec);
+      } else if (!_M_late) {
+        _M_stats.late_rotations++;
+        _M_late = true;
+      }
+    }
+
+    struct file* f = &_M_files[_M_current];
+    if (!f->pcap_file.write_packet(sec, usec, buf, count, len)) {
+      return false;
+    }
+
+    f->size += reclen;
+
+    return true;
+  }
+}
+
+#endif // NET_PCAP_ROTATOR_H
@@ -0,0 +1,210 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include "net/pcap_segment.h"
+
+net::pcap_segment::pcap_segment()
+  : _M_fd(-1),
+    _M_data(reinterpret_cast<uint8_t*>(MAP_FAILED)),
+    _M_size(0),
+    _M_end(0),
+    _M_trailer(NULL)
+{
+  *_M_pathname = 0;
+}
+
+net::pcap_segment::~pcap_segment()
+{
+  close();
+}
+
+bool net::pcap_segment::create(const char* pathname, size_t size, const pcap_file::pcap_hdr_t& hdr, bool lock)
+{
+  size_t len;
+  if ((len = strlen(pathname)) >= sizeof(_M_pathname)) {
+    return false;
+  }
+
+  // Don't overwrite a segment which might have to be recovered.
+  if ((_M_fd = open(pathname, O_CREAT | O_EXCL | O_RDWR, 0644)) < 0) {
+    return false;
+  }
+
+  memcpy(_M_pathname, pathname, len + 1);
+
+  _M_end = sizeof(pcap_file::pcap_hdr_t) + size;
+
+  // The trailer is aligned and lives at the end of the file.
+  _M_size = ((_M_end + 7) & ~static_cast<size_t>(7)) + sizeof(struct trailer);
+
+  // Reserve the space now, so that writing to the mapping can't fail
+  // (SIGBUS) when the file system gets full.
+  if ((posix_fallocate(_M_fd, 0, _M_size) != 0) ||
+      ((_M_data = reinterpret_cast<uint8_t*>(mmap(NULL,
+                                                  _M_size,
+                                                  PROT_READ | PROT_WRITE,
+                                                  MAP_SHARED | MAP_POPULATE,
+                                                  _M_fd,
+                                                  0))) == MAP_FAILED)) {
+    close();
+    unlink(pathname);
+
+    return false;
+  }
+
+  // Lock the memory (not fatal, it might exceed RLIMIT_MEMLOCK).
+  if (lock) {
+    mlock(_M_data, _M_size);
+  }
+
+  memcpy(_M_data, &hdr, sizeof(pcap_file::pcap_hdr_t));
+
+  _M_trailer = reinterpret_cast<struct trailer*>(_M_data + _M_size - sizeof(struct trailer));
+  _M_trailer->magic = kMagic;
+  _M_trailer->committed = sizeof(pcap_file::pcap_hdr_t);
+
+  return true;
+}
+
+bool net::pcap_segment::save(const char* pathname)
+{
+  if (_M_fd == -1) {
+    return false;
+  }
+
+  uint64_t committed = _M_trailer->committed;
+
+  munmap(_M_data, _M_size);
+  _M_data = reinterpret_cast<uint8_t*>(MAP_FAILED);
+  _M_trailer = NULL;
+
+  int fd = _M_fd;
+  _M_fd = -1;
+
+  return save(fd, _M_pathname, committed, pathname);
+}
+
+bool net::pcap_segment::recover(const char* segment, const char* pathname)
+{
+  int fd;
+  if ((fd = open(segment, O_RDWR)) < 0) {
+    fprintf(stderr, "Couldn't open segment %s.\n", segment);
+    return false;
+  }
+
+  struct stat sbuf;
+  struct trailer trailer;
+  if ((fstat(fd, &sbuf) < 0) ||
+      (sbuf.st_size < static_cast<off_t>(sizeof(pcap_file::pcap_hdr_t) + sizeof(struct trailer))) ||
+      (pread(fd, &trailer, sizeof(struct trailer), sbuf.st_size - sizeof(struct trailer)) != static_cast<ssize_t>(sizeof(struct trailer))) ||
+      (trailer.magic != kMagic) ||
+      (trailer.committed < sizeof(pcap_file::pcap_hdr_t)) ||
+      (trailer.committed > sbuf.st_size - sizeof(struct trailer))) {
+    fprintf(stderr, "%s is not a valid segment.\n", segment);
+
+    ::close(fd);
+    return false;
+  }
+
+  uint64_t committed = trailer.committed;
+
+  if (!save(fd, segment, committed, pathname)) {
+    fprintf(stderr, "Couldn't save segment %s to %s.\n", segment, pathname);
+    return false;
+  }
+
+  fprintf(stderr, "%llu bytes recovered to %s.\n", committed, pathname);
+
+  return true;
+}
+
+void net::pcap_segment::close()
+{
+  if (_M_data != MAP_FAILED) {
+    munmap(_M_data, _M_size);
+    _M_data = reinterpret_cast<uint8_t*>(MAP_FAILED);
+  }
+
+  _M_trailer = NULL;
+
+  if (_M_fd != -1) {
+    ::close(_M_fd);
+    _M_fd = -1;
+  }
+}
+
+bool net::pcap_segment::save(int fd, const char* segment, uint64_t committed, const char* pathname)
+{
+  // Same file system?
+  if (rename(segment, pathname) == 0) {
+    // Remove the unused space and the trailer (only now: a segment which
+    // couldn't be saved keeps its trailer and can still be recovered).
+    if (ftruncate(fd, committed) < 0) {
+      rename(pathname, segment);
+
+      ::close(fd);
+      return false;
+    }
+
+    ::close(fd);
+    return true;
+  } else if (errno != EXDEV) {
+    ::close(fd);
+    return false;
+  }
+
+  // Copy the segment (the committed bytes, the segment is left intact).
+  int out;
+  if ((out = open(pathname, O_CREAT | O_TRUNC | O_WRONLY, 0644)) < 0) {
+    ::close(fd);
+    return false;
+  }
+
+  bool use_copy_file_range = true;
+
+  off_t off = 0;
+  while (static_cast<uint64_t>(off) < committed) {
+    ssize_t ret;
+
+    if (use_copy_file_range) {
+      if ((ret = copy_file_range(fd, &off, out, NULL, committed - off, 0)) < 0) {
+        if ((errno == EXDEV) || (errno == ENOSYS) || (errno == EINVAL) || (errno == EOPNOTSUPP)) {
+          // Not supported between these file systems.
+          use_copy_file_range = false;
+          continue;
+        }
+      }
+    } else {
+      ret = sendfile(out, fd, &off, committed - off);
+    }
+
+    if (ret < 0) {
+      if (errno != EINTR) {
+        break;
+      }
+    } else if (ret == 0) {
+      break;
+    }
+  }
+
+  bool ret = (static_cast<uint64_t>(off) == committed);
+
+  if (::close(out) < 0) {
+    ret = false;
+  }
+
+  ::close(fd);
+
+  if (ret) {
+    unlink(segment);
+  } else {
+    unlink(pathname);
+  }
+
+  return ret;
+}
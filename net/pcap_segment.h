@@ -0,0 +1,101 @@
+#ifndef NET_PCAP_SEGMENT_H
+#define NET_PCAP_SEGMENT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <sys/types.h>
+#include "net/pcap_file.h"
+
+namespace net {
+  // Memory mapped file (usually under /dev/shm) where the packets are
+  // stored as a valid capture file, followed by a trailer with the number
+  // of bytes committed. If the program dies, the segment survives and can
+  // be recovered.
+  //
+  // +-------------+---------+-----+---------+--------+---------+
+  // | File header | Record  | ... | Record  | Unused | Trailer |
+  // +-------------+---------+-----+---------+--------+---------+
+  class pcap_segment {
+    public:
+      // Constructor.
+      pcap_segment();
+
+      // Destructor.
+      ~pcap_segment();
+
+      // Create segment (size: number of bytes for the records, lock: lock
+      // the memory).
+      bool create(const char* pathname, size_t size, const pcap_file::pcap_hdr_t& hdr, bool lock);
+
+      // Append packet.
+      bool append_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len);
+
+      // Turn the segment into the capture file pathname (the segment is
+      // removed).
+      bool save(const char* pathname);
+
+      // Turn a segment left by a previous run into a capture file.
+      static bool recover(const char* segment, const char* pathname);
+
+    private:
+      static const uint64_t kMagic = 0x746e656d67657370ULL; // "psegment"
+
+      struct trailer {
+        uint64_t magic;
+
+        // Number of valid bytes (file header and records).
+        uint64_t committed;
+      };
+
+      int _M_fd;
+
+      char _M_pathname[PATH_MAX];
+
+      uint8_t* _M_data;
+      size_t _M_size; // Size of the file.
+
+      // End of the space for the records.
+      size_t _M_end;
+
+      struct trailer* _M_trailer;
+
+      // Close segment.
+      void close();
+
+      // Truncate the file to the committed bytes and move it (the file
+      // descriptor is closed).
+      static bool save(int fd, const char* segment, uint64_t committed, const char* pathname);
+
+      // Disable copy constructor and assignment operator.
+      pcap_segment(const pcap_segment&);
+      pcap_segment& operator=(const pcap_segment&);
+  };
+
+  inline bool pcap_segment::append_packet(uint32_t sec, uint32_t usec, const void* buf, size_t count, size_t len)
+  {
+    uint64_t committed = _M_trailer->committed;
+
+    // If the packet doesn't fit...
+    if (committed + sizeof(pcap_file::pcaprec_hdr_t) + count > _M_end) {
+      return false;
+    }
+
+    pcap_file::pcaprec_hdr_t* hdr = reinterpret_cast<pcap_file::pcaprec_hdr_t*>(_M_data + committed);
+    hdr->tv.ts_sec = sec;
+    hdr->tv.ts_usec = usec;
+    hdr->incl_len = count;
+    hdr->orig_len = len;
+
+    memcpy(hdr + 1, buf, count);
+
+    // Commit the record once it has been written.
+    __atomic_store_n(&_M_trailer->committed,
+                     committed + sizeof(pcap_file::pcaprec_hdr_t) + count,
+                     __ATOMIC_RELEASE);
+
+    return true;
+  }
+}
+
+#endif // NET_PCAP_SEGMENT_H
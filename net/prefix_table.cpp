@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "net/prefix_table.h"
+#include "macros/macros.h"
+
+void net::prefix_table::free()
+{
+  if (_M_prefixes) {
+    ::free(_M_prefixes);
+    _M_prefixes = NULL;
+  }
+
+  _M_nprefixes = 0;
+  _M_size = 0;
+
+  if (_M_tbl24) {
+    ::free(_M_tbl24);
+    _M_tbl24 = NULL;
+  }
+
+  if (_M_tbl8) {
+    ::free(_M_tbl8);
+    _M_tbl8 = NULL;
+  }
+
+  _M_ntbl8 = 0;
+
+  if (_M_direct) {
+    ::free(_M_direct);
+    _M_direct = NULL;
+  }
+
+  if (_M_nodes) {
+    ::free(_M_nodes);
+    _M_nodes = NULL;
+  }
+
+  _M_nnodes = 0;
+
+  if (_M_leaves) {
+    ::free(_M_leaves);
+    _M_leaves = NULL;
+  }
+
+  _M_nleaves = 0;
+
+  if (_M_trie) {
+    ::free(_M_trie);
+    _M_trie = NULL;
+  }
+
+  _M_ntrie = 0;
+  _M_trie_size = 0;
+}
+
+bool net::prefix_table::add(const char* prefix, size_t len, uint8_t mask, uint8_t value)
+{
+  // Longest prefix: IPv6 address + "/128".
+  char buf[INET6_ADDRSTRLEN + 4];
+  if ((len == 0) || (len >= sizeof(buf))) {
+    return false;
+  }
+
+  memcpy(buf, prefix, len);
+  buf[len] = 0;
+
+  struct prefix p;
+  memset(&p, 0, sizeof(struct prefix));
+
+  p.ipv6 = (memchr(buf, ':', len) != NULL);
+
+  unsigned maxlen = p.ipv6 ? 128 : 32;
+  unsigned prefixlen = maxlen;
+
+  char* slash;
+  if ((slash = strchr(buf, '/')) != NULL) {
+    *slash = 0;
+
+    const char* s = slash + 1;
+    if (!IS_DIGIT(*s)) {
+      return false;
+    }
+
+    prefixlen = 0;
+    while (IS_DIGIT(*s)) {
+      if ((prefixlen = (prefixlen * 10) + (*s - '0')) > maxlen) {
+        return false;
+      }
+
+      s++;
+    }
+
+    if ((*s) || (prefixlen == 0)) {
+      return false;
+    }
+  }
+
+  if (inet_pton(p.ipv6 ? AF_INET6 : AF_INET, buf, p.addr) != 1) {
+    return false;
+  }
+
+  // Clear the host bits.
+  for (unsigned i = 0; i < maxlen / 8; i++) {
+    if (prefixlen <= i * 8) {
+      p.addr[i] = 0;
+    } else if (prefixlen < (i + 1) * 8) {
+      p.addr[i] &= 0xff << ((i + 1) * 8 - prefixlen);
+    }
+  }
+
+  p.len = prefixlen;
+  p.mask = mask;
+  p.value = value & mask;
+
+  if (_M_nprefixes == _M_size) {
+    size_t size = (_M_size == 0) ? kInitialPrefixes : _M_size * 2;
+
+    struct prefix* prefixes;
+    if ((prefixes = reinterpret_cast<struct prefix*>(realloc(_M_prefixes, size * sizeof(struct prefix)))) == NULL) {
+      return false;
+    }
+
+    _M_prefixes = prefixes;
+    _M_size = size;
+  }
+
+  _M_prefixes[_M_nprefixes++] = p;
+
+  return true;
+}
+
+bool net::prefix_table::load(const char* filename, uint8_t mask, uint8_t value)
+{
+  FILE* file;
+  if ((file = fopen(filename, "r")) == NULL) {
+    fprintf(stderr, "Couldn't open prefix file %s.\n", filename);
+    return false;
+  }
+
+  char line[256];
+  unsigned nline = 0;
+  while (fgets(line, sizeof(line), file)) {
+    nline++;
+
+    // Skip white spaces.
+    const char* begin = line;
+    while (IS_WHITE_SPACE(*begin)) {
+      begin++;
+    }
+
+    const char* end = begin;
+    while ((*end) && (*end != '#') && (*end != '\r') && (*end != '\n') && (!IS_WHITE_SPACE(*end))) {
+      end++;
+    }
+
+    // Empty line or comment?
+    if (end == begin) {
+      continue;
+    }
+
+    if (!add(begin, end - begin, mask, value)) {
+      fprintf(stderr, "Invalid prefix in %s, line %u.\n", filename, nline);
+
+      fclose(file);
+      return false;
+    }
+  }
+
+  fclose(file);
+  return true;
+}
+
+bool net::prefix_table::build()
+{
+  // Paint the prefixes from the shortest to the longest one, for the same
+  // prefix the biggest value (e.g. an exclusion) wins. A prefix never
+  // finds its entries split by a longer one.
+  qsort(_M_prefixes, _M_nprefixes, sizeof(struct prefix), compare);
+
+  uint8_t* direct_leaves = NULL;
+  int32_t* direct_children = NULL;
+
+  for (size_t i = 0; i < _M_nprefixes; i++) {
+    const struct prefix* p = &_M_prefixes[i];
+
+    if (!p->ipv6) {
+      if (!_M_tbl24) {
+        if ((_M_tbl24 = reinterpret_cast<uint16_t*>(calloc(kTbl24Size, sizeof(uint16_t)))) == NULL) {
+          return false;
+        }
+      }
+
+      if (!paint4(p)) {
+        return false;
+      }
+    } else {
+      if (!direct_leaves) {
+        if ((direct_leaves = reinterpret_cast<uint8_t*>(calloc(1 << kDirectBits, sizeof(uint8_t)))) == NULL) {
+          return false;
+        }
+
+        if ((direct_children = reinterpret_cast<int32_t*>(malloc((1 << kDirectBits) * sizeof(int32_t)))) == NULL) {
+          ::free(direct_leaves);
+          return false;
+        }
+
+        memset(direct_children, 0xff, (1 << kDirectBits) * sizeof(int32_t));
+      }
+
+      if (!paint6(p, direct_leaves, direct_children)) {
+        ::free(direct_leaves);
+        ::free(direct_children);
+
+        return false;
+      }
+    }
+  }
+
+  if (!direct_leaves) {
+    return true;
+  }
+
+  // Compress the trie (every uncompressed node becomes a node, with at most
+  // one run of leaves per entry).
+  bool ret = false;
+  if (((_M_direct = reinterpret_cast<uint32_t*>(malloc((1 << kDirectBits) * sizeof(uint32_t)))) != NULL) &&
+      ((_M_ntrie == 0) ||
+       (((_M_nodes = reinterpret_cast<struct node*>(malloc(_M_ntrie * sizeof(struct node)))) != NULL) &&
+        ((_M_leaves = reinterpret_cast<uint8_t*>(malloc(_M_ntrie * (1 << kStride)))) != NULL)))) {
+    ret = true;
+
+    for (unsigned i = 0; i < (1 << kDirectBits); i++) {
+      if (direct_children[i] < 0) {
+        _M_direct[i] = kLeafFlag | direct_leaves[i];
+      } else {
+        _M_direct[i] = _M_nnodes++;
+
+        if (!compress(direct_children[i], _M_direct[i])) {
+          ret = false;
+          break;
+        }
+      }
+    }
+  }
+
+  ::free(direct_leaves);
+  ::free(direct_children);
+
+  // The uncompressed trie is not needed anymore.
+  if (_M_trie) {
+    ::free(_M_trie);
+    _M_trie = NULL;
+  }
+
+  _M_ntrie = 0;
+  _M_trie_size = 0;
+
+  return ret;
+}
+
+int net::prefix_table::compare(const void* p1, const void* p2)
+{
+  const struct prefix* prefix1 = reinterpret_cast<const struct prefix*>(p1);
+  const struct prefix* prefix2 = reinterpret_cast<const struct prefix*>(p2);
+
+  if (prefix1->len != prefix2->len) {
+    return (prefix1->len < prefix2->len) ? -1 : 1;
+  }
+
+  return static_cast<int>(prefix1->value) - static_cast<int>(prefix2->value);
+}
+
+bool net::prefix_table::paint4(const struct prefix* p)
+{
+  uint32_t addr = (p->addr[0] << 24) | (p->addr[1] << 16) | (p->addr[2] << 8) | p->addr[3];
+
+  if (p->len <= 24) {
+    unsigned first = addr >> 8;
+    unsigned count = 1 << (24 - p->len);
+
+    for (unsigned i = first; i < first + count; i++) {
+      _M_tbl24[i] = (_M_tbl24[i] & ~p->mask) | p->value;
+    }
+
+    return true;
+  }
+
+  // Split the entry in a group of 256 entries.
+  uint16_t entry = _M_tbl24[addr >> 8];
+  if ((entry & kTbl8Flag) == 0) {
+    if (_M_ntbl8 == kMaxTbl8Groups) {
+      fprintf(stderr, "Too many IPv4 prefixes longer than /24.\n");
+      return false;
+    }
+
+    // Grow the groups by powers of two.
+    if ((_M_ntbl8 & (_M_ntbl8 - 1)) == 0) {
+      size_t size = (_M_ntbl8 == 0) ? 1 : _M_ntbl8 * 2;
+
+      uint8_t* tbl8;
+      if ((tbl8 = reinterpret_cast<uint8_t*>(realloc(_M_tbl8, size * 256))) == NULL) {
+        return false;
+      }
+
+      _M_tbl8 = tbl8;
+    }
+
+    memset(_M_tbl8 + (_M_ntbl8 * 256), entry, 256);
+
+    entry = kTbl8Flag | _M_ntbl8++;
+    _M_tbl24[addr >> 8] = entry;
+  }
+
+  uint8_t* group = _M_tbl8 + ((entry & ~kTbl8Flag) * 256);
+
+  unsigned first = addr & 0xff;
+  unsigned count = 1 << (32 - p->len);
+
+  for (unsigned i = first; i < first + count; i++) {
+    group[i] = (group[i] & ~p->mask) | p->value;
+  }
+
+  return true;
+}
+
+bool net::prefix_table::paint6(const struct prefix* p, uint8_t* direct_leaves, int32_t* direct_children)
+{
+  const uint8_t* addr = p->addr;
+  unsigned d = (addr[0] << 8) | addr[1];
+
+  if (p->len <= kDirectBits) {
+    unsigned count = 1 << (kDirectBits - p->len);
+
+    for (unsigned i = d; i < d + count; i++) {
+      direct_leaves[i] = (direct_leaves[i] & ~p->mask) | p->value;
+    }
+
+    return true;
+  }
+
+  int32_t t;
+  if ((t = direct_children[d]) < 0) {
+    if ((t = new_trie_node(direct_leaves[d])) < 0) {
+      return false;
+    }
+
+    direct_children[d] = t;
+  }
+
+  unsigned offset = kDirectBits;
+  while (p->len - offset > kStride) {
+    unsigned i = bits(addr, offset);
+
+    int32_t child;
+    if ((child = _M_trie[t].child[i]) < 0) {
+      if ((child = new_trie_node(_M_trie[t].leaf[i])) < 0) {
+        return false;
+      }
+
+      _M_trie[t].child[i] = child;
+    }
+
+    t = child;
+    offset += kStride;
+  }
+
+  unsigned count = 1 << (kStride - (p->len - offset));
+  unsigned first = bits(addr, offset);
+
+  for (unsigned i = first; i < first + count; i++) {
+    _M_trie[t].leaf[i] = (_M_trie[t].leaf[i] & ~p->mask) | p->value;
+  }
+
+  return true;
+}
+
+int32_t net::prefix_table::new_trie_node(uint8_t leaf)
+{
+  if (_M_ntrie == _M_trie_size) {
+    unsigned size = (_M_trie_size == 0) ? 256 : _M_trie_size * 2;
+
+    struct trie_node* trie;
+    if ((trie = reinterpret_cast<struct trie_node*>(realloc(_M_trie, size * sizeof(struct trie_node)))) == NULL) {
+      return -1;
+    }
+
+    _M_trie = trie;
+    _M_trie_size = size;
+  }
+
+  struct trie_node* t = &_M_trie[_M_ntrie];
+  memset(t->leaf, leaf, sizeof(t->leaf));
+  memset(t->child, 0xff, sizeof(t->child));
+
+  return _M_ntrie++;
+}
+
+bool net::prefix_table::compress(unsigned t, unsigned n)
+{
+  const struct trie_node* trie = &_M_trie[t];
+  struct node* node = &_M_nodes[n];
+
+  node->vector = 0;
+  node->leafvec = 0;
+  node->base0 = _M_nleaves;
+
+  // The leaves of the node, one per run of entries with the same value.
+  bool first = true;
+  uint8_t prev = 0;
+  for (unsigned i = 0; i < (1 << kStride); i++) {
+    if (trie->child[i] >= 0) {
+      node->vector |= static_cast<uint64_t>(1) << i;
+    } else if ((first) || (trie->leaf[i] != prev)) {
+      node->leafvec |= static_cast<uint64_t>(1) << i;
+      _M_leaves[_M_nleaves++] = trie->leaf[i];
+
+      prev = trie->leaf[i];
+      first = false;
+    }
+  }
+
+  // The children of the node are contiguous.
+  node->base1 = _M_nnodes;
+  _M_nnodes += __builtin_popcountll(node->vector);
+
+  unsigned base1 = node->base1;
+  for (unsigned i = 0, k = 0; i < (1 << kStride); i++) {
+    if (_M_trie[t].child[i] >= 0) {
+      if (!compress(_M_trie[t].child[i], base1 + k++)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
@@ -0,0 +1,206 @@
+#ifndef NET_PREFIX_TABLE_H
+#define NET_PREFIX_TABLE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+
+namespace net {
+  // Longest prefix match table of IPv4 and IPv6 prefixes. Every prefix
+  // paints a value into some bits of the entries of its addresses, the
+  // longest prefixes are painted last.
+  //
+  // IPv4: DIR-24-8, the first 24 bits of the address index a table of
+  // 2^24 entries, which is either the value or the index of a group of
+  // 256 entries for the last 8 bits (at most two memory reads).
+  //
+  // IPv6: poptrie, the first 16 bits of the address index a table of 2^16
+  // entries, which is either the value or the index of a node. Each node
+  // covers 6 bits of the address with two 64-bit vectors (children and
+  // runs of leaves), the children and the leaves of a node are stored
+  // contiguously and are indexed with popcount.
+  class prefix_table {
+    public:
+      // Constructor.
+      prefix_table();
+
+      // Destructor.
+      ~prefix_table();
+
+      // Free.
+      void free();
+
+      // Add prefix (e.g. "10.0.0.0/8", "2001:db8::/32" or an address). The
+      // bits of mask of the entries of the prefix are set to value.
+      bool add(const char* prefix, size_t len, uint8_t mask, uint8_t value);
+
+      // Load prefixes from a file (one per line, '#' starts a comment).
+      bool load(const char* filename, uint8_t mask, uint8_t value);
+
+      // Build the lookup tables.
+      bool build();
+
+      // Get number of prefixes.
+      size_t count() const;
+
+      // Look up IPv4 address (host byte order).
+      uint8_t lookup(uint32_t addr) const;
+
+      // Look up IPv6 address (16 bytes, network byte order).
+      uint8_t lookup(const uint8_t* addr) const;
+
+    private:
+      // Initial number of prefixes.
+      static const size_t kInitialPrefixes = 1024;
+
+      // IPv4.
+      static const unsigned kTbl24Size = 1 << 24;
+      static const uint16_t kTbl8Flag = 0x8000;
+      static const unsigned kMaxTbl8Groups = 0x8000;
+
+      // IPv6.
+      static const unsigned kDirectBits = 16;
+      static const unsigned kStride = 6;
+      static const uint32_t kLeafFlag = 0x80000000;
+
+      struct prefix {
+        uint8_t addr[16];
+        uint8_t len;
+        bool ipv6;
+        uint8_t mask;
+        uint8_t value;
+      };
+
+      struct prefix* _M_prefixes;
+      size_t _M_nprefixes;
+      size_t _M_size;
+
+      // IPv4: tbl24 (value or kTbl8Flag | group) and groups of 256 values.
+      uint16_t* _M_tbl24;
+      uint8_t* _M_tbl8;
+      unsigned _M_ntbl8;
+
+      // IPv6: direct table (kLeafFlag | value or node).
+      struct node {
+        uint64_t vector;  // Bit i: entry i is a child.
+        uint64_t leafvec; // Bit i: entry i starts a run of leaves.
+        uint32_t base0;   // First leaf.
+        uint32_t base1;   // First child.
+      };
+
+      uint32_t* _M_direct;
+      struct node* _M_nodes;
+      unsigned _M_nnodes;
+      uint8_t* _M_leaves;
+      unsigned _M_nleaves;
+
+      // Uncompressed node (only while building).
+      struct trie_node {
+        uint8_t leaf[1 << kStride];
+        int32_t child[1 << kStride];
+      };
+
+      struct trie_node* _M_trie;
+      unsigned _M_ntrie;
+      unsigned _M_trie_size;
+
+      // Compare prefixes (shortest first).
+      static int compare(const void* p1, const void* p2);
+
+      // Get the kStride bits of an IPv6 address at offset.
+      static unsigned bits(const uint8_t* addr, unsigned offset);
+
+      // Paint IPv4 prefix.
+      bool paint4(const struct prefix* p);
+
+      // Paint IPv6 prefix into the uncompressed trie.
+      bool paint6(const struct prefix* p, uint8_t* direct_leaves, int32_t* direct_children);
+
+      // New uncompressed node (all the leaves set to leaf).
+      int32_t new_trie_node(uint8_t leaf);
+
+      // Compress the uncompressed node into node n.
+      bool compress(unsigned t, unsigned n);
+
+      // Disable copy constructor and assignment operator.
+      prefix_table(const prefix_table&);
+      prefix_table& operator=(const prefix_table&);
+  };
+
+  inline prefix_table::prefix_table()
+    : _M_prefixes(NULL),
+      _M_nprefixes(0),
+      _M_size(0),
+      _M_tbl24(NULL),
+      _M_tbl8(NULL),
+      _M_ntbl8(0),
+      _M_direct(NULL),
+      _M_nodes(NULL),
+      _M_nnodes(0),
+      _M_leaves(NULL),
+      _M_nleaves(0),
+      _M_trie(NULL),
+      _M_ntrie(0),
+      _M_trie_size(0)
+  {
+  }
+
+  inline prefix_table::~prefix_table()
+  {
+    free();
+  }
+
+  inline size_t prefix_table::count() const
+  {
+    return _M_nprefixes;
+  }
+
+  inline uint8_t prefix_table::lookup(uint32_t addr) const
+  {
+    if (!_M_tbl24) {
+      return 0;
+    }
+
+    uint16_t entry = _M_tbl24[addr >> 8];
+    if ((entry & kTbl8Flag) == 0) {
+      return static_cast<uint8_t>(entry);
+    }
+
+    return _M_tbl8[((entry & ~kTbl8Flag) << 8) | (addr & 0xff)];
+  }
+
+  inline unsigned prefix_table::bits(const uint8_t* addr, unsigned offset)
+  {
+    unsigned i = offset / 8;
+    unsigned word = (addr[i] << 8) | ((i < 15) ? addr[i + 1] : 0);
+    return (word >> (16 - kStride - (offset % 8))) & ((1 << kStride) - 1);
+  }
+
+  inline uint8_t prefix_table::lookup(const uint8_t* addr) const
+  {
+    if (!_M_direct) {
+      return 0;
+    }
+
+    uint32_t entry = _M_direct[(addr[0] << 8) | addr[1]];
+    if ((entry & kLeafFlag) != 0) {
+      return static_cast<uint8_t>(entry);
+    }
+
+    const struct node* n = &_M_nodes[entry];
+    unsigned offset = kDirectBits;
+
+    do {
+      uint64_t bit = static_cast<uint64_t>(1) << bits(addr, offset);
+      uint64_t below = (bit << 1) - 1; // Bits up to and including bit.
+
+      if ((n->vector & bit) == 0) {
+        return _M_leaves[n->base0 + __builtin_popcountll(n->leafvec & below) - 1];
+      }
+
+      n = &_M_nodes[n->base1 + __builtin_popcountll(n->vector & below) - 1];
+      offset += kStride;
+    } while (true);
+  }
+}
+
+#endif // NET_PREFIX_TABLE_H
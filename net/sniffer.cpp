@@ -1,17 +1,22 @@
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <poll.h>
 #include <errno.h>
 #include <sys/mman.h>
+#include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#include <arpa/inet.h>
 #include <netinet/tcp.h>
 #include <netinet/udp.h>
 #include "net/sniffer.h"
 #include "fs/file.h"
+#include "fs/path.h"
+#include "macros/macros.h"
 
 net::sniffer::sniffer()
 {
@@ -23,15 +28,79 @@ net::sniffer::sniffer()
 
   _M_idx = 0;
 
-  _M_npackets = 0;
+  memset(&_M_stats, 0, sizeof(struct statistics));
+
+  _M_kernel_filter = false;
+
+  _M_use_expression = false;
+
+  _M_decapsulate = false;
 
   _M_max_pcap_filesize = 0;
+  _M_flight_recorder = false;
+
+  _M_use_segment = false;
+
+  _M_use_triggers = false;
+
+  _M_use_dedup = false;
+
+  _M_use_sampler = false;
+
+  _M_use_cutoff = false;
+
+  _M_use_shedder = false;
+  _M_use_low_priority = false;
+
+  _M_rotate = false;
+
+  _M_use_direct = false;
 
   _M_running = false;
+
+  _M_live_statistics = false;
+  memset(&_M_live, 0, sizeof(struct live_statistics));
+
+#ifdef HAVE_TPACKET_V3
+  _M_batches = NULL;
+
+  _M_use_writer = false;
+  _M_writer_running = false;
+  _M_writer_ret = true;
+
+  _M_queued = 0;
+  _M_released = 0;
+
+  _M_use_uring = false;
+  _M_writes = NULL;
+  _M_nfree_writes = 0;
+
+  _M_batch_writes = false;
+  _M_records = NULL;
+
+  _M_batch_filter = false;
+
+  _M_track_occupancy = false;
+  _M_ready = 0;
+#endif // HAVE_TPACKET_V3
 }
 
 net::sniffer::~sniffer()
 {
+#ifdef HAVE_TPACKET_V3
+  if (_M_records) {
+    free(_M_records);
+  }
+
+  if (_M_writes) {
+    free(_M_writes);
+  }
+
+  if (_M_batches) {
+    free(_M_batches);
+  }
+#endif // HAVE_TPACKET_V3
+
   if (_M_buf != MAP_FAILED) {
     munmap(_M_buf, _M_ring_size);
   }
@@ -45,8 +114,11 @@ net::sniffer::~sniffer()
   }
 }
 
-bool net::sniffer::create(const char* interface, const char* pathname, size_t ring_size, size_t max_pcap_filesize)
+bool net::sniffer::create(const char* interface, const char* pathname, const options& opts)
 {
+  size_t ring_size = opts.ring_size;
+  size_t max_pcap_filesize = opts.max_pcap_filesize;
+
   // Sanity checks.
   if ((ring_size < kMinRingSize) || (ring_size > kMaxRingSize)) {
     return false;
@@ -116,28 +188,264 @@ bool net::sniffer::create(const char* interface, const char* pathname, size_t ri
     return false;
   }
 
+  // Compile expression.
+  if (opts.expression) {
+    if (!_M_expression.parse(opts.expression)) {
+      fprintf(stderr, "Invalid expression (%s).\n", opts.expression);
+      return false;
+    }
+
+    _M_use_expression = true;
+  }
+
+  _M_decapsulate = opts.decapsulate;
+
+  // Drop the duplicate packets?
+  if (opts.dedup_window > 0) {
+    if (!_M_dedup.create(opts.dedup_window)) {
+      return false;
+    }
+
+    _M_use_dedup = true;
+  }
+
+  // Sample the flows?
+  if (opts.sample_rate > 0) {
+    _M_sampler.rate(opts.sample_rate);
+    _M_use_sampler = true;
+  }
+
+  // Load shedding.
+  if (opts.load_shedding) {
+#ifdef HAVE_TPACKET_V3
+    // The level changes are logged next to the capture file.
+    char log[PATH_MAX];
+    if (snprintf(log, sizeof(log), "%s.shed", pathname) >= static_cast<int>(sizeof(log))) {
+      return false;
+    }
+
+    if (!_M_shedder.create(opts.watermarks, log)) {
+      return false;
+    }
+
+    _M_shed_sampler.rate(net::load_shedder::kSampleRate);
+
+    if (opts.low_priority) {
+      if (!_M_low_priority.parse(opts.low_priority)) {
+        fprintf(stderr, "Invalid low-priority filter (%s).\n", opts.low_priority);
+        return false;
+      }
+
+      _M_use_low_priority = true;
+    }
+
+    _M_use_shedder = true;
+#else
+    fprintf(stderr, "The load shedding requires TPACKET_V3.\n");
+    return false;
+#endif
+  }
+
+  // Create the flow table of the cutoff.
+  if (opts.flow_cutoff > 0) {
+    if (!_M_cutoff.create(opts.flow_cutoff, opts.max_flows)) {
+      fprintf(stderr, "Couldn't create the flow table of the cutoff (%lu flows).\n", opts.max_flows);
+      return false;
+    }
+
+    _M_use_cutoff = true;
+  }
+
+  _M_live_statistics = opts.live_statistics;
+
+#ifdef HAVE_TPACKET_V3
+  _M_track_occupancy = ((_M_use_shedder) || (_M_live_statistics));
+#endif
+
+  // Attach filter before setting up the ring, so that the packets which
+  // don't match never make it to the ring. The BPF program only sees the
+  // outer headers, if the tunnels are decapsulated only the snap length
+  // can be applied by the kernel.
+  if ((opts.kernel_filter) &&
+      ((_M_filter.have_filter()) || (_M_filter.snaplen() < net::filter::kMaxSnaplen)) &&
+      ((!_M_decapsulate) || (!_M_filter.have_filter()))) {
+    if (attach_filter()) {
+      _M_kernel_filter = true;
+    } else {
+      fprintf(stderr, "Couldn't attach filter to the socket, filtering in user space.\n");
+    }
+  }
+
+#if defined(HAVE_TPACKET_V3) && !DEBUG_TRAFFIC
+  // Filter the packets of each block in batches (the keys are the
+  // protocols and ports).
+  _M_batch_filter = ((!_M_kernel_filter) && (_M_filter.have_ports()));
+#endif
+
   // Setup packet ring.
-  if (!setup_packet_ring(ring_size)) {
+  uint16_t snaplen = _M_filter.max_snaplen();
+  if (!setup_packet_ring(ring_size, snaplen)) {
+    return false;
+  }
+
+  _M_pcap_file.snaplen(snaplen);
+
+#ifdef HAVE_TPACKET_V3
+  // With a writer thread, every block of the ring might be waiting to be
+  // written.
+  size_t nbatches = 1;
+  if (opts.writer_thread) {
+    if (!_M_queue.create(_M_nblocks)) {
+      return false;
+    }
+
+    _M_use_writer = true;
+    _M_stats.ring_blocks = _M_nblocks;
+
+    nbatches = _M_nblocks;
+  }
+
+  // With io_uring, every block being written needs its batch.
+  if (opts.output == kUringOutput) {
+    if ((opts.writer_thread) ||
+        (max_pcap_filesize > 0) ||
+        (opts.rotate_filesize > 0) ||
+        (opts.rotate_seconds > 0)) {
+      fprintf(stderr, "The io_uring output cannot be combined with -W, -m, -C or -G.\n");
+      return false;
+    }
+
+    nbatches = kUringDepth;
+  }
+
+  if ((_M_batches = reinterpret_cast<struct batch*>(malloc(nbatches * sizeof(struct batch)))) == NULL) {
+    return false;
+  }
+#else
+  if (opts.writer_thread) {
+    fprintf(stderr, "The writer thread requires TPACKET_V3.\n");
     return false;
   }
 
-  if (max_pcap_filesize == 0) {
+  if (opts.output == kUringOutput) {
+    fprintf(stderr, "The io_uring output requires TPACKET_V3.\n");
+    return false;
+  }
+#endif // HAVE_TPACKET_V3
+
+  if (opts.output == kUringOutput) {
+#ifdef HAVE_TPACKET_V3
+    if (!setup_uring(pathname)) {
+      return false;
+    }
+#endif // HAVE_TPACKET_V3
+  } else if (opts.output == kDirectOutput) {
+    if ((max_pcap_filesize > 0) || (opts.rotate_filesize > 0) || (opts.rotate_seconds > 0)) {
+      fprintf(stderr, "The O_DIRECT output cannot be combined with -m, -C or -G.\n");
+      return false;
+    }
+
+    if (!_M_direct_file.create(opts.direct_buffer_size, fs::direct_file::kDefaultBuffers)) {
+      fprintf(stderr, "Couldn't allocate the buffers of the O_DIRECT output.\n");
+      return false;
+    }
+
+    const struct net::pcap_file::pcap_hdr_t& hdr = _M_pcap_file.header();
+
+    if ((!_M_direct_file.open(pathname, 0644)) ||
+        (_M_direct_file.write(&hdr, sizeof(struct net::pcap_file::pcap_hdr_t)) < 0)) {
+      fprintf(stderr, "Couldn't open capture file %s for writing with O_DIRECT.\n", pathname);
+      return false;
+    }
+
+    _M_direct_file.latency(&_M_latencies[kOutputLatency]);
+
+    _M_use_direct = true;
+  } else if ((opts.rotate_filesize > 0) || (opts.rotate_seconds > 0)) {
+    if (max_pcap_filesize > 0) {
+      fprintf(stderr, "File rotation cannot be combined with a maximum capture file size.\n");
+      return false;
+    }
+
+    if (!_M_rotator.create(pathname,
+                           snaplen,
+                           opts.rotate_filesize,
+                           opts.rotate_seconds,
+                           opts.max_files,
+                           opts.quota)) {
+      fprintf(stderr, "Couldn't open capture file %s for writing.\n", pathname);
+      return false;
+    }
+
+    _M_rotator.latency(&_M_latencies[kOutputLatency]);
+
+    _M_rotate = true;
+  } else if (max_pcap_filesize == 0) {
     // Open capture file (unlimited file size).
     if (!_M_pcap_file.open(pathname)) {
       fprintf(stderr, "Couldn't open capture file %s for writing.\n", pathname);
       return false;
     }
+
+    _M_pcap_file.latency(&_M_latencies[kOutputLatency]);
+
+    // With a memory mapped file, writing a packet doesn't need a system
+    // call.
+#if defined(HAVE_TPACKET_V3) && !defined(USE_OMEMFILE)
+    if ((_M_records = reinterpret_cast<struct records*>(malloc(sizeof(struct records)))) == NULL) {
+      return false;
+    }
+
+    _M_batch_writes = true;
+#endif
   } else {
-    if (!_M_pkts.allocate(max_pcap_filesize)) {
+    // The triggers need the packets in a ring.
+    _M_flight_recorder = ((opts.flight_recorder) || (opts.triggers));
+
+    if (opts.segment_dir) {
+      if (_M_flight_recorder) {
+        fprintf(stderr, "The flight recorder and the triggers cannot use a segment.\n");
+        return false;
+      }
+
+      if (!create_segment(opts.segment_dir, pathname, max_pcap_filesize, opts.memory_flags)) {
+        return false;
+      }
+    } else if (!allocate_memory(max_pcap_filesize, opts.memory_flags)) {
+      if (_M_flight_recorder) {
 #if __WORDSIZE == 64
-      fprintf(stderr, "Couldn't preallocate %llu bytes for the capture file.\n", max_pcap_filesize);
+        fprintf(stderr, "Couldn't preallocate %llu bytes for the flight recorder.\n", max_pcap_filesize);
 #else
-      fprintf(stderr, "Couldn't preallocate %u bytes for the capture file.\n", max_pcap_filesize);
+        fprintf(stderr, "Couldn't preallocate %u bytes for the flight recorder.\n", max_pcap_filesize);
 #endif
+      } else {
+#if __WORDSIZE == 64
+        fprintf(stderr, "Couldn't preallocate %llu bytes for the capture file.\n", max_pcap_filesize);
+#else
+        fprintf(stderr, "Couldn't preallocate %u bytes for the capture file.\n", max_pcap_filesize);
+#endif
+      }
 
       return false;
     }
 
+    if (opts.triggers) {
+      if (!_M_trigger.parse(opts.triggers)) {
+        fprintf(stderr, "Invalid trigger list (%s).\n", opts.triggers);
+        return false;
+      }
+
+      if (!_M_trigger_recorder.create(pathname,
+                                      snaplen,
+                                      &_M_recorder,
+                                      opts.trigger_before,
+                                      opts.trigger_after)) {
+        return false;
+      }
+
+      _M_use_triggers = true;
+    }
+
     // Save pathname.
     memcpy(_M_pathname, pathname, pathnamelen + 1);
 
@@ -156,6 +464,18 @@ bool net::sniffer::create(const char* interface, const char* pathname, size_t ri
     return false;
   }
 
+  // Join fanout group (if any).
+  if (opts.fanout_id >= 0) {
+    if (!join_fanout_group(opts.fanout_id, opts.fanout_mode)) {
+      perror("setsockopt");
+      return false;
+    }
+  }
+
+  // Set before the capture thread starts, so that a stop() which comes
+  // before start() is not lost.
+  _M_running = true;
+
   return true;
 }
 
@@ -166,32 +486,158 @@ bool net::sniffer::start()
   pfd.events = POLLIN | POLLRDNORM | POLLERR;
   pfd.revents = 0;
 
-  _M_running = true;
+#ifdef HAVE_TPACKET_V3
+  if ((_M_use_writer) && (!start_writer())) {
+    return false;
+  }
+#endif // HAVE_TPACKET_V3
+
   do {
+#ifdef HAVE_TPACKET_V3
+    // Release the blocks which have been written (if all the writes are
+    // in flight, wait for one of them).
+    if ((_M_use_uring) && (!reap_writes(_M_nfree_writes == 0))) {
+      _M_running = false;
+      break;
+    }
+
+    // If all the blocks are being held by the writer thread...
+    if ((_M_use_writer) && (ring_held())) {
+      // Wait.
+      usleep(kIdleSleep);
+      continue;
+    }
+#endif // HAVE_TPACKET_V3
+
     // While we don't have a new packet...
     if (!have_new_packet()) {
+#ifdef HAVE_TPACKET_V3
+      // Let the load shedding restore the capture while the ring is empty.
+      if (_M_use_shedder) {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+
+        _M_shedder.idle(occupancy(), tv.tv_sec, tv.tv_usec);
+      }
+#endif // HAVE_TPACKET_V3
+
+      // The writer backlog keeps draining.
+      if (_M_live_statistics) {
+        publish();
+      }
+
       // Wait.
-      poll(&pfd, 1, -1);
+      poll(&pfd, 1, kPollTimeout);
       continue;
     }
 
+#ifdef HAVE_TPACKET_V3
+    record_handoff();
+
+    uint64_t start = util::tsc::read();
+#endif
+
     // Process packet(s).
     if (!process_packets()) {
       _M_running = false;
       break;
     }
 
-    // Mark block/frame as free.
+#ifdef HAVE_TPACKET_V3
+    _M_latencies[kBlockLatency].record(util::tsc::nanoseconds(util::tsc::read() - start));
+#endif
+
+#ifdef HAVE_TPACKET_V3
+    if (_M_use_writer) {
+      // The writer thread will mark the block as free.
+      enqueue_block();
+    } else if (_M_use_uring) {
+      // The block will be marked as free when its write completes.
+      if (!submit_block()) {
+        _M_running = false;
+        break;
+      }
+    } else {
+      // Mark block as free.
+      mark_as_free();
+    }
+#else
+    // Mark frame as free.
     mark_as_free();
+#endif
+
+    if (_M_live_statistics) {
+      publish();
+    }
 
     _M_idx = (_M_idx + 1) % _M_max_idx;
-  } while (_M_running);
+  } while (__atomic_load_n(&_M_running, __ATOMIC_RELAXED));
 
-#if SHOW_STATISTICS
-  show_statistics();
-#endif
+#ifdef HAVE_TPACKET_V3
+  if (_M_use_writer) {
+    stop_writer();
+
+    // Has the writer thread failed to write a block?
+    if (!_M_writer_ret) {
+      fprintf(stderr, "Couldn't write packets to the capture file.\n");
+      return false;
+    }
+  }
+
+  if (_M_use_uring) {
+    bool ret = drain_writes();
+
+    if ((!_M_uring_file.close()) || (!ret)) {
+      fprintf(stderr, "Couldn't write packets to the capture file.\n");
+      return false;
+    }
+  }
+#endif // HAVE_TPACKET_V3
+
+  if (_M_use_direct) {
+    bool ret = _M_direct_file.close();
+
+    const struct fs::direct_file::statistics& stats = _M_direct_file.stats();
+    _M_stats.direct_writes = stats.writes;
+    _M_stats.direct_write_time_sum = stats.write_time_sum;
+    _M_stats.max_direct_write_time = stats.max_write_time;
+    _M_stats.direct_stalls = stats.stalls;
 
-  if (_M_max_pcap_filesize > 0) {
+    if (!ret) {
+      fprintf(stderr, "Couldn't write packets to the capture file.\n");
+      return false;
+    }
+  } else if (_M_rotate) {
+    bool ret = _M_rotator.close();
+
+    _M_stats.files = _M_rotator.stats().files;
+    _M_stats.late_rotations = _M_rotator.stats().late_rotations;
+    _M_stats.deleted_files = _M_rotator.stats().deleted_files;
+
+    if (!ret) {
+      fprintf(stderr, "Couldn't close the capture file.\n");
+      return false;
+    }
+  } else if (_M_use_triggers) {
+    // Only the capture windows are written.
+    _M_trigger_recorder.stop();
+
+    const struct net::trigger_recorder::statistics& stats = _M_trigger_recorder.stats();
+    _M_stats.triggers = stats.triggers;
+    _M_stats.trigger_windows = stats.windows;
+    _M_stats.trigger_packets = stats.packets;
+    _M_stats.trigger_overruns = stats.overruns;
+  } else if (_M_flight_recorder) {
+    if (_M_pcap_file.write_packets(_M_pathname, _M_recorder) < 0) {
+      fprintf(stderr, "Couldn't write packets to the capture file %s.\n", _M_pathname);
+      return false;
+    }
+  } else if (_M_use_segment) {
+    if (!_M_segment.save(_M_pathname)) {
+      fprintf(stderr, "Couldn't move the segment to the capture file %s.\n", _M_pathname);
+      return false;
+    }
+  } else if (_M_max_pcap_filesize > 0) {
     if (!_M_pcap_file.write_packets(_M_pathname, _M_pkts)) {
       fprintf(stderr, "Couldn't write packets to the capture file %s.\n", _M_pathname);
       return false;
@@ -204,6 +650,8 @@ bool net::sniffer::start()
 #ifdef HAVE_TPACKET_V2
   bool net::sniffer::get_header_length()
   {
+    // PACKET_HDRLEN takes the version and returns its header length.
+    _M_hdrlen = TPACKET_V2;
     socklen_t optlen = sizeof(_M_hdrlen);
     return (getsockopt(_M_fd, SOL_PACKET, PACKET_HDRLEN, &_M_hdrlen, &optlen) == 0);
   }
@@ -215,10 +663,10 @@ bool net::sniffer::set_packet_version(tpacket_versions version)
   return (setsockopt(_M_fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(int)) == 0);
 }
 
-bool net::sniffer::setup_packet_ring(size_t ring_size)
+bool net::sniffer::setup_packet_ring(size_t ring_size, size_t snaplen)
 {
-  // Calculate frame size.
-  _M_frame_size = TPACKET_ALIGN(TPACKET_HDRLEN) + TPACKET_ALIGN(ETH_DATA_LEN);
+  // Calculate frame size (big enough for the biggest snap length).
+  _M_frame_size = TPACKET_ALIGN(TPACKET_HDRLEN) + TPACKET_ALIGN(MIN(ETH_FRAME_LEN, snaplen));
   size_t n;
   for (n = 8; n < _M_frame_size; n *= 2);
   _M_frame_size = n;
@@ -269,6 +717,22 @@ bool net::sniffer::setup_packet_ring(size_t ring_size)
 #endif
 }
 
+bool net::sniffer::join_fanout_group(int id, int mode)
+{
+  int val = (id & 0xffff) | (mode << 16);
+  return (setsockopt(_M_fd, SOL_PACKET, PACKET_FANOUT, &val, sizeof(int)) == 0);
+}
+
+bool net::sniffer::attach_filter()
+{
+  bpf_program program;
+  if (!_M_filter.compile(program)) {
+    return false;
+  }
+
+  return (setsockopt(_M_fd, SOL_SOCKET, SO_ATTACH_FILTER, program.fprog(), sizeof(struct sock_fprog)) == 0);
+}
+
 bool net::sniffer::allocate_frames(size_t num, size_t size)
 {
   if ((_M_frames = reinterpret_cast<struct iovec*>(malloc(num * sizeof(struct iovec)))) == NULL) {
@@ -285,127 +749,557 @@ bool net::sniffer::allocate_frames(size_t num, size_t size)
   return true;
 }
 
+bool net::sniffer::allocate_memory(size_t size, unsigned flags)
+{
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  do {
+    if (_M_flight_recorder ? _M_recorder.create(size, flags) : _M_pkts.map(size, flags)) {
+      break;
+    }
+
+    // There might not be enough huge pages reserved.
+    if ((flags & string::buffer::kHugePages) == 0) {
+      return false;
+    }
+
+    fprintf(stderr, "Couldn't allocate huge pages, using transparent huge pages.\n");
+
+    flags = (flags & ~string::buffer::kHugePages) | string::buffer::kTransparentHugePages;
+  } while (true);
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  bool locked = _M_flight_recorder ? _M_recorder.locked() : _M_pkts.locked();
+
+  fprintf(stderr,
+          "%llu MB preallocated and pre-faulted in %.3f seconds%s.\n",
+          static_cast<unsigned long long>(size / (1024 * 1024)),
+          (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1000000000.0),
+          ((flags & string::buffer::kLock) && (!locked)) ? " (couldn't lock the memory)" : "");
+
+  return true;
+}
+
+bool net::sniffer::create_segment(const char* dir, const char* pathname, size_t size, unsigned flags)
+{
+  // <dir>/<basename>.<pid>.seg
+  const char* base;
+  if ((base = strrchr(pathname, '/')) != NULL) {
+    base++;
+  } else {
+    base = pathname;
+  }
+
+  char segment[PATH_MAX];
+  if (snprintf(segment, sizeof(segment), "%s/%s.%d.seg", dir, base, getpid()) >= static_cast<int>(sizeof(segment))) {
+    return false;
+  }
+
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (!_M_segment.create(segment, size, _M_pcap_file.header(), (flags & string::buffer::kLock) != 0)) {
+    fprintf(stderr, "Couldn't create segment %s.\n", segment);
+    return false;
+  }
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  fprintf(stderr,
+          "%llu MB preallocated in segment %s in %.3f seconds.\n",
+          static_cast<unsigned long long>(size / (1024 * 1024)),
+          segment,
+          (end.tv_sec - start.tv_sec) + ((end.tv_nsec - start.tv_nsec) / 1000000000.0));
+
+  _M_use_segment = true;
+
+  return true;
+}
+
 #ifdef HAVE_TPACKET_V3
   bool net::sniffer::walk_block()
   {
-    _M_hdr = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(_M_block_desc) + _M_block_desc->bh1.offset_to_first_pkt);
+    struct batch* batch;
+    if (_M_use_writer) {
+      batch = &_M_batches[_M_idx];
+    } else if (_M_use_uring) {
+      batch = &_M_batches[_M_free_writes[_M_nfree_writes - 1]];
+    } else {
+      batch = &_M_batches[0];
+    }
+    unsigned npackets = 0;
 
-    uint32_t num_pkts = _M_block_desc->bh1.num_pkts;
-    for (uint32_t i = 0; i < num_pkts; i++) {
-      // IP packet?
-      const struct ethhdr* eth;
-      eth = reinterpret_cast<const struct ethhdr*>(reinterpret_cast<const uint8_t*>(_M_hdr) + _M_hdr->tp_mac);
-      if (eth->h_proto == htons(ETH_P_IP)) {
-        if (!process_ip_packet(eth, _M_hdr->tp_snaplen)) {
-          return false;
+    if (_M_track_occupancy) {
+      unsigned occupancy = this->occupancy();
+
+      // Update the level of the load shedding.
+      if (_M_use_shedder) {
+        _M_shedder.update(occupancy,
+                          _M_block_desc->bh1.ts_first_pkt.ts_sec,
+                          _M_block_desc->bh1.ts_first_pkt.ts_nsec / 1000);
+      }
+
+      if (_M_live_statistics) {
+        raise_max_occupancy(occupancy);
+      }
+
+      // The current block is not ahead anymore.
+      _M_ready--;
+    }
+
+    if (_M_batch_filter) {
+      npackets = filter_block(batch);
+    } else {
+      uint32_t offset = _M_block_desc->bh1.offset_to_first_pkt;
+
+      uint32_t num_pkts = _M_block_desc->bh1.num_pkts;
+      for (uint32_t i = 0; i < num_pkts; i++) {
+        _M_hdr = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(_M_block_desc) + offset);
+
+        uint16_t len;
+        if ((len = caplen(_M_hdr)) != 0) {
+          batch->packets[npackets].offset = offset;
+          batch->packets[npackets].caplen = len;
+
+          npackets++;
         }
-      } else if (!_M_filter.have_filter()) {
-        if (!write_packet(eth, _M_hdr->tp_snaplen)) {
-          return false;
+
+        offset += _M_hdr->tp_next_offset;
+      }
+    }
+
+    batch->npackets = npackets;
+
+    // If there is a writer thread or io_uring is being used, the packets
+    // will be written later.
+    return ((_M_use_writer) || (_M_use_uring)) ? true : write_batch(_M_block_desc, batch);
+  }
+
+  unsigned net::sniffer::occupancy()
+  {
+    size_t held = this->held();
+
+    // The held blocks are behind _M_idx, only look for ready blocks in
+    // front of it (without walking again the ones already known).
+    size_t limit = _M_max_idx - held;
+    while (_M_ready < limit) {
+      const struct block_desc* block_desc;
+      block_desc = reinterpret_cast<const struct block_desc*>(_M_frames[(_M_idx + _M_ready) % _M_max_idx].iov_base);
+
+      if ((__atomic_load_n(&block_desc->bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+        break;
+      }
+
+      _M_ready++;
+    }
+
+    return ((_M_ready + held) * 100) / _M_max_idx;
+  }
+
+  unsigned net::sniffer::filter_block(struct batch* batch)
+  {
+    uint8_t* block = reinterpret_cast<uint8_t*>(_M_block_desc);
+    unsigned npackets = 0;
+
+    uint32_t offset = _M_block_desc->bh1.offset_to_first_pkt;
+
+    uint32_t num_pkts = _M_block_desc->bh1.num_pkts;
+    _M_stats.ring_packets += num_pkts;
+
+    for (uint32_t first = 0; first < num_pkts; first += net::filter::kBatchSize) {
+      unsigned count = MIN(num_pkts - first, net::filter::kBatchSize);
+
+      // Gather the offsets of the packets and prefetch their transport
+      // headers.
+      for (unsigned i = 0; i < count; i++) {
+        const struct tpacket3_hdr* hdr = reinterpret_cast<const struct tpacket3_hdr*>(block + offset);
+        __builtin_prefetch(reinterpret_cast<const uint8_t*>(hdr) + hdr->tp_mac + ETH_HLEN + sizeof(struct iphdr));
+
+        _M_offsets[i] = offset;
+        offset += hdr->tp_next_offset;
+
+        _M_stats.ring_bytes += hdr->tp_len;
+      }
+
+      // Extract the keys of the packets.
+      for (unsigned i = 0; i < count; i++) {
+        extract(reinterpret_cast<const struct tpacket3_hdr*>(block + _M_offsets[i]), i);
+      }
+
+      _M_filter.match(_M_keys, count);
+
+      // Keep the packets which match (and match the VLAN IDs, the addresses
+      // and the expression).
+      for (unsigned i = 0; i < count; i++) {
+        if (_M_keys.snaplen[i] != 0) {
+          const struct tpacket3_hdr* hdr = reinterpret_cast<const struct tpacket3_hdr*>(block + _M_offsets[i]);
+
+          if ((!_M_filter.match_headers(_M_headers[i])) ||
+              ((_M_use_expression) && (!_M_expression.match(_M_headers[i])))) {
+            continue;
+          }
+
+          uint16_t len;
+          if ((len = caplen(hdr, _M_headers[i], _M_keys.snaplen[i])) == 0) {
+            continue;
+          }
+
+          batch->packets[npackets].offset = _M_offsets[i];
+          batch->packets[npackets].caplen = len;
+
+          npackets++;
         }
       }
+    }
 
-      _M_hdr = reinterpret_cast<struct tpacket3_hdr*>(reinterpret_cast<uint8_t*>(_M_hdr) + _M_hdr->tp_next_offset);
+    return npackets;
+  }
+
+  bool net::sniffer::write_batch(const struct block_desc* block_desc, const struct batch* batch)
+  {
+    if (_M_batch_writes) {
+      if (batch->npackets == 0) {
+        return true;
+      }
+
+      // Write the whole block at once.
+      unsigned iovcnt = fill_records(block_desc, batch, _M_records);
+
+      int ncalls;
+      if ((ncalls = _M_pcap_file.write_records(_M_records->iov, iovcnt)) < 0) {
+        return false;
+      }
+
+      _M_stats.written_blocks++;
+      _M_stats.write_calls += ncalls;
+
+      return true;
+    }
+
+    for (unsigned i = 0; i < batch->npackets; i++) {
+      const struct packet* pkt = &batch->packets[i];
+
+      const struct tpacket3_hdr* hdr;
+      hdr = reinterpret_cast<const struct tpacket3_hdr*>(reinterpret_cast<const uint8_t*>(block_desc) + pkt->offset);
+
+      if (!write_packet(hdr, pkt->caplen)) {
+        return false;
+      }
     }
 
     return true;
   }
-#else
-  bool net::sniffer::process_frame()
+
+  void net::sniffer::enqueue_block()
   {
-    // IP packet?
-    const struct ethhdr* eth;
-    eth = reinterpret_cast<const struct ethhdr*>(reinterpret_cast<const uint8_t*>(_M_hdr) + _M_hdr->tp_mac);
-    if (eth->h_proto == htons(ETH_P_IP)) {
-      return process_ip_packet(eth, _M_hdr->tp_snaplen);
-    } else if (!_M_filter.have_filter()) {
-      return write_packet(eth, _M_hdr->tp_snaplen);
+    size_t depth = _M_queued - __atomic_load_n(&_M_released, __ATOMIC_ACQUIRE);
+
+    _M_stats.queued_blocks++;
+    _M_stats.queue_depth_sum += depth;
+    if (depth > _M_stats.max_queue_depth) {
+      _M_stats.max_queue_depth = depth;
     }
 
-    return true;
+    _M_batches[_M_idx].timestamp = now();
+
+    // The queue has room for all the blocks of the ring.
+    _M_queue.push(_M_idx);
+    _M_queued++;
   }
-#endif
 
-bool net::sniffer::process_ip_packet(const struct ethhdr* eth, size_t ethlen)
-{
-  if (ethlen < ETH_HLEN + sizeof(struct iphdr)) {
+  bool net::sniffer::start_writer()
+  {
+    _M_writer_ret = true;
+    _M_writer_running = true;
+
+    if (pthread_create(&_M_writer, NULL, writer, this) != 0) {
+      _M_writer_running = false;
+      return false;
+    }
+
     return true;
   }
 
-  const uint8_t* pkt = reinterpret_cast<const uint8_t*>(eth);
-  const struct iphdr* ip_header = reinterpret_cast<const struct iphdr*>(pkt + ETH_HLEN);
-  size_t iphdrlen = ip_header->ihl * 4;
-  size_t iplen = ethlen - ETH_HLEN;
-  if (iplen < iphdrlen) {
-    return true;
+  void net::sniffer::stop_writer()
+  {
+    // The writer thread writes the pending blocks before exiting.
+    __atomic_store_n(&_M_writer_running, false, __ATOMIC_RELEASE);
+
+    pthread_join(_M_writer, NULL);
+  }
+
+  void* net::sniffer::writer(void* arg)
+  {
+    reinterpret_cast<net::sniffer*>(arg)->write_blocks();
+    return NULL;
+  }
+
+  void net::sniffer::write_blocks()
+  {
+    do {
+      // Check whether the capture thread has finished before checking the
+      // queue, so that no block is left behind.
+      bool running = __atomic_load_n(&_M_writer_running, __ATOMIC_ACQUIRE);
+
+      unsigned idx;
+      if (_M_queue.pop(idx)) {
+        struct block_desc* block_desc = reinterpret_cast<struct block_desc*>(_M_frames[idx].iov_base);
+        struct batch* batch = &_M_batches[idx];
+
+        // After an error, the blocks are released without being written.
+        if ((_M_writer_ret) && (!write_batch(block_desc, batch))) {
+          _M_writer_ret = false;
+          stop();
+        }
+
+        uint64_t hold_time = now() - batch->timestamp;
+        _M_stats.hold_time_sum += hold_time;
+        if (hold_time > _M_stats.max_hold_time) {
+          _M_stats.max_hold_time = hold_time;
+        }
+
+        // Give the block back to the kernel.
+        __atomic_store_n(&block_desc->bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+        __atomic_store_n(&_M_released, _M_released + 1, __ATOMIC_RELEASE);
+      } else if (!running) {
+        return;
+      } else {
+        usleep(kIdleSleep);
+      }
+    } while (true);
+  }
+
+  unsigned net::sniffer::fill_records(const struct block_desc* block_desc,
+                                      const struct batch* batch,
+                                      struct records* records)
+  {
+    struct iovec* iov = records->iov;
+
+    for (unsigned i = 0; i < batch->npackets; i++) {
+      const struct packet* pkt = &batch->packets[i];
+
+      const struct tpacket3_hdr* hdr;
+      hdr = reinterpret_cast<const struct tpacket3_hdr*>(reinterpret_cast<const uint8_t*>(block_desc) + pkt->offset);
+
+      struct net::pcap_file::pcaprec_hdr_t* rec = &records->hdrs[i];
+      rec->tv.ts_sec = hdr->tp_sec;
+      rec->tv.ts_usec = hdr->tp_nsec / 1000;
+      rec->incl_len = pkt->caplen;
+      rec->orig_len = hdr->tp_len;
+
+      iov->iov_base = rec;
+      iov->iov_len = sizeof(struct net::pcap_file::pcaprec_hdr_t);
+      iov++;
+
+      iov->iov_base = const_cast<uint8_t*>(reinterpret_cast<const uint8_t*>(hdr) + hdr->tp_mac);
+      iov->iov_len = pkt->caplen;
+      iov++;
+    }
+
+    return iov - records->iov;
   }
 
-  // If the packet doesn't match the filter...
-  if (!_M_filter.match(ip_header, iphdrlen, iplen)) {
-    // Do nothing.
+  bool net::sniffer::setup_uring(const char* pathname)
+  {
+    if (!_M_uring_file.create(kUringDepth)) {
+      perror("io_uring_setup");
+      return false;
+    }
+
+    if ((_M_writes = reinterpret_cast<struct uring_write*>(malloc(kUringDepth * sizeof(struct uring_write)))) == NULL) {
+      return false;
+    }
+
+    for (unsigned i = 0; i < kUringDepth; i++) {
+      _M_free_writes[i] = i;
+    }
+
+    _M_nfree_writes = kUringDepth;
+
+    // Open capture file and write the header.
+    if ((!_M_uring_file.open(pathname, O_CREAT | O_TRUNC | O_WRONLY, 0644)) ||
+        (!_M_uring_file.write(&_M_pcap_file.header(), sizeof(struct net::pcap_file::pcap_hdr_t)))) {
+      fprintf(stderr, "Couldn't open capture file %s for writing.\n", pathname);
+      return false;
+    }
+
+    _M_use_uring = true;
+
     return true;
   }
 
-#if DEBUG_TRAFFIC
-  show_packet(ip_header, iphdrlen, iplen);
-#endif
+  bool net::sniffer::submit_block()
+  {
+    unsigned idx = _M_free_writes[_M_nfree_writes - 1];
+    const struct batch* batch = &_M_batches[idx];
 
-  return write_packet(eth, ethlen);
-}
+    // Nothing to write?
+    if (batch->npackets == 0) {
+      mark_as_free();
+      return true;
+    }
 
-void net::sniffer::show_packet(const struct iphdr* ip_header, size_t iphdrlen, size_t iplen)
-{
-  const uint8_t* saddr = reinterpret_cast<const uint8_t*>(&ip_header->saddr);
-  const uint8_t* daddr = reinterpret_cast<const uint8_t*>(&ip_header->daddr);
+    struct uring_write* w = &_M_writes[idx];
+    unsigned iovcnt = fill_records(_M_block_desc, batch, &w->records);
+
+    // There are as many entries in the submission queue as in _M_writes.
+    ssize_t len;
+    if ((len = _M_uring_file.writev(w->records.iov, iovcnt, idx)) < 0) {
+      return false;
+    }
+
+    w->block = _M_idx;
+    w->len = len;
+
+    _M_nfree_writes--;
+
+    _M_stats.async_writes++;
+
+    unsigned inflight = kUringDepth - _M_nfree_writes;
+    if (inflight > _M_stats.max_inflight_writes) {
+      _M_stats.max_inflight_writes = inflight;
+    }
+
+    if (!_M_uring_file.submit()) {
+      perror("io_uring_enter");
+      return false;
+    }
+
+    return true;
+  }
 
-  // TCP?
-  if (ip_header->protocol == 0x06) {
-    if (iplen < iphdrlen + sizeof(struct tcphdr)) {
-      return;
+  bool net::sniffer::reap_writes(bool wait)
+  {
+    if ((wait) && (!_M_uring_file.wait())) {
+      perror("io_uring_enter");
+      return false;
     }
 
-    const struct tcphdr* tcp_header;
-    tcp_header = reinterpret_cast<const struct tcphdr*>(reinterpret_cast<const uint8_t*>(ip_header) + iphdrlen);
-    size_t tcphdrlen = tcp_header->doff * 4;
-    if (iplen < iphdrlen + tcphdrlen) {
-      return;
+    bool ret = true;
+
+    uint64_t idx;
+    int res;
+    while (_M_uring_file.completion(idx, res)) {
+      const struct uring_write* w = &_M_writes[idx];
+
+      if (res != static_cast<int>(w->len)) {
+        if (ret) {
+          if (res < 0) {
+            fprintf(stderr, "Couldn't write to the capture file (%s).\n", strerror(-res));
+          } else {
+            fprintf(stderr, "Short write to the capture file.\n");
+          }
+        }
+
+        ret = false;
+      }
+
+      // Give the block back to the kernel.
+      struct block_desc* block_desc = reinterpret_cast<struct block_desc*>(_M_frames[w->block].iov_base);
+      __atomic_store_n(&block_desc->bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+
+      _M_free_writes[_M_nfree_writes++] = idx;
     }
 
-    unsigned short sport = ntohs(tcp_header->source);
-    unsigned short dport = ntohs(tcp_header->dest);
+    return ret;
+  }
+
+  bool net::sniffer::drain_writes()
+  {
+    bool ret = true;
 
-    printf("[TCP] %u.%u.%u.%u:%u -> %u.%u.%u.%u:%u\n",
-           saddr[0], saddr[1], saddr[2], saddr[3], sport,
-           daddr[0], daddr[1], daddr[2], daddr[3], dport);
-  } else if (ip_header->protocol == 0x11) {
-    // UDP.
-    if (iplen < iphdrlen + sizeof(struct udphdr)) {
-      return;
+    while (_M_nfree_writes < kUringDepth) {
+      if (!_M_uring_file.wait()) {
+        perror("io_uring_enter");
+        return false;
+      }
+
+      if (!reap_writes(false)) {
+        ret = false;
+      }
     }
 
-    const struct udphdr* udp_header;
-    udp_header = reinterpret_cast<const struct udphdr*>(reinterpret_cast<const uint8_t*>(ip_header) + iphdrlen);
+    return ret;
+  }
+#else
+  bool net::sniffer::process_frame()
+  {
+    uint16_t len;
+    if ((len = caplen(_M_hdr)) == 0) {
+      return true;
+    }
+
+    return write_packet(_M_hdr, len);
+  }
+#endif
 
-    unsigned short sport = ntohs(udp_header->source);
-    unsigned short dport = ntohs(udp_header->dest);
+void net::sniffer::show_packet(const struct net::headers& h)
+{
+  char saddr[INET6_ADDRSTRLEN];
+  char daddr[INET6_ADDRSTRLEN];
+
+  if (h.version == 4) {
+    inet_ntop(AF_INET, &h.ipv4()->saddr, saddr, sizeof(saddr));
+    inet_ntop(AF_INET, &h.ipv4()->daddr, daddr, sizeof(daddr));
+  } else if (h.version == 6) {
+    inet_ntop(AF_INET6, &h.ipv6()->ip6_src, saddr, sizeof(saddr));
+    inet_ntop(AF_INET6, &h.ipv6()->ip6_dst, daddr, sizeof(daddr));
+  } else {
+    printf("[non-IP]\n");
+    return;
+  }
 
-    printf("[UDP] %u.%u.%u.%u:%u -> %u.%u.%u.%u:%u\n",
-           saddr[0], saddr[1], saddr[2], saddr[3], sport,
-           daddr[0], daddr[1], daddr[2], daddr[3], dport);
-  } else if (ip_header->protocol == 0x01) {
-    // ICMP.
-    printf("[ICMP] %u.%u.%u.%u -> %u.%u.%u.%u\n",
-           saddr[0], saddr[1], saddr[2], saddr[3],
-           daddr[0], daddr[1], daddr[2], daddr[3]);
+  if ((h.protocol == IPPROTO_TCP) && (!h.fragment) && (h.l4len >= sizeof(struct tcphdr))) {
+    const struct tcphdr* tcp_header = reinterpret_cast<const struct tcphdr*>(h.l4);
+
+    printf("[TCP] %s:%u -> %s:%u\n",
+           saddr, ntohs(tcp_header->source),
+           daddr, ntohs(tcp_header->dest));
+  } else if ((h.protocol == IPPROTO_UDP) && (!h.fragment) && (h.l4len >= sizeof(struct udphdr))) {
+    const struct udphdr* udp_header = reinterpret_cast<const struct udphdr*>(h.l4);
+
+    printf("[UDP] %s:%u -> %s:%u\n",
+           saddr, ntohs(udp_header->source),
+           daddr, ntohs(udp_header->dest));
+  } else if ((h.protocol == IPPROTO_ICMP) || (h.protocol == IPPROTO_ICMPV6)) {
+    printf("[ICMP] %s -> %s\n", saddr, daddr);
   } else {
-    printf("[protocol: 0x%02x] %u.%u.%u.%u -> %u.%u.%u.%u\n",
-           ip_header->protocol,
-           saddr[0], saddr[1], saddr[2], saddr[3],
-           daddr[0], daddr[1], daddr[2], daddr[3]);
+    printf("[protocol: 0x%02x] %s -> %s\n", h.protocol, saddr, daddr);
   }
 }
 
-bool net::sniffer::show_statistics()
+bool net::sniffer::dump()
+{
+  if (!_M_flight_recorder) {
+    return true;
+  }
+
+  char pathname[PATH_MAX];
+  if (!fs::path::add_timestamp(_M_pathname, pathname, sizeof(pathname))) {
+    return false;
+  }
+
+  // The capture keeps running while the snapshot is being written.
+  net::pcap_file pcap_file;
+  pcap_file.snaplen(_M_pcap_file.snaplen());
+
+  ssize_t npackets;
+  if ((npackets = pcap_file.write_packets(pathname, _M_recorder)) < 0) {
+    fprintf(stderr, "Couldn't write snapshot to %s.\n", pathname);
+    return false;
+  }
+
+  fprintf(stderr, "Snapshot written to %s (%ld packets).\n", pathname, npackets);
+
+  return true;
+}
+
+bool net::sniffer::read_kernel_statistics()
 {
 #ifdef HAVE_TPACKET_V3
   struct tpacket_stats_v3 stats;
@@ -413,14 +1307,114 @@ bool net::sniffer::show_statistics()
   struct tpacket_stats stats;
 #endif
 
+  // The kernel resets its counters after each call.
   socklen_t optlen = sizeof(stats);
   if (getsockopt(_M_fd, SOL_PACKET, PACKET_STATISTICS, &stats, &optlen) < 0) {
     return false;
   }
 
-  printf("%u packets received.\n", stats.tp_packets);
-  printf("%u packets matched the filter.\n", _M_npackets);
-  printf("%u packets dropped by kernel.\n", stats.tp_drops);
+  _M_stats.received += stats.tp_packets;
+  _M_stats.dropped += stats.tp_drops;
+
+#ifdef HAVE_TPACKET_V3
+  _M_stats.queue_freezes += stats.tp_freeze_q_cnt;
+#endif
 
   return true;
 }
+
+bool net::sniffer::update_statistics()
+{
+  if (!read_kernel_statistics()) {
+    return false;
+  }
+
+  _M_stats.overwritten = _M_recorder.overwritten();
+
+  if (_M_use_sampler) {
+    _M_stats.sample_rate = _M_sampler.rate();
+  }
+
+  if (_M_use_shedder) {
+    const struct net::load_shedder::statistics& stats = _M_shedder.stats();
+    for (unsigned i = 0; i < net::load_shedder::kLevels; i++) {
+      _M_stats.shed_blocks[i] = stats.blocks[i];
+    }
+
+    _M_stats.shed_changes = stats.changes;
+    _M_stats.max_occupancy = stats.max_occupancy;
+  }
+
+  if (_M_use_cutoff) {
+    _M_stats.expired_flows = _M_cutoff.stats().expired;
+    _M_stats.evicted_flows = _M_cutoff.stats().evicted;
+  }
+
+  return true;
+}
+
+bool net::sniffer::snapshot(struct live_statistics& live)
+{
+  // Only this thread reads the kernel counters while the capture is
+  // running.
+  if (!read_kernel_statistics()) {
+    return false;
+  }
+
+  live.received = _M_stats.received;
+  live.dropped = _M_stats.dropped;
+  live.queue_freezes = _M_stats.queue_freezes;
+
+  live.ring_packets = __atomic_load_n(&_M_live.ring_packets, __ATOMIC_RELAXED);
+  live.ring_bytes = __atomic_load_n(&_M_live.ring_bytes, __ATOMIC_RELAXED);
+  live.matched = __atomic_load_n(&_M_live.matched, __ATOMIC_RELAXED);
+  live.matched_bytes = __atomic_load_n(&_M_live.matched_bytes, __ATOMIC_RELAXED);
+  live.written_packets = __atomic_load_n(&_M_live.written_packets, __ATOMIC_RELAXED);
+  live.written_bytes = __atomic_load_n(&_M_live.written_bytes, __ATOMIC_RELAXED);
+  live.backlog = __atomic_load_n(&_M_live.backlog, __ATOMIC_RELAXED);
+
+  // Start a new high-water mark.
+  live.max_occupancy = __atomic_exchange_n(&_M_live.max_occupancy, 0, __ATOMIC_RELAXED);
+
+  return true;
+}
+
+bool net::sniffer::parse_fanout_mode(const char* s, int& mode)
+{
+  static const struct {
+    const char* name;
+    int mode;
+  } modes[] = {
+    {"hash",     PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG},
+    {"lb",       PACKET_FANOUT_LB},
+    {"cpu",      PACKET_FANOUT_CPU},
+    {"rollover", PACKET_FANOUT_ROLLOVER},
+    {"rnd",      PACKET_FANOUT_RND},
+    {"qm",       PACKET_FANOUT_QM}
+  };
+
+  for (size_t i = 0; i < ARRAY_SIZE(modes); i++) {
+    if (strcasecmp(s, modes[i].name) == 0) {
+      mode = modes[i].mode;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool net::sniffer::parse_output(const char* s, int& output)
+{
+  if (strcasecmp(s, "file") == 0) {
+    output = kFileOutput;
+    return true;
+  } else if (strcasecmp(s, "uring") == 0) {
+    output = kUringOutput;
+    return true;
+  } else if (strcasecmp(s, "direct") == 0) {
+    output = kDirectOutput;
+    return true;
+  }
+
+  return false;
+}
@@ -3,12 +3,30 @@
 
 #include <stdint.h>
 #include <sys/uio.h>
-#include <netinet/ip.h>
 #include <linux/if_packet.h>
 #include <linux/if_ether.h>
 #include <limits.h>
+#include <time.h>
+#include <pthread.h>
+#include "net/headers.h"
 #include "net/filter.h"
+#include "net/expression.h"
 #include "net/pcap_file.h"
+#include "net/pcap_ring.h"
+#include "net/pcap_rotator.h"
+#include "net/pcap_segment.h"
+#include "net/trigger.h"
+#include "net/trigger_recorder.h"
+#include "net/flow_cutoff.h"
+#include "net/flow_sampler.h"
+#include "net/load_shedder.h"
+#include "net/dedup.h"
+#include "fs/uring_file.h"
+#include "fs/direct_file.h"
+#include "thread/spsc_queue.h"
+#include "util/histogram.h"
+#include "util/tsc.h"
+#include "macros/macros.h"
 
 namespace net {
   class sniffer {
@@ -23,6 +41,221 @@ namespace net {
 
       static const size_t kDefaultRingSize = 256 * 1024 * 1024; // 256 MB.
 
+      // Default number of seconds written before / after a trigger.
+      static const unsigned kDefaultTriggerWindow = 10;
+
+      // Output backends.
+      static const int kFileOutput = 0;  // fs::file or fs::omemfile.
+      static const int kUringOutput = 1; // io_uring (only TPACKET_V3).
+      static const int kDirectOutput = 2; // O_DIRECT.
+
+      // Latency histograms (nanoseconds).
+      static const unsigned kHandoffLatency = 0; // Retire of the block to walk_block() (TPACKET_V3).
+      static const unsigned kBlockLatency = 1;   // process_packets() per block (TPACKET_V3).
+      static const unsigned kOutputLatency = 2;  // Output system call or remap.
+      static const unsigned kLatencies = 3;
+
+      struct options {
+        size_t ring_size;
+        size_t max_pcap_filesize;
+
+        // Use the max_pcap_filesize bytes as a ring which overwrites the
+        // oldest packets.
+        bool flight_recorder;
+
+        // PACKET_FANOUT group (-1: don't join a fanout group).
+        int fanout_id;
+        int fanout_mode;
+
+        // Write the packets from a dedicated writer thread.
+        bool writer_thread;
+
+        // Compile the filter to classic BPF and attach it to the socket.
+        bool kernel_filter;
+
+        // Filter expression (NULL: no expression), and-ed with the filter.
+        const char* expression;
+
+        // Match the inner packet of the tunneled packets (VXLAN, GTP-U, GRE
+        // and IP-in-IP), the whole packet is written.
+        bool decapsulate;
+
+        // Default snap length.
+        uint16_t snaplen;
+
+        // Output backend.
+        int output;
+
+        // Size of the buffers of the O_DIRECT output.
+        size_t direct_buffer_size;
+
+        // How the max_pcap_filesize bytes are allocated (string::buffer::map()
+        // flags).
+        unsigned memory_flags;
+
+        // Directory where the max_pcap_filesize bytes are stored as a
+        // segment which survives the program (NULL: in memory).
+        const char* segment_dir;
+
+        // Trigger list (NULL: no triggers). The max_pcap_filesize bytes are
+        // used as a ring and, when a trigger fires, the packets received
+        // from trigger_before seconds before to trigger_after seconds after
+        // are written to a timestamped file.
+        const char* triggers;
+        unsigned trigger_before;
+        unsigned trigger_after;
+
+        // Rotate the capture file when it reaches rotate_filesize bytes or
+        // every rotate_seconds seconds (0: don't rotate).
+        size_t rotate_filesize;
+        unsigned rotate_seconds;
+
+        // Keep at most max_files files / quota bytes (0: no limit).
+        unsigned max_files;
+        size_t quota;
+
+        // Drop the packets identical (apart from the TTL) to a packet
+        // received less than dedup_window microseconds before (0: don't).
+        unsigned dedup_window;
+
+        // Only keep 1 in sample_rate flows (0: no sampling, the rate can
+        // then not be changed at runtime).
+        unsigned sample_rate;
+
+        // Degrade the capture when the ring fills up (see load_shedder):
+        // watermarks of the levels and filter list of the low-priority
+        // packets dropped by the last level (NULL: none). Only TPACKET_V3.
+        bool load_shedding;
+        unsigned watermarks[net::load_shedder::kLevels - 1];
+        const char* low_priority;
+
+        // Only keep the first flow_cutoff bytes of every flow (0: no cutoff)
+        // and track at most max_flows flows.
+        size_t flow_cutoff;
+        size_t max_flows;
+
+        // Publish the counters of the capture thread for the live
+        // statistics (see snapshot()).
+        bool live_statistics;
+
+        // Constructor.
+        options();
+      };
+
+      struct statistics {
+        uint64_t received;
+        uint64_t matched;
+        uint64_t dropped;
+
+        // Number of times the kernel froze the queue of blocks because the
+        // ring was full (TPACKET_V3).
+        uint64_t queue_freezes;
+
+        // Packets read from the ring and their original length.
+        uint64_t ring_packets;
+        uint64_t ring_bytes;
+
+        // Packets handed to the output and their captured length.
+        uint64_t written_packets;
+        uint64_t written_bytes;
+
+        // Original length of the matching packets and number of bytes
+        // which were not written because of the snap length.
+        uint64_t bytes;
+        uint64_t saved_bytes;
+
+        // Flight recorder.
+        uint64_t overwritten;
+
+        // Writer thread.
+        uint64_t ring_blocks;
+        uint64_t queued_blocks;
+        uint64_t queue_depth_sum;
+        uint64_t max_queue_depth;
+        uint64_t hold_time_sum; // Nanoseconds.
+        uint64_t max_hold_time; // Nanoseconds.
+
+        // File rotation.
+        uint64_t files;
+        uint64_t late_rotations;
+        uint64_t deleted_files;
+
+        // io_uring.
+        uint64_t async_writes;
+        uint64_t max_inflight_writes;
+
+        // O_DIRECT.
+        uint64_t direct_writes;
+        uint64_t direct_write_time_sum; // Nanoseconds.
+        uint64_t max_direct_write_time; // Nanoseconds.
+        uint64_t direct_stalls;
+
+        // Batched writes.
+        uint64_t written_blocks;
+        uint64_t write_calls;
+
+        // Triggers.
+        uint64_t triggers;
+        uint64_t trigger_windows;
+        uint64_t trigger_packets;
+        uint64_t trigger_overruns;
+
+        // Flow cutoff: packets not written because their flow had reached
+        // the cutoff, their original length, and flows which have expired /
+        // have been evicted because the table was full.
+        uint64_t cutoff_packets;
+        uint64_t cutoff_bytes;
+        uint64_t expired_flows;
+        uint64_t evicted_flows;
+
+        // Duplicate packets and their original length.
+        uint64_t duplicate_packets;
+        uint64_t duplicate_bytes;
+
+        // Flow sampling: packets not written because their flow was not
+        // sampled, their original length and the current rate.
+        uint64_t sampled_packets;
+        uint64_t sampled_bytes;
+        uint64_t sample_rate;
+
+        // Load shedding: packets dropped (sample and drop levels), their
+        // original length, bytes not written because of the truncate level,
+        // blocks processed at each level, level changes and highest ring
+        // occupancy (percentage).
+        uint64_t shed_packets;
+        uint64_t shed_bytes;
+        uint64_t shed_truncated_bytes;
+        uint64_t shed_blocks[net::load_shedder::kLevels];
+        uint64_t shed_changes;
+        uint64_t max_occupancy;
+      };
+
+      // Counters of the live statistics.
+      struct live_statistics {
+        // Kernel counters (packets received, including the dropped ones,
+        // packets dropped and queue freezes).
+        uint64_t received;
+        uint64_t dropped;
+        uint64_t queue_freezes;
+
+        // Packets read from the ring, matching the filter and handed to the
+        // output, and their length (original length for the first two,
+        // captured length for the written ones).
+        uint64_t ring_packets;
+        uint64_t ring_bytes;
+        uint64_t matched;
+        uint64_t matched_bytes;
+        uint64_t written_packets;
+        uint64_t written_bytes;
+
+        // Highest ring occupancy (percentage) since the previous snapshot
+        // (TPACKET_V3).
+        uint64_t max_occupancy;
+
+        // Blocks held by the writer thread or io_uring.
+        uint64_t backlog;
+      };
+
       // Constructor.
       sniffer();
 
@@ -30,7 +263,7 @@ namespace net {
       ~sniffer();
 
       // Create.
-      bool create(const char* interface, const char* pathname, size_t ring_size, size_t max_pcap_filesize = 0);
+      bool create(const char* interface, const char* pathname, const options& opts);
 
       // Start.
       bool start();
@@ -38,18 +271,100 @@ namespace net {
       // Stop.
       void stop();
 
+      // Dump a snapshot of the flight recorder to a timestamped file.
+      bool dump();
+
       // Get filter.
       net::filter& filter();
 
+      // Get flow sampler.
+      net::flow_sampler& sampler();
+
+      // Update statistics.
+      bool update_statistics();
+
+      // Take a snapshot of the live statistics while the capture is
+      // running (from another thread: the capture thread only publishes its
+      // counters after each block). Not to be called concurrently with
+      // update_statistics().
+      bool snapshot(struct live_statistics& live);
+
+      // Get statistics.
+      const struct statistics& stats() const;
+
+      // Get latency histogram (can be read while the capture is running).
+      const util::histogram& latency(unsigned idx) const;
+
+      // Parse fanout mode.
+      static bool parse_fanout_mode(const char* s, int& mode);
+
+      // Parse output backend.
+      static bool parse_output(const char* s, int& output);
+
     protected:
       static const size_t kBlockSize = 4096 << 2;
 
+      // Poll timeout (milliseconds).
+      static const int kPollTimeout = 200;
+
 #ifdef HAVE_TPACKET_V3
+      typedef struct tpacket3_hdr tpacket_hdr_t;
+#elif HAVE_TPACKET_V2
+      typedef struct tpacket2_hdr tpacket_hdr_t;
+#else
+      typedef struct tpacket_hdr tpacket_hdr_t;
+#endif
+
+#ifdef HAVE_TPACKET_V3
+      // Maximum number of packets which fit in a block.
+      static const unsigned kMaxPacketsPerBlock = kBlockSize / TPACKET3_HDRLEN;
+
+      // Time the threads sleep when they have nothing to do (microseconds).
+      static const unsigned kIdleSleep = 100;
+
       struct block_desc {
         uint32_t version;
         uint32_t offset_to_priv;
         struct tpacket_hdr_v1 bh1;
       };
+
+      // Packet to be written.
+      struct packet {
+        // Offset of the packet from the beginning of the block.
+        uint16_t offset;
+
+        // Number of bytes to write.
+        uint16_t caplen;
+      };
+
+      // Packets of a block which have to be written.
+      struct batch {
+        struct packet packets[kMaxPacketsPerBlock];
+        unsigned npackets;
+
+        // When the block was handed to the writer thread (nanoseconds).
+        uint64_t timestamp;
+      };
+
+      // Maximum number of blocks being written with io_uring.
+      static const unsigned kUringDepth = 64;
+
+      // Record headers and iovecs of the packets of a block (two iovecs
+      // per packet: the record header and the packet, which is written
+      // straight from the ring).
+      struct records {
+        struct net::pcap_file::pcaprec_hdr_t hdrs[kMaxPacketsPerBlock];
+        struct iovec iov[2 * kMaxPacketsPerBlock];
+      };
+
+      // Block being written with io_uring (the block stays in the ring
+      // until the write completes).
+      struct uring_write {
+        unsigned block;
+        size_t len;
+
+        struct records records;
+      };
 #endif // HAVE_TPACKET_V3
 
       int _M_fd;
@@ -69,28 +384,119 @@ namespace net {
 
 #ifdef HAVE_TPACKET_V3
       struct block_desc* _M_block_desc;
-      struct tpacket3_hdr* _M_hdr;
-#elif HAVE_TPACKET_V2
-      struct tpacket2_hdr* _M_hdr;
-#else
-      struct tpacket_hdr* _M_hdr;
 #endif
 
+      tpacket_hdr_t* _M_hdr;
+
       size_t _M_idx;
       size_t _M_max_idx;
 
-      unsigned _M_npackets;
+      struct statistics _M_stats;
 
       net::filter _M_filter;
 
+      // Is the filter being run by the kernel?
+      bool _M_kernel_filter;
+
+      // Filter expression (always run in user space).
+      bool _M_use_expression;
+      net::expression _M_expression;
+
+      // Match the inner packet of the tunneled packets?
+      bool _M_decapsulate;
+
       net::pcap_file _M_pcap_file;
 
       char _M_pathname[PATH_MAX + 1];
       size_t _M_max_pcap_filesize;
       string::buffer _M_pkts;
 
+      bool _M_flight_recorder;
+      net::pcap_ring _M_recorder;
+
+      bool _M_use_segment;
+      net::pcap_segment _M_segment;
+
+      bool _M_use_triggers;
+      net::trigger _M_trigger;
+      net::trigger_recorder _M_trigger_recorder;
+
+      bool _M_use_dedup;
+      net::dedup _M_dedup;
+
+      bool _M_use_sampler;
+      net::flow_sampler _M_sampler;
+
+      bool _M_use_cutoff;
+      net::flow_cutoff _M_cutoff;
+
+      // Load shedding.
+      bool _M_use_shedder;
+      net::load_shedder _M_shedder;
+      net::flow_sampler _M_shed_sampler;
+      bool _M_use_low_priority;
+      net::filter _M_low_priority;
+
+      bool _M_rotate;
+      net::pcap_rotator _M_rotator;
+
+      bool _M_use_direct;
+      fs::direct_file _M_direct_file;
+
       bool _M_running;
 
+      // Counters published for the live statistics.
+      bool _M_live_statistics;
+      struct live_statistics _M_live;
+
+      // Latency histograms (each one written by a single thread: the
+      // capture thread, the writer thread or the O_DIRECT thread).
+      util::histogram _M_latencies[kLatencies];
+
+#ifdef HAVE_TPACKET_V3
+      struct batch* _M_batches;
+
+      // Writer thread.
+      bool _M_use_writer;
+      pthread_t _M_writer;
+      bool _M_writer_running;
+      bool _M_writer_ret;
+
+      // Indices of the blocks handed to the writer thread.
+      thread::spsc_queue _M_queue;
+
+      // Number of blocks handed to / released by the writer thread.
+      uint64_t _M_queued;
+      uint64_t _M_released;
+
+      // io_uring.
+      bool _M_use_uring;
+      fs::uring_file _M_uring_file;
+      struct uring_write* _M_writes;
+
+      // Write each block with as few writev() calls as possible.
+      bool _M_batch_writes;
+      struct records* _M_records;
+
+      // Indices of the free entries of _M_writes (and _M_batches).
+      unsigned _M_free_writes[kUringDepth];
+      unsigned _M_nfree_writes;
+
+      // Measure the ring occupancy of every block (load shedding and live
+      // statistics)?
+      bool _M_track_occupancy;
+
+      // Number of blocks known to be ready from _M_idx (the kernel hands the
+      // blocks over in order).
+      size_t _M_ready;
+
+      // Filter the packets of each block in batches (user space filter).
+      bool _M_batch_filter;
+      struct net::filter::keys _M_keys;
+      uint32_t _M_offsets[net::filter::kBatchSize];
+      struct net::headers _M_headers[net::filter::kBatchSize];
+#endif // HAVE_TPACKET_V3
+
 #ifdef HAVE_TPACKET_V2
       // Get header length.
       bool get_header_length();
@@ -100,11 +506,23 @@ namespace net {
       bool set_packet_version(tpacket_versions version);
 
       // Setup packet ring.
-      bool setup_packet_ring(size_t ring_size);
+      bool setup_packet_ring(size_t ring_size, size_t snaplen);
+
+      // Join fanout group.
+      bool join_fanout_group(int id, int mode);
+
+      // Attach filter to the socket.
+      bool attach_filter();
 
       // Allocate frames.
       bool allocate_frames(size_t num, size_t size);
 
+      // Allocate and pre-fault the memory for the packets (-m).
+      bool allocate_memory(size_t size, unsigned flags);
+
+      // Create the segment for the packets (-m).
+      bool create_segment(const char* dir, const char* pathname, size_t size, unsigned flags);
+
       // Have new packet.
       bool have_new_packet();
 
@@ -114,25 +532,112 @@ namespace net {
 #ifdef HAVE_TPACKET_V3
       // Walk block.
       bool walk_block();
+
+      // Get the percentage of the ring which the kernel cannot fill: the
+      // ready blocks not processed yet (including the current one) and the
+      // blocks held by the writer thread or io_uring.
+      unsigned occupancy();
+
+      // Get the number of blocks held by the writer thread or io_uring.
+      size_t held() const;
+
+      // Raise the high-water mark of the ring occupancy of the live
+      // statistics.
+      void raise_max_occupancy(unsigned occupancy);
+
+      // Filter the packets of a block in batches: gather the offsets of the
+      // packets, extract their keys and match them at once (returns the
+      // number of packets which match).
+      unsigned filter_block(struct batch* batch);
+
+      // Parse the headers and extract the keys of a packet.
+      void extract(const struct tpacket3_hdr* hdr, unsigned i);
+
+      // Write the packets of a block.
+      bool write_batch(const struct block_desc* block_desc, const struct batch* batch);
+
+      // Fill the record headers and the iovecs of the packets of a block
+      // (returns the number of iovecs).
+      static unsigned fill_records(const struct block_desc* block_desc,
+                                   const struct batch* batch,
+                                   struct records* records);
+
+      // Is the ring full of blocks held by the writer thread?
+      bool ring_held() const;
+
+      // Hand block to the writer thread.
+      void enqueue_block();
+
+      // Start writer thread.
+      bool start_writer();
+
+      // Stop writer thread.
+      void stop_writer();
+
+      // Writer thread.
+      static void* writer(void* arg);
+
+      // Write the blocks handed by the capture thread.
+      void write_blocks();
+
+      // Get monotonic time in nanoseconds.
+      static uint64_t now();
+
+      // Open the capture file for io_uring.
+      bool setup_uring(const char* pathname);
+
+      // Submit the write of the current block.
+      bool submit_block();
+
+      // Release the blocks whose writes have completed (if wait is true,
+      // wait for at least one write).
+      bool reap_writes(bool wait);
+
+      // Wait for all the writes in flight.
+      bool drain_writes();
 #else
       // Process frame.
       bool process_frame();
 #endif
 
-      // Process IP packet.
-      bool process_ip_packet(const struct ethhdr* eth, size_t ethlen);
+      // Get the VLAN ID of the tag stripped by the kernel (or
+      // net::headers::kNoVlan).
+      static int vlan(const tpacket_hdr_t* hdr);
+
+      // Parse the headers of a packet.
+      void parse(const tpacket_hdr_t* hdr, struct net::headers& h) const;
+
+      // Match packet (returns the snap length or 0 if the packet doesn't
+      // match).
+      uint16_t match(const struct net::headers& h) const;
+
+      // Get number of bytes to write (0 if the packet doesn't match).
+      uint16_t caplen(const tpacket_hdr_t* hdr);
+
+      // Get number of bytes to write of a packet which matches (0 if the
+      // packet is dropped because it is a duplicate or because of the flow
+      // sampling, the load shedding or the flow cutoff).
+      uint16_t caplen(const tpacket_hdr_t* hdr, const struct net::headers& h, uint16_t snaplen);
 
       // Write packet.
-      bool write_packet(const struct ethhdr* eth, size_t ethlen);
+      bool write_packet(const tpacket_hdr_t* hdr, size_t caplen);
 
       // Mark as free.
       void mark_as_free();
 
-      // Show packet.
-      static void show_packet(const struct iphdr* ip_header, size_t iphdrlen, size_t iplen);
+#ifdef HAVE_TPACKET_V3
+      // Record the time from the retire of the current block to now.
+      void record_handoff();
+#endif
+
+      // Add the kernel counters to the statistics (the kernel resets them).
+      bool read_kernel_statistics();
 
-      // Show statistics.
-      bool show_statistics();
+      // Publish the counters of the capture thread for the live statistics.
+      void publish();
+
+      // Show packet.
+      static void show_packet(const struct net::headers& h);
 
     private:
       // Disable copy constructor and assignment operator.
@@ -140,9 +645,44 @@ namespace net {
       sniffer& operator=(const sniffer&);
   };
 
+  inline sniffer::options::options()
+    : ring_size(kDefaultRingSize),
+      max_pcap_filesize(0),
+      flight_recorder(false),
+      fanout_id(-1),
+      fanout_mode(PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG),
+      writer_thread(false),
+      kernel_filter(true),
+      expression(NULL),
+      decapsulate(false),
+      snaplen(net::filter::kMaxSnaplen),
+      output(kFileOutput),
+      direct_buffer_size(fs::direct_file::kDefaultBufferSize),
+      memory_flags(string::buffer::kLock),
+      segment_dir(NULL),
+      triggers(NULL),
+      trigger_before(kDefaultTriggerWindow),
+      trigger_after(kDefaultTriggerWindow),
+      rotate_filesize(0),
+      rotate_seconds(0),
+      max_files(0),
+      quota(0),
+      dedup_window(0),
+      sample_rate(0),
+      load_shedding(false),
+      low_priority(NULL),
+      flow_cutoff(0),
+      max_flows(net::flow_cutoff::kDefaultMaxFlows),
+      live_statistics(false)
+  {
+    watermarks[net::load_shedder::kTruncate - 1] = net::load_shedder::kDefaultTruncateWatermark;
+    watermarks[net::load_shedder::kSample - 1] = net::load_shedder::kDefaultSampleWatermark;
+    watermarks[net::load_shedder::kDrop - 1] = net::load_shedder::kDefaultDropWatermark;
+  }
+
   inline void sniffer::stop()
   {
-    _M_running = false;
+    __atomic_store_n(&_M_running, false, __ATOMIC_RELAXED);
   }
 
   inline net::filter& sniffer::filter()
@@ -150,6 +690,21 @@ namespace net {
     return _M_filter;
   }
 
+  inline net::flow_sampler& sniffer::sampler()
+  {
+    return _M_sampler;
+  }
+
+  inline const struct sniffer::statistics& sniffer::stats() const
+  {
+    return _M_stats;
+  }
+
+  inline const util::histogram& sniffer::latency(unsigned idx) const
+  {
+    return _M_latencies[idx];
+  }
+
   inline bool sniffer::have_new_packet()
   {
 #ifdef HAVE_TPACKET_V3
@@ -173,21 +728,194 @@ namespace net {
 #endif
   }
 
-  inline bool sniffer::write_packet(const struct ethhdr* eth, size_t ethlen)
+  inline int sniffer::vlan(const tpacket_hdr_t* hdr)
   {
-    _M_npackets++;
+#ifdef HAVE_TPACKET_V3
+    return ((hdr->tp_status & TP_STATUS_VLAN_VALID) != 0) ? (hdr->hv1.tp_vlan_tci & 0x0fff) :
+                                                           net::headers::kNoVlan;
+#elif HAVE_TPACKET_V2
+    return ((hdr->tp_status & TP_STATUS_VLAN_VALID) != 0) ? (hdr->tp_vlan_tci & 0x0fff) :
+                                                           net::headers::kNoVlan;
+#else
+    return net::headers::kNoVlan;
+#endif
+  }
+
+  inline void sniffer::parse(const tpacket_hdr_t* hdr, struct net::headers& h) const
+  {
+    const struct ethhdr* eth;
+    eth = reinterpret_cast<const struct ethhdr*>(reinterpret_cast<const uint8_t*>(hdr) + hdr->tp_mac);
+
+    h.parse(eth, hdr->tp_snaplen, vlan(hdr));
 
-    uint32_t sec = _M_hdr->tp_sec;
+    if ((_M_decapsulate) && (h.tunneled())) {
+      h.decapsulate();
+    }
+  }
+
+  inline uint16_t sniffer::match(const struct net::headers& h) const
+  {
+    uint16_t snaplen;
+
+    // If the kernel has already filtered and truncated the packet (the
+    // kernel filter only looks into untagged IPv4 packets, it is not
+    // attached when the tunnels are decapsulated)...
+    if ((_M_kernel_filter) && (h.version == 4) && (h.nvlans == 0)) {
+      // The addresses are always matched in user space.
+      snaplen = _M_filter.match_headers(h) ? net::filter::kMaxSnaplen : 0;
+    } else {
+      snaplen = _M_filter.match(h);
+    }
+
+    // Does the packet match the expression?
+    if ((snaplen != 0) && (_M_use_expression) && (!_M_expression.match(h))) {
+      return 0;
+    }
+
+#if DEBUG_TRAFFIC
+    if (snaplen != 0) {
+      show_packet(h);
+    }
+#endif
+
+    return snaplen;
+  }
 
+  inline uint16_t sniffer::caplen(const tpacket_hdr_t* hdr)
+  {
+    _M_stats.ring_packets++;
+    _M_stats.ring_bytes += hdr->tp_len;
+
+    struct net::headers h;
+    parse(hdr, h);
+
+    uint16_t snaplen;
+    if ((snaplen = match(h)) == 0) {
+      return 0;
+    }
+
+    return caplen(hdr, h, snaplen);
+  }
+
+  inline uint16_t sniffer::caplen(const tpacket_hdr_t* hdr, const struct net::headers& h, uint16_t snaplen)
+  {
+    uint16_t caplen = MIN(hdr->tp_snaplen, snaplen);
+
+    // Does the packet fire a trigger?
+    if ((_M_use_triggers) && (_M_trigger.match(h))) {
+#if defined(HAVE_TPACKET_V3) || defined(HAVE_TPACKET_V2)
+      _M_trigger_recorder.fire(hdr->tp_sec, hdr->tp_nsec / 1000);
+#else
+      _M_trigger_recorder.fire(hdr->tp_sec, hdr->tp_usec);
+#endif
+    }
+
+    _M_stats.matched++;
+    _M_stats.bytes += hdr->tp_len;
+
+    // Is the packet a duplicate?
 #if defined(HAVE_TPACKET_V3) || defined(HAVE_TPACKET_V2)
-    uint32_t usec = _M_hdr->tp_nsec / 1000;
+    if ((_M_use_dedup) &&
+        (_M_dedup.duplicate(h, hdr->tp_len, (static_cast<uint64_t>(hdr->tp_sec) * 1000000ULL) + (hdr->tp_nsec / 1000)))) {
 #else
-    uint32_t usec = _M_hdr->tp_usec;
+    if ((_M_use_dedup) &&
+        (_M_dedup.duplicate(h, hdr->tp_len, (static_cast<uint64_t>(hdr->tp_sec) * 1000000ULL) + hdr->tp_usec))) {
 #endif
+      _M_stats.duplicate_packets++;
+      _M_stats.duplicate_bytes += hdr->tp_len;
+
+      return 0;
+    }
+
+    // Is the flow sampled?
+    if ((_M_use_sampler) && (!_M_sampler.sample(h))) {
+      _M_stats.sampled_packets++;
+      _M_stats.sampled_bytes += hdr->tp_len;
+
+      return 0;
+    }
+
+    // Is the capture degraded? Drop the low-priority packets and the
+    // packets of the flows which are not sampled?
+    unsigned level = _M_use_shedder ? _M_shedder.level() : net::load_shedder::kFull;
+    if ((level >= net::load_shedder::kSample) &&
+        (((level >= net::load_shedder::kDrop) && (_M_use_low_priority) && (_M_low_priority.match(h) != 0)) ||
+         (!_M_shed_sampler.sample(h)))) {
+      _M_stats.shed_packets++;
+      _M_stats.shed_bytes += hdr->tp_len;
+
+      return 0;
+    }
+
+    // Has the flow already reached the cutoff?
+    if ((_M_use_cutoff) && (!_M_cutoff.account(h, hdr->tp_len, hdr->tp_sec))) {
+      _M_stats.cutoff_packets++;
+      _M_stats.cutoff_bytes += hdr->tp_len;
+
+      return 0;
+    }
+
+    _M_stats.saved_bytes += hdr->tp_len - caplen;
+
+    // Truncate the packet (load shedding)?
+    if ((level >= net::load_shedder::kTruncate) && (caplen > net::load_shedder::kTruncateSnaplen)) {
+      _M_stats.shed_truncated_bytes += caplen - net::load_shedder::kTruncateSnaplen;
+      caplen = net::load_shedder::kTruncateSnaplen;
+    }
 
-    return (_M_max_pcap_filesize == 0) ?
-            _M_pcap_file.write_packet(sec, usec, eth, ethlen) :
-            _M_pcap_file.append_packet(sec, usec, eth, ethlen, _M_pkts);
+    _M_stats.written_packets++;
+    _M_stats.written_bytes += caplen;
+
+    return caplen;
+  }
+
+#ifdef HAVE_TPACKET_V3
+  inline void sniffer::extract(const struct tpacket3_hdr* hdr, unsigned i)
+  {
+    parse(hdr, _M_headers[i]);
+    net::filter::extract(_M_headers[i], _M_keys, i);
+  }
+#endif // HAVE_TPACKET_V3
+
+  inline bool sniffer::write_packet(const tpacket_hdr_t* hdr, size_t caplen)
+  {
+    const void* eth = reinterpret_cast<const uint8_t*>(hdr) + hdr->tp_mac;
+
+    uint32_t sec = hdr->tp_sec;
+
+#if defined(HAVE_TPACKET_V3) || defined(HAVE_TPACKET_V2)
+    uint32_t usec = hdr->tp_nsec / 1000;
+#else
+    uint32_t usec = hdr->tp_usec;
+#endif
+
+    if (_M_rotate) {
+      return _M_rotator.write_packet(sec, usec, eth, caplen, hdr->tp_len);
+    } else if (_M_use_direct) {
+      struct net::pcap_file::pcaprec_hdr_t rec;
+      rec.tv.ts_sec = sec;
+      rec.tv.ts_usec = usec;
+      rec.incl_len = caplen;
+      rec.orig_len = hdr->tp_len;
+
+      struct iovec iov[2];
+      iov[0].iov_base = &rec;
+      iov[0].iov_len = sizeof(struct net::pcap_file::pcaprec_hdr_t);
+
+      iov[1].iov_base = const_cast<void*>(eth);
+      iov[1].iov_len = caplen;
+
+      return (_M_direct_file.writev(iov, 2) == static_cast<ssize_t>(sizeof(struct net::pcap_file::pcaprec_hdr_t) + caplen));
+    } else if (_M_max_pcap_filesize == 0) {
+      return _M_pcap_file.write_packet(sec, usec, eth, caplen, hdr->tp_len);
+    } else if (_M_flight_recorder) {
+      // The flight recorder never gets full.
+      _M_recorder.append(sec, usec, eth, caplen, hdr->tp_len);
+      return true;
+    } else {
+      return _M_use_segment ? _M_segment.append_packet(sec, usec, eth, caplen, hdr->tp_len) :
+                              _M_pcap_file.append_packet(sec, usec, eth, caplen, hdr->tp_len, _M_pkts);
+    }
   }
 
   inline void sniffer::mark_as_free()
@@ -198,6 +926,79 @@ namespace net {
     _M_hdr->tp_status = TP_STATUS_KERNEL;
 #endif
   }
+
+#ifdef HAVE_TPACKET_V3
+  inline void sniffer::record_handoff()
+  {
+    // The block has no retire timestamp: the age of its last packet is the
+    // time the kernel kept the block open after the last packet (block
+    // timeout) plus the time the block waited to be read.
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    const struct tpacket_bd_ts& last = _M_block_desc->bh1.ts_last_pkt;
+
+    int64_t age = ((static_cast<int64_t>(now.tv_sec) - last.ts_sec) * 1000000000LL) +
+                  (static_cast<int64_t>(now.tv_nsec) - last.ts_nsec);
+
+    _M_latencies[kHandoffLatency].record((age > 0) ? age : 0);
+  }
+#endif // HAVE_TPACKET_V3
+
+  inline void sniffer::publish()
+  {
+    // Relaxed stores: each counter is read on its own.
+    __atomic_store_n(&_M_live.ring_packets, _M_stats.ring_packets, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_live.ring_bytes, _M_stats.ring_bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_live.matched, _M_stats.matched, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_live.matched_bytes, _M_stats.bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_live.written_packets, _M_stats.written_packets, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_live.written_bytes, _M_stats.written_bytes, __ATOMIC_RELAXED);
+
+#ifdef HAVE_TPACKET_V3
+    __atomic_store_n(&_M_live.backlog, held(), __ATOMIC_RELAXED);
+#endif
+  }
+
+#ifdef HAVE_TPACKET_V3
+  inline size_t sniffer::held() const
+  {
+    if (_M_use_writer) {
+      return _M_queued - __atomic_load_n(&_M_released, __ATOMIC_ACQUIRE);
+    } else if (_M_use_uring) {
+      return kUringDepth - _M_nfree_writes;
+    } else {
+      return 0;
+    }
+  }
+
+  inline void sniffer::raise_max_occupancy(unsigned occupancy)
+  {
+    // The monitor thread resets the high-water mark after reading it, only
+    // a new high-water mark costs a compare-and-swap.
+    uint64_t max = __atomic_load_n(&_M_live.max_occupancy, __ATOMIC_RELAXED);
+    while ((occupancy > max) &&
+           (!__atomic_compare_exchange_n(&_M_live.max_occupancy,
+                                         &max,
+                                         occupancy,
+                                         true,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED)));
+  }
+
+  inline bool sniffer::ring_held() const
+  {
+    return (_M_queued - __atomic_load_n(&_M_released, __ATOMIC_ACQUIRE) == _M_max_idx);
+  }
+
+  inline uint64_t sniffer::now()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+  }
+#endif // HAVE_TPACKET_V3
 }
 
 #endif // NET_SNIFFER_H
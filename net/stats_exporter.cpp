@@ -0,0 +1,180 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include "net/stats_exporter.h"
+#include "fs/file.h"
+
+net::stats_exporter::stats_exporter()
+  : _M_fd(-1)
+{
+  *_M_socket = 0;
+  *_M_textfile = 0;
+  *_M_tmpfile = 0;
+}
+
+net::stats_exporter::~stats_exporter()
+{
+  if (_M_fd != -1) {
+    close(_M_fd);
+    unlink(_M_socket);
+  }
+}
+
+bool net::stats_exporter::create(const char* socket, const char* textfile)
+{
+  if ((socket) && (!listen(socket))) {
+    return false;
+  }
+
+  if (textfile) {
+    // The temporary file is in the same directory (rename() is atomic) and
+    // its name doesn't end in .prom (ignored by the textfile collector).
+    size_t len = strlen(textfile);
+    if ((len >= sizeof(_M_textfile)) ||
+        (snprintf(_M_tmpfile, sizeof(_M_tmpfile), "%s.tmp", textfile) >= static_cast<int>(sizeof(_M_tmpfile)))) {
+      fprintf(stderr, "Statistics file name too long (%s).\n", textfile);
+      return false;
+    }
+
+    memcpy(_M_textfile, textfile, len + 1);
+  }
+
+  return true;
+}
+
+bool net::stats_exporter::listen(const char* socket)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(struct sockaddr_un));
+  addr.sun_family = AF_UNIX;
+
+  size_t len;
+  if ((len = strlen(socket)) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Statistics socket name too long (%s).\n", socket);
+    return false;
+  }
+
+  memcpy(addr.sun_path, socket, len + 1);
+
+  // Remove the socket left by a previous run (but nothing else).
+  struct stat sbuf;
+  if (lstat(socket, &sbuf) == 0) {
+    if (!S_ISSOCK(sbuf.st_mode)) {
+      fprintf(stderr, "%s already exists and is not a socket.\n", socket);
+      return false;
+    }
+
+    unlink(socket);
+  }
+
+  if ((_M_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0) {
+    perror("socket");
+    return false;
+  }
+
+  if (bind(_M_fd, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(struct sockaddr_un)) < 0) {
+    perror("bind");
+
+    close(_M_fd);
+    _M_fd = -1;
+
+    return false;
+  }
+
+  if (::listen(_M_fd, SOMAXCONN) < 0) {
+    perror("listen");
+
+    close(_M_fd);
+    _M_fd = -1;
+
+    unlink(socket);
+
+    return false;
+  }
+
+  memcpy(_M_socket, socket, len + 1);
+
+  return true;
+}
+
+void net::stats_exporter::serve(int timeout)
+{
+  if (_M_fd == -1) {
+    poll(NULL, 0, timeout);
+    return;
+  }
+
+  struct pollfd pfd;
+  pfd.fd = _M_fd;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  if (poll(&pfd, 1, timeout) <= 0) {
+    return;
+  }
+
+  int fd;
+  while ((fd = accept4(_M_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+    // A client which doesn't read only delays the next report.
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = kSendTimeout * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(struct timeval));
+
+    const char* data = _M_json.data();
+    size_t left = _M_json.count();
+    while (left > 0) {
+      ssize_t ret;
+      if ((ret = send(fd, data, left, MSG_NOSIGNAL)) < 0) {
+        if (errno != EINTR) {
+          break;
+        }
+      } else {
+        data += ret;
+        left -= ret;
+      }
+    }
+
+    close(fd);
+  }
+}
+
+bool net::stats_exporter::publish(const string::buffer& json, const string::buffer& text)
+{
+  _M_json.reset();
+  if (!_M_json.append(json.data(), json.count())) {
+    return false;
+  }
+
+  return (*_M_textfile) ? write_textfile(text) : true;
+}
+
+bool net::stats_exporter::write_textfile(const string::buffer& text)
+{
+  fs::file f;
+  if (!f.open(_M_tmpfile, O_CREAT | O_TRUNC | O_WRONLY, 0644)) {
+    fprintf(stderr, "Couldn't open statistics file %s.\n", _M_tmpfile);
+    return false;
+  }
+
+  if ((f.write(text.data(), text.count()) != static_cast<ssize_t>(text.count())) || (!f.close())) {
+    fprintf(stderr, "Couldn't write statistics file %s.\n", _M_tmpfile);
+
+    unlink(_M_tmpfile);
+    return false;
+  }
+
+  if (rename(_M_tmpfile, _M_textfile) < 0) {
+    fprintf(stderr, "Couldn't rename %s to %s.\n", _M_tmpfile, _M_textfile);
+
+    unlink(_M_tmpfile);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,62 @@
+#ifndef NET_STATS_EXPORTER_H
+#define NET_STATS_EXPORTER_H
+
+#include <limits.h>
+#include <sys/un.h>
+#include "string/buffer.h"
+
+namespace net {
+  // Exports the live statistics: the last report is served as JSON to the
+  // clients of a Unix socket (the report is written and the connection is
+  // closed, e.g. "socat - UNIX-CONNECT:<socket>") and written to a text
+  // file in the Prometheus exposition format for the textfile collector.
+  // The text file is written next to its final name and renamed, so that
+  // the collector never reads a partial file.
+  //
+  // Only the monitor thread uses the exporter.
+  class stats_exporter {
+    public:
+      // Maximum time a client can take to read a report (milliseconds).
+      static const int kSendTimeout = 100;
+
+      // Constructor.
+      stats_exporter();
+
+      // Destructor.
+      ~stats_exporter();
+
+      // Create (socket, textfile: NULL if not used).
+      bool create(const char* socket, const char* textfile);
+
+      // Serve the clients of the socket for up to timeout milliseconds.
+      void serve(int timeout);
+
+      // Publish a report (json: served on the socket, text: Prometheus
+      // exposition format).
+      bool publish(const string::buffer& json, const string::buffer& text);
+
+    private:
+      // Listening socket (-1: none).
+      int _M_fd;
+      char _M_socket[sizeof(sockaddr_un::sun_path)];
+
+      // Text file and temporary file (empty: none).
+      char _M_textfile[PATH_MAX];
+      char _M_tmpfile[PATH_MAX];
+
+      // Last report.
+      string::buffer _M_json;
+
+      // Listen on the socket.
+      bool listen(const char* socket);
+
+      // Write the text file.
+      bool write_textfile(const string::buffer& text);
+
+      // Disable copy constructor and assignment operator.
+      stats_exporter(const stats_exporter&);
+      stats_exporter& operator=(const stats_exporter&);
+  };
+}
+
+#endif // NET_STATS_EXPORTER_H
@@ -0,0 +1,87 @@
+#include <strings.h>
+#include "net/trigger.h"
+#include "macros/macros.h"
+
+bool net::trigger::parse(const char* triggers)
+{
+  _M_triggers = false;
+  _M_rst = false;
+  _M_unreachable = false;
+  memset(_M_rst_ports, 0, sizeof(_M_rst_ports));
+
+  while (*triggers) {
+    // Skip white spaces.
+    if (IS_WHITE_SPACE(*triggers)) {
+      triggers++;
+      continue;
+    }
+
+    const char* end = triggers + 1;
+    while ((*end) && (!IS_WHITE_SPACE(*end))) {
+      end++;
+    }
+
+    size_t len = end - triggers;
+
+    if ((len == 3) && (strncasecmp(triggers, "rst", 3) == 0)) {
+      _M_rst = true;
+    } else if ((len > 4) && (strncasecmp(triggers, "rst:", 4) == 0)) {
+      unsigned first, last;
+      if (!parse_ports(triggers + 4, len - 4, first, last)) {
+        return false;
+      }
+
+      for (unsigned port = first; port <= last; port++) {
+        _M_rst_ports[port >> 3] |= (1 << (port & 0x07));
+      }
+    } else if ((len == 11) && (strncasecmp(triggers, "unreachable", 11) == 0)) {
+      _M_unreachable = true;
+    } else {
+      return false;
+    }
+
+    _M_triggers = true;
+
+    triggers = end;
+  }
+
+  return _M_triggers;
+}
+
+bool net::trigger::parse_ports(const char* s, size_t len, unsigned& first, unsigned& last)
+{
+  const char* end = s + len;
+
+  if (!IS_DIGIT(*s)) {
+    return false;
+  }
+
+  first = 0;
+  while ((s < end) && (IS_DIGIT(*s))) {
+    if ((first = (first * 10) + (*s - '0')) > 65535) {
+      return false;
+    }
+
+    s++;
+  }
+
+  if (s == end) {
+    last = first;
+    return true;
+  }
+
+  if ((*s != '-') || (++s == end)) {
+    return false;
+  }
+
+  last = 0;
+  while (s < end) {
+    if ((!IS_DIGIT(*s)) || ((last = (last * 10) + (*s - '0')) > 65535)) {
+      return false;
+    }
+
+    s++;
+  }
+
+  return (first <= last);
+}
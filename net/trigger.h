@@ -0,0 +1,100 @@
+#ifndef NET_TRIGGER_H
+#define NET_TRIGGER_H
+
+#include <stdint.h>
+#include <string.h>
+#include "net/headers.h"
+
+namespace net {
+  // Trigger rules: events which make the packets around them be written.
+  class trigger {
+    public:
+      // Constructor.
+      trigger();
+
+      // Parse trigger list.
+      bool parse(const char* triggers);
+
+      // Have triggers?
+      bool have_triggers() const;
+
+      // Does the packet fire a trigger?
+      bool match(const struct headers& h) const;
+
+    private:
+      static const uint8_t kIcmpUnreachable = 3;
+      static const uint8_t kIcmp6Unreachable = 1;
+      static const uint8_t kTcpRst = 0x04;
+
+      bool _M_triggers;
+
+      // TCP RST on any port?
+      bool _M_rst;
+
+      // Ports where a TCP RST fires the trigger (bitmap).
+      uint8_t _M_rst_ports[(64 * 1024) / 8];
+
+      // ICMP destination unreachable?
+      bool _M_unreachable;
+
+      // Parse port range.
+      static bool parse_ports(const char* s, size_t len, unsigned& first, unsigned& last);
+
+      // Is the port set?
+      bool rst_port(uint16_t port) const;
+
+      // Disable copy constructor and assignment operator.
+      trigger(const trigger&);
+      trigger& operator=(const trigger&);
+  };
+
+  inline trigger::trigger()
+    : _M_triggers(false),
+      _M_rst(false),
+      _M_unreachable(false)
+  {
+    memset(_M_rst_ports, 0, sizeof(_M_rst_ports));
+  }
+
+  inline bool trigger::have_triggers() const
+  {
+    return _M_triggers;
+  }
+
+  inline bool trigger::rst_port(uint16_t port) const
+  {
+    return ((_M_rst_ports[port >> 3] & (1 << (port & 0x07))) != 0);
+  }
+
+  inline bool trigger::match(const struct headers& h) const
+  {
+    // Not the first fragment (or truncated IP headers)?
+    if ((h.fragment) || (!h.l4)) {
+      return false;
+    }
+
+    const uint8_t* l4 = h.l4;
+    size_t l4len = h.l4len;
+
+    if (h.protocol == IPPROTO_TCP) {
+      // Source port, destination port, ..., flags (offset 13).
+      if ((l4len < 14) || ((l4[13] & kTcpRst) == 0)) {
+        return false;
+      }
+
+      if (_M_rst) {
+        return true;
+      }
+
+      return ((rst_port((l4[0] << 8) | l4[1])) || (rst_port((l4[2] << 8) | l4[3])));
+    } else if ((h.protocol == IPPROTO_ICMP) && (h.version == 4)) {
+      return ((_M_unreachable) && (l4len >= 1) && (l4[0] == kIcmpUnreachable));
+    } else if ((h.protocol == IPPROTO_ICMPV6) && (h.version == 6)) {
+      return ((_M_unreachable) && (l4len >= 1) && (l4[0] == kIcmp6Unreachable));
+    }
+
+    return false;
+  }
+}
+
+#endif // NET_TRIGGER_H
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "net/trigger_recorder.h"
+#include "fs/path.h"
+
+net::trigger_recorder::trigger_recorder()
+  : _M_ring(NULL),
+    _M_before(0),
+    _M_after(0),
+    _M_trigger_time(0),
+    _M_ntriggers(0),
+    _M_buf(NULL),
+    _M_off(0),
+    _M_count(0),
+    _M_pos(0),
+    _M_running(false)
+{
+  memset(&_M_stats, 0, sizeof(struct statistics));
+}
+
+net::trigger_recorder::~trigger_recorder()
+{
+  stop();
+
+  if (_M_buf) {
+    free(_M_buf);
+  }
+}
+
+bool net::trigger_recorder::create(const char* pathname, uint32_t snaplen, const pcap_ring* ring, unsigned before, unsigned after)
+{
+  size_t len;
+  if ((len = strlen(pathname)) >= sizeof(_M_pathname)) {
+    return false;
+  }
+
+  if ((_M_buf = reinterpret_cast<char*>(malloc(kBufferSize))) == NULL) {
+    return false;
+  }
+
+  memcpy(_M_pathname, pathname, len + 1);
+
+  _M_pcap_file.snaplen(snaplen);
+
+  _M_ring = ring;
+  _M_before = before;
+  _M_after = after;
+
+  // Start background thread.
+  _M_running = true;
+  if (pthread_create(&_M_thread, NULL, run, this) != 0) {
+    _M_running = false;
+    return false;
+  }
+
+  return true;
+}
+
+void net::trigger_recorder::stop()
+{
+  if (_M_running) {
+    __atomic_store_n(&_M_running, false, __ATOMIC_RELEASE);
+    pthread_join(_M_thread, NULL);
+
+    _M_stats.triggers = _M_ntriggers;
+  }
+}
+
+void* net::trigger_recorder::run(void* arg)
+{
+  reinterpret_cast<net::trigger_recorder*>(arg)->record();
+  return NULL;
+}
+
+void net::trigger_recorder::record()
+{
+  uint64_t seen = 0;
+
+  do {
+    // Check whether the capture has finished before checking the
+    // triggers, so that no trigger is left behind.
+    bool running = __atomic_load_n(&_M_running, __ATOMIC_ACQUIRE);
+
+    if (__atomic_load_n(&_M_ntriggers, __ATOMIC_ACQUIRE) != seen) {
+      if (!write_window(seen)) {
+        fprintf(stderr, "Couldn't write capture window.\n");
+      }
+    } else if (!running) {
+      return;
+    } else {
+      usleep(kIdleSleep);
+    }
+  } while (true);
+}
+
+bool net::trigger_recorder::write_window(uint64_t& seen)
+{
+  seen = __atomic_load_n(&_M_ntriggers, __ATOMIC_ACQUIRE);
+
+  uint64_t t = __atomic_load_n(&_M_trigger_time, __ATOMIC_RELAXED);
+  uint64_t before = static_cast<uint64_t>(_M_before) * 1000000ULL;
+  uint64_t start = (t > before) ? t - before : 0;
+  uint64_t end = t + (static_cast<uint64_t>(_M_after) * 1000000ULL);
+
+  char pathname[PATH_MAX];
+  if ((!fs::path::add_timestamp(_M_pathname, pathname, sizeof(pathname))) ||
+      (!_M_pcap_file.open(pathname))) {
+    // Skip the packets of the window.
+    _M_count = 0;
+    _M_pos = _M_ring->head();
+
+    return false;
+  }
+
+  _M_stats.windows++;
+
+  // The packets older than the oldest one in the ring are gone anyway.
+  uint64_t tail = _M_ring->tail();
+  if (_M_pos < tail) {
+    _M_pos = tail;
+  }
+
+  bool ret = true;
+
+  do {
+    if (_M_count == 0) {
+      uint64_t head = _M_ring->head();
+
+      // No new packets?
+      if (_M_pos == head) {
+        extend(seen, end);
+
+        // Has the window finished?
+        if ((!__atomic_load_n(&_M_running, __ATOMIC_ACQUIRE)) ||
+            (now() > end)) {
+          break;
+        }
+
+        usleep(kIdleSleep);
+        continue;
+      }
+
+      // Have packets been overwritten before being written?
+      if (_M_pos < _M_ring->tail()) {
+        _M_stats.overruns++;
+      }
+
+      _M_count = _M_ring->copy(_M_pos, head, _M_buf, kBufferSize);
+      _M_off = 0;
+
+      continue;
+    }
+
+    const pcap_file::pcaprec_hdr_t* hdr = reinterpret_cast<const pcap_file::pcaprec_hdr_t*>(_M_buf + _M_off);
+    uint64_t ts = (static_cast<uint64_t>(hdr->tv.ts_sec) * 1000000ULL) + hdr->tv.ts_usec;
+
+    // After the end of the window?
+    if (ts > end) {
+      extend(seen, end);
+
+      // The packet is kept for the next window.
+      if (ts > end) {
+        break;
+      }
+    }
+
+    if (ts >= start) {
+      if ((ret) && (!_M_pcap_file.write_packet(hdr->tv.ts_sec,
+                                                hdr->tv.ts_usec,
+                                                hdr + 1,
+                                                hdr->incl_len,
+                                                hdr->orig_len))) {
+        ret = false;
+      }
+
+      _M_stats.packets++;
+    }
+
+    size_t reclen = sizeof(pcap_file::pcaprec_hdr_t) + hdr->incl_len;
+    _M_off += reclen;
+    _M_count -= reclen;
+  } while (true);
+
+  if (!_M_pcap_file.close()) {
+    ret = false;
+  }
+
+  return ret;
+}
+
+void net::trigger_recorder::extend(uint64_t& seen, uint64_t& end) const
+{
+  uint64_t ntriggers = __atomic_load_n(&_M_ntriggers, __ATOMIC_ACQUIRE);
+  if (ntriggers != seen) {
+    seen = ntriggers;
+
+    uint64_t e = __atomic_load_n(&_M_trigger_time, __ATOMIC_RELAXED) +
+                 (static_cast<uint64_t>(_M_after) * 1000000ULL);
+
+    if (e > end) {
+      end = e;
+    }
+  }
+}
+
+uint64_t net::trigger_recorder::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return (static_cast<uint64_t>(ts.tv_sec) * 1000000ULL) + (ts.tv_nsec / 1000);
+}
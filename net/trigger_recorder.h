@@ -0,0 +1,110 @@
+#ifndef NET_TRIGGER_RECORDER_H
+#define NET_TRIGGER_RECORDER_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include "net/pcap_file.h"
+#include "net/pcap_ring.h"
+
+namespace net {
+  // Writes capture windows around the triggers: when a trigger fires, a
+  // background thread writes the packets of the previous before seconds
+  // and of the next after seconds from the ring to a timestamped capture
+  // file. A trigger which fires during a window extends it.
+  //
+  // Firing a trigger only takes two atomic stores in the capture thread.
+  class trigger_recorder {
+    public:
+      struct statistics {
+        uint64_t triggers;
+        uint64_t windows;
+        uint64_t packets;
+
+        // Number of times the ring overwrote packets which had to be written.
+        uint64_t overruns;
+      };
+
+      // Constructor.
+      trigger_recorder();
+
+      // Destructor.
+      ~trigger_recorder();
+
+      // Create.
+      bool create(const char* pathname, uint32_t snaplen, const pcap_ring* ring, unsigned before, unsigned after);
+
+      // Fire trigger (timestamp of the packet which fired it).
+      void fire(uint32_t sec, uint32_t usec);
+
+      // Stop (the current window is written up to the newest packet).
+      void stop();
+
+      // Get statistics.
+      const struct statistics& stats() const;
+
+    private:
+      // Time the thread sleeps when there is nothing to do (microseconds).
+      static const unsigned kIdleSleep = 10000;
+
+      // Buffer where the records are copied from the ring.
+      static const size_t kBufferSize = 1024 * 1024;
+
+      char _M_pathname[PATH_MAX];
+
+      const pcap_ring* _M_ring;
+
+      net::pcap_file _M_pcap_file;
+
+      unsigned _M_before;
+      unsigned _M_after;
+
+      // Timestamp of the last trigger (microseconds) and number of
+      // triggers fired.
+      uint64_t _M_trigger_time;
+      uint64_t _M_ntriggers;
+
+      // Records copied from the ring but not processed yet.
+      char* _M_buf;
+      size_t _M_off;
+      size_t _M_count;
+
+      // Position of the next record to copy from the ring.
+      uint64_t _M_pos;
+
+      pthread_t _M_thread;
+      bool _M_running;
+
+      struct statistics _M_stats;
+
+      // Background thread.
+      static void* run(void* arg);
+      void record();
+
+      // Write window.
+      bool write_window(uint64_t& seen);
+
+      // If new triggers have fired, extend the end of the window.
+      void extend(uint64_t& seen, uint64_t& end) const;
+
+      // Get current time in microseconds.
+      static uint64_t now();
+
+      // Disable copy constructor and assignment operator.
+      trigger_recorder(const trigger_recorder&);
+      trigger_recorder& operator=(const trigger_recorder&);
+  };
+
+  inline void trigger_recorder::fire(uint32_t sec, uint32_t usec)
+  {
+    __atomic_store_n(&_M_trigger_time, (static_cast<uint64_t>(sec) * 1000000ULL) + usec, __ATOMIC_RELAXED);
+    __atomic_store_n(&_M_ntriggers, _M_ntriggers + 1, __ATOMIC_RELEASE);
+  }
+
+  inline const struct trigger_recorder::statistics& trigger_recorder::stats() const
+  {
+    return _M_stats;
+  }
+}
+
+#endif // NET_TRIGGER_RECORDER_H
@@ -1,12 +1,36 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "string/buffer.h"
 
+namespace {
+  // Maximum number of threads which pre-fault the memory.
+  const unsigned kMaxPrefaultThreads = 16;
+
+  // Minimum number of bytes per thread.
+  const size_t kMinPrefaultSize = 64 * 1024 * 1024;
+
+  // Huge page size.
+  const size_t kHugePageSize = 2 * 1024 * 1024;
+
+  struct range {
+    char* begin;
+    char* end;
+  };
+}
+
 bool string::buffer::allocate(size_t size)
 {
   if ((size += _M_used) <= _M_size) {
     return true;
   }
 
+  // A mapped buffer cannot grow.
+  if (_M_mapped > 0) {
+    return false;
+  }
+
   size_t s;
   if (_M_size == 0) {
     s = _M_initial_size;
@@ -41,6 +65,100 @@ bool string::buffer::allocate(size_t size)
   return true;
 }
 
+bool string::buffer::map(size_t size, unsigned flags)
+{
+  if ((size == 0) || (_M_data)) {
+    return false;
+  }
+
+  size_t len = size;
+
+  int mmap_flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (flags & kHugePages) {
+    mmap_flags |= MAP_HUGETLB;
+
+    // The length has to be a multiple of the huge page size.
+    len = ((size + kHugePageSize - 1) / kHugePageSize) * kHugePageSize;
+  }
+
+  void* data;
+  if ((data = mmap(NULL, len, PROT_READ | PROT_WRITE, mmap_flags, -1, 0)) == MAP_FAILED) {
+    return false;
+  }
+
+  if (flags & kTransparentHugePages) {
+    madvise(data, len, MADV_HUGEPAGE);
+  }
+
+  _M_data = reinterpret_cast<char*>(data);
+  _M_size = size;
+  _M_used = 0;
+  _M_mapped = len;
+
+  // Pre-fault the memory in parallel.
+  unsigned nthreads = len / kMinPrefaultSize;
+  if (nthreads > kMaxPrefaultThreads) {
+    nthreads = kMaxPrefaultThreads;
+  }
+
+  long ncpus;
+  if (((ncpus = sysconf(_SC_NPROCESSORS_ONLN)) > 0) && (nthreads > static_cast<unsigned>(ncpus))) {
+    nthreads = ncpus;
+  }
+
+  if (nthreads == 0) {
+    nthreads = 1;
+  }
+
+  struct range ranges[kMaxPrefaultThreads];
+  pthread_t threads[kMaxPrefaultThreads];
+
+  size_t chunk = len / nthreads;
+  unsigned nstarted = 0;
+
+  for (unsigned i = 0; i < nthreads; i++) {
+    ranges[i].begin = _M_data + (i * chunk);
+    ranges[i].end = (i + 1 < nthreads) ? ranges[i].begin + chunk : _M_data + len;
+
+    // The calling thread pre-faults the last range.
+    if ((i + 1 < nthreads) && (pthread_create(&threads[i], NULL, prefault, &ranges[i]) == 0)) {
+      nstarted++;
+    } else {
+      // Pre-fault the remaining ranges from the calling thread.
+      ranges[i].end = _M_data + len;
+      prefault(&ranges[i]);
+      break;
+    }
+  }
+
+  for (unsigned i = 0; i < nstarted; i++) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // Lock the memory (not fatal, it might exceed RLIMIT_MEMLOCK).
+  if (flags & kLock) {
+    _M_locked = (mlock(_M_data, len) == 0);
+  }
+
+  return true;
+}
+
+void* string::buffer::prefault(void* arg)
+{
+  const struct range* r = reinterpret_cast<const struct range*>(arg);
+
+  long pagesize;
+  if ((pagesize = sysconf(_SC_PAGESIZE)) <= 0) {
+    pagesize = 4096;
+  }
+
+  for (volatile char* p = r->begin; p < r->end; p += pagesize) {
+    *p = 0;
+  }
+
+  return NULL;
+}
+
 bool string::buffer::vformat(const char* format, va_list ap)
 {
   if (!allocate(_M_initial_size)) {
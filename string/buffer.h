@@ -4,12 +4,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <sys/mman.h>
 
 namespace string {
   class buffer {
     public:
       static const size_t kDefaultInitialSize = 64;
 
+      // Flags for map().
+      static const unsigned kHugePages = 1;            // MAP_HUGETLB.
+      static const unsigned kTransparentHugePages = 2; // MADV_HUGEPAGE.
+      static const unsigned kLock = 4;                 // mlock().
+
       // Constructor.
       buffer(size_t initial_size = kDefaultInitialSize);
 
@@ -47,6 +53,13 @@ namespace string {
       // Allocate memory.
       bool allocate(size_t size);
 
+      // Allocate exactly size bytes with an anonymous mapping, which is
+      // pre-faulted by several threads. The buffer cannot grow afterwards.
+      bool map(size_t size, unsigned flags);
+
+      // Has the memory been locked?
+      bool locked() const;
+
       // Append.
       bool append(char c);
       bool append(const char* string);
@@ -66,6 +79,13 @@ namespace string {
 
       size_t _M_initial_size;
 
+      // Size of the anonymous mapping (0 if the memory was malloc'ed).
+      size_t _M_mapped;
+      bool _M_locked;
+
+      // Touch the pages of the buffer.
+      static void* prefault(void* arg);
+
     private:
       // Disable copy constructor and assignment operator.
       buffer(const buffer&);
@@ -78,6 +98,9 @@ namespace string {
     _M_size = 0;
     _M_used = 0;
 
+    _M_mapped = 0;
+    _M_locked = false;
+
     set_initial_size(initial_size);
   }
 
@@ -89,7 +112,14 @@ namespace string {
   inline void buffer::free()
   {
     if (_M_data) {
-      ::free(_M_data);
+      if (_M_mapped > 0) {
+        munmap(_M_data, _M_mapped);
+        _M_mapped = 0;
+        _M_locked = false;
+      } else {
+        ::free(_M_data);
+      }
+
       _M_data = NULL;
     }
 
@@ -122,6 +152,11 @@ namespace string {
     return _M_size;
   }
 
+  inline bool buffer::locked() const
+  {
+    return _M_locked;
+  }
+
   inline size_t buffer::count() const
   {
     return _M_used;
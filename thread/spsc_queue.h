@@ -0,0 +1,106 @@
+#ifndef THREAD_SPSC_QUEUE_H
+#define THREAD_SPSC_QUEUE_H
+
+#include <stdlib.h>
+
+namespace thread {
+  // Lock-free single-producer / single-consumer queue of unsigned integers.
+  class spsc_queue {
+    public:
+      static const size_t kCacheLineSize = 64;
+
+      // Constructor.
+      spsc_queue();
+
+      // Destructor.
+      ~spsc_queue();
+
+      // Create (the size is rounded up to a power of two).
+      bool create(size_t size);
+
+      // Push (producer).
+      bool push(unsigned val);
+
+      // Pop (consumer).
+      bool pop(unsigned& val);
+
+      // Get number of elements.
+      size_t count() const;
+
+    private:
+      unsigned* _M_values;
+      size_t _M_mask;
+
+      // The producer and the consumer indices live in different cache lines.
+      size_t _M_head __attribute__((aligned(kCacheLineSize)));
+      size_t _M_tail __attribute__((aligned(kCacheLineSize)));
+
+      // Disable copy constructor and assignment operator.
+      spsc_queue(const spsc_queue&);
+      spsc_queue& operator=(const spsc_queue&);
+  };
+
+  inline spsc_queue::spsc_queue()
+    : _M_values(NULL),
+      _M_mask(0),
+      _M_head(0),
+      _M_tail(0)
+  {
+  }
+
+  inline spsc_queue::~spsc_queue()
+  {
+    if (_M_values) {
+      free(_M_values);
+    }
+  }
+
+  inline bool spsc_queue::create(size_t size)
+  {
+    size_t n;
+    for (n = 1; n < size; n *= 2);
+
+    if ((_M_values = reinterpret_cast<unsigned*>(malloc(n * sizeof(unsigned)))) == NULL) {
+      return false;
+    }
+
+    _M_mask = n - 1;
+
+    return true;
+  }
+
+  inline bool spsc_queue::push(unsigned val)
+  {
+    size_t head = _M_head;
+    if (head - __atomic_load_n(&_M_tail, __ATOMIC_ACQUIRE) > _M_mask) {
+      // Full.
+      return false;
+    }
+
+    _M_values[head & _M_mask] = val;
+    __atomic_store_n(&_M_head, head + 1, __ATOMIC_RELEASE);
+
+    return true;
+  }
+
+  inline bool spsc_queue::pop(unsigned& val)
+  {
+    size_t tail = _M_tail;
+    if (tail == __atomic_load_n(&_M_head, __ATOMIC_ACQUIRE)) {
+      // Empty.
+      return false;
+    }
+
+    val = _M_values[tail & _M_mask];
+    __atomic_store_n(&_M_tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+  }
+
+  inline size_t spsc_queue::count() const
+  {
+    return __atomic_load_n(&_M_head, __ATOMIC_ACQUIRE) - __atomic_load_n(&_M_tail, __ATOMIC_ACQUIRE);
+  }
+}
+
+#endif // THREAD_SPSC_QUEUE_H
@@ -0,0 +1,61 @@
+#include <string.h>
+#include "util/histogram.h"
+
+void util::histogram::clear()
+{
+  memset(_M_buckets, 0, sizeof(_M_buckets));
+
+  _M_count = 0;
+  _M_sum = 0;
+  _M_max = 0;
+}
+
+void util::histogram::merge(const histogram& other)
+{
+  // The number of values is the sum of the buckets read (the writer might
+  // have recorded more values since).
+  for (unsigned i = 0; i < kBuckets; i++) {
+    uint64_t n;
+    if ((n = __atomic_load_n(&other._M_buckets[i], __ATOMIC_RELAXED)) != 0) {
+      _M_buckets[i] += n;
+      _M_count += n;
+    }
+  }
+
+  _M_sum += other.sum();
+
+  uint64_t max = other.max();
+  if (max > _M_max) {
+    _M_max = max;
+  }
+}
+
+uint64_t util::histogram::percentile(double p) const
+{
+  if (_M_count == 0) {
+    return 0;
+  }
+
+  // Nearest rank (1 .. count).
+  double r = (p * _M_count) / 100.0;
+  uint64_t rank = static_cast<uint64_t>(r);
+  if (rank < r) {
+    rank++;
+  }
+
+  if (rank == 0) {
+    rank = 1;
+  } else if (rank > _M_count) {
+    rank = _M_count;
+  }
+
+  uint64_t n = 0;
+  for (unsigned i = 0; i < kBuckets; i++) {
+    if ((n += _M_buckets[i]) >= rank) {
+      uint64_t value = highest(i);
+      return (value < _M_max) ? value : _M_max;
+    }
+  }
+
+  return _M_max;
+}
@@ -0,0 +1,139 @@
+#ifndef UTIL_HISTOGRAM_H
+#define UTIL_HISTOGRAM_H
+
+#include <stdint.h>
+
+namespace util {
+  // Log-bucketed histogram (HDR style) of durations in nanoseconds: the
+  // values below 2^kSubBits have a bucket each and every power of two above
+  // is split in 2^kSubBits buckets, so the percentiles are within 1 /
+  // 2^kSubBits (3%) of the recorded values. The values from 2^kMaxBits
+  // nanoseconds (18 minutes) go to the last bucket.
+  //
+  // A histogram has a single writer, which records without atomic
+  // read-modify-write instructions, and can be read by the other threads at
+  // any time: the histograms of several threads are merged into a private
+  // one to compute the percentiles.
+  class histogram {
+    public:
+      static const unsigned kSubBits = 5;
+      static const unsigned kMaxBits = 40;
+
+      // Number of buckets.
+      static const unsigned kBuckets = (kMaxBits - kSubBits + 1) << kSubBits;
+
+      // Constructor.
+      histogram();
+
+      // Record value (writer).
+      void record(uint64_t value);
+
+      // Reset (not while the writer records).
+      void clear();
+
+      // Add the values of another histogram (which might be being written).
+      void merge(const histogram& other);
+
+      // Get number of values.
+      uint64_t count() const;
+
+      // Get sum of the values.
+      uint64_t sum() const;
+
+      // Get highest value.
+      uint64_t max() const;
+
+      // Get percentile (0 .. 100): highest value of the bucket where the
+      // percentile falls (0 if there are no values).
+      uint64_t percentile(double p) const;
+
+    private:
+      uint64_t _M_buckets[kBuckets];
+
+      uint64_t _M_count;
+      uint64_t _M_sum;
+      uint64_t _M_max;
+
+      // Get bucket of a value.
+      static unsigned bucket(uint64_t value);
+
+      // Get highest value of a bucket.
+      static uint64_t highest(unsigned bucket);
+
+      // Increment counter (single writer).
+      static void add(uint64_t& counter, uint64_t n);
+
+      // Disable copy constructor and assignment operator.
+      histogram(const histogram&);
+      histogram& operator=(const histogram&);
+  };
+
+  inline histogram::histogram()
+  {
+    clear();
+  }
+
+  inline void histogram::add(uint64_t& counter, uint64_t n)
+  {
+    // Plain load and store (the other threads only read them), atomic so
+    // that the readers never see a torn value.
+    __atomic_store_n(&counter, __atomic_load_n(&counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+  }
+
+  inline void histogram::record(uint64_t value)
+  {
+    add(_M_buckets[bucket(value)], 1);
+    add(_M_count, 1);
+    add(_M_sum, value);
+
+    if (value > _M_max) {
+      __atomic_store_n(&_M_max, value, __ATOMIC_RELAXED);
+    }
+  }
+
+  inline uint64_t histogram::count() const
+  {
+    return __atomic_load_n(&_M_count, __ATOMIC_RELAXED);
+  }
+
+  inline uint64_t histogram::sum() const
+  {
+    return __atomic_load_n(&_M_sum, __ATOMIC_RELAXED);
+  }
+
+  inline uint64_t histogram::max() const
+  {
+    return __atomic_load_n(&_M_max, __ATOMIC_RELAXED);
+  }
+
+  inline unsigned histogram::bucket(uint64_t value)
+  {
+    if (value < (1ULL << kSubBits)) {
+      return static_cast<unsigned>(value);
+    }
+
+    // Position of the most significant bit.
+    unsigned msb = 63 - __builtin_clzll(value);
+    if (msb >= kMaxBits) {
+      return kBuckets - 1;
+    }
+
+    unsigned shift = msb - kSubBits;
+
+    return ((shift + 1) << kSubBits) + static_cast<unsigned>((value >> shift) & ((1ULL << kSubBits) - 1));
+  }
+
+  inline uint64_t histogram::highest(unsigned bucket)
+  {
+    if (bucket < (1U << kSubBits)) {
+      return bucket;
+    }
+
+    unsigned shift = (bucket >> kSubBits) - 1;
+    uint64_t mantissa = (1ULL << kSubBits) + (bucket & ((1U << kSubBits) - 1));
+
+    return ((mantissa + 1) << shift) - 1;
+  }
+}
+
+#endif // UTIL_HISTOGRAM_H
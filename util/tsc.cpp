@@ -0,0 +1,32 @@
+#include <unistd.h>
+#if HAVE_RDTSC
+  #include <cpuid.h>
+#endif
+#include "util/tsc.h"
+
+bool util::tsc::_M_rdtsc = false;
+uint64_t util::tsc::_M_mult = 1ULL << kShift;
+
+void util::tsc::calibrate()
+{
+#if HAVE_RDTSC
+  // Invariant TSC (CPUID.80000007H:EDX[8])?
+  unsigned eax, ebx, ecx, edx;
+  if ((!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) || ((edx & (1 << 8)) == 0)) {
+    return;
+  }
+
+  uint64_t start = monotonic();
+  uint64_t ticks = __rdtsc();
+
+  usleep(kCalibrationTime / 1000);
+
+  uint64_t elapsed = monotonic() - start;
+  ticks = __rdtsc() - ticks;
+
+  if ((ticks > 0) && (elapsed > 0)) {
+    _M_mult = (elapsed << kShift) / ticks;
+    _M_rdtsc = true;
+  }
+#endif // HAVE_RDTSC
+}
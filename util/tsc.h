@@ -0,0 +1,71 @@
+#ifndef UTIL_TSC_H
+#define UTIL_TSC_H
+
+#include <stdint.h>
+#include <time.h>
+
+#if HAVE_RDTSC
+  #include <x86intrin.h>
+#endif
+
+namespace util {
+  // Clock for measuring short durations on the fast path. The time stamp
+  // counter is read with rdtsc (a few nanoseconds, much cheaper than
+  // clock_gettime()) if the CPU has an invariant TSC (constant rate, not
+  // stopped in deep C-states, HAVE_RDTSC in the Makefile), otherwise
+  // CLOCK_MONOTONIC is read and a tick is a nanosecond.
+  class tsc {
+    public:
+      // Calibrate the counter against CLOCK_MONOTONIC (before the threads
+      // which read it start).
+      static void calibrate();
+
+      // Read the counter (ticks).
+      static uint64_t read();
+
+      // Convert ticks to nanoseconds (durations up to about 15 minutes).
+      static uint64_t nanoseconds(uint64_t ticks);
+
+    private:
+      // Fixed-point shift of the conversion factor.
+      static const unsigned kShift = 24;
+
+      // Time the calibration takes (nanoseconds).
+      static const uint64_t kCalibrationTime = 10 * 1000 * 1000;
+
+      // Read the time stamp counter?
+      static bool _M_rdtsc;
+
+      // Nanoseconds per tick << kShift.
+      static uint64_t _M_mult;
+
+      // Read CLOCK_MONOTONIC (nanoseconds).
+      static uint64_t monotonic();
+  };
+
+  inline uint64_t tsc::read()
+  {
+#if HAVE_RDTSC
+    if (_M_rdtsc) {
+      return __rdtsc();
+    }
+#endif
+
+    return monotonic();
+  }
+
+  inline uint64_t tsc::nanoseconds(uint64_t ticks)
+  {
+    return (ticks * _M_mult) >> kShift;
+  }
+
+  inline uint64_t tsc::monotonic()
+  {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL) + ts.tv_nsec;
+  }
+}
+
+#endif // UTIL_TSC_H